@@ -145,7 +145,7 @@ static int open_monitor(const char *path)
 	struct sockaddr_hci addr;
 	int opt = 1;
 
-	snoop = btsnoop_create(path, BTSNOOP_TYPE_HCI);
+	snoop = btsnoop_create(path, 0, 0, 0, BTSNOOP_TYPE_HCI);
 	if (!snoop)
 		return -1;
 
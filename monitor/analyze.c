@@ -27,7 +27,9 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
@@ -35,6 +37,194 @@
 #include "monitor/bt.h"
 #include "analyze.h"
 
+/*
+ * Histograms use buckets that are exact below 8 and split every power
+ * of two into 8 sub-buckets above that. This keeps percentiles within
+ * about 12% of the real value in a fixed amount of memory.
+ */
+#define HIST_SUB_BITS	3
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(HIST_SUB * (33 - HIST_SUB_BITS))
+
+struct hist {
+	unsigned long count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t buckets[HIST_BUCKETS];
+};
+
+static unsigned int hist_bucket(uint32_t value)
+{
+	unsigned int exp;
+
+	if (value < HIST_SUB)
+		return value;
+
+	exp = 31 - __builtin_clz(value);
+
+	return (exp - HIST_SUB_BITS + 1) * HIST_SUB +
+			((value >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static uint32_t hist_bucket_max(unsigned int bucket)
+{
+	unsigned int exp, sub;
+
+	if (bucket < HIST_SUB)
+		return bucket;
+
+	exp = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+	sub = bucket % HIST_SUB;
+
+	return ((uint64_t) (HIST_SUB + sub + 1) << (exp - HIST_SUB_BITS)) - 1;
+}
+
+static void hist_add(struct hist *hist, uint32_t value)
+{
+	if (!hist->count || value < hist->min)
+		hist->min = value;
+
+	if (value > hist->max)
+		hist->max = value;
+
+	hist->buckets[hist_bucket(value)]++;
+	hist->count++;
+}
+
+static uint32_t hist_percentile(const struct hist *hist, unsigned int pct)
+{
+	unsigned long target, total = 0;
+	unsigned int i;
+
+	target = (hist->count * pct + 99) / 100;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		total += hist->buckets[i];
+
+		if (total >= target)
+			break;
+	}
+
+	if (i == HIST_BUCKETS || hist_bucket_max(i) > hist->max)
+		return hist->max;
+
+	return hist_bucket_max(i);
+}
+
+static void print_hist_header(FILE *out, const char *label)
+{
+	fprintf(out, "  %-24s %8s %8s %8s %8s %8s %8s\n", label,
+				"count", "min", "p50", "p90", "p99", "max");
+}
+
+static void print_hist(FILE *out, const char *label, const struct hist *hist)
+{
+	if (!hist->count)
+		return;
+
+	fprintf(out, "    %-22s %8lu %8u %8u %8u %8u %8u\n", label,
+				hist->count, hist->min,
+				hist_percentile(hist, 50),
+				hist_percentile(hist, 90),
+				hist_percentile(hist, 99), hist->max);
+}
+
+/* Power of two ranges from the sub-buckets of two histograms */
+static void print_size_table(FILE *out, const struct hist *tx,
+						const struct hist *rx)
+{
+	unsigned int row, max_row;
+
+	if (!tx->count && !rx->count)
+		return;
+
+	max_row = hist_bucket(tx->max > rx->max ? tx->max : rx->max) /
+								HIST_SUB;
+
+	fprintf(out, "  %-24s %10s %10s\n", "Packet size (bytes)", "TX", "RX");
+
+	for (row = 0; row <= max_row; row++) {
+		unsigned long num_tx = 0, num_rx = 0;
+		char range[24];
+		unsigned int i;
+
+		for (i = row * HIST_SUB; i < (row + 1) * HIST_SUB; i++) {
+			num_tx += tx->buckets[i];
+			num_rx += rx->buckets[i];
+		}
+
+		if (!num_tx && !num_rx)
+			continue;
+
+		snprintf(range, sizeof(range), "%u-%u",
+				row ? hist_bucket_max(row * HIST_SUB - 1) + 1 : 0,
+				hist_bucket_max((row + 1) * HIST_SUB - 1));
+
+		fprintf(out, "    %-22s %10lu %10lu\n", range, num_tx, num_rx);
+	}
+}
+
+static uint64_t tv_to_usec(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ull + tv->tv_usec;
+}
+
+/* Only this many packets are tracked while waiting for completion */
+#define CONN_TX_PENDING		256
+
+/* Only the latest parameter changes are kept for the timeline */
+#define CONN_PARAMS_MAX		16
+
+/* Only this many commands are tracked while waiting for a response */
+#define DEV_CMD_PENDING		8
+
+struct conn_params {
+	struct timeval tv;
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t supv_timeout;
+};
+
+struct hci_conn {
+	unsigned int handle;
+	uint16_t index;
+	uint8_t type;
+	uint8_t bdaddr[6];
+	bool setup_seen;
+	struct timeval time_setup;
+	struct timeval time_first;
+	struct timeval time_last;
+	unsigned long tx_num;
+	unsigned long rx_num;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	struct hist tx_size;
+	struct hist rx_size;
+	struct hist completed;
+	uint64_t *tx_pending;
+	unsigned int tx_head;
+	unsigned int tx_len;
+	unsigned long tx_untracked;
+	struct conn_params params[CONN_PARAMS_MAX];
+	unsigned int num_params;
+};
+
+#define CONN_TYPE_UNKNOWN	0x00
+#define CONN_TYPE_BREDR		0x01
+#define CONN_TYPE_LE		0x02
+#define CONN_TYPE_SCO		0x03
+#define CONN_TYPE_ESCO		0x04
+
+struct cmd_pending {
+	uint16_t opcode;
+	uint64_t sent;
+};
+
+struct cmd_stats {
+	unsigned int opcode;
+	struct hist latency;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -45,9 +235,283 @@ struct hci_dev {
 	unsigned long num_evt;
 	unsigned long num_acl;
 	unsigned long num_sco;
+	unsigned long num_conn;
+	struct queue *conn_list;
+	FILE *conn_report;
+	struct queue *cmd_list;
+	struct cmd_pending cmd_pending[DEV_CMD_PENDING];
+	unsigned int num_cmd_pending;
+	unsigned long num_cmd_untracked;
 };
 
 static struct queue *dev_list;
+static struct queue *dev_removed;
+
+static void print_rate(FILE *out, const char *label, unsigned long num,
+					uint64_t bytes, uint64_t duration)
+{
+	if (!duration) {
+		fprintf(out, "  %s: %lu packets, %llu bytes\n", label, num,
+						(unsigned long long) bytes);
+		return;
+	}
+
+	fprintf(out, "  %s: %lu packets, %llu bytes, %.1f packets/s, "
+				"%.1f bytes/s\n", label, num,
+				(unsigned long long) bytes,
+				num * 1000000.0 / duration,
+				bytes * 1000000.0 / duration);
+}
+
+static void conn_report(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	FILE *out = user_data;
+	uint64_t duration;
+	unsigned int i;
+	const char *str;
+
+	switch (conn->type) {
+	case CONN_TYPE_BREDR:
+		str = "BR/EDR ACL";
+		break;
+	case CONN_TYPE_LE:
+		str = "LE ACL";
+		break;
+	case CONN_TYPE_SCO:
+		str = "SCO";
+		break;
+	case CONN_TYPE_ESCO:
+		str = "eSCO";
+		break;
+	default:
+		str = "unknown";
+		break;
+	}
+
+	fprintf(out, "Found %s connection with handle %u on index %u\n", str,
+						conn->handle, conn->index);
+
+	if (conn->setup_seen)
+		fprintf(out, "  BD_ADDR %2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X\n",
+			conn->bdaddr[5], conn->bdaddr[4], conn->bdaddr[3],
+			conn->bdaddr[2], conn->bdaddr[1], conn->bdaddr[0]);
+
+	duration = tv_to_usec(&conn->time_last) -
+					tv_to_usec(&conn->time_first);
+
+	print_rate(out, "TX", conn->tx_num, conn->tx_bytes, duration);
+	print_rate(out, "RX", conn->rx_num, conn->rx_bytes, duration);
+
+	print_size_table(out, &conn->tx_size, &conn->rx_size);
+
+	if (conn->completed.count) {
+		print_hist_header(out, "Completed (usec)");
+		print_hist(out, "TX to completion", &conn->completed);
+	}
+
+	if (conn->tx_untracked)
+		fprintf(out, "  %lu packets not tracked for completion\n",
+							conn->tx_untracked);
+
+	if (conn->num_params) {
+		unsigned int first = 0;
+		uint64_t start;
+
+		fprintf(out, "  Connection parameters\n");
+
+		if (conn->num_params > CONN_PARAMS_MAX) {
+			first = conn->num_params - CONN_PARAMS_MAX;
+			fprintf(out, "    %u earlier changes omitted\n", first);
+		}
+
+		/* Times are relative to the connection setup */
+		if (conn->setup_seen)
+			start = tv_to_usec(&conn->time_setup);
+		else
+			start = tv_to_usec(&conn->params[first %
+						CONN_PARAMS_MAX].tv);
+
+		for (i = first; i < conn->num_params; i++) {
+			const struct conn_params *params;
+			uint64_t offset;
+
+			params = &conn->params[i % CONN_PARAMS_MAX];
+
+			offset = tv_to_usec(&params->tv);
+			offset = offset > start ? offset - start : 0;
+
+			fprintf(out, "    +%llu.%06llu interval %.2f msec "
+					"latency %u timeout %u msec\n",
+					(unsigned long long) offset / 1000000,
+					(unsigned long long) offset % 1000000,
+					params->interval * 1.25,
+					params->latency,
+					params->supv_timeout * 10);
+		}
+	}
+
+	fprintf(out, "\n");
+}
+
+static void conn_free(void *data)
+{
+	struct hci_conn *conn = data;
+
+	free(conn->tx_pending);
+	free(conn);
+}
+
+/*
+ * Connections that are over get reported right away so that they can be
+ * freed, but into a temporary file that is only copied out after the
+ * summary of their controller.
+ */
+static void conn_destroy(struct hci_dev *dev, struct hci_conn *conn)
+{
+	if (!dev->conn_report)
+		dev->conn_report = tmpfile();
+
+	conn_report(conn, dev->conn_report ? : stdout);
+	conn_free(conn);
+}
+
+static struct hci_conn *conn_alloc(struct hci_dev *dev, uint16_t handle,
+								uint8_t type)
+{
+	struct hci_conn *conn;
+
+	conn = new0(struct hci_conn, 1);
+	conn->handle = handle;
+	conn->index = dev->index;
+	conn->type = type;
+
+	dev->num_conn++;
+
+	queue_push_tail(dev->conn_list, conn);
+
+	return conn;
+}
+
+static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle)
+{
+	struct hci_conn *conn;
+
+	conn = queue_find_by_key(dev->conn_list, handle);
+	if (!conn)
+		conn = conn_alloc(dev, handle, CONN_TYPE_UNKNOWN);
+
+	return conn;
+}
+
+static void conn_setup(struct hci_dev *dev, struct timeval *tv,
+				uint16_t handle, uint8_t type,
+				const uint8_t *bdaddr)
+{
+	struct hci_conn *conn;
+
+	/* A stale connection with the same handle is over by now */
+	conn = queue_remove_by_key(dev->conn_list, handle);
+	if (conn)
+		conn_destroy(dev, conn);
+
+	conn = conn_alloc(dev, handle, type);
+	conn->setup_seen = true;
+	conn->time_setup = *tv;
+	memcpy(conn->bdaddr, bdaddr, 6);
+}
+
+static void conn_add_params(struct hci_conn *conn, struct timeval *tv,
+				uint16_t interval, uint16_t latency,
+				uint16_t supv_timeout)
+{
+	struct conn_params *params;
+
+	params = &conn->params[conn->num_params++ % CONN_PARAMS_MAX];
+	params->tv = *tv;
+	params->interval = interval;
+	params->latency = latency;
+	params->supv_timeout = supv_timeout;
+}
+
+static void conn_data(struct hci_conn *conn, struct timeval *tv, bool out,
+								uint16_t size)
+{
+	if (!conn->tx_num && !conn->rx_num)
+		conn->time_first = *tv;
+
+	conn->time_last = *tv;
+
+	if (!out) {
+		conn->rx_num++;
+		conn->rx_bytes += size;
+		hist_add(&conn->rx_size, size);
+		return;
+	}
+
+	conn->tx_num++;
+	conn->tx_bytes += size;
+	hist_add(&conn->tx_size, size);
+
+	if (!conn->tx_pending) {
+		conn->tx_pending = new0(uint64_t, CONN_TX_PENDING);
+		conn->tx_head = 0;
+		conn->tx_len = 0;
+	}
+
+	/* Forget the oldest packet when completions are missing */
+	if (conn->tx_len == CONN_TX_PENDING) {
+		conn->tx_head = (conn->tx_head + 1) % CONN_TX_PENDING;
+		conn->tx_len--;
+		conn->tx_untracked++;
+	}
+
+	conn->tx_pending[(conn->tx_head + conn->tx_len) % CONN_TX_PENDING] =
+							tv_to_usec(tv);
+	conn->tx_len++;
+}
+
+static void conn_completed(struct hci_conn *conn, struct timeval *tv,
+							uint16_t count)
+{
+	uint64_t now = tv_to_usec(tv);
+
+	while (count-- && conn->tx_len) {
+		uint64_t sent = conn->tx_pending[conn->tx_head];
+
+		hist_add(&conn->completed, now > sent ? now - sent : 0);
+
+		conn->tx_head = (conn->tx_head + 1) % CONN_TX_PENDING;
+		conn->tx_len--;
+	}
+}
+
+static void cmd_stats_destroy(void *data)
+{
+	free(data);
+}
+
+static void print_cmd_stats(void *data, void *user_data)
+{
+	struct cmd_stats *stats = data;
+	char label[16];
+
+	snprintf(label, sizeof(label), "0x%2.2x|0x%4.4x",
+			stats->opcode >> 10, stats->opcode & 0x03ff);
+
+	print_hist(stdout, label, &stats->latency);
+}
+
+static void copy_report(FILE *report)
+{
+	char buf[4096];
+	size_t len;
+
+	rewind(report);
+
+	while ((len = fread(buf, 1, sizeof(buf), report)) > 0)
+		fwrite(buf, 1, len, stdout);
+}
 
 static void dev_destroy(void *data)
 {
@@ -74,8 +538,29 @@ static void dev_destroy(void *data)
 	printf("  %lu events\n", dev->num_evt);
 	printf("  %lu ACL packets\n", dev->num_acl);
 	printf("  %lu SCO packets\n", dev->num_sco);
+	printf("  %lu connections\n", dev->num_conn);
+
+	if (!queue_isempty(dev->cmd_list)) {
+		print_hist_header(stdout, "Command latency (usec)");
+		queue_foreach(dev->cmd_list, print_cmd_stats, NULL);
+	}
+
+	if (dev->num_cmd_untracked)
+		printf("  %lu commands not tracked for latency\n",
+						dev->num_cmd_untracked);
+
 	printf("\n");
 
+	if (dev->conn_report) {
+		copy_report(dev->conn_report);
+		fclose(dev->conn_report);
+	}
+
+	queue_foreach(dev->conn_list, conn_report, stdout);
+
+	queue_destroy(dev->conn_list, conn_free);
+	queue_destroy(dev->cmd_list, cmd_stats_destroy);
+
 	free(dev);
 }
 
@@ -90,6 +575,8 @@ static struct hci_dev *dev_alloc(uint16_t index)
 	}
 
 	dev->index = index;
+	dev->conn_list = queue_new_keyed(offsetof(struct hci_conn, handle));
+	dev->cmd_list = queue_new_keyed(offsetof(struct cmd_stats, opcode));
 
 	return dev;
 }
@@ -147,7 +634,8 @@ static void del_index(struct timeval *tv, uint16_t index,
 		return;
 	}
 
-	dev_destroy(dev);
+	/* Reported after the summary of the whole trace */
+	queue_push_tail(dev_removed, dev);
 }
 
 static void command_pkt(struct timeval *tv, uint16_t index,
@@ -164,6 +652,50 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_cmd++;
+
+	/* Forget the oldest command when responses are missing */
+	if (dev->num_cmd_pending == DEV_CMD_PENDING) {
+		memmove(dev->cmd_pending, dev->cmd_pending + 1,
+			sizeof(dev->cmd_pending[0]) * (DEV_CMD_PENDING - 1));
+		dev->num_cmd_pending--;
+		dev->num_cmd_untracked++;
+	}
+
+	dev->cmd_pending[dev->num_cmd_pending].opcode =
+						le16_to_cpu(hdr->opcode);
+	dev->cmd_pending[dev->num_cmd_pending].sent = tv_to_usec(tv);
+	dev->num_cmd_pending++;
+}
+
+static void cmd_response(struct hci_dev *dev, struct timeval *tv,
+							uint16_t opcode)
+{
+	struct cmd_stats *stats;
+	uint64_t now = tv_to_usec(tv), sent;
+	unsigned int i;
+
+	for (i = 0; i < dev->num_cmd_pending; i++) {
+		if (dev->cmd_pending[i].opcode == opcode)
+			break;
+	}
+
+	if (i == dev->num_cmd_pending)
+		return;
+
+	sent = dev->cmd_pending[i].sent;
+
+	dev->num_cmd_pending--;
+	memmove(dev->cmd_pending + i, dev->cmd_pending + i + 1,
+		sizeof(dev->cmd_pending[0]) * (dev->num_cmd_pending - i));
+
+	stats = queue_find_by_key(dev->cmd_list, opcode);
+	if (!stats) {
+		stats = new0(struct cmd_stats, 1);
+		stats->opcode = opcode;
+		queue_push_tail(dev->cmd_list, stats);
+	}
+
+	hist_add(&stats->latency, now > sent ? now - sent : 0);
 }
 
 static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
@@ -190,6 +722,8 @@ static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 
 	opcode = le16_to_cpu(evt->opcode);
 
+	cmd_response(dev, tv, opcode);
+
 	switch (opcode) {
 	case BT_HCI_CMD_READ_BD_ADDR:
 		rsp_read_bd_addr(dev, tv, data, size);
@@ -197,6 +731,173 @@ static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 	}
 }
 
+static void evt_cmd_status(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_cmd_status *evt = data;
+
+	if (size < sizeof(*evt))
+		return;
+
+	cmd_response(dev, tv, le16_to_cpu(evt->opcode));
+}
+
+static uint8_t link_type_to_conn(uint8_t link_type)
+{
+	switch (link_type) {
+	case 0x00:
+		return CONN_TYPE_SCO;
+	case 0x01:
+		return CONN_TYPE_BREDR;
+	case 0x02:
+		return CONN_TYPE_ESCO;
+	}
+
+	return CONN_TYPE_UNKNOWN;
+}
+
+static void evt_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_setup(dev, tv, le16_to_cpu(evt->handle),
+				link_type_to_conn(evt->link_type), evt->bdaddr);
+}
+
+static void evt_sync_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_sync_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_setup(dev, tv, le16_to_cpu(evt->handle),
+				link_type_to_conn(evt->link_type), evt->bdaddr);
+}
+
+static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+	struct hci_conn *conn;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn = queue_remove_by_key(dev->conn_list, le16_to_cpu(evt->handle));
+	if (conn)
+		conn_destroy(dev, conn);
+}
+
+static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const uint8_t *num_handles = data;
+	const uint8_t *ptr = data + 1;
+	unsigned int i;
+
+	if (size < 1 || size - 1 < *num_handles * 4)
+		return;
+
+	for (i = 0; i < *num_handles; i++, ptr += 4) {
+		uint16_t handle = get_le16(ptr);
+		uint16_t count = get_le16(ptr + 2);
+		struct hci_conn *conn;
+
+		conn = queue_find_by_key(dev->conn_list, handle);
+		if (conn)
+			conn_completed(conn, tv, count);
+	}
+}
+
+static void evt_le_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_conn_complete *evt = data;
+	struct hci_conn *conn;
+	uint16_t handle;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	handle = le16_to_cpu(evt->handle);
+
+	conn_setup(dev, tv, handle, CONN_TYPE_LE, evt->peer_addr);
+
+	conn = queue_find_by_key(dev->conn_list, handle);
+	conn_add_params(conn, tv, le16_to_cpu(evt->interval),
+				le16_to_cpu(evt->latency),
+				le16_to_cpu(evt->supv_timeout));
+}
+
+static void evt_le_enhanced_conn_complete(struct hci_dev *dev,
+					struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_enhanced_conn_complete *evt = data;
+	struct hci_conn *conn;
+	uint16_t handle;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	handle = le16_to_cpu(evt->handle);
+
+	conn_setup(dev, tv, handle, CONN_TYPE_LE, evt->peer_addr);
+
+	conn = queue_find_by_key(dev->conn_list, handle);
+	conn_add_params(conn, tv, le16_to_cpu(evt->interval),
+				le16_to_cpu(evt->latency),
+				le16_to_cpu(evt->supv_timeout));
+}
+
+static void evt_le_conn_update_complete(struct hci_dev *dev,
+					struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_conn_update_complete *evt = data;
+	struct hci_conn *conn;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn = conn_lookup(dev, le16_to_cpu(evt->handle));
+	conn_add_params(conn, tv, le16_to_cpu(evt->interval),
+				le16_to_cpu(evt->latency),
+				le16_to_cpu(evt->supv_timeout));
+}
+
+static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	uint8_t subevent;
+
+	if (size < 1)
+		return;
+
+	subevent = *((const uint8_t *) data);
+
+	data += 1;
+	size -= 1;
+
+	switch (subevent) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+		evt_le_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_CONN_UPDATE_COMPLETE:
+		evt_le_conn_update_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		evt_le_enhanced_conn_complete(dev, tv, data, size);
+		break;
+	}
+}
+
 static void event_pkt(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -213,42 +914,67 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	dev->num_evt++;
 
 	switch (hdr->evt) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+		evt_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		evt_disconnect_complete(dev, tv, data, size);
+		break;
 	case BT_HCI_EVT_CMD_COMPLETE:
 		evt_cmd_complete(dev, tv, data, size);
 		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		evt_cmd_status(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		evt_num_completed_packets(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+		evt_sync_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta_event(dev, tv, data, size);
+		break;
 	}
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index,
+static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_acl_hdr *hdr = data;
 	struct hci_dev *dev;
 
-	data += sizeof(*hdr);
-	size -= sizeof(*hdr);
+	if (size < sizeof(*hdr))
+		return;
 
 	dev = dev_lookup(index);
 	if (!dev)
 		return;
 
 	dev->num_acl++;
+
+	/* Sizes come from the header, captures may be truncated */
+	conn_data(conn_lookup(dev, le16_to_cpu(hdr->handle) & 0x0fff), tv,
+					out, le16_to_cpu(hdr->dlen));
 }
 
-static void sco_pkt(struct timeval *tv, uint16_t index,
+static void sco_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_sco_hdr *hdr = data;
 	struct hci_dev *dev;
 
-	data += sizeof(*hdr);
-	size -= sizeof(*hdr);
+	if (size < sizeof(*hdr))
+		return;
 
 	dev = dev_lookup(index);
 	if (!dev)
 		return;
 
 	dev->num_sco++;
+
+	conn_data(conn_lookup(dev, le16_to_cpu(hdr->handle) & 0x0fff), tv,
+							out, hdr->dlen);
 }
 
 void analyze_trace(const char *path)
@@ -279,13 +1005,15 @@ void analyze_trace(const char *path)
 		goto done;
 	}
 
+	dev_removed = queue_new();
+
 	while (1) {
-		unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
+		const void *buf;
 		struct timeval tv;
 		uint16_t index, opcode, pktlen;
 
-		if (!btsnoop_read_hci(btsnoop_file, &tv, &index, &opcode,
-								buf, &pktlen))
+		if (!btsnoop_next_hci(btsnoop_file, &tv, &index, &opcode,
+								&buf, &pktlen))
 			break;
 
 		switch (opcode) {
@@ -302,12 +1030,16 @@ void analyze_trace(const char *path)
 			event_pkt(&tv, index, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_ACL_TX_PKT:
+			acl_pkt(&tv, index, true, buf, pktlen);
+			break;
 		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, buf, pktlen);
+			acl_pkt(&tv, index, false, buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_SCO_TX_PKT:
+			sco_pkt(&tv, index, true, buf, pktlen);
+			break;
 		case BTSNOOP_OPCODE_SCO_RX_PKT:
-			sco_pkt(&tv, index, buf, pktlen);
+			sco_pkt(&tv, index, false, buf, pktlen);
 			break;
 		default:
 			fprintf(stderr, "Wrong opcode %u\n", opcode);
@@ -319,6 +1051,7 @@ void analyze_trace(const char *path)
 
 	printf("Trace contains %lu packets\n\n", num_packets);
 
+	queue_destroy(dev_removed, dev_destroy);
 	queue_destroy(dev_list, dev_destroy);
 
 done:
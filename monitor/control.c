@@ -32,7 +32,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -41,6 +44,7 @@
 #include "lib/mgmt.h"
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
 #include "src/shared/btsnoop.h"
 #include "src/shared/mainloop.h"
 
@@ -1142,14 +1146,285 @@ void control_server(const char *path)
 	server_fd = fd;
 }
 
-bool control_writer(const char *path)
+#define WRITER_BUFFER_SIZE	(64 * 1024)
+
+static void writer_flush(int id, void *user_data)
 {
-	btsnoop_file = btsnoop_create(path, BTSNOOP_TYPE_MONITOR);
+	btsnoop_flush(btsnoop_file);
 
-	return !!btsnoop_file;
+	mainloop_modify_timeout(id, PTR_TO_UINT(user_data));
 }
 
-void control_reader(const char *path)
+bool control_writer(const char *path, size_t max_size, unsigned int max_secs,
+			unsigned int max_count, unsigned int flush_msec)
+{
+	btsnoop_file = btsnoop_create(path, max_size, max_secs, max_count,
+							BTSNOOP_TYPE_MONITOR);
+	if (!btsnoop_file)
+		return false;
+
+	if (!flush_msec)
+		return true;
+
+	/* Without the buffer every packet is still written right away */
+	if (!btsnoop_set_buffer(btsnoop_file, WRITER_BUFFER_SIZE, flush_msec))
+		return true;
+
+	/* Flush even when no further packets arrive */
+	mainloop_add_timeout(flush_msec, writer_flush, UINT_TO_PTR(flush_msec),
+									NULL);
+
+	return true;
+}
+
+void control_cleanup(void)
+{
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+static bool reader_next(const struct timeval *since,
+				const struct timeval *until, struct timeval *tv,
+				uint16_t *index, uint16_t *opcode,
+				const void **data, uint16_t *size)
+{
+	while (btsnoop_next_hci(btsnoop_file, tv, index, opcode, data, size)) {
+		if (*opcode == 0xffff)
+			continue;
+
+		if (since && timercmp(tv, since, <))
+			continue;
+
+		if (until && timercmp(tv, until, >))
+			return false;
+
+		return true;
+	}
+
+	return false;
+}
+
+/* Packets rendered by one worker process */
+#define READER_CHUNK	4096
+
+static bool reader_chunk(const struct timeval *since,
+				const struct timeval *until, bool inject)
+{
+	struct timeval tv;
+	uint16_t index, opcode, pktlen;
+	const void *data;
+	int n;
+
+	for (n = 0; n < READER_CHUNK; n++) {
+		if (!reader_next(since, until, &tv, &index, &opcode,
+							&data, &pktlen))
+			return false;
+
+		packet_monitor(&tv, index, opcode, data, pktlen);
+
+		if (inject)
+			ellisys_inject_hci(&tv, index, opcode, data, pktlen);
+	}
+
+	return true;
+}
+
+struct reader_job {
+	pid_t pid;
+	FILE *out;
+};
+
+static struct reader_job *start_job(const struct timeval *since,
+						const struct timeval *until)
+{
+	struct reader_job *job;
+
+	job = new0(struct reader_job, 1);
+
+	job->out = tmpfile();
+	if (!job->out) {
+		free(job);
+		return NULL;
+	}
+
+	/* Nothing buffered may end up in the output of the worker */
+	fflush(stdout);
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		fclose(job->out);
+		free(job);
+		return NULL;
+	}
+
+	if (job->pid == 0) {
+		dup2(fileno(job->out), STDOUT_FILENO);
+
+		reader_chunk(since, until, false);
+
+		if (fflush(stdout) || ferror(stdout))
+			_exit(EXIT_FAILURE);
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	return job;
+}
+
+static void free_job(struct reader_job *job)
+{
+	fclose(job->out);
+	free(job);
+}
+
+static void abort_job(void *data)
+{
+	struct reader_job *job = data;
+
+	kill(job->pid, SIGKILL);
+	while (waitpid(job->pid, NULL, 0) < 0 && errno == EINTR);
+
+	free_job(job);
+}
+
+/* Copies the output of a worker, which is only complete if it exited
+ * successfully
+ */
+static bool finish_job(struct reader_job *job, int out_fd)
+{
+	int fd = fileno(job->out);
+	unsigned char buf[16384];
+	bool result = false;
+	ssize_t len;
+	int status;
+
+	while (waitpid(job->pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			goto done;
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+		goto done;
+
+	lseek(fd, 0, SEEK_SET);
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		ssize_t written = 0;
+
+		while (written < len) {
+			ssize_t ret;
+
+			ret = write(out_fd, buf + written, len - written);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				goto done;
+			}
+
+			written += ret;
+		}
+	}
+
+	result = len == 0;
+
+done:
+	free_job(job);
+
+	return result;
+}
+
+/*
+ * Every chunk of packets gets rendered by its own worker process. The
+ * workers are forked right at the start of their chunk and so inherit
+ * the complete decoder state, including connections and L2CAP channels.
+ * The main process then runs the chunk through the decoders in quiet
+ * mode to bring its state up to date for the next worker, and copies
+ * the output of finished workers in order.
+ *
+ * The state a failed worker started from is gone by the time it gets
+ * noticed, so its chunk can't be rendered again and decoding stops.
+ */
+static void reader_jobs(unsigned int jobs, const struct timeval *since,
+						const struct timeval *until)
+{
+	struct queue *pending;
+	struct reader_job *job;
+	int out_fd, null_fd;
+	bool more = true;
+
+	/* Settle the output settings before stdout gets replaced */
+	use_color();
+	num_columns();
+
+	fflush(stdout);
+
+	out_fd = dup(STDOUT_FILENO);
+	if (out_fd < 0)
+		goto sequential;
+
+	null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (null_fd < 0) {
+		close(out_fd);
+		goto sequential;
+	}
+
+	dup2(null_fd, STDOUT_FILENO);
+
+	pending = queue_new();
+
+	while (more) {
+		if (queue_length(pending) >= jobs &&
+				!finish_job(queue_pop_head(pending), out_fd))
+			goto failed;
+
+		job = start_job(since, until);
+		if (job) {
+			queue_push_tail(pending, job);
+
+			set_quiet(true);
+			more = reader_chunk(since, until, true);
+			set_quiet(false);
+			continue;
+		}
+
+		/* Without a worker the chunk gets rendered right here */
+		while ((job = queue_pop_head(pending))) {
+			if (!finish_job(job, out_fd))
+				goto failed;
+		}
+
+		dup2(out_fd, STDOUT_FILENO);
+		more = reader_chunk(since, until, true);
+		fflush(stdout);
+		dup2(null_fd, STDOUT_FILENO);
+	}
+
+	while ((job = queue_pop_head(pending))) {
+		if (!finish_job(job, out_fd))
+			goto failed;
+	}
+
+	goto done;
+
+failed:
+	fprintf(stderr, "Decoding worker failed, output is incomplete\n");
+
+done:
+	queue_destroy(pending, abort_job);
+
+	fflush(stdout);
+	dup2(out_fd, STDOUT_FILENO);
+	close(out_fd);
+	close(null_fd);
+
+	return;
+
+sequential:
+	while (reader_chunk(since, until, true));
+}
+
+void control_reader(const char *path, const struct timeval *since,
+				const struct timeval *until, unsigned int jobs)
 {
 	unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
 	uint16_t pktlen;
@@ -1174,25 +1449,24 @@ void control_reader(const char *path)
 		break;
 	}
 
+	/* Without a usable index the packets get filtered one by one */
+	if (since)
+		btsnoop_seek(btsnoop_file, since);
+
 	open_pager();
 
 	switch (type) {
 	case BTSNOOP_TYPE_HCI:
 	case BTSNOOP_TYPE_UART:
 	case BTSNOOP_TYPE_MONITOR:
-		while (1) {
-			uint16_t index, opcode;
-
-			if (!btsnoop_read_hci(btsnoop_file, &tv, &index,
-							&opcode, buf, &pktlen))
-				break;
-
-			if (opcode == 0xffff)
-				continue;
-
-			packet_monitor(&tv, index, opcode, buf, pktlen);
-			ellisys_inject_hci(&tv, index, opcode, buf, pktlen);
-		}
+		/* Workers share the file position with the main process
+		 * unless the trace is mapped, so anything else gets decoded
+		 * in order
+		 */
+		if (jobs > 1 && btsnoop_is_mapped(btsnoop_file))
+			reader_jobs(jobs, since, until);
+		else
+			while (reader_chunk(since, until, true));
 		break;
 
 	case BTSNOOP_TYPE_SIMULATOR:
@@ -23,10 +23,15 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
 
-bool control_writer(const char *path);
-void control_reader(const char *path);
+bool control_writer(const char *path, size_t max_size, unsigned int max_secs,
+			unsigned int max_count, unsigned int flush_msec);
+void control_reader(const char *path, const struct timeval *since,
+				const struct timeval *until, unsigned int jobs);
 void control_server(const char *path);
 int control_tracing(void);
+void control_cleanup(void);
 
 void control_message(uint16_t opcode, const void *data, uint16_t size);
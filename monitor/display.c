@@ -40,6 +40,7 @@
 #include "display.h"
 
 static pid_t pager_pid = 0;
+static bool quiet = false;
 
 bool use_color(void)
 {
@@ -51,6 +52,20 @@ bool use_color(void)
 	return cached_use_color;
 }
 
+/*
+ * Decoding still runs in quiet mode to keep track of state, only the
+ * output formatting is skipped.
+ */
+bool use_quiet(void)
+{
+	return quiet;
+}
+
+void set_quiet(bool enable)
+{
+	quiet = enable;
+}
+
 int num_columns(void)
 {
 	static int cached_num_columns = -1;
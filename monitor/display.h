@@ -25,6 +25,8 @@
 #include <stdbool.h>
 
 bool use_color(void);
+bool use_quiet(void);
+void set_quiet(bool enable);
 
 #define COLOR_OFF	"\x1B[0m"
 #define COLOR_BLACK	"\x1B[0;30m"
@@ -44,6 +46,8 @@ bool use_color(void);
 
 #define print_indent(indent, color1, prefix, title, color2, fmt, args...) \
 do { \
+	if (use_quiet()) \
+		break; \
 	printf("%*c%s%s%s%s" fmt "%s\n", (indent), ' ', \
 		use_color() ? (color1) : "", prefix, title, \
 		use_color() ? (color2) : "", ## args, \
@@ -28,9 +28,13 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <getopt.h>
+#include <sys/time.h>
 
 #include "src/shared/mainloop.h"
 
@@ -59,6 +63,13 @@ static void usage(void)
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t-z, --max-size <size>  Start a new trace file at size [kMG]\n"
+		"\t-Z, --max-time <secs>  Start a new trace file every secs\n"
+		"\t-n, --max-files <num>  Keep only the newest num trace files\n"
+		"\t-F, --flush <msec>     Buffer trace writes for up to msec\n"
+		"\t    --since <time>     Skip traces before time\n"
+		"\t    --until <time>     Skip traces after time\n"
+		"\t-j, --jobs <num>       Decode traces with num processes\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-i, --index <num>      Show only specified controller\n"
@@ -67,11 +78,20 @@ static void usage(void)
 		"\t-S, --sco              Dump SCO traffic\n"
 		"\t-E, --ellisys [ip]     Send Ellisys HCI Injection\n"
 		"\t-h, --help             Show help options\n");
+	printf("\nTime is given as \"YYYY-MM-DD HH:MM:SS[.usec]\" in local time\n"
+		"or as seconds[.usec] since the epoch\n");
 }
 
 static const struct option main_options[] = {
 	{ "read",    required_argument, NULL, 'r' },
 	{ "write",   required_argument, NULL, 'w' },
+	{ "max-size",  required_argument, NULL, 'z' },
+	{ "max-time",  required_argument, NULL, 'Z' },
+	{ "max-files", required_argument, NULL, 'n' },
+	{ "flush",   required_argument, NULL, 'F' },
+	{ "since",   required_argument, NULL, 'B' },
+	{ "until",   required_argument, NULL, 'U' },
+	{ "jobs",    required_argument, NULL, 'j' },
 	{ "analyze", required_argument, NULL, 'a' },
 	{ "server",  required_argument, NULL, 's' },
 	{ "index",   required_argument, NULL, 'i' },
@@ -85,11 +105,112 @@ static const struct option main_options[] = {
 	{ }
 };
 
+static bool parse_uint(const char *str, unsigned int *value)
+{
+	unsigned long val;
+	char *end;
+
+	/* strtoul() silently negates a leading minus sign */
+	if (!isdigit(*str))
+		return false;
+
+	errno = 0;
+	val = strtoul(str, &end, 10);
+	if (errno || *end != '\0' || val > UINT_MAX)
+		return false;
+
+	*value = val;
+
+	return true;
+}
+
+static bool parse_size(const char *str, size_t *size)
+{
+	unsigned long long value;
+	char *end;
+
+	value = strtoull(str, &end, 10);
+	if (end == str)
+		return false;
+
+	switch (*end) {
+	case 'g':
+	case 'G':
+		value <<= 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		value <<= 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		value <<= 10;
+		end++;
+		break;
+	}
+
+	if (*end != '\0')
+		return false;
+
+	*size = value;
+
+	return true;
+}
+
+static bool parse_time(const char *str, struct timeval *tv)
+{
+	unsigned long usec = 0;
+	const char *end;
+	char *ptr;
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_isdst = -1;
+
+	end = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+	if (end) {
+		tv->tv_sec = mktime(&tm);
+		if (tv->tv_sec == (time_t) -1)
+			return false;
+	} else {
+		tv->tv_sec = strtoul(str, &ptr, 10);
+		if (ptr == str)
+			return false;
+		end = ptr;
+	}
+
+	if (*end == '.') {
+		unsigned int digits;
+
+		for (end++, digits = 0; isdigit(*end); end++, digits++) {
+			if (digits < 6)
+				usec = usec * 10 + (*end - '0');
+		}
+
+		for (; digits < 6; digits++)
+			usec *= 10;
+	}
+
+	if (*end != '\0')
+		return false;
+
+	tv->tv_usec = usec;
+
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
 	unsigned long filter_mask = 0;
 	const char *reader_path = NULL;
+	struct timeval reader_since, reader_until;
+	bool since_set = false, until_set = false;
+	unsigned int reader_jobs = 1;
 	const char *writer_path = NULL;
+	size_t writer_max_size = 0;
+	unsigned int writer_max_secs = 0;
+	unsigned int writer_max_count = 0;
+	unsigned int writer_flush = 0;
 	const char *analyze_path = NULL;
 	const char *ellisys_server = NULL;
 	unsigned short ellisys_port = 0;
@@ -104,7 +225,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "r:w:a:s:i:tTSE:vh",
+		opt = getopt_long(argc, argv, "r:w:z:Z:n:F:j:a:s:i:tTSE:vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -116,6 +237,51 @@ int main(int argc, char *argv[])
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'z':
+			if (!parse_size(optarg, &writer_max_size)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'Z':
+			if (!parse_uint(optarg, &writer_max_secs)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			if (!parse_uint(optarg, &writer_max_count)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'F':
+			if (!parse_uint(optarg, &writer_flush)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'B':
+			if (!parse_time(optarg, &reader_since)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			since_set = true;
+			break;
+		case 'U':
+			if (!parse_time(optarg, &reader_until)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			until_set = true;
+			break;
+		case 'j':
+			if (!parse_uint(optarg, &reader_jobs) ||
+							!reader_jobs) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
@@ -174,6 +340,16 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if ((since_set || until_set) && !reader_path) {
+		fprintf(stderr, "Time range needs a trace to read\n");
+		return EXIT_FAILURE;
+	}
+
+	if (writer_max_count && !writer_max_size && !writer_max_secs) {
+		fprintf(stderr, "Maximum files needs a size or time limit\n");
+		return EXIT_FAILURE;
+	}
+
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
@@ -195,11 +371,15 @@ int main(int argc, char *argv[])
 		if (ellisys_server)
 			ellisys_enable(ellisys_server, ellisys_port);
 
-		control_reader(reader_path);
+		control_reader(reader_path, since_set ? &reader_since : NULL,
+					until_set ? &reader_until : NULL,
+					reader_jobs);
 		return EXIT_SUCCESS;
 	}
 
-	if (writer_path && !control_writer(writer_path)) {
+	if (writer_path && !control_writer(writer_path, writer_max_size,
+					writer_max_secs, writer_max_count,
+					writer_flush)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
 	}
@@ -212,6 +392,8 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run();
 
+	control_cleanup();
+
 	keys_cleanup();
 
 	return exit_status;
@@ -168,6 +168,9 @@ static void print_packet(struct timeval *tv, uint16_t index, char ident,
 	char line[256], ts_str[64];
 	int n, ts_len = 0, ts_pos = 0, len = 0, pos = 0;
 
+	if (use_quiet())
+		return;
+
 	if (filter_mask & PACKET_FILTER_SHOW_INDEX) {
 		if (use_color()) {
 			n = sprintf(ts_str + ts_pos, "%s", COLOR_INDEX_LABEL);
@@ -357,19 +360,35 @@ static const struct {
 	{ }
 };
 
+static const char *error2str(uint8_t error)
+{
+	static const char *error_index[256];
+	static bool error_index_ready;
+	int i;
+
+	if (!error_index_ready) {
+		for (i = 0; error2str_table[i].str; i++) {
+			uint8_t code = error2str_table[i].error;
+
+			if (!error_index[code])
+				error_index[code] = error2str_table[i].str;
+		}
+
+		error_index_ready = true;
+	}
+
+	return error_index[error];
+}
+
 static void print_error(const char *label, uint8_t error)
 {
 	const char *str = "Unknown";
 	const char *color_on, *color_off;
 	bool unknown = true;
-	int i;
 
-	for (i = 0; error2str_table[i].str; i++) {
-		if (error2str_table[i].error == error) {
-			str = error2str_table[i].str;
-			unknown = false;
-			break;
-		}
+	if (error2str(error)) {
+		str = error2str(error);
+		unknown = false;
 	}
 
 	if (use_color()) {
@@ -1815,9 +1834,15 @@ static void print_link_key(const uint8_t *link_key)
 
 static void print_pin_code(const uint8_t *pin_code, uint8_t pin_len)
 {
-	char str[pin_len + 1];
+	char str[17];
 	uint8_t i;
 
+	/* The PIN code field is 16 octets, whatever the length says */
+	if (pin_len > 16)
+		pin_len = 16;
+
+	str[0] = '\0';
+
 	for (i = 0; i < pin_len; i++)
 		sprintf(str + i, "%c", (const char) pin_code[i]);
 
@@ -3613,7 +3638,7 @@ void packet_hexdump(const unsigned char *buf, uint16_t len)
 	char str[68];
 	uint16_t i;
 
-	if (!len)
+	if (!len || use_quiet())
 		return;
 
 	for (i = 0; i < len; i++) {
@@ -7186,16 +7211,85 @@ static const struct opcode_data opcode_table[] = {
 	{ }
 };
 
-static const char *get_supported_command(int bit)
+/*
+ * The opcode table is looked up for every command, command complete and
+ * command status, so it gets indexed by OGF and OCF on first use. Each
+ * OGF only gets as many slots as its highest OCF needs.
+ */
+static const struct opcode_data **opcode_index[64];
+static uint16_t opcode_index_len[64];
+static const char **command_bit_index;
+static int command_bit_len;
+
+static void setup_opcode_index(void)
 {
 	int i;
 
 	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].bit == bit)
-			return opcode_table[i].str;
+		uint16_t ogf = cmd_opcode_ogf(opcode_table[i].opcode);
+		uint16_t ocf = cmd_opcode_ocf(opcode_table[i].opcode);
+
+		if (ocf >= opcode_index_len[ogf])
+			opcode_index_len[ogf] = ocf + 1;
+
+		if (opcode_table[i].bit >= command_bit_len)
+			command_bit_len = opcode_table[i].bit + 1;
 	}
 
-	return NULL;
+	for (i = 0; i < 64; i++) {
+		if (!opcode_index_len[i])
+			continue;
+
+		opcode_index[i] = calloc(opcode_index_len[i],
+						sizeof(*opcode_index[i]));
+		if (!opcode_index[i])
+			opcode_index_len[i] = 0;
+	}
+
+	command_bit_index = calloc(command_bit_len, sizeof(*command_bit_index));
+	if (!command_bit_index)
+		command_bit_len = 0;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		uint16_t ogf = cmd_opcode_ogf(opcode_table[i].opcode);
+		uint16_t ocf = cmd_opcode_ocf(opcode_table[i].opcode);
+		int bit = opcode_table[i].bit;
+
+		if (ocf < opcode_index_len[ogf] && !opcode_index[ogf][ocf])
+			opcode_index[ogf][ocf] = &opcode_table[i];
+
+		if (bit >= 0 && bit < command_bit_len &&
+						!command_bit_index[bit])
+			command_bit_index[bit] = opcode_table[i].str;
+	}
+}
+
+static const struct opcode_data *find_opcode(uint16_t opcode)
+{
+	static bool ready;
+	uint16_t ogf = cmd_opcode_ogf(opcode);
+	uint16_t ocf = cmd_opcode_ocf(opcode);
+
+	if (!ready) {
+		setup_opcode_index();
+		ready = true;
+	}
+
+	if (ocf >= opcode_index_len[ogf])
+		return NULL;
+
+	return opcode_index[ogf][ocf];
+}
+
+static const char *get_supported_command(int bit)
+{
+	/* Make sure the index has been set up */
+	find_opcode(0x0000);
+
+	if (bit < 0 || bit >= command_bit_len)
+		return NULL;
+
+	return command_bit_index[bit];
 }
 
 static void inquiry_complete_evt(const void *data, uint8_t size)
@@ -7210,6 +7304,13 @@ static void inquiry_result_evt(const void *data, uint8_t size)
 	const struct bt_hci_evt_inquiry_result *evt = data;
 
 	print_num_resp(evt->num_resp);
+
+	/* Without any response there is nothing more to decode */
+	if (size < sizeof(*evt)) {
+		packet_hexdump(data + 1, size - 1);
+		return;
+	}
+
 	print_bdaddr(evt->bdaddr);
 	print_pscan_rep_mode(evt->pscan_rep_mode);
 	print_pscan_period_mode(evt->pscan_period_mode);
@@ -7348,14 +7449,8 @@ static void cmd_complete_evt(const void *data, uint8_t size)
 	uint16_t ocf = cmd_opcode_ocf(opcode);
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->rsp_func)
@@ -7418,14 +7513,8 @@ static void cmd_status_evt(const void *data, uint8_t size)
 	uint16_t ocf = cmd_opcode_ocf(opcode);
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
-	int i;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		opcode_color = COLOR_HCI_COMMAND;
@@ -7474,6 +7563,12 @@ static void num_completed_packets_evt(const void *data, uint8_t size)
 	const struct bt_hci_evt_num_completed_packets *evt = data;
 
 	print_field("Num handles: %d", evt->num_handles);
+
+	if (size < sizeof(*evt)) {
+		packet_hexdump(data + 1, size - 1);
+		return;
+	}
+
 	print_handle(evt->handle);
 	print_field("Count: %d", le16_to_cpu(evt->count));
 
@@ -7611,6 +7706,12 @@ static void inquiry_result_with_rssi_evt(const void *data, uint8_t size)
 	const struct bt_hci_evt_inquiry_result_with_rssi *evt = data;
 
 	print_num_resp(evt->num_resp);
+
+	if (size < sizeof(*evt)) {
+		packet_hexdump(data + 1, size - 1);
+		return;
+	}
+
 	print_bdaddr(evt->bdaddr);
 	print_pscan_rep_mode(evt->pscan_rep_mode);
 	print_pscan_period_mode(evt->pscan_period_mode);
@@ -7676,6 +7777,12 @@ static void ext_inquiry_result_evt(const void *data, uint8_t size)
 	const struct bt_hci_evt_ext_inquiry_result *evt = data;
 
 	print_num_resp(evt->num_resp);
+
+	if (size < sizeof(*evt)) {
+		packet_hexdump(data + 1, size - 1);
+		return;
+	}
+
 	print_bdaddr(evt->bdaddr);
 	print_pscan_rep_mode(evt->pscan_rep_mode);
 	print_pscan_period_mode(evt->pscan_period_mode);
@@ -7898,6 +8005,12 @@ static void num_completed_data_blocks_evt(const void *data, uint8_t size)
 	print_field("Total num data blocks: %d",
 				le16_to_cpu(evt->total_num_blocks));
 	print_field("Num handles: %d", evt->num_handles);
+
+	if (size < sizeof(*evt)) {
+		packet_hexdump(data + 3, size - 3);
+		return;
+	}
+
 	print_handle(evt->handle);
 	print_field("Num packets: %d", evt->num_packets);
 	print_field("Num blocks: %d", evt->num_blocks);
@@ -8211,20 +8324,34 @@ static const struct subevent_data subevent_table[] = {
 	{ }
 };
 
-static void le_meta_event_evt(const void *data, uint8_t size)
+static const struct subevent_data *find_subevent(uint8_t subevent)
 {
-	uint8_t subevent = *((const uint8_t *) data);
-	const struct subevent_data *subevent_data = NULL;
-	const char *subevent_color, *subevent_str;
+	static const struct subevent_data *subevent_index[256];
+	static bool subevent_index_ready;
 	int i;
 
-	for (i = 0; subevent_table[i].str; i++) {
-		if (subevent_table[i].subevent == subevent) {
-			subevent_data = &subevent_table[i];
-			break;
+	if (!subevent_index_ready) {
+		for (i = 0; subevent_table[i].str; i++) {
+			uint8_t code = subevent_table[i].subevent;
+
+			if (!subevent_index[code])
+				subevent_index[code] = &subevent_table[i];
 		}
+
+		subevent_index_ready = true;
 	}
 
+	return subevent_index[subevent];
+}
+
+static void le_meta_event_evt(const void *data, uint8_t size)
+{
+	uint8_t subevent = *((const uint8_t *) data);
+	const struct subevent_data *subevent_data;
+	const char *subevent_color, *subevent_str;
+
+	subevent_data = find_subevent(subevent);
+
 	if (subevent_data) {
 		if (subevent_data->func)
 			subevent_color = COLOR_HCI_EVENT;
@@ -8429,6 +8556,26 @@ static const struct event_data event_table[] = {
 	{ }
 };
 
+static const struct event_data *find_event(uint8_t event)
+{
+	static const struct event_data *event_index[256];
+	static bool event_index_ready;
+	int i;
+
+	if (!event_index_ready) {
+		for (i = 0; event_table[i].str; i++) {
+			uint8_t code = event_table[i].event;
+
+			if (!event_index[code])
+				event_index[code] = &event_table[i];
+		}
+
+		event_index_ready = true;
+	}
+
+	return event_index[event];
+}
+
 void packet_new_index(struct timeval *tv, uint16_t index, const char *label,
 				uint8_t type, uint8_t bus, const char *name)
 {
@@ -8457,7 +8604,6 @@ void packet_hci_command(struct timeval *tv, uint16_t index,
 	const struct opcode_data *opcode_data = NULL;
 	const char *opcode_color, *opcode_str;
 	char extra_str[25];
-	int i;
 
 	if (size < HCI_COMMAND_HDR_SIZE) {
 		sprintf(extra_str, "(len %d)", size);
@@ -8470,12 +8616,7 @@ void packet_hci_command(struct timeval *tv, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	for (i = 0; opcode_table[i].str; i++) {
-		if (opcode_table[i].opcode == opcode) {
-			opcode_data = &opcode_table[i];
-			break;
-		}
-	}
+	opcode_data = find_opcode(opcode);
 
 	if (opcode_data) {
 		if (opcode_data->cmd_func)
@@ -8534,7 +8675,6 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 	const struct event_data *event_data = NULL;
 	const char *event_color, *event_str;
 	char extra_str[25];
-	int i;
 
 	if (size < HCI_EVENT_HDR_SIZE) {
 		sprintf(extra_str, "(len %d)", size);
@@ -8547,12 +8687,7 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	for (i = 0; event_table[i].str; i++) {
-		if (event_table[i].event == hdr->evt) {
-			event_data = &event_table[i];
-			break;
-		}
-	}
+	event_data = find_event(hdr->evt);
 
 	if (event_data) {
 		if (event_data->func)
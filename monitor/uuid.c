@@ -31,6 +31,7 @@
 
 #include "uuid.h"
 
+/* Sorted by UUID, uuid16_to_str() relies on that */
 static struct {
 	uint16_t uuid;
 	const char *str;
@@ -339,11 +340,19 @@ static struct {
 
 const char *uuid16_to_str(uint16_t uuid)
 {
-	int i;
+	size_t lo = 0, hi = sizeof(uuid16_table) / sizeof(uuid16_table[0]) - 1;
 
-	for (i = 0; uuid16_table[i].str; i++) {
-		if (uuid16_table[i].uuid == uuid)
-			return uuid16_table[i].str;
+	/* The table is sorted by UUID, the terminating entry is skipped */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (uuid16_table[mid].uuid == uuid)
+			return uuid16_table[mid].str;
+
+		if (uuid16_table[mid].uuid < uuid)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
 	return "Unknown";
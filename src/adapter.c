@@ -58,6 +58,7 @@
 #include "src/shared/queue.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
+#include "src/shared/crypto.h"
 
 #include "hcid.h"
 #include "sdpd.h"
@@ -93,6 +94,8 @@
 #define SCAN_TYPE_LE ((1 << BDADDR_LE_PUBLIC) | (1 << BDADDR_LE_RANDOM))
 #define SCAN_TYPE_DUAL (SCAN_TYPE_BREDR | SCAN_TYPE_LE)
 
+#define RPA_CACHE_SIZE		256
+
 #define HCI_RSSI_INVALID	127
 #define DISTANCE_VAL_INVALID	0x7FFF
 #define PATHLOSS_MAX		137
@@ -234,6 +237,7 @@ struct btd_adapter {
 	GSList *connect_list;		/* Devices to connect when found */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
+	struct bt_crypto_resolver *rpa_resolver; /* IRKs of bonded devices */
 
 	struct btd_gatt_database *database;
 	struct btd_advertising *adv_manager;
@@ -3328,6 +3332,19 @@ static void load_irks(struct btd_adapter *adapter, GSList *irks)
 	unsigned int id;
 	GSList *l;
 
+	/*
+	 * Keep a copy for resolving RPAs in reports the kernel did not
+	 * resolve, including controllers without LE Privacy support.
+	 */
+	bt_crypto_resolver_clear(adapter->rpa_resolver);
+
+	for (l = irks; l != NULL; l = g_slist_next(l)) {
+		struct irk_info *info = l->data;
+
+		bt_crypto_resolver_add(adapter->rpa_resolver, info->val,
+					info->bdaddr.b, info->bdaddr_type);
+	}
+
 	/*
 	 * If the controller does not support LE Privacy operation,
 	 * there is no support for loading identity resolving keys
@@ -4197,6 +4214,8 @@ static void adapter_free(gpointer user_data)
 
 	mgmt_unref(adapter->mgmt);
 
+	bt_crypto_resolver_free(adapter->rpa_resolver);
+
 	sdp_list_free(adapter->services, NULL);
 
 	g_slist_free(adapter->connections);
@@ -5112,6 +5131,7 @@ static void load_config(struct btd_adapter *adapter)
 static struct btd_adapter *btd_adapter_new(uint16_t index)
 {
 	struct btd_adapter *adapter;
+	struct bt_crypto *crypto;
 
 	adapter = g_try_new0(struct btd_adapter, 1);
 	if (!adapter)
@@ -5148,6 +5168,10 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->auths = g_queue_new();
 
+	crypto = bt_crypto_new();
+	adapter->rpa_resolver = bt_crypto_resolver_new(crypto, RPA_CACHE_SIZE);
+	bt_crypto_unref(crypto);
+
 	return btd_adapter_ref(adapter);
 }
 
@@ -5371,6 +5395,28 @@ static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
 	return got_match;
 }
 
+/*
+ * The kernel normally resolves RPAs of bonded devices itself. This
+ * catches reports it did not resolve, e.g. when the IRK only became
+ * known after scanning started, without a crypto pass per report.
+ */
+static struct btd_device *resolve_rpa_device(struct btd_adapter *adapter,
+							const bdaddr_t *bdaddr,
+							uint8_t bdaddr_type)
+{
+	bdaddr_t identity;
+	uint8_t identity_type;
+
+	if (bdaddr_type != BDADDR_LE_RANDOM)
+		return NULL;
+
+	if (!bt_crypto_resolver_resolve(adapter->rpa_resolver, bdaddr->b,
+						identity.b, &identity_type))
+		return NULL;
+
+	return btd_adapter_find_device(adapter, &identity, identity_type);
+}
+
 static void update_found_devices(struct btd_adapter *adapter,
 					const bdaddr_t *bdaddr,
 					uint8_t bdaddr_type, int8_t rssi,
@@ -5394,6 +5440,9 @@ static void update_found_devices(struct btd_adapter *adapter,
 	ba2str(bdaddr, addr);
 
 	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+	if (!dev)
+		dev = resolve_rpa_device(adapter, bdaddr, bdaddr_type);
+
 	if (!dev) {
 		/*
 		 * If no client has requested discovery or the device is
@@ -5977,6 +6026,9 @@ int btd_adapter_remove_bonding(struct btd_adapter *adapter,
 {
 	struct mgmt_cp_unpair_device cp;
 
+	bt_crypto_resolver_remove(adapter->rpa_resolver, bdaddr->b,
+								bdaddr_type);
+
 	memset(&cp, 0, sizeof(cp));
 	bacpy(&cp.addr.bdaddr, bdaddr);
 	cp.addr.type = bdaddr_type;
@@ -7014,6 +7066,9 @@ static void new_irk_callback(uint16_t index, uint16_t length,
 	if (duplicate)
 		device_merge_duplicate(device, duplicate);
 
+	bt_crypto_resolver_add(adapter->rpa_resolver, irk->val,
+						addr->bdaddr.b, addr->type);
+
 	persistent = !!ev->store_hint;
 	if (!persistent)
 		return;
@@ -8181,6 +8236,9 @@ void adapter_cleanup(void)
 		btd_adapter_unref(adapter);
 	}
 
+	/* Only prints when MGMT_DEBUG enabled the debug callback */
+	mgmt_print_latency(mgmt_master);
+
 	/*
 	 * In case there is another reference active, clear out
 	 * registered handlers for index added and index removed.
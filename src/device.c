@@ -50,6 +50,7 @@
 #include "src/shared/att.h"
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
 #include "src/shared/gatt-client.h"
 #include "src/shared/gatt-server.h"
 #include "src/shared/ad.h"
@@ -4181,13 +4182,64 @@ static void register_gatt_services(struct btd_device *device)
 	device_svc_resolved(device, device->bdaddr_type, 0);
 }
 
+static void gatt_cache_filename(struct btd_device *device, char *filename)
+{
+	char local[18], peer[18];
+
+	ba2str(btd_adapter_get_address(device->adapter), local);
+	ba2str(&device->bdaddr, peer);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/gatt", local, peer);
+}
+
+static void store_gatt_cache(struct btd_device *device)
+{
+	char filename[PATH_MAX];
+
+	if (!device->le_state.bonded || gatt_db_isempty(device->db))
+		return;
+
+	gatt_cache_filename(device, filename);
+	create_file(filename, S_IRUSR | S_IWUSR);
+
+	if (!gatt_cache_store(device->db, filename))
+		error("Unable to store GATT cache to %s", filename);
+}
+
+static void load_gatt_cache(struct btd_device *device)
+{
+	char filename[PATH_MAX];
+
+	if (!device->le_state.bonded || !gatt_db_isempty(device->db))
+		return;
+
+	gatt_cache_filename(device, filename);
+
+	if (gatt_cache_load(device->db, filename))
+		DBG("GATT cache loaded from %s", filename);
+}
+
+static void count_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
 static void gatt_client_ready_cb(bool success, uint8_t att_ecode,
 								void *user_data)
 {
 	struct btd_device *device = user_data;
+	struct bt_gatt_client_discovery_stats stats;
 
 	DBG("status: %s, error: %u", success ? "success" : "failed", att_ecode);
 
+	if (bt_gatt_client_get_discovery_stats(device->client, &stats))
+		DBG("discovery %s in %llu ms using %llu requests",
+				stats.cached ? "skipped" : "done",
+				(unsigned long long) stats.duration / 1000,
+				(unsigned long long) stats.requests);
+
 	if (!success) {
 		if (device->browse) {
 			struct browse_req *req = device->browse;
@@ -4203,6 +4255,10 @@ static void gatt_client_ready_cb(bool success, uint8_t att_ecode,
 
 	device_accept_gatt_profiles(device);
 
+	/* Only a freshly discovered database needs to be written back */
+	if (!device->gatt_cache_used)
+		store_gatt_cache(device);
+
 	btd_gatt_client_ready(device->client_dbus);
 
 	/*
@@ -4223,7 +4279,29 @@ static void gatt_client_service_changed(uint16_t start_handle,
 							uint16_t end_handle,
 							void *user_data)
 {
+	struct btd_device *device = user_data;
+	char filename[PATH_MAX];
+	unsigned int count = 0;
+
 	DBG("start 0x%04x, end: 0x%04x", start_handle, end_handle);
+
+	if (!device->le_state.bonded)
+		return;
+
+	/*
+	 * bt_gatt_client clears the range when rediscovery fails, so an empty
+	 * range cannot be told apart from an error. Drop the cache in that
+	 * case and let the next connection do a full discovery.
+	 */
+	gatt_db_foreach_service_in_range(device->db, NULL, count_service,
+						&count, start_handle, end_handle);
+	if (count) {
+		store_gatt_cache(device);
+		return;
+	}
+
+	gatt_cache_filename(device, filename);
+	unlink(filename);
 }
 
 static void gatt_debug(const char *str, void *user_data)
@@ -4235,6 +4313,9 @@ static void gatt_client_init(struct btd_device *device)
 {
 	gatt_client_cleanup(device);
 
+	/* Skip discovery entirely if a bonded device left a cache behind */
+	load_gatt_cache(device);
+
 	device->client = bt_gatt_client_new(device->db, device->att,
 							device->att_mtu);
 	if (!device->client) {
@@ -4768,6 +4849,14 @@ void device_set_bonded(struct btd_device *device, uint8_t bdaddr_type)
 		device->le_state.bonded = true;
 
 	btd_device_set_temporary(device, false);
+
+	/*
+	 * Discovery may have completed before pairing did, in which case the
+	 * ready callback did not store the database.
+	 */
+	if (bdaddr_type != BDADDR_BREDR &&
+				bt_gatt_client_is_ready(device->client))
+		store_gatt_cache(device);
 }
 
 void device_set_legacy(struct btd_device *device, bool legacy)
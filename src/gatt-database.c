@@ -73,6 +73,8 @@ struct btd_gatt_database {
 	uint32_t gap_handle;
 	uint32_t gatt_handle;
 	struct queue *device_states;
+	struct queue *subscriptions;	/* Subscribed CCC states by handle */
+	struct btd_gatt_database_notify_stats notify_stats;
 	struct queue *ccc_callbacks;
 	struct gatt_db_attribute *svc_chngd;
 	struct gatt_db_attribute *svc_chngd_ccc;
@@ -142,6 +144,13 @@ struct device_state {
 struct ccc_state {
 	uint16_t handle;
 	uint8_t value[2];
+	struct device_state *dev_state;
+	bool subscribed;
+};
+
+struct ccc_subscription {
+	unsigned int handle;
+	struct queue *states;
 };
 
 struct ccc_cb_data {
@@ -289,11 +298,70 @@ static struct ccc_state *get_ccc_state(struct btd_gatt_database *database,
 		return NULL;
 
 	ccc->handle = handle;
+	ccc->dev_state = dev_state;
 	queue_push_tail(dev_state->ccc_states, ccc);
 
 	return ccc;
 }
 
+static void subscription_free(void *data)
+{
+	struct ccc_subscription *sub = data;
+
+	queue_destroy(sub->states, NULL);
+	free(sub);
+}
+
+/*
+ * Keep track of the devices subscribed to each CCC, so that sending a value
+ * only visits the devices that want it.
+ */
+static void update_subscription(struct btd_gatt_database *database,
+							struct ccc_state *ccc)
+{
+	struct ccc_subscription *sub;
+	bool subscribed = ccc->value[0] || ccc->value[1];
+
+	if (subscribed == ccc->subscribed)
+		return;
+
+	sub = queue_find_by_key(database->subscriptions, ccc->handle);
+
+	if (!subscribed) {
+		ccc->subscribed = false;
+
+		if (!sub)
+			return;
+
+		queue_remove(sub->states, ccc);
+
+		if (queue_isempty(sub->states)) {
+			queue_remove(database->subscriptions, sub);
+			subscription_free(sub);
+		}
+
+		return;
+	}
+
+	if (!sub) {
+		sub = new0(struct ccc_subscription, 1);
+		if (!sub)
+			return;
+
+		sub->handle = ccc->handle;
+		sub->states = queue_new();
+		if (!sub->states) {
+			free(sub);
+			return;
+		}
+
+		queue_push_tail(database->subscriptions, sub);
+	}
+
+	queue_push_tail(sub->states, ccc);
+	ccc->subscribed = true;
+}
+
 static void device_state_free(void *data)
 {
 	struct device_state *state = data;
@@ -446,10 +514,12 @@ static void gatt_database_free(void *data)
 	/* TODO: Persistently store CCC states before freeing them */
 	gatt_db_unregister(database->db, database->db_id);
 
+	queue_destroy(database->subscriptions, subscription_free);
 	queue_destroy(database->device_states, device_state_free);
 	queue_destroy(database->services, service_free);
 	queue_destroy(database->profiles, profile_free);
 	queue_destroy(database->ccc_callbacks, ccc_cb_free);
+	database->subscriptions = NULL;
 	database->device_states = NULL;
 	database->ccc_callbacks = NULL;
 
@@ -793,6 +863,7 @@ static void gatt_ccc_write_cb(struct gatt_db_attribute *attrib,
 	if (!ecode) {
 		ccc->value[0] = value[0];
 		ccc->value[1] = value[1];
+		update_subscription(database, ccc);
 	}
 
 done:
@@ -893,6 +964,7 @@ struct notify {
 	const uint8_t *value;
 	uint16_t len;
 	bool indicate;
+	unsigned int sent;
 };
 
 static void conf_cb(void *user_data)
@@ -902,15 +974,11 @@ static void conf_cb(void *user_data)
 
 static void send_notification_to_device(void *data, void *user_data)
 {
-	struct device_state *device_state = data;
+	struct ccc_state *ccc = data;
+	struct device_state *device_state = ccc->dev_state;
 	struct notify *notify = user_data;
-	struct ccc_state *ccc;
 	struct btd_device *device;
 
-	ccc = find_ccc_state(device_state, notify->ccc_handle);
-	if (!ccc)
-		return;
-
 	if (!ccc->value[0] || (notify->indicate && !(ccc->value[0] & 0x02)))
 		return;
 
@@ -926,19 +994,21 @@ static void send_notification_to_device(void *data, void *user_data)
 	 */
 	if (!notify->indicate) {
 		DBG("GATT server sending notification");
-		bt_gatt_server_send_notification(
+		if (bt_gatt_server_send_notification(
 					btd_device_get_gatt_server(device),
 					notify->handle, notify->value,
-					notify->len);
+					notify->len))
+			notify->sent++;
 		return;
 	}
 
 	DBG("GATT server sending indication");
-	bt_gatt_server_send_indication(btd_device_get_gatt_server(device),
+	if (bt_gatt_server_send_indication(btd_device_get_gatt_server(device),
 							notify->handle,
 							notify->value,
 							notify->len, conf_cb,
-							NULL, NULL);
+							NULL, NULL))
+		notify->sent++;
 }
 
 static void send_notification_to_devices(struct btd_gatt_database *database,
@@ -946,7 +1016,14 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 					uint16_t len, uint16_t ccc_handle,
 					bool indicate)
 {
+	struct btd_gatt_database_notify_stats *stats = &database->notify_stats;
+	struct ccc_subscription *sub;
 	struct notify notify;
+	gint64 start, elapsed;
+
+	sub = queue_find_by_key(database->subscriptions, ccc_handle);
+	if (!sub)
+		return;
 
 	memset(&notify, 0, sizeof(notify));
 
@@ -957,8 +1034,21 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 	notify.len = len;
 	notify.indicate = indicate;
 
-	queue_foreach(database->device_states, send_notification_to_device,
-								&notify);
+	start = g_get_monotonic_time();
+
+	queue_foreach(sub->states, send_notification_to_device, &notify);
+
+	elapsed = g_get_monotonic_time() - start;
+
+	stats->fanouts++;
+	stats->recipients += notify.sent;
+	stats->total_usec += elapsed;
+	if ((uint64_t) elapsed > stats->max_usec)
+		stats->max_usec = elapsed;
+
+	DBG("Handle 0x%04x sent to %u of %u subscribers in %lld us", handle,
+					notify.sent, queue_length(sub->states),
+					(long long) elapsed);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
@@ -1018,6 +1108,19 @@ static void remove_device_ccc(void *data, void *user_data)
 	queue_remove_all(state->ccc_states, ccc_match_service, user_data, free);
 }
 
+static bool subscription_match_service(const void *data,
+							const void *match_data)
+{
+	const struct ccc_subscription *sub = data;
+	const struct gatt_db_attribute *attrib = match_data;
+	uint16_t start, end;
+
+	if (!gatt_db_attribute_get_service_handles(attrib, &start, &end))
+		return false;
+
+	return sub->handle >= start && sub->handle <= end;
+}
+
 static void gatt_db_service_removed(struct gatt_db_attribute *attrib,
 								void *user_data)
 {
@@ -1027,6 +1130,8 @@ static void gatt_db_service_removed(struct gatt_db_attribute *attrib,
 
 	send_service_changed(database, attrib);
 
+	queue_remove_all(database->subscriptions, subscription_match_service,
+						attrib, subscription_free);
 	queue_foreach(database->device_states, remove_device_ccc, attrib);
 	queue_remove_all(database->ccc_callbacks, ccc_cb_match_service, attrib,
 								ccc_cb_free);
@@ -2492,6 +2597,11 @@ struct btd_gatt_database *btd_gatt_database_new(struct btd_adapter *adapter)
 	if (!database->device_states)
 		goto fail;
 
+	database->subscriptions = queue_new_keyed(
+				offsetof(struct ccc_subscription, handle));
+	if (!database->subscriptions)
+		goto fail;
+
 	database->services = queue_new();
 	if (!database->services)
 		goto fail;
@@ -2565,6 +2675,17 @@ void btd_gatt_database_destroy(struct btd_gatt_database *database)
 	gatt_database_free(database);
 }
 
+bool btd_gatt_database_get_notify_stats(struct btd_gatt_database *database,
+				struct btd_gatt_database_notify_stats *stats)
+{
+	if (!database || !stats)
+		return false;
+
+	*stats = database->notify_stats;
+
+	return true;
+}
+
 struct gatt_db *btd_gatt_database_get_db(struct btd_gatt_database *database)
 {
 	if (!database)
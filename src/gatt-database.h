@@ -24,6 +24,16 @@ void btd_gatt_database_destroy(struct btd_gatt_database *database);
 
 struct gatt_db *btd_gatt_database_get_db(struct btd_gatt_database *database);
 
+struct btd_gatt_database_notify_stats {
+	uint64_t fanouts;	/* Values sent to their subscribers */
+	uint64_t recipients;	/* Notifications and indications queued */
+	uint64_t total_usec;	/* Time spent sending them */
+	uint64_t max_usec;	/* Slowest single fan-out */
+};
+
+bool btd_gatt_database_get_notify_stats(struct btd_gatt_database *database,
+				struct btd_gatt_database_notify_stats *stats);
+
 typedef uint8_t (*btd_gatt_database_ccc_write_t) (uint16_t value,
 							void *user_data);
 typedef void (*btd_gatt_database_destroy_t) (void *data);
@@ -42,6 +42,9 @@
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_TIMEOUT_SLACK		1000  /* 1000 ms */
+#define ATT_WRITE_BATCH			32  /* PDUs per writer wakeup */
+#define ATT_OP_POOL_MAX			64  /* Cached send ops per bearer */
 
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
@@ -61,8 +64,16 @@ struct bt_att {
 	struct att_send_op *pending_ind;
 	struct queue *write_queue;	/* Queue of PDUs ready to send */
 	bool writer_active;
+	unsigned int write_batch;	/* Max PDUs sent per writer wakeup */
+	struct bt_att_stats stats;
+
+	struct att_send_op *op_pool;	/* Recycled MTU sized send ops */
+	unsigned int op_pool_len;
 
 	struct queue *notify_list;	/* List of registered callbacks */
+	struct queue *notify_table[256];	/* Callbacks by opcode */
+	struct queue *notify_removed;	/* Removed while dispatching */
+	bool in_notify;
 	struct queue *disconn_list;	/* List of disconnect handlers */
 
 	bool in_req;			/* There's a pending incoming request */
@@ -182,17 +193,76 @@ static uint8_t get_req_opcode(uint8_t rsp_opcode)
 }
 
 struct att_send_op {
+	struct bt_att *att;
 	unsigned int id;
 	unsigned int timeout_id;
 	enum att_op_type type;
 	uint16_t opcode;
-	void *pdu;
 	uint16_t len;
+	uint16_t size;			/* Size of the PDU buffer */
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
+	struct queue_entry entry;	/* Link in req, ind or write queue */
+	struct att_send_op *next_free;	/* Link in the bearer's op pool */
+	uint8_t pdu[0];
 };
 
+/* Send ops carry their PDU buffer inline, sized to the MTU at the time they
+ * were allocated. Completed ops go back to a small per bearer pool so that
+ * steady streams of notifications don't hit the allocator at all.
+ */
+static struct att_send_op *alloc_att_send_op(struct bt_att *att)
+{
+	struct att_send_op *op = att->op_pool;
+	uint16_t size;
+
+	if (op) {
+		att->op_pool = op->next_free;
+		att->op_pool_len--;
+		size = op->size;
+	} else {
+		op = malloc(sizeof(*op) + att->mtu);
+		if (!op)
+			return NULL;
+
+		size = att->mtu;
+	}
+
+	memset(op, 0, sizeof(*op));
+	op->att = att;
+	op->size = size;
+
+	return op;
+}
+
+static void free_att_send_op(struct att_send_op *op)
+{
+	struct bt_att *att = op->att;
+
+	/* Buffers from before an MTU change are simply dropped */
+	if (op->size != att->mtu || att->op_pool_len >= ATT_OP_POOL_MAX) {
+		free(op);
+		return;
+	}
+
+	op->next_free = att->op_pool;
+	att->op_pool = op;
+	att->op_pool_len++;
+}
+
+static void flush_att_op_pool(struct bt_att *att)
+{
+	while (att->op_pool) {
+		struct att_send_op *op = att->op_pool;
+
+		att->op_pool = op->next_free;
+		free(op);
+	}
+
+	att->op_pool_len = 0;
+}
+
 static void destroy_att_send_op(void *data)
 {
 	struct att_send_op *op = data;
@@ -203,8 +273,7 @@ static void destroy_att_send_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->pdu);
-	free(op);
+	free_att_send_op(op);
 }
 
 static void cancel_att_send_op(struct att_send_op *op)
@@ -220,6 +289,7 @@ static void cancel_att_send_op(struct att_send_op *op)
 struct att_notify {
 	unsigned int id;
 	uint16_t opcode;
+	bool removed;
 	bt_att_notify_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
@@ -235,14 +305,6 @@ static void destroy_att_notify(void *data)
 	free(notify);
 }
 
-static bool match_notify_id(const void *a, const void *b)
-{
-	const struct att_notify *notify = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify->id == id;
-}
-
 struct att_disconn {
 	unsigned int id;
 	bool removed;
@@ -261,71 +323,73 @@ static void destroy_att_disconn(void *data)
 	free(disconn);
 }
 
-static bool match_disconn_id(const void *a, const void *b)
-{
-	const struct att_disconn *disconn = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return disconn->id == id;
-}
-
 static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
-					const void *pdu, uint16_t length)
+				const struct iovec *iov, int iovcnt,
+				size_t length)
 {
-	uint16_t pdu_len = 1;
+	size_t pdu_len = 1;
 	struct sign_info *sign = att->local_sign;
 	uint32_t sign_cnt;
+	int i;
 
 	if (sign && (op->opcode & ATT_OP_SIGNED_MASK))
 		pdu_len += BT_ATT_SIGNATURE_LEN;
 
-	if (length && pdu)
-		pdu_len += length;
+	pdu_len += length;
 
-	if (pdu_len > att->mtu)
+	if (pdu_len > att->mtu || pdu_len > op->size)
 		return false;
 
 	op->len = pdu_len;
-	op->pdu = malloc(op->len);
-	if (!op->pdu)
-		return false;
+	op->pdu[0] = op->opcode;
+
+	for (i = 0, pdu_len = 1; i < iovcnt; i++) {
+		if (!iov[i].iov_len)
+			continue;
 
-	((uint8_t *) op->pdu)[0] = op->opcode;
-	if (pdu_len > 1)
-		memcpy(op->pdu + 1, pdu, length);
+		memcpy(op->pdu + pdu_len, iov[i].iov_base, iov[i].iov_len);
+		pdu_len += iov[i].iov_len;
+	}
 
 	if (!sign || !(op->opcode & ATT_OP_SIGNED_MASK))
 		return true;
 
 	if (!sign->counter(&sign_cnt, sign->user_data))
-		goto fail;
+		return false;
 
 	if ((bt_crypto_sign_att(att->crypto, sign->key, op->pdu, 1 + length,
-				sign_cnt, &((uint8_t *) op->pdu)[1 + length])))
+					sign_cnt, &op->pdu[1 + length])))
 		return true;
 
 	util_debug(att->debug_callback, att->debug_data,
 					"ATT unable to generate signature");
 
-fail:
-	free(op->pdu);
 	return false;
 }
 
 static struct att_send_op *create_att_send_op(struct bt_att *att,
 						uint8_t opcode,
-						const void *pdu,
-						uint16_t length,
+						const struct iovec *iov,
+						int iovcnt,
 						bt_att_response_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy)
 {
 	struct att_send_op *op;
 	enum att_op_type op_type;
+	size_t length = 0;
+	int i;
 
-	if (length && !pdu)
+	if (iovcnt < 0 || (iovcnt && !iov))
 		return NULL;
 
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len && !iov[i].iov_base)
+			return NULL;
+
+		length += iov[i].iov_len;
+	}
+
 	op_type = get_op_type(opcode);
 	if (op_type == ATT_OP_TYPE_UNKNOWN)
 		return NULL;
@@ -343,7 +407,7 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	if (!callback && (op_type == ATT_OP_TYPE_REQ || op_type == ATT_OP_TYPE_IND))
 		return NULL;
 
-	op = new0(struct att_send_op, 1);
+	op = alloc_att_send_op(att);
 	if (!op)
 		return NULL;
 
@@ -352,9 +416,10 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	op->callback = callback;
 	op->destroy = destroy;
 	op->user_data = user_data;
+	queue_entry_init(&op->entry, op);
 
-	if (!encode_pdu(att, op, pdu, length)) {
-		free(op);
+	if (!encode_pdu(att, op, iov, iovcnt, length)) {
+		free_att_send_op(op);
 		return NULL;
 	}
 
@@ -439,48 +504,37 @@ static void write_watch_destroy(void *user_data)
 	att->writer_active = false;
 }
 
-static bool can_write_data(struct io *io, void *user_data)
+static void start_op_timeout(struct bt_att *att, struct att_send_op *op)
 {
-	struct bt_att *att = user_data;
-	struct att_send_op *op;
 	struct timeout_data *timeout;
-	ssize_t ret;
-	struct iovec iov;
-
-	op = pick_next_send_op(att);
-	if (!op)
-		return false;
-
-	iov.iov_base = op->pdu;
-	iov.iov_len = op->len;
 
-	ret = io_send(io, &iov, 1);
-	if (ret < 0) {
-		util_debug(att->debug_callback, att->debug_data,
-					"write failed: %s", strerror(-ret));
-		if (op->callback)
-			op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
-							op->user_data);
+	timeout = new0(struct timeout_data, 1);
+	if (!timeout)
+		return;
 
-		destroy_att_send_op(op);
-		return true;
-	}
+	timeout->att = att;
+	timeout->id = op->id;
+	op->timeout_id = timeout_add_slack(ATT_TIMEOUT_INTERVAL,
+						ATT_TIMEOUT_SLACK, timeout_cb,
+						timeout, free);
+}
 
+static void complete_send_op(struct bt_att *att, struct att_send_op *op)
+{
 	util_debug(att->debug_callback, att->debug_data,
 					"ATT op 0x%02x", op->opcode);
 
-	util_hexdump('<', op->pdu, ret, att->debug_callback, att->debug_data);
+	util_hexdump('<', op->pdu, op->len, att->debug_callback,
+							att->debug_data);
 
-	/* Based on the operation type, set either the pending request or the
-	 * pending indication. If it came from the write queue, then there is
-	 * no need to keep it around.
+	/* Requests and indications have already been made pending when they
+	 * were picked for sending. If it came from the write queue, then
+	 * there is no need to keep it around.
 	 */
 	switch (op->type) {
 	case ATT_OP_TYPE_REQ:
-		att->pending_req = op;
-		break;
 	case ATT_OP_TYPE_IND:
-		att->pending_ind = op;
+		start_op_timeout(att, op);
 		break;
 	case ATT_OP_TYPE_RSP:
 		/* Set in_req to false to indicate that no request is pending */
@@ -493,17 +547,135 @@ static bool can_write_data(struct io *io, void *user_data)
 	case ATT_OP_TYPE_UNKNOWN:
 	default:
 		destroy_att_send_op(op);
-		return true;
+		break;
 	}
+}
 
-	timeout = new0(struct timeout_data, 1);
-	if (!timeout)
-		return true;
+static void requeue_send_op(struct bt_att *att, struct att_send_op *op)
+{
+	if (op == att->pending_req) {
+		att->pending_req = NULL;
+		queue_push_head_entry(att->req_queue, &op->entry);
+	} else if (op == att->pending_ind) {
+		att->pending_ind = NULL;
+		queue_push_head_entry(att->ind_queue, &op->entry);
+	} else
+		queue_push_head_entry(att->write_queue, &op->entry);
+}
 
-	timeout->att = att;
-	timeout->id = op->id;
-	op->timeout_id = timeout_add(ATT_TIMEOUT_INTERVAL, timeout_cb,
-								timeout, free);
+static void fail_send_op(struct bt_att *att, struct att_send_op *op)
+{
+	if (op == att->pending_req)
+		att->pending_req = NULL;
+	else if (op == att->pending_ind)
+		att->pending_ind = NULL;
+
+	if (op->callback)
+		op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0, op->user_data);
+
+	destroy_att_send_op(op);
+}
+
+static int write_send_ops(struct bt_att *att, struct att_send_op **ops,
+							unsigned int count)
+{
+	struct mmsghdr msgs[ATT_WRITE_BATCH];
+	struct iovec iov[ATT_WRITE_BATCH];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = ops[i]->pdu;
+		iov[i].iov_len = ops[i]->len;
+	}
+
+	att->stats.tx_syscalls++;
+
+	if (count == 1) {
+		ret = io_send(att->io, iov, 1);
+		return ret < 0 ? ret : 1;
+	}
+
+	memset(msgs, 0, count * sizeof(*msgs));
+
+	for (i = 0; i < count; i++) {
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		ret = sendmmsg(att->fd, msgs, count, MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+static bool can_write_data(struct io *io, void *user_data)
+{
+	struct bt_att *att = user_data;
+	struct att_send_op *ops[ATT_WRITE_BATCH];
+	unsigned int count = 0, sent, i;
+	int ret;
+
+	/* Pick as many PDUs as allowed by the ATT sequencing rules. Picking a
+	 * request or an indication makes it pending right away, so that at
+	 * most one of each can be part of a batch.
+	 */
+	while (count < att->write_batch) {
+		struct att_send_op *op;
+
+		op = pick_next_send_op(att);
+		if (!op)
+			break;
+
+		if (op->type == ATT_OP_TYPE_REQ)
+			att->pending_req = op;
+		else if (op->type == ATT_OP_TYPE_IND)
+			att->pending_ind = op;
+
+		ops[count++] = op;
+	}
+
+	if (!count)
+		return false;
+
+	ret = write_send_ops(att, ops, count);
+	if (ret == -EAGAIN || ret == -EWOULDBLOCK)
+		ret = 0;
+
+	bt_att_ref(att);
+
+	if (ret < 0) {
+		util_debug(att->debug_callback, att->debug_data,
+					"write failed: %s", strerror(-ret));
+
+		for (i = count; i > 1; i--)
+			requeue_send_op(att, ops[i - 1]);
+
+		fail_send_op(att, ops[0]);
+		goto done;
+	}
+
+	sent = ret;
+
+	/* Put back whatever did not fit into the socket, newest first */
+	for (i = count; i > sent; i--)
+		requeue_send_op(att, ops[i - 1]);
+
+	att->stats.tx_wakeups++;
+
+	for (i = 0; i < sent; i++) {
+		att->stats.tx_pdus++;
+		att->stats.tx_bytes += ops[i]->len;
+
+		complete_send_op(att, ops[i]);
+	}
+
+done:
+	bt_att_unref(att);
 
 	/* Return true as there may be more operations ready to write. */
 	return true;
@@ -669,13 +841,73 @@ struct notify_data {
 
 static bool opcode_match(uint8_t opcode, uint8_t test_opcode)
 {
-	enum att_op_type op_type = get_op_type(test_opcode);
+	enum att_op_type op_type;
 
-	if (opcode == BT_ATT_ALL_REQUESTS && (op_type == ATT_OP_TYPE_REQ ||
-						op_type == ATT_OP_TYPE_CMD))
-		return true;
+	if (opcode != BT_ATT_ALL_REQUESTS)
+		return opcode == test_opcode;
+
+	op_type = get_op_type(test_opcode);
 
-	return opcode == test_opcode;
+	return op_type == ATT_OP_TYPE_REQ || op_type == ATT_OP_TYPE_CMD;
+}
+
+/*
+ * Each registration is linked into the handler list of every opcode it
+ * matches, so that an incoming PDU only needs to look at its own slot.
+ * Lists keep registration order, which is also the order of invocation.
+ */
+static void notify_table_remove(struct bt_att *att, struct att_notify *notify)
+{
+	unsigned int i;
+
+	for (i = 0; i < 256; i++) {
+		if (!att->notify_table[i] || !opcode_match(notify->opcode, i))
+			continue;
+
+		queue_remove(att->notify_table[i], notify);
+	}
+}
+
+static bool notify_table_add(struct bt_att *att, struct att_notify *notify)
+{
+	unsigned int i;
+
+	for (i = 0; i < 256; i++) {
+		if (!opcode_match(notify->opcode, i))
+			continue;
+
+		if (!att->notify_table[i])
+			att->notify_table[i] = queue_new();
+
+		if (!att->notify_table[i] ||
+				!queue_push_tail(att->notify_table[i], notify)) {
+			notify_table_remove(att, notify);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void remove_att_notify(struct bt_att *att, struct att_notify *notify)
+{
+	/* Handler lists must stay intact while they are being walked */
+	if (att->in_notify) {
+		notify->removed = true;
+		queue_push_tail(att->notify_removed, notify);
+		return;
+	}
+
+	notify_table_remove(att, notify);
+	destroy_att_notify(notify);
+}
+
+static void flush_removed_notify(struct bt_att *att)
+{
+	struct att_notify *notify;
+
+	while ((notify = queue_pop_head(att->notify_removed)))
+		remove_att_notify(att, notify);
 }
 
 static void respond_not_supported(struct bt_att *att, uint8_t opcode)
@@ -742,14 +974,14 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 	bt_att_ref(att);
 
 	found = false;
-	entry = queue_get_entries(att->notify_list);
+	att->in_notify = true;
 
-	while (entry) {
+	for (entry = queue_get_entries(att->notify_table[opcode]); entry;
+							entry = entry->next) {
 		struct att_notify *notify = entry->data;
 
-		entry = entry->next;
-
-		if (!opcode_match(notify->opcode, opcode))
+		/* callback could have removed the entry */
+		if (notify->removed)
 			continue;
 
 		found = true;
@@ -757,12 +989,11 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 		if (notify->callback)
 			notify->callback(opcode, pdu, pdu_len,
 							notify->user_data);
-
-		/* callback could remove all entries from notify list */
-		if (queue_isempty(att->notify_list))
-			break;
 	}
 
+	att->in_notify = false;
+	flush_removed_notify(att);
+
 	/*
 	 * If this was a request and no handler was registered for it, respond
 	 * with "Not Supported"
@@ -784,6 +1015,9 @@ static bool can_read_data(struct io *io, void *user_data)
 	if (bytes_read < 0)
 		return false;
 
+	att->stats.rx_pdus++;
+	att->stats.rx_bytes += bytes_read;
+
 	util_hexdump('>', att->buf, bytes_read,
 					att->debug_callback, att->debug_data);
 
@@ -870,8 +1104,23 @@ static bool is_io_l2cap_based(int fd)
 	return proto == BTPROTO_L2CAP;
 }
 
+static bool is_io_seqpacket(int fd)
+{
+	int type;
+	socklen_t len;
+
+	type = 0;
+	len = sizeof(type);
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+		return false;
+
+	return type == SOCK_SEQPACKET;
+}
+
 static void bt_att_free(struct bt_att *att)
 {
+	unsigned int i;
+
 	if (att->pending_req)
 		destroy_att_send_op(att->pending_req);
 
@@ -885,6 +1134,11 @@ static void bt_att_free(struct bt_att *att)
 	queue_destroy(att->ind_queue, NULL);
 	queue_destroy(att->write_queue, NULL);
 	queue_destroy(att->notify_list, NULL);
+	queue_destroy(att->notify_removed, NULL);
+
+	for (i = 0; i < 256; i++)
+		queue_destroy(att->notify_table[i], NULL);
+
 	queue_destroy(att->disconn_list, NULL);
 
 	if (att->timeout_destroy)
@@ -896,6 +1150,7 @@ static void bt_att_free(struct bt_att *att)
 	free(att->local_sign);
 	free(att->remote_sign);
 
+	flush_att_op_pool(att);
 	free(att->buf);
 
 	free(att);
@@ -927,23 +1182,27 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 	if (!ext_signed)
 		att->crypto = bt_crypto_new();
 
-	att->req_queue = queue_new();
+	att->req_queue = queue_new_keyed(offsetof(struct att_send_op, id));
 	if (!att->req_queue)
 		goto fail;
 
-	att->ind_queue = queue_new();
+	att->ind_queue = queue_new_keyed(offsetof(struct att_send_op, id));
 	if (!att->ind_queue)
 		goto fail;
 
-	att->write_queue = queue_new();
+	att->write_queue = queue_new_keyed(offsetof(struct att_send_op, id));
 	if (!att->write_queue)
 		goto fail;
 
-	att->notify_list = queue_new();
+	att->notify_list = queue_new_keyed(offsetof(struct att_notify, id));
 	if (!att->notify_list)
 		goto fail;
 
-	att->disconn_list = queue_new();
+	att->notify_removed = queue_new();
+	if (!att->notify_removed)
+		goto fail;
+
+	att->disconn_list = queue_new_keyed(offsetof(struct att_disconn, id));
 	if (!att->disconn_list)
 		goto fail;
 
@@ -957,6 +1216,9 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 	if (!att->io_on_l2cap)
 		att->io_sec_level = BT_SECURITY_LOW;
 
+	/* Only packet based sockets keep PDU boundaries with sendmmsg */
+	att->write_batch = is_io_seqpacket(att->fd) ? ATT_WRITE_BATCH : 1;
+
 	return bt_att_ref(att);
 
 fail:
@@ -1005,6 +1267,16 @@ int bt_att_get_fd(struct bt_att *att)
 	return att->fd;
 }
 
+bool bt_att_get_stats(struct bt_att *att, struct bt_att_stats *stats)
+{
+	if (!att || !stats)
+		return false;
+
+	*stats = att->stats;
+
+	return true;
+}
+
 bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
 				void *user_data, bt_att_destroy_func_t destroy)
 {
@@ -1048,6 +1320,9 @@ bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 	att->mtu = mtu;
 	att->buf = buf;
 
+	/* Pooled ops can't hold a full PDU anymore if the MTU has grown */
+	flush_att_op_pool(att);
+
 	return true;
 }
 
@@ -1106,8 +1381,7 @@ bool bt_att_unregister_disconnect(struct bt_att *att, unsigned int id)
 	if (!att || !id)
 		return false;
 
-	disconn = queue_remove_if(att->disconn_list, match_disconn_id,
-							UINT_TO_PTR(id));
+	disconn = queue_remove_by_key(att->disconn_list, id);
 	if (!disconn)
 		return false;
 
@@ -1119,6 +1393,23 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 				const void *pdu, uint16_t length,
 				bt_att_response_func_t callback, void *user_data,
 				bt_att_destroy_func_t destroy)
+{
+	struct iovec iov;
+
+	if (length && !pdu)
+		return 0;
+
+	iov.iov_base = (void *) pdu;
+	iov.iov_len = length;
+
+	return bt_att_send_iov(att, opcode, &iov, length ? 1 : 0, callback,
+							user_data, destroy);
+}
+
+unsigned int bt_att_send_iov(struct bt_att *att, uint8_t opcode,
+				const struct iovec *iov, int iovcnt,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
 {
 	struct att_send_op *op;
 	bool result;
@@ -1126,7 +1417,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	if (!att || !att->io)
 		return 0;
 
-	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
+	op = create_att_send_op(att, opcode, iov, iovcnt, callback, user_data,
 								destroy);
 	if (!op)
 		return 0;
@@ -1139,10 +1430,10 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	/* Add the op to the correct queue based on its type */
 	switch (op->type) {
 	case ATT_OP_TYPE_REQ:
-		result = queue_push_tail(att->req_queue, op);
+		result = queue_push_tail_entry(att->req_queue, &op->entry);
 		break;
 	case ATT_OP_TYPE_IND:
-		result = queue_push_tail(att->ind_queue, op);
+		result = queue_push_tail_entry(att->ind_queue, &op->entry);
 		break;
 	case ATT_OP_TYPE_CMD:
 	case ATT_OP_TYPE_NOT:
@@ -1150,13 +1441,12 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	case ATT_OP_TYPE_RSP:
 	case ATT_OP_TYPE_CONF:
 	default:
-		result = queue_push_tail(att->write_queue, op);
+		result = queue_push_tail_entry(att->write_queue, &op->entry);
 		break;
 	}
 
 	if (!result) {
-		free(op->pdu);
-		free(op);
+		free_att_send_op(op);
 		return 0;
 	}
 
@@ -1165,14 +1455,6 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	return op->id;
 }
 
-static bool match_op_id(const void *a, const void *b)
-{
-	const struct att_send_op *op = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return op->id == id;
-}
-
 bool bt_att_cancel(struct bt_att *att, unsigned int id)
 {
 	struct att_send_op *op;
@@ -1192,15 +1474,15 @@ bool bt_att_cancel(struct bt_att *att, unsigned int id)
 		return true;
 	}
 
-	op = queue_remove_if(att->req_queue, match_op_id, UINT_TO_PTR(id));
+	op = queue_remove_by_key(att->req_queue, id);
 	if (op)
 		goto done;
 
-	op = queue_remove_if(att->ind_queue, match_op_id, UINT_TO_PTR(id));
+	op = queue_remove_by_key(att->ind_queue, id);
 	if (op)
 		goto done;
 
-	op = queue_remove_if(att->write_queue, match_op_id, UINT_TO_PTR(id));
+	op = queue_remove_by_key(att->write_queue, id);
 	if (op)
 		goto done;
 
@@ -1308,7 +1590,13 @@ unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
 
 	notify->id = att->next_reg_id++;
 
+	if (!notify_table_add(att, notify)) {
+		free(notify);
+		return 0;
+	}
+
 	if (!queue_push_tail(att->notify_list, notify)) {
+		notify_table_remove(att, notify);
 		free(notify);
 		return 0;
 	}
@@ -1323,21 +1611,24 @@ bool bt_att_unregister(struct bt_att *att, unsigned int id)
 	if (!att || !id)
 		return false;
 
-	notify = queue_remove_if(att->notify_list, match_notify_id,
-							UINT_TO_PTR(id));
+	notify = queue_remove_by_key(att->notify_list, id);
 	if (!notify)
 		return false;
 
-	destroy_att_notify(notify);
+	remove_att_notify(att, notify);
 	return true;
 }
 
 bool bt_att_unregister_all(struct bt_att *att)
 {
+	struct att_notify *notify;
+
 	if (!att)
 		return false;
 
-	queue_remove_all(att->notify_list, NULL, NULL, destroy_att_notify);
+	while ((notify = queue_pop_head(att->notify_list)))
+		remove_att_notify(att, notify);
+
 	queue_remove_all(att->disconn_list, NULL, NULL, destroy_att_disconn);
 
 	return true;
@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "src/shared/att-types.h"
 
@@ -51,6 +52,17 @@ typedef bool (*bt_att_counter_func_t)(uint32_t *sign_cnt, void *user_data);
 bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
 				void *user_data, bt_att_destroy_func_t destroy);
 
+struct bt_att_stats {
+	uint64_t tx_pdus;
+	uint64_t tx_bytes;
+	uint64_t tx_wakeups;	/* Writer wakeups that sent PDUs */
+	uint64_t tx_syscalls;
+	uint64_t rx_pdus;
+	uint64_t rx_bytes;
+};
+
+bool bt_att_get_stats(struct bt_att *att, struct bt_att_stats *stats);
+
 uint16_t bt_att_get_mtu(struct bt_att *att);
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu);
 
@@ -63,6 +75,11 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 					bt_att_response_func_t callback,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
+unsigned int bt_att_send_iov(struct bt_att *att, uint8_t opcode,
+					const struct iovec *iov, int iovcnt,
+					bt_att_response_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
 bool bt_att_cancel(struct bt_att *att, unsigned int id);
 bool bt_att_cancel_all(struct bt_att *att);
 
@@ -26,12 +26,18 @@
 #endif
 
 #include <endian.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <dirent.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "src/shared/btsnoop.h"
 
@@ -64,6 +70,28 @@ struct pklg_pkt {
 } __attribute__ ((packed));
 #define PKLG_PKT_SIZE (sizeof(struct pklg_pkt))
 
+struct btsnoop_idx_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 2 */
+	uint32_t	interval;	/* Packets per entry */
+	uint64_t	file_size;	/* Size of the indexed trace */
+	uint64_t	file_mtime;	/* Modification time in nanoseconds */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_HDR_SIZE (sizeof(struct btsnoop_idx_hdr))
+
+struct btsnoop_idx {
+	uint64_t	ts;		/* Latest timestamp before offset */
+	uint64_t	offset;		/* Offset of the packet */
+} __attribute__ ((packed));
+#define BTSNOOP_IDX_SIZE (sizeof(struct btsnoop_idx))
+
+static const uint8_t btsnoop_idx_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					  0x69, 0x64, 0x78, 0x00 };
+
+static const uint32_t btsnoop_idx_version = 2;
+
+#define BTSNOOP_INDEX_INTERVAL	1024
+
 struct btsnoop {
 	int ref_count;
 	int fd;
@@ -72,13 +100,106 @@ struct btsnoop {
 	uint16_t index;
 	bool aborted;
 	bool pklg_format;
+	char *path;
+	size_t max_size;
+	size_t cur_size;
+	unsigned int max_count;
+	unsigned int cur_count;
+	unsigned int max_secs;
+	time_t file_start;
+	uint8_t *buf;
+	size_t buf_size;
+	size_t buf_len;
+	unsigned int flush_interval;
+	struct timeval buf_start;
+	const uint8_t *map;
+	size_t map_size;
+	uint64_t map_mtime;
+	size_t offset;
+	size_t data_offset;
+	uint8_t *read_buf;
+	struct btsnoop_idx *idx;
+	size_t idx_count;
 };
 
+/* Returns the next len bytes of the trace, pointing straight into the
+ * mapping when there is one and copied into buf otherwise. Running out
+ * of data in the middle of the requested range aborts the trace.
+ */
+static const void *pull(struct btsnoop *btsnoop, void *buf, size_t len)
+{
+	size_t done = 0;
+
+	if (btsnoop->map) {
+		const void *ptr = btsnoop->map + btsnoop->offset;
+
+		if (btsnoop->map_size - btsnoop->offset < len) {
+			if (btsnoop->offset < btsnoop->map_size)
+				btsnoop->aborted = true;
+			return NULL;
+		}
+
+		btsnoop->offset += len;
+
+		return ptr;
+	}
+
+	while (done < len) {
+		ssize_t ret;
+
+		ret = read(btsnoop->fd, buf + done, len - done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			btsnoop->aborted = true;
+			return NULL;
+		}
+
+		if (ret == 0)
+			break;
+
+		done += ret;
+	}
+
+	if (done < len) {
+		if (done)
+			btsnoop->aborted = true;
+		return NULL;
+	}
+
+	btsnoop->offset += len;
+
+	return buf;
+}
+
+static void map_file(struct btsnoop *btsnoop)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(btsnoop->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (!st.st_size || (uint64_t) st.st_size > SIZE_MAX)
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, btsnoop->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	btsnoop->map = map;
+	btsnoop->map_size = st.st_size;
+	btsnoop->map_mtime = st.st_mtim.tv_sec * 1000000000ull +
+							st.st_mtim.tv_nsec;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
-	struct btsnoop_hdr hdr;
-	ssize_t len;
+	const struct btsnoop_hdr *hdr;
+	struct btsnoop_hdr buf;
 
 	btsnoop = calloc(1, sizeof(*btsnoop));
 	if (!btsnoop)
@@ -92,23 +213,37 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 
 	btsnoop->flags = flags;
 
-	len = read(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (len < 0 || len != BTSNOOP_HDR_SIZE)
+	btsnoop->path = strdup(path);
+	if (!btsnoop->path)
 		goto failed;
 
-	if (!memcmp(hdr.id, btsnoop_id, sizeof(btsnoop_id))) {
+	/* Regular files are mapped, pipes and the like get read() from */
+	map_file(btsnoop);
+
+	if (!btsnoop->map) {
+		btsnoop->read_buf = malloc(BTSNOOP_MAX_PACKET_SIZE);
+		if (!btsnoop->read_buf)
+			goto failed;
+	}
+
+	hdr = pull(btsnoop, &buf, BTSNOOP_HDR_SIZE);
+	if (!hdr)
+		goto failed;
+
+	if (!memcmp(hdr->id, btsnoop_id, sizeof(btsnoop_id))) {
 		/* Check for BTSnoop version 1 format */
-		if (be32toh(hdr.version) != btsnoop_version)
+		if (be32toh(hdr->version) != btsnoop_version)
 			goto failed;
 
-		btsnoop->type = be32toh(hdr.type);
+		btsnoop->type = be32toh(hdr->type);
 		btsnoop->index = 0xffff;
+		btsnoop->data_offset = BTSNOOP_HDR_SIZE;
 	} else {
 		if (!(btsnoop->flags & BTSNOOP_FLAG_PKLG_SUPPORT))
 			goto failed;
 
 		/* Check for Apple Packet Logger format */
-		if (hdr.id[0] != 0x00 || hdr.id[1] != 0x00)
+		if (hdr->id[0] != 0x00 || hdr->id[1] != 0x00)
 			goto failed;
 
 		btsnoop->type = BTSNOOP_TYPE_MONITOR;
@@ -116,45 +251,213 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		btsnoop->pklg_format = true;
 
 		/* Apple Packet Logger format has no header */
-		lseek(btsnoop->fd, 0, SEEK_SET);
+		if (!btsnoop->map)
+			lseek(btsnoop->fd, 0, SEEK_SET);
+
+		btsnoop->offset = 0;
+		btsnoop->data_offset = 0;
 	}
 
 	return btsnoop_ref(btsnoop);
 
 failed:
+	if (btsnoop->map)
+		munmap((void *) btsnoop->map, btsnoop->map_size);
+
 	close(btsnoop->fd);
+	free(btsnoop->read_buf);
+	free(btsnoop->path);
 	free(btsnoop);
 
 	return NULL;
 }
 
-struct btsnoop *btsnoop_create(const char *path, uint32_t type)
+static bool rotates(struct btsnoop *btsnoop)
+{
+	return btsnoop->max_size || btsnoop->max_secs;
+}
+
+static int create_file(struct btsnoop *btsnoop, const char *path)
 {
-	struct btsnoop *btsnoop;
 	struct btsnoop_hdr hdr;
 	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return -1;
+
+	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+	hdr.version = htobe32(btsnoop_version);
+	hdr.type = htobe32(btsnoop->type);
+
+	written = write(fd, &hdr, BTSNOOP_HDR_SIZE);
+	if (written < 0) {
+		close(fd);
+		return -1;
+	}
+
+	btsnoop->cur_size = BTSNOOP_HDR_SIZE;
+
+	return fd;
+}
+
+/* Rotated captures are written to <path>.0, <path>.1 and so on. With a
+ * maximum count, the file that falls out of the ring gets removed.
+ */
+static bool open_next_file(struct btsnoop *btsnoop)
+{
+	char path[PATH_MAX];
+
+	if (btsnoop->max_count && btsnoop->cur_count >= btsnoop->max_count) {
+		snprintf(path, sizeof(path), "%s.%u", btsnoop->path,
+				btsnoop->cur_count - btsnoop->max_count);
+		unlink(path);
+	}
+
+	snprintf(path, sizeof(path), "%s.%u", btsnoop->path,
+							btsnoop->cur_count);
+
+	btsnoop->fd = create_file(btsnoop, path);
+	if (btsnoop->fd < 0)
+		return false;
+
+	btsnoop->cur_count++;
+	btsnoop->file_start = 0;
+
+	return true;
+}
+
+/* Returns the number of a <path>.N file in the capture directory or -1
+ * for any other entry.
+ */
+static long long rotated_number(const char *name, const char *base,
+							size_t base_len)
+{
+	unsigned long long n = 0;
+	const char *ptr;
+
+	if (strncmp(name, base, base_len) || name[base_len] != '.')
+		return -1;
+
+	ptr = name + base_len + 1;
+	if (!*ptr)
+		return -1;
+
+	for (; *ptr; ptr++) {
+		if (*ptr < '0' || *ptr > '9')
+			return -1;
+
+		n = n * 10 + (*ptr - '0');
+		if (n >= UINT_MAX)
+			return -1;
+	}
+
+	return n;
+}
+
+/* A restarted capture continues numbering after the files an earlier run
+ * left behind, so that the ring still removes the oldest ones first. Files
+ * that already fall outside of the ring are removed right away.
+ */
+static void scan_files(struct btsnoop *btsnoop)
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	const char *base;
+	struct dirent *d;
+	size_t base_len;
+	DIR *dp;
+
+	base = strrchr(btsnoop->path, '/');
+	if (!base) {
+		strcpy(dir, ".");
+		base = btsnoop->path;
+	} else if (base == btsnoop->path) {
+		strcpy(dir, "/");
+		base++;
+	} else {
+		snprintf(dir, sizeof(dir), "%.*s",
+				(int) (base - btsnoop->path), btsnoop->path);
+		base++;
+	}
+
+	base_len = strlen(base);
+
+	dp = opendir(dir);
+	if (!dp)
+		return;
+
+	while ((d = readdir(dp))) {
+		long long n = rotated_number(d->d_name, base, base_len);
+
+		if (n >= btsnoop->cur_count)
+			btsnoop->cur_count = n + 1;
+	}
+
+	if (!btsnoop->max_count || btsnoop->cur_count < btsnoop->max_count)
+		goto done;
+
+	rewinddir(dp);
+
+	while ((d = readdir(dp))) {
+		long long n = rotated_number(d->d_name, base, base_len);
+
+		if (n < 0 || n + btsnoop->max_count > btsnoop->cur_count)
+			continue;
+
+		snprintf(path, sizeof(path), "%s.%lld", btsnoop->path, n);
+		unlink(path);
+	}
+
+done:
+	closedir(dp);
+}
+
+struct btsnoop *btsnoop_create(const char *path, size_t max_size,
+				unsigned int max_secs, unsigned int max_count,
+				uint32_t type)
+{
+	struct btsnoop *btsnoop;
+
+	/* A ring of files needs something to rotate on */
+	if (max_count && !max_size && !max_secs)
+		return NULL;
+
+	if (max_size && max_size < BTSNOOP_HDR_SIZE + BTSNOOP_PKT_SIZE +
+						BTSNOOP_MAX_PACKET_SIZE)
+		return NULL;
 
 	btsnoop = calloc(1, sizeof(*btsnoop));
 	if (!btsnoop)
 		return NULL;
 
-	btsnoop->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
-					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (btsnoop->fd < 0) {
+	btsnoop->type = type;
+	btsnoop->index = 0xffff;
+	btsnoop->max_size = max_size;
+	btsnoop->max_secs = max_secs;
+	btsnoop->max_count = max_count;
+
+	if (!rotates(btsnoop)) {
+		btsnoop->fd = create_file(btsnoop, path);
+		if (btsnoop->fd < 0) {
+			free(btsnoop);
+			return NULL;
+		}
+
+		return btsnoop_ref(btsnoop);
+	}
+
+	btsnoop->path = strdup(path);
+	if (!btsnoop->path) {
 		free(btsnoop);
 		return NULL;
 	}
 
-	btsnoop->type = type;
-	btsnoop->index = 0xffff;
-
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->type);
+	scan_files(btsnoop);
 
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
-		close(btsnoop->fd);
+	if (!open_next_file(btsnoop)) {
+		free(btsnoop->path);
 		free(btsnoop);
 		return NULL;
 	}
@@ -162,6 +465,72 @@ struct btsnoop *btsnoop_create(const char *path, uint32_t type)
 	return btsnoop_ref(btsnoop);
 }
 
+static bool flush_buf(struct btsnoop *btsnoop)
+{
+	size_t offset = 0;
+
+	while (offset < btsnoop->buf_len) {
+		ssize_t written;
+
+		written = write(btsnoop->fd, btsnoop->buf + offset,
+						btsnoop->buf_len - offset);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			btsnoop->buf_len = 0;
+			return false;
+		}
+
+		offset += written;
+	}
+
+	btsnoop->buf_len = 0;
+
+	return true;
+}
+
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+						unsigned int flush_msec)
+{
+	uint8_t *buf;
+
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	if (size && size < BTSNOOP_PKT_SIZE + BTSNOOP_MAX_PACKET_SIZE)
+		return false;
+
+	if (!flush_buf(btsnoop))
+		return false;
+
+	if (!size) {
+		free(btsnoop->buf);
+		btsnoop->buf = NULL;
+		btsnoop->buf_size = 0;
+		btsnoop->flush_interval = 0;
+		return true;
+	}
+
+	buf = realloc(btsnoop->buf, size);
+	if (!buf)
+		return false;
+
+	btsnoop->buf = buf;
+	btsnoop->buf_size = size;
+	btsnoop->flush_interval = flush_msec;
+
+	return true;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || btsnoop->fd < 0)
+		return false;
+
+	return flush_buf(btsnoop);
+}
+
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop)
 {
 	if (!btsnoop)
@@ -180,9 +549,18 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
-	if (btsnoop->fd >= 0)
+	if (btsnoop->fd >= 0) {
+		flush_buf(btsnoop);
 		close(btsnoop->fd);
+	}
+
+	if (btsnoop->map)
+		munmap((void *) btsnoop->map, btsnoop->map_size);
 
+	free(btsnoop->idx);
+	free(btsnoop->read_buf);
+	free(btsnoop->buf);
+	free(btsnoop->path);
 	free(btsnoop);
 }
 
@@ -194,14 +572,73 @@ uint32_t btsnoop_get_type(struct btsnoop *btsnoop)
 	return btsnoop->type;
 }
 
+bool btsnoop_is_mapped(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return false;
+
+	return btsnoop->map != NULL;
+}
+
+static bool rotate_file(struct btsnoop *btsnoop, struct timeval *tv,
+							size_t len)
+{
+	/* Nothing but the header in it, keep the current file */
+	if (btsnoop->cur_size == BTSNOOP_HDR_SIZE) {
+		btsnoop->file_start = tv->tv_sec;
+		return true;
+	}
+
+	if (btsnoop->max_size && btsnoop->cur_size + len > btsnoop->max_size)
+		goto rotate;
+
+	if (btsnoop->max_secs &&
+			tv->tv_sec - btsnoop->file_start >= btsnoop->max_secs)
+		goto rotate;
+
+	return true;
+
+rotate:
+	flush_buf(btsnoop);
+	close(btsnoop->fd);
+
+	if (!open_next_file(btsnoop))
+		return false;
+
+	btsnoop->file_start = tv->tv_sec;
+
+	return true;
+}
+
+static bool flush_due(struct btsnoop *btsnoop, struct timeval *tv)
+{
+	int64_t msec;
+
+	if (!btsnoop->flush_interval)
+		return false;
+
+	msec = (tv->tv_sec - btsnoop->buf_start.tv_sec) * 1000ll +
+			(tv->tv_usec - btsnoop->buf_start.tv_usec) / 1000;
+
+	return msec >= btsnoop->flush_interval;
+}
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint32_t flags, const void *data, uint16_t size)
 {
 	struct btsnoop_pkt pkt;
+	struct iovec iov[2];
 	uint64_t ts;
 	ssize_t written;
 
-	if (!btsnoop || !tv)
+	if (!btsnoop || !tv || btsnoop->fd < 0)
+		return false;
+
+	if (!data)
+		size = 0;
+
+	if (rotates(btsnoop) && !rotate_file(btsnoop, tv,
+						BTSNOOP_PKT_SIZE + size))
 		return false;
 
 	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
@@ -212,16 +649,40 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.drops = htobe32(0);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (written < 0)
-		return false;
+	btsnoop->cur_size += BTSNOOP_PKT_SIZE + size;
 
-	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
+	if (!btsnoop->buf) {
+		iov[0].iov_base = &pkt;
+		iov[0].iov_len = BTSNOOP_PKT_SIZE;
+		iov[1].iov_base = (void *) data;
+		iov[1].iov_len = size;
+
+		written = writev(btsnoop->fd, iov, size > 0 ? 2 : 1);
 		if (written < 0)
 			return false;
+
+		return true;
+	}
+
+	if (btsnoop->buf_len + BTSNOOP_PKT_SIZE + size > btsnoop->buf_size) {
+		if (!flush_buf(btsnoop))
+			return false;
 	}
 
+	if (!btsnoop->buf_len)
+		btsnoop->buf_start = *tv;
+
+	memcpy(btsnoop->buf + btsnoop->buf_len, &pkt, BTSNOOP_PKT_SIZE);
+	btsnoop->buf_len += BTSNOOP_PKT_SIZE;
+
+	if (size > 0) {
+		memcpy(btsnoop->buf + btsnoop->buf_len, data, size);
+		btsnoop->buf_len += size;
+	}
+
+	if (flush_due(btsnoop, tv))
+		return flush_buf(btsnoop);
+
 	return true;
 }
 
@@ -316,35 +777,37 @@ static uint16_t get_opcode_from_pklg(uint8_t type)
 	return 0xffff;
 }
 
-static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
+static bool pklg_next_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
-					void *data, uint16_t *size)
+					const void **data, uint16_t *size)
 {
-	struct pklg_pkt pkt;
+	const struct pklg_pkt *pkt;
+	struct pklg_pkt buf;
 	uint32_t toread;
 	uint64_t ts;
-	ssize_t len;
 
-	len = read(btsnoop->fd, &pkt, PKLG_PKT_SIZE);
-	if (len == 0)
+	pkt = pull(btsnoop, &buf, PKLG_PKT_SIZE);
+	if (!pkt)
 		return false;
 
-	if (len < 0 || len != PKLG_PKT_SIZE) {
+	/* Length covers the timestamp and type fields as well */
+	toread = be32toh(pkt->len);
+	if (toread < 9 || toread - 9 > BTSNOOP_MAX_PACKET_SIZE) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
-	toread = be32toh(pkt.len) - 9;
+	toread -= 9;
 
-	ts = be64toh(pkt.ts);
+	ts = be64toh(pkt->ts);
 	tv->tv_sec = ts >> 32;
 	tv->tv_usec = ts & 0xffffffff;
 
 	*index = 0;
-	*opcode = get_opcode_from_pklg(pkt.type);
+	*opcode = get_opcode_from_pklg(pkt->type);
 
-	len = read(btsnoop->fd, data, toread);
-	if (len < 0) {
+	*data = pull(btsnoop, btsnoop->read_buf, toread);
+	if (!*data) {
 		btsnoop->aborted = true;
 		return false;
 	}
@@ -389,40 +852,39 @@ static uint16_t get_opcode_from_flags(uint8_t type, uint32_t flags)
 	return 0xffff;
 }
 
-bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
+/* The returned data stays valid until the next packet is read, for mapped
+ * traces it even stays valid until the trace is released.
+ */
+bool btsnoop_next_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
-					void *data, uint16_t *size)
+					const void **data, uint16_t *size)
 {
-	struct btsnoop_pkt pkt;
+	const struct btsnoop_pkt *pkt;
+	struct btsnoop_pkt buf;
+	const uint8_t *pkt_type;
 	uint32_t toread, flags;
 	uint64_t ts;
-	uint8_t pkt_type;
-	ssize_t len;
+	uint8_t type;
 
 	if (!btsnoop || btsnoop->aborted)
 		return false;
 
 	if (btsnoop->pklg_format)
-		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
+		return pklg_next_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (len == 0)
+	pkt = pull(btsnoop, &buf, BTSNOOP_PKT_SIZE);
+	if (!pkt)
 		return false;
 
-	if (len < 0 || len != BTSNOOP_PKT_SIZE) {
-		btsnoop->aborted = true;
-		return false;
-	}
-
-	toread = be32toh(pkt.size);
+	toread = be32toh(pkt->size);
 	if (toread > BTSNOOP_MAX_PACKET_SIZE) {
 		btsnoop->aborted = true;
 		return false;
 	}
 
-	flags = be32toh(pkt.flags);
+	flags = be32toh(pkt->flags);
 
-	ts = be64toh(pkt.ts) - 0x00E03AB44A676000ll;
+	ts = be64toh(pkt->ts) - 0x00E03AB44A676000ll;
 	tv->tv_sec = (ts / 1000000ll) + 946684800ll;
 	tv->tv_usec = ts % 1000000ll;
 
@@ -433,15 +895,15 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_TYPE_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
-		if (len < 0) {
+		pkt_type = toread ? pull(btsnoop, &type, 1) : NULL;
+		if (!pkt_type) {
 			btsnoop->aborted = true;
 			return false;
 		}
 		toread--;
 
 		*index = 0;
-		*opcode = get_opcode_from_flags(pkt_type, flags);
+		*opcode = get_opcode_from_flags(*pkt_type, flags);
 		break;
 
 	case BTSNOOP_TYPE_MONITOR:
@@ -454,8 +916,8 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
-	if (len < 0) {
+	*data = pull(btsnoop, btsnoop->read_buf, toread);
+	if (!*data) {
 		btsnoop->aborted = true;
 		return false;
 	}
@@ -465,6 +927,275 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 	return true;
 }
 
+bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					void *data, uint16_t *size)
+{
+	const void *ptr;
+
+	if (!btsnoop_next_hci(btsnoop, tv, index, opcode, &ptr, size))
+		return false;
+
+	memcpy(data, ptr, *size);
+
+	return true;
+}
+
+static uint64_t tv_to_usec(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ull + tv->tv_usec;
+}
+
+static bool load_index(struct btsnoop *btsnoop)
+{
+	struct btsnoop_idx_hdr hdr;
+	struct btsnoop_idx *idx;
+	char path[PATH_MAX];
+	struct stat st;
+	size_t count, i;
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s.idx", btsnoop->path);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) BTSNOOP_IDX_HDR_SIZE)
+		goto failed;
+
+	len = read(fd, &hdr, BTSNOOP_IDX_HDR_SIZE);
+	if (len < 0 || len != BTSNOOP_IDX_HDR_SIZE)
+		goto failed;
+
+	if (memcmp(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id)) ||
+			be32toh(hdr.version) != btsnoop_idx_version)
+		goto failed;
+
+	/* A trace that changed after indexing needs a new index */
+	if (be64toh(hdr.file_size) != btsnoop->map_size ||
+			be64toh(hdr.file_mtime) != btsnoop->map_mtime)
+		goto failed;
+
+	count = (st.st_size - BTSNOOP_IDX_HDR_SIZE) / BTSNOOP_IDX_SIZE;
+	if (!count)
+		goto failed;
+
+	idx = malloc(count * BTSNOOP_IDX_SIZE);
+	if (!idx)
+		goto failed;
+
+	len = read(fd, idx, count * BTSNOOP_IDX_SIZE);
+	if (len < 0 || (size_t) len != count * BTSNOOP_IDX_SIZE) {
+		free(idx);
+		goto failed;
+	}
+
+	/* Seeking relies on sorted entries starting with the first packet */
+	for (i = 0; i < count; i++) {
+		idx[i].ts = be64toh(idx[i].ts);
+		idx[i].offset = be64toh(idx[i].offset);
+
+		if (idx[i].offset > btsnoop->map_size)
+			break;
+
+		if (!i && idx[i].offset != btsnoop->data_offset)
+			break;
+
+		if (i && (idx[i].ts < idx[i - 1].ts ||
+					idx[i].offset <= idx[i - 1].offset))
+			break;
+	}
+
+	if (i < count) {
+		free(idx);
+		goto failed;
+	}
+
+	close(fd);
+
+	btsnoop->idx = idx;
+	btsnoop->idx_count = count;
+
+	return true;
+
+failed:
+	close(fd);
+
+	return false;
+}
+
+static void save_index(struct btsnoop *btsnoop, unsigned int interval)
+{
+	struct btsnoop_idx_hdr hdr;
+	struct btsnoop_idx *idx;
+	struct iovec iov[2];
+	char path[PATH_MAX];
+	size_t i;
+	ssize_t written;
+	int fd;
+
+	idx = malloc(btsnoop->idx_count * BTSNOOP_IDX_SIZE);
+	if (!idx)
+		return;
+
+	for (i = 0; i < btsnoop->idx_count; i++) {
+		idx[i].ts = htobe64(btsnoop->idx[i].ts);
+		idx[i].offset = htobe64(btsnoop->idx[i].offset);
+	}
+
+	memcpy(hdr.id, btsnoop_idx_id, sizeof(btsnoop_idx_id));
+	hdr.version = htobe32(btsnoop_idx_version);
+	hdr.interval = htobe32(interval);
+	hdr.file_size = htobe64(btsnoop->map_size);
+	hdr.file_mtime = htobe64(btsnoop->map_mtime);
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = BTSNOOP_IDX_HDR_SIZE;
+	iov[1].iov_base = idx;
+	iov[1].iov_len = btsnoop->idx_count * BTSNOOP_IDX_SIZE;
+
+	snprintf(path, sizeof(path), "%s.idx", btsnoop->path);
+
+	/* The index is only a cache, not being able to store it is fine */
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		free(idx);
+		return;
+	}
+
+	written = writev(fd, iov, 2);
+	if (written < 0 ||
+			(size_t) written != iov[0].iov_len + iov[1].iov_len)
+		unlink(path);
+
+	close(fd);
+	free(idx);
+}
+
+/* Every interval packets the index records the offset of the packet
+ * together with the latest timestamp seen before it. Using the latest
+ * timestamp rather than the one of the packet itself keeps the entries
+ * sorted even when the clock jumps back during a capture.
+ */
+bool btsnoop_build_index(struct btsnoop *btsnoop, unsigned int interval)
+{
+	struct btsnoop_idx *idx = NULL;
+	size_t offset, count = 0, alloc = 0;
+	unsigned long num_packets = 0;
+	uint64_t latest = 0;
+	bool aborted;
+
+	if (!btsnoop || !btsnoop->map || !interval)
+		return false;
+
+	offset = btsnoop->offset;
+	aborted = btsnoop->aborted;
+
+	btsnoop->offset = btsnoop->data_offset;
+	btsnoop->aborted = false;
+
+	while (1) {
+		struct timeval tv;
+		uint16_t index, opcode, size;
+		const void *data;
+		uint64_t ts;
+
+		if (!(num_packets % interval)) {
+			if (count == alloc) {
+				struct btsnoop_idx *tmp;
+
+				alloc = alloc ? alloc * 2 : 64;
+				tmp = realloc(idx, alloc * BTSNOOP_IDX_SIZE);
+				if (!tmp) {
+					free(idx);
+					btsnoop->offset = offset;
+					btsnoop->aborted = aborted;
+					return false;
+				}
+
+				idx = tmp;
+			}
+
+			idx[count].ts = latest;
+			idx[count].offset = btsnoop->offset;
+			count++;
+		}
+
+		if (!btsnoop_next_hci(btsnoop, &tv, &index, &opcode,
+								&data, &size))
+			break;
+
+		ts = tv_to_usec(&tv);
+		if (ts > latest)
+			latest = ts;
+
+		num_packets++;
+	}
+
+	btsnoop->offset = offset;
+	btsnoop->aborted = aborted;
+
+	free(btsnoop->idx);
+	btsnoop->idx = idx;
+	btsnoop->idx_count = count;
+
+	save_index(btsnoop, interval);
+
+	return true;
+}
+
+bool btsnoop_seek(struct btsnoop *btsnoop, const struct timeval *tv)
+{
+	uint64_t target;
+	size_t lo, hi;
+
+	if (!btsnoop || !btsnoop->map)
+		return false;
+
+	if (!btsnoop->idx && !load_index(btsnoop) &&
+			!btsnoop_build_index(btsnoop, BTSNOOP_INDEX_INTERVAL))
+		return false;
+
+	target = tv_to_usec(tv);
+
+	/* Find the last entry with only earlier packets in front of it */
+	lo = 0;
+	hi = btsnoop->idx_count;
+
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (btsnoop->idx[mid].ts < target)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	btsnoop->offset = btsnoop->idx[lo].offset;
+	btsnoop->aborted = false;
+
+	while (1) {
+		struct timeval pkt_tv;
+		uint16_t index, opcode, size;
+		const void *data;
+		size_t offset = btsnoop->offset;
+
+		if (!btsnoop_next_hci(btsnoop, &pkt_tv, &index, &opcode,
+								&data, &size))
+			break;
+
+		if (!timercmp(&pkt_tv, tv, <)) {
+			btsnoop->offset = offset;
+			break;
+		}
+	}
+
+	return true;
+}
+
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size)
 {
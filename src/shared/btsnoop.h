@@ -23,6 +23,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/time.h>
 
 #define BTSNOOP_TYPE_INVALID		0
@@ -56,12 +57,19 @@ struct btsnoop_opcode_new_index {
 struct btsnoop;
 
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags);
-struct btsnoop *btsnoop_create(const char *path, uint32_t type);
+struct btsnoop *btsnoop_create(const char *path, size_t max_size,
+				unsigned int max_secs, unsigned int max_count,
+				uint32_t type);
 
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop);
 void btsnoop_unref(struct btsnoop *btsnoop);
 
 uint32_t btsnoop_get_type(struct btsnoop *btsnoop);
+bool btsnoop_is_mapped(struct btsnoop *btsnoop);
+
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+						unsigned int flush_msec);
+bool btsnoop_flush(struct btsnoop *btsnoop);
 
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint32_t flags, const void *data, uint16_t size);
@@ -71,8 +79,14 @@ bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
 bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t frequency, const void *data, uint16_t size);
 
+bool btsnoop_next_hci(struct btsnoop *btsnoop, struct timeval *tv,
+					uint16_t *index, uint16_t *opcode,
+					const void **data, uint16_t *size);
 bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
 					void *data, uint16_t *size);
+bool btsnoop_build_index(struct btsnoop *btsnoop, unsigned int interval);
+bool btsnoop_seek(struct btsnoop *btsnoop, const struct timeval *tv);
+
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
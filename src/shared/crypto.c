@@ -26,113 +26,509 @@
 #endif
 
 #include <fcntl.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/socket.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AESNI
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#endif
 
 #include "src/shared/util.h"
 #include "src/shared/crypto.h"
 
-#ifndef HAVE_LINUX_IF_ALG_H
-#ifndef HAVE_LINUX_TYPES_H
-typedef uint8_t __u8;
-typedef uint16_t __u16;
-typedef uint32_t __u32;
-#else
-#include <linux/types.h>
-#endif
+/* Maximum message length that can be passed to aes_cmac */
+#define CMAC_MSG_MAX	80
+
+#define AES_ROUNDS	10
 
-struct sockaddr_alg {
-	__u16   salg_family;
-	__u8    salg_type[14];
-	__u32   salg_feat;
-	__u32   salg_mask;
-	__u8    salg_name[64];
+/*
+ * Expanded AES-128 key. Round keys are stored in FIPS-197 byte order,
+ * i.e. most significant octet first, which is also the order the AES-NI
+ * instructions expect when loaded as a little endian vector.
+ */
+struct aes_key {
+	uint8_t rk[AES_ROUNDS + 1][16];
 };
 
-struct af_alg_iv {
-	__u32   ivlen;
-	__u8    iv[0];
+struct aes_impl {
+	const char *name;
+	void (*expand_key)(const uint8_t key[16], struct aes_key *ak);
+	void (*encrypt)(const struct aes_key *ak, const uint8_t in[16],
+							uint8_t out[16]);
+	int (*resolve)(const uint8_t irks[][16], unsigned int num_irks,
+							const uint8_t rpa[6]);
 };
 
-#define ALG_SET_KEY                     1
-#define ALG_SET_IV                      2
-#define ALG_SET_OP                      3
+struct bt_crypto {
+	int ref_count;
+	int urandom;
+	const struct aes_impl *aes;
+};
 
-#define ALG_OP_DECRYPT                  0
-#define ALG_OP_ENCRYPT                  1
+/*
+ * Portable AES-128 implementation. The S-box is evaluated with the
+ * Boyar-Peralta circuit on a bitsliced copy of the state so that no
+ * memory access depends on key or data, keeping it constant time.
+ */
+static void aes_sub_bytes(uint8_t s[16])
+{
+	uint32_t q[8] = { 0 };
+	uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	uint32_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	uint32_t y20, y21;
+	uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	uint32_t z10, z11, z12, z13, z14, z15, z16, z17;
+	uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	uint32_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	uint32_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	uint32_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	uint32_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	uint32_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	uint32_t t60, t61, t62, t63, t64, t65, t66, t67;
+	uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+	int i, b;
+
+	/* Transpose the state so that q[b] holds bit b of every byte */
+	for (i = 0; i < 16; i++)
+		for (b = 0; b < 8; b++)
+			q[b] |= (uint32_t) ((s[i] >> b) & 1) << i;
+
+	/* Top linear transformation */
+	x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+	x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* Non-linear section */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* Bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+	q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+
+	for (i = 0; i < 16; i++) {
+		s[i] = 0;
+		for (b = 0; b < 8; b++)
+			s[i] |= ((q[b] >> i) & 1) << b;
+	}
+}
 
-#define PF_ALG		38	/* Algorithm sockets.  */
-#define AF_ALG		PF_ALG
-#else
-#include <linux/if_alg.h>
-#endif
+static void aes_shift_rows(uint8_t s[16])
+{
+	uint8_t t;
 
-#ifndef SOL_ALG
-#define SOL_ALG		279
-#endif
+	/* Row 1 rotates by one column */
+	t = s[1]; s[1] = s[5]; s[5] = s[9]; s[9] = s[13]; s[13] = t;
 
-/* Maximum message length that can be passed to aes_cmac */
-#define CMAC_MSG_MAX	80
+	/* Row 2 rotates by two columns */
+	t = s[2]; s[2] = s[10]; s[10] = t;
+	t = s[6]; s[6] = s[14]; s[14] = t;
 
-struct bt_crypto {
-	int ref_count;
-	int ecb_aes;
-	int urandom;
-	int cmac_aes;
+	/* Row 3 rotates by three columns */
+	t = s[15]; s[15] = s[11]; s[11] = s[7]; s[7] = s[3]; s[3] = t;
+}
+
+static inline uint8_t aes_xtime(uint8_t x)
+{
+	return (x << 1) ^ (0x1b & -(x >> 7));
+}
+
+static void aes_mix_columns(uint8_t s[16])
+{
+	int c;
+
+	for (c = 0; c < 16; c += 4) {
+		uint8_t a0 = s[c], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+		uint8_t t = a0 ^ a1 ^ a2 ^ a3;
+
+		s[c] = a0 ^ t ^ aes_xtime(a0 ^ a1);
+		s[c + 1] = a1 ^ t ^ aes_xtime(a1 ^ a2);
+		s[c + 2] = a2 ^ t ^ aes_xtime(a2 ^ a3);
+		s[c + 3] = a3 ^ t ^ aes_xtime(a3 ^ a0);
+	}
+}
+
+static inline void aes_add_round_key(uint8_t s[16], const uint8_t rk[16])
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+}
+
+static void aes_ct_expand_key(const uint8_t key[16], struct aes_key *ak)
+{
+	uint8_t rcon = 0x01;
+	uint8_t w[16];
+	int r, i;
+
+	memcpy(ak->rk[0], key, 16);
+
+	for (r = 1; r <= AES_ROUNDS; r++) {
+		const uint8_t *prev = ak->rk[r - 1];
+		uint8_t *rk = ak->rk[r];
+
+		/* SubWord(RotWord(w[i - 1])) */
+		memset(w, 0, sizeof(w));
+		w[0] = prev[13];
+		w[1] = prev[14];
+		w[2] = prev[15];
+		w[3] = prev[12];
+		aes_sub_bytes(w);
+
+		rk[0] = prev[0] ^ w[0] ^ rcon;
+		rk[1] = prev[1] ^ w[1];
+		rk[2] = prev[2] ^ w[2];
+		rk[3] = prev[3] ^ w[3];
+
+		for (i = 4; i < 16; i++)
+			rk[i] = prev[i] ^ rk[i - 4];
+
+		rcon = aes_xtime(rcon);
+	}
+}
+
+static void aes_ct_encrypt(const struct aes_key *ak, const uint8_t in[16],
+							uint8_t out[16])
+{
+	uint8_t s[16];
+	int r;
+
+	memcpy(s, in, 16);
+	aes_add_round_key(s, ak->rk[0]);
+
+	for (r = 1; r < AES_ROUNDS; r++) {
+		aes_sub_bytes(s);
+		aes_shift_rows(s);
+		aes_mix_columns(s);
+		aes_add_round_key(s, ak->rk[r]);
+	}
+
+	aes_sub_bytes(s);
+	aes_shift_rows(s);
+	aes_add_round_key(s, ak->rk[AES_ROUNDS]);
+
+	memcpy(out, s, 16);
+}
+
+static int aes_ct_resolve(const uint8_t irks[][16], unsigned int num_irks,
+							const uint8_t rpa[6])
+{
+	struct aes_key ak;
+	uint8_t key[16], in[16], out[16];
+	unsigned int i;
+	int j;
+
+	/* r' = padding || prand, most significant octet first */
+	memset(in, 0, 16);
+	in[13] = rpa[5];
+	in[14] = rpa[4];
+	in[15] = rpa[3];
+
+	for (i = 0; i < num_irks; i++) {
+		for (j = 0; j < 16; j++)
+			key[j] = irks[i][15 - j];
+
+		aes_ct_expand_key(key, &ak);
+		aes_ct_encrypt(&ak, in, out);
+
+		if (out[15] == rpa[0] && out[14] == rpa[1] &&
+							out[13] == rpa[2])
+			return i;
+	}
+
+	return -1;
+}
+
+static const struct aes_impl aes_ct = {
+	.name = "portable",
+	.expand_key = aes_ct_expand_key,
+	.encrypt = aes_ct_encrypt,
+	.resolve = aes_ct_resolve,
 };
 
-static int urandom_setup(void)
+#ifdef HAVE_AESNI
+__attribute__((target("aes,ssse3")))
+static inline __m128i aesni_expand_round(__m128i key, __m128i assist)
 {
-	int fd;
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
 
-	fd = open("/dev/urandom", O_RDONLY);
-	if (fd < 0)
-		return -1;
+	return _mm_xor_si128(key, assist);
+}
 
-	return fd;
+/* The round constant has to be an immediate, hence the macro */
+#define AESNI_EXPAND(ak, k, r, rcon) do { \
+		k = aesni_expand_round(k, _mm_aeskeygenassist_si128(k, rcon)); \
+		_mm_storeu_si128((__m128i *) (ak)->rk[r], k); \
+	} while (0)
+
+__attribute__((target("aes,ssse3")))
+static void aesni_expand_key(const uint8_t key[16], struct aes_key *ak)
+{
+	__m128i k = _mm_loadu_si128((const __m128i *) key);
+
+	_mm_storeu_si128((__m128i *) ak->rk[0], k);
+
+	AESNI_EXPAND(ak, k, 1, 0x01);
+	AESNI_EXPAND(ak, k, 2, 0x02);
+	AESNI_EXPAND(ak, k, 3, 0x04);
+	AESNI_EXPAND(ak, k, 4, 0x08);
+	AESNI_EXPAND(ak, k, 5, 0x10);
+	AESNI_EXPAND(ak, k, 6, 0x20);
+	AESNI_EXPAND(ak, k, 7, 0x40);
+	AESNI_EXPAND(ak, k, 8, 0x80);
+	AESNI_EXPAND(ak, k, 9, 0x1b);
+	AESNI_EXPAND(ak, k, 10, 0x36);
 }
 
-static int ecb_aes_setup(void)
+__attribute__((target("aes,ssse3")))
+static void aesni_encrypt(const struct aes_key *ak, const uint8_t in[16],
+							uint8_t out[16])
 {
-	struct sockaddr_alg salg;
-	int fd;
+	__m128i m = _mm_loadu_si128((const __m128i *) in);
+	int r;
 
-	fd = socket(PF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-	if (fd < 0)
-		return -1;
+	m = _mm_xor_si128(m, _mm_loadu_si128((const __m128i *) ak->rk[0]));
 
-	memset(&salg, 0, sizeof(salg));
-	salg.salg_family = AF_ALG;
-	strcpy((char *) salg.salg_type, "skcipher");
-	strcpy((char *) salg.salg_name, "ecb(aes)");
+	for (r = 1; r < AES_ROUNDS; r++)
+		m = _mm_aesenc_si128(m,
+				_mm_loadu_si128((const __m128i *) ak->rk[r]));
 
-	if (bind(fd, (struct sockaddr *) &salg, sizeof(salg)) < 0) {
-		close(fd);
-		return -1;
+	m = _mm_aesenclast_si128(m,
+			_mm_loadu_si128((const __m128i *) ak->rk[AES_ROUNDS]));
+
+	_mm_storeu_si128((__m128i *) out, m);
+}
+
+#define AESNI_LANES	8
+
+/*
+ * Resolve many IRKs at once. Each lane runs its own key expansion in
+ * lock step with the encryption, and lanes are independent of each
+ * other so the CPU can overlap the latency of the AES instructions.
+ *
+ * AESKEYGENASSIST is not pipelined on most cores, so the key schedule
+ * uses AESENCLAST instead. With RotWord(w[3]) broadcast to all columns
+ * ShiftRows is a no-op and the result is SubWord(RotWord(w[3])) ^ rcon.
+ */
+__attribute__((target("aes,ssse3")))
+static int aesni_resolve(const uint8_t irks[][16], unsigned int num_irks,
+							const uint8_t rpa[6])
+{
+	/* IRKs are stored least significant octet first */
+	const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+							11, 12, 13, 14, 15);
+	const __m128i rot = _mm_set_epi8(12, 15, 14, 13, 12, 15, 14, 13,
+					12, 15, 14, 13, 12, 15, 14, 13);
+	const __m128i in = _mm_set_epi8(rpa[3], rpa[4], rpa[5], 0, 0, 0, 0,
+						0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const uint32_t hash = rpa[2] | rpa[1] << 8 | rpa[0] << 16;
+	__m128i k[AESNI_LANES], m[AESNI_LANES];
+	unsigned int i, l, n;
+	int r;
+
+	for (i = 0; i < num_irks; i += n) {
+		__m128i rcon = _mm_set1_epi32(0x01);
+
+		n = num_irks - i;
+		if (n > AESNI_LANES)
+			n = AESNI_LANES;
+
+		for (l = 0; l < n; l++) {
+			k[l] = _mm_loadu_si128((const __m128i *) irks[i + l]);
+			k[l] = _mm_shuffle_epi8(k[l], swap);
+			m[l] = _mm_xor_si128(in, k[l]);
+		}
+
+		for (r = 1; r <= AES_ROUNDS; r++) {
+			for (l = 0; l < n; l++) {
+				__m128i t = _mm_shuffle_epi8(k[l], rot);
+
+				t = _mm_aesenclast_si128(t, rcon);
+				k[l] = aesni_expand_round(k[l], t);
+
+				if (r < AES_ROUNDS)
+					m[l] = _mm_aesenc_si128(m[l], k[l]);
+				else
+					m[l] = _mm_aesenclast_si128(m[l], k[l]);
+			}
+
+			/* 0x80 is followed by 0x1b in GF(2^8) */
+			if (r == 8)
+				rcon = _mm_set1_epi32(0x1b);
+			else
+				rcon = _mm_slli_epi32(rcon, 1);
+		}
+
+		/* ah() is the least significant 24 bits of the result */
+		for (l = 0; l < n; l++) {
+			uint32_t out = _mm_cvtsi128_si32(_mm_srli_si128(m[l],
+									12));
+
+			if ((out >> 8) == hash)
+				return i + l;
+		}
 	}
 
-	return fd;
+	return -1;
 }
 
-static int cmac_aes_setup(void)
+static const struct aes_impl aes_ni = {
+	.name = "aes-ni",
+	.expand_key = aesni_expand_key,
+	.encrypt = aesni_encrypt,
+	.resolve = aesni_resolve,
+};
+#endif
+
+static const struct aes_impl *aes_select(void)
 {
-	struct sockaddr_alg salg;
-	int fd;
+	const char *impl = getenv("BT_CRYPTO_AES");
 
-	fd = socket(PF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-	if (fd < 0)
-		return -1;
+	/* Allows tests to cover the portable code on any machine */
+	if (impl && !strcmp(impl, aes_ct.name))
+		return &aes_ct;
 
-	memset(&salg, 0, sizeof(salg));
-	salg.salg_family = AF_ALG;
-	strcpy((char *) salg.salg_type, "hash");
-	strcpy((char *) salg.salg_name, "cmac(aes)");
+#ifdef HAVE_AESNI
+	__builtin_cpu_init();
 
-	if (bind(fd, (struct sockaddr *) &salg, sizeof(salg)) < 0) {
-		close(fd);
+	if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3"))
+		return &aes_ni;
+#endif
+
+	return &aes_ct;
+}
+
+static int urandom_setup(void)
+{
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
 		return -1;
-	}
 
 	return fd;
 }
@@ -145,26 +541,13 @@ struct bt_crypto *bt_crypto_new(void)
 	if (!crypto)
 		return NULL;
 
-	crypto->ecb_aes = ecb_aes_setup();
-	if (crypto->ecb_aes < 0) {
-		free(crypto);
-		return NULL;
-	}
-
 	crypto->urandom = urandom_setup();
 	if (crypto->urandom < 0) {
-		close(crypto->ecb_aes);
 		free(crypto);
 		return NULL;
 	}
 
-	crypto->cmac_aes = cmac_aes_setup();
-	if (crypto->cmac_aes < 0) {
-		close(crypto->urandom);
-		close(crypto->ecb_aes);
-		free(crypto);
-		return NULL;
-	}
+	crypto->aes = aes_select();
 
 	return bt_crypto_ref(crypto);
 }
@@ -188,12 +571,18 @@ void bt_crypto_unref(struct bt_crypto *crypto)
 		return;
 
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
 
 	free(crypto);
 }
 
+const char *bt_crypto_get_aes_impl(struct bt_crypto *crypto)
+{
+	if (!crypto)
+		return NULL;
+
+	return crypto->aes->name;
+}
+
 bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 					uint8_t *buf, uint8_t num_bytes)
 {
@@ -209,52 +598,34 @@ bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 	return true;
 }
 
-static int alg_new(int fd, const void *keyval, socklen_t keylen)
-{
-	if (setsockopt(fd, SOL_ALG, ALG_SET_KEY, keyval, keylen) < 0)
-		return -1;
-
-	/* FIXME: This should use accept4() with SOCK_CLOEXEC */
-	return accept(fd, NULL, 0);
-}
+typedef struct {
+	uint64_t a, b;
+} u128;
 
-static bool alg_encrypt(int fd, const void *inbuf, size_t inlen,
-						void *outbuf, size_t outlen)
+static inline void u128_xor(const uint8_t p[16], const uint8_t q[16],
+								uint8_t r[16])
 {
-	__u32 alg_op = ALG_OP_ENCRYPT;
-	char cbuf[CMSG_SPACE(sizeof(alg_op))];
-	struct cmsghdr *cmsg;
-	struct msghdr msg;
-	struct iovec iov;
-	ssize_t len;
-
-	memset(cbuf, 0, sizeof(cbuf));
-	memset(&msg, 0, sizeof(msg));
-
-	msg.msg_control = cbuf;
-	msg.msg_controllen = sizeof(cbuf);
+	u128 pp, qq, rr;
 
-	cmsg = CMSG_FIRSTHDR(&msg);
-	cmsg->cmsg_level = SOL_ALG;
-	cmsg->cmsg_type = ALG_SET_OP;
-	cmsg->cmsg_len = CMSG_LEN(sizeof(alg_op));
-	memcpy(CMSG_DATA(cmsg), &alg_op, sizeof(alg_op));
+	memcpy(&pp, p, 16);
+	memcpy(&qq, q, 16);
 
-	iov.iov_base = (void *) inbuf;
-	iov.iov_len = inlen;
+	rr.a = pp.a ^ qq.a;
+	rr.b = pp.b ^ qq.b;
 
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
+	memcpy(r, &rr, 16);
+}
 
-	len = sendmsg(fd, &msg, 0);
-	if (len < 0)
-		return false;
+/* Multiply by x in GF(2^128), most significant octet first */
+static inline void gf128_double(uint8_t v[16])
+{
+	uint8_t carry = v[0] >> 7;
+	int i;
 
-	len = read(fd, outbuf, outlen);
-	if (len < 0)
-		return false;
+	for (i = 0; i < 15; i++)
+		v[i] = (v[i] << 1) | (v[i + 1] >> 7);
 
-	return true;
+	v[15] = (v[15] << 1) ^ (0x87 & -carry);
 }
 
 static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
@@ -265,12 +636,55 @@ static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 		dst[len - 1 - i] = src[i];
 }
 
+/*
+ * AES-CMAC as defined by RFC 4493. Key, message and result all use the
+ * most significant octet first byte order.
+ */
+static void aes_cmac_msb(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t *msg, size_t msg_len,
+				uint8_t res[16])
+{
+	struct aes_key ak;
+	uint8_t k[16], x[16];
+	size_t n, i;
+	int j;
+
+	crypto->aes->expand_key(key, &ak);
+
+	/* L = AES-128(K, 0^128), K1 = L << 1, K2 = K1 << 1 */
+	memset(k, 0, 16);
+	crypto->aes->encrypt(&ak, k, k);
+	gf128_double(k);
+
+	n = msg_len ? (msg_len + 15) / 16 : 1;
+
+	memset(x, 0, 16);
+
+	for (i = 0; i < n - 1; i++) {
+		u128_xor(x, msg + i * 16, x);
+		crypto->aes->encrypt(&ak, x, x);
+	}
+
+	msg += i * 16;
+	msg_len -= i * 16;
+
+	/* Complete last block uses K1, padded last block uses K2 */
+	if (msg_len < 16) {
+		gf128_double(k);
+		x[msg_len] ^= 0x80;
+	}
+
+	for (j = 0; j < (int) msg_len; j++)
+		x[j] ^= msg[j];
+
+	u128_xor(x, k, x);
+	crypto->aes->encrypt(&ak, x, res);
+}
+
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt, uint8_t signature[12])
 {
-	int fd;
-	int len;
 	uint8_t tmp[16], out[16];
 	uint16_t msg_len = m_len + sizeof(uint32_t);
 	uint8_t msg[msg_len];
@@ -288,26 +702,10 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
 	/* Swap msg before signing */
 	swap_buf(msg, msg_s, msg_len);
 
-	len = send(fd, msg_s, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	close(fd);
+	aes_cmac_msb(crypto, tmp, msg_s, msg_len, out);
 
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
@@ -325,6 +723,7 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 
 	return true;
 }
+
 /*
  * Security function e
  *
@@ -341,33 +740,24 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16])
 {
+	struct aes_key ak;
 	uint8_t tmp[16], in[16], out[16];
-	int fd;
 
 	if (!crypto)
 		return false;
 
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
-
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
+	crypto->aes->expand_key(tmp, &ak);
 
 	/* Most significant octet of plaintextData corresponds to in[0] */
 	swap_buf(plaintext, in, 16);
 
-	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
-		return false;
-	}
+	crypto->aes->encrypt(&ak, in, out);
 
 	/* Most significant octet of encryptedData corresponds to out[0] */
 	swap_buf(out, encrypted, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -426,22 +816,21 @@ bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 	return true;
 }
 
-typedef struct {
-	uint64_t a, b;
-} u128;
-
-static inline void u128_xor(const uint8_t p[16], const uint8_t q[16],
-								uint8_t r[16])
+/*
+ * Resolve a resolvable private address against a list of IRKs
+ *
+ * The most significant octet of rpa is rpa[5], so prand occupies
+ * rpa[3..5] and hash occupies rpa[0..2]. Returns the index of the first
+ * IRK for which ah(irk, prand) == hash, or -1 if none matches.
+ */
+int bt_crypto_resolve_batch(struct bt_crypto *crypto,
+				const uint8_t irks[][16], unsigned int num_irks,
+				const uint8_t rpa[6])
 {
-	u128 pp, qq, rr;
-
-	memcpy(&pp, p, 16);
-	memcpy(&qq, q, 16);
-
-	rr.a = pp.a ^ qq.a;
-	rr.b = pp.b ^ qq.b;
+	if (!crypto || !irks)
+		return -1;
 
-	memcpy(r, &rr, 16);
+	return crypto->aes->resolve(irks, num_irks, rpa);
 }
 
 /*
@@ -574,34 +963,20 @@ static bool aes_cmac(struct bt_crypto *crypto, uint8_t key[16], uint8_t *msg,
 					size_t msg_len, uint8_t res[16])
 {
 	uint8_t key_msb[16], out[16], msg_msb[CMAC_MSG_MAX];
-	ssize_t len;
-	int fd;
 
-	if (msg_len > CMAC_MSG_MAX)
+	if (!crypto)
 		return false;
 
-	swap_buf(key, key_msb, 16);
-	fd = alg_new(crypto->cmac_aes, key_msb, 16);
-	if (fd < 0)
+	if (msg_len > CMAC_MSG_MAX)
 		return false;
 
+	swap_buf(key, key_msb, 16);
 	swap_buf(msg, msg_msb, msg_len);
-	len = send(fd, msg_msb, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
+	aes_cmac_msb(crypto, key_msb, msg_msb, msg_len, out);
 
 	swap_buf(out, res, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -681,3 +1056,339 @@ bool bt_crypto_g2(struct bt_crypto *crypto, uint8_t u[32], uint8_t v[32],
 
 	return true;
 }
+
+struct rpa_entry {
+	uint8_t rpa[6];
+	int irk;			/* -1 when no IRK matched */
+	struct rpa_entry *hash_next;
+	struct rpa_entry *lru_prev;
+	struct rpa_entry *lru_next;
+};
+
+struct resolver_id {
+	uint8_t addr[6];
+	uint8_t addr_type;
+};
+
+struct bt_crypto_resolver {
+	struct bt_crypto *crypto;
+	uint8_t (*irks)[16];
+	struct resolver_id *ids;
+	unsigned int num_irks;
+	unsigned int max_irks;
+	struct rpa_entry *entries;
+	unsigned int cache_size;
+	unsigned int num_entries;
+	struct rpa_entry *free_entries;
+	struct rpa_entry **buckets;
+	unsigned int bucket_mask;
+	struct rpa_entry lru;		/* Most recently used first */
+};
+
+static void cache_clear(struct bt_crypto_resolver *resolver)
+{
+	resolver->num_entries = 0;
+	resolver->free_entries = NULL;
+	resolver->lru.lru_next = &resolver->lru;
+	resolver->lru.lru_prev = &resolver->lru;
+	memset(resolver->buckets, 0, sizeof(struct rpa_entry *) *
+					(resolver->bucket_mask + 1));
+}
+
+/* The 24-bit hash of an RPA is an AES output, so use it as is */
+static struct rpa_entry **cache_bucket(struct bt_crypto_resolver *resolver,
+							const uint8_t rpa[6])
+{
+	uint32_t hash = rpa[0] | rpa[1] << 8 | rpa[2] << 16;
+
+	return &resolver->buckets[hash & resolver->bucket_mask];
+}
+
+static void cache_lru_unlink(struct rpa_entry *entry)
+{
+	entry->lru_prev->lru_next = entry->lru_next;
+	entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+static void cache_lru_push(struct bt_crypto_resolver *resolver,
+						struct rpa_entry *entry)
+{
+	entry->lru_prev = &resolver->lru;
+	entry->lru_next = resolver->lru.lru_next;
+	resolver->lru.lru_next->lru_prev = entry;
+	resolver->lru.lru_next = entry;
+}
+
+static void cache_unlink(struct bt_crypto_resolver *resolver,
+						struct rpa_entry *entry)
+{
+	struct rpa_entry **bucket = cache_bucket(resolver, entry->rpa);
+
+	while (*bucket != entry)
+		bucket = &(*bucket)->hash_next;
+
+	*bucket = entry->hash_next;
+
+	cache_lru_unlink(entry);
+}
+
+static void cache_drop(struct bt_crypto_resolver *resolver,
+						struct rpa_entry *entry)
+{
+	cache_unlink(resolver, entry);
+
+	entry->hash_next = resolver->free_entries;
+	resolver->free_entries = entry;
+}
+
+static struct rpa_entry *cache_lookup(struct bt_crypto_resolver *resolver,
+							const uint8_t rpa[6])
+{
+	struct rpa_entry *entry;
+
+	for (entry = *cache_bucket(resolver, rpa); entry;
+						entry = entry->hash_next) {
+		if (memcmp(entry->rpa, rpa, 6))
+			continue;
+
+		cache_lru_unlink(entry);
+		cache_lru_push(resolver, entry);
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+static void cache_insert(struct bt_crypto_resolver *resolver,
+					const uint8_t rpa[6], int irk)
+{
+	struct rpa_entry **bucket;
+	struct rpa_entry *entry;
+
+	if (resolver->free_entries) {
+		entry = resolver->free_entries;
+		resolver->free_entries = entry->hash_next;
+	} else if (resolver->num_entries < resolver->cache_size) {
+		entry = &resolver->entries[resolver->num_entries++];
+	} else {
+		/* Evict the least recently used entry */
+		entry = resolver->lru.lru_prev;
+		cache_unlink(resolver, entry);
+	}
+
+	memcpy(entry->rpa, rpa, 6);
+	entry->irk = irk;
+
+	bucket = cache_bucket(resolver, rpa);
+	entry->hash_next = *bucket;
+	*bucket = entry;
+
+	cache_lru_push(resolver, entry);
+}
+
+struct bt_crypto_resolver *bt_crypto_resolver_new(struct bt_crypto *crypto,
+						unsigned int cache_size)
+{
+	struct bt_crypto_resolver *resolver;
+	unsigned int buckets = 1;
+
+	if (!crypto || !cache_size)
+		return NULL;
+
+	while (buckets < cache_size)
+		buckets <<= 1;
+
+	resolver = new0(struct bt_crypto_resolver, 1);
+	if (!resolver)
+		return NULL;
+
+	resolver->entries = new0(struct rpa_entry, cache_size);
+	resolver->buckets = new0(struct rpa_entry *, buckets);
+	if (!resolver->entries || !resolver->buckets) {
+		free(resolver->entries);
+		free(resolver->buckets);
+		free(resolver);
+		return NULL;
+	}
+
+	resolver->crypto = bt_crypto_ref(crypto);
+	resolver->cache_size = cache_size;
+	resolver->bucket_mask = buckets - 1;
+
+	cache_clear(resolver);
+
+	return resolver;
+}
+
+void bt_crypto_resolver_free(struct bt_crypto_resolver *resolver)
+{
+	if (!resolver)
+		return;
+
+	bt_crypto_unref(resolver->crypto);
+	free(resolver->irks);
+	free(resolver->ids);
+	free(resolver->entries);
+	free(resolver->buckets);
+	free(resolver);
+}
+
+static int resolver_find_id(struct bt_crypto_resolver *resolver,
+				const uint8_t addr[6], uint8_t addr_type)
+{
+	unsigned int i;
+
+	for (i = 0; i < resolver->num_irks; i++) {
+		struct resolver_id *id = &resolver->ids[i];
+
+		if (id->addr_type == addr_type && !memcmp(id->addr, addr, 6))
+			return i;
+	}
+
+	return -1;
+}
+
+bool bt_crypto_resolver_add(struct bt_crypto_resolver *resolver,
+				const uint8_t irk[16], const uint8_t addr[6],
+				uint8_t addr_type)
+{
+	struct rpa_entry *entry, *next;
+	int index;
+
+	if (!resolver || !irk || !addr)
+		return false;
+
+	index = resolver_find_id(resolver, addr, addr_type);
+	if (index >= 0) {
+		memcpy(resolver->irks[index], irk, 16);
+		cache_clear(resolver);
+		return true;
+	}
+
+	if (resolver->num_irks == resolver->max_irks) {
+		unsigned int max = resolver->max_irks ?
+					resolver->max_irks * 2 : 16;
+		void *irks, *ids;
+
+		irks = realloc(resolver->irks, max * 16);
+		if (!irks)
+			return false;
+
+		resolver->irks = irks;
+
+		ids = realloc(resolver->ids, max * sizeof(struct resolver_id));
+		if (!ids)
+			return false;
+
+		resolver->ids = ids;
+		resolver->max_irks = max;
+	}
+
+	index = resolver->num_irks++;
+	memcpy(resolver->irks[index], irk, 16);
+	memcpy(resolver->ids[index].addr, addr, 6);
+	resolver->ids[index].addr_type = addr_type;
+
+	/* Addresses that did not resolve before may resolve now */
+	for (entry = resolver->lru.lru_next; entry != &resolver->lru;
+							entry = next) {
+		next = entry->lru_next;
+
+		if (entry->irk < 0)
+			cache_drop(resolver, entry);
+	}
+
+	return true;
+}
+
+bool bt_crypto_resolver_remove(struct bt_crypto_resolver *resolver,
+				const uint8_t addr[6], uint8_t addr_type)
+{
+	struct rpa_entry *entry, *next;
+	unsigned int last;
+	int index;
+
+	if (!resolver || !addr)
+		return false;
+
+	index = resolver_find_id(resolver, addr, addr_type);
+	if (index < 0)
+		return false;
+
+	/* Move the last IRK into the hole to keep the list contiguous */
+	last = --resolver->num_irks;
+	memcpy(resolver->irks[index], resolver->irks[last], 16);
+	resolver->ids[index] = resolver->ids[last];
+
+	for (entry = resolver->lru.lru_next; entry != &resolver->lru;
+							entry = next) {
+		next = entry->lru_next;
+
+		if (entry->irk == index)
+			cache_drop(resolver, entry);
+		else if (entry->irk == (int) last)
+			entry->irk = index;
+	}
+
+	return true;
+}
+
+void bt_crypto_resolver_clear(struct bt_crypto_resolver *resolver)
+{
+	if (!resolver)
+		return;
+
+	resolver->num_irks = 0;
+	cache_clear(resolver);
+}
+
+unsigned int bt_crypto_resolver_count(struct bt_crypto_resolver *resolver)
+{
+	if (!resolver)
+		return 0;
+
+	return resolver->num_irks;
+}
+
+/*
+ * Look up the identity address for a resolvable private address. The
+ * result, including a failure to resolve, is remembered so that repeated
+ * advertising reports from the same RPA skip the crypto entirely.
+ */
+bool bt_crypto_resolver_resolve(struct bt_crypto_resolver *resolver,
+				const uint8_t rpa[6], uint8_t addr[6],
+				uint8_t *addr_type)
+{
+	struct rpa_entry *entry;
+	int index;
+
+	if (!resolver || !rpa)
+		return false;
+
+	/* Only resolvable private addresses have the 0b01 prefix */
+	if ((rpa[5] & 0xc0) != 0x40)
+		return false;
+
+	entry = cache_lookup(resolver, rpa);
+	if (entry) {
+		index = entry->irk;
+	} else {
+		index = bt_crypto_resolve_batch(resolver->crypto,
+						(const uint8_t (*)[16])
+						resolver->irks,
+						resolver->num_irks, rpa);
+		cache_insert(resolver, rpa, index);
+	}
+
+	if (index < 0)
+		return false;
+
+	if (addr)
+		memcpy(addr, resolver->ids[index].addr, 6);
+
+	if (addr_type)
+		*addr_type = resolver->ids[index].addr_type;
+
+	return true;
+}
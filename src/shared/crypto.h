@@ -31,6 +31,8 @@ struct bt_crypto *bt_crypto_new(void);
 struct bt_crypto *bt_crypto_ref(struct bt_crypto *crypto);
 void bt_crypto_unref(struct bt_crypto *crypto);
 
+const char *bt_crypto_get_aes_impl(struct bt_crypto *crypto);
+
 bool bt_crypto_random_bytes(struct bt_crypto *crypto,
 					uint8_t *buf, uint8_t num_bytes);
 
@@ -38,6 +40,9 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16]);
 bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 					const uint8_t r[3], uint8_t hash[3]);
+int bt_crypto_resolve_batch(struct bt_crypto *crypto,
+				const uint8_t irks[][16], unsigned int num_irks,
+				const uint8_t rpa[6]);
 bool bt_crypto_c1(struct bt_crypto *crypto, const uint8_t k[16],
 			const uint8_t r[16], const uint8_t pres[7],
 			const uint8_t preq[7], uint8_t iat,
@@ -59,3 +64,21 @@ bool bt_crypto_g2(struct bt_crypto *crypto, uint8_t u[32], uint8_t v[32],
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt, uint8_t signature[12]);
+
+struct bt_crypto_resolver;
+
+struct bt_crypto_resolver *bt_crypto_resolver_new(struct bt_crypto *crypto,
+						unsigned int cache_size);
+void bt_crypto_resolver_free(struct bt_crypto_resolver *resolver);
+
+bool bt_crypto_resolver_add(struct bt_crypto_resolver *resolver,
+				const uint8_t irk[16], const uint8_t addr[6],
+				uint8_t addr_type);
+bool bt_crypto_resolver_remove(struct bt_crypto_resolver *resolver,
+				const uint8_t addr[6], uint8_t addr_type);
+void bt_crypto_resolver_clear(struct bt_crypto_resolver *resolver);
+unsigned int bt_crypto_resolver_count(struct bt_crypto_resolver *resolver);
+
+bool bt_crypto_resolver_resolve(struct bt_crypto_resolver *resolver,
+				const uint8_t rpa[6], uint8_t addr[6],
+				uint8_t *addr_type);
@@ -69,6 +69,7 @@ typedef struct {
 static uint64_t curve_p[NUM_ECC_DIGITS] = CURVE_P_32;
 static struct ecc_point curve_g = CURVE_G_32;
 static uint64_t curve_n[NUM_ECC_DIGITS] = CURVE_N_32;
+static const uint64_t curve_one[NUM_ECC_DIGITS] = { 1, 0, 0, 0 };
 
 static bool get_random_number(uint64_t *vli)
 {
@@ -128,44 +129,34 @@ static uint64_t vli_test_bit(const uint64_t *vli, unsigned int bit)
 	return (vli[bit / 64] & ((uint64_t) 1 << (bit % 64)));
 }
 
-/* Counts the number of 64-bit "digits" in vli. */
-static unsigned int vli_num_digits(const uint64_t *vli)
+/* Sets dest = src. */
+static void vli_set(uint64_t *dest, const uint64_t *src)
 {
 	int i;
 
-	/* Search from the end until we find a non-zero digit.
-	 * We do it in reverse because we expect that most digits will
-	 * be nonzero.
-	 */
-	for (i = NUM_ECC_DIGITS - 1; i >= 0 && vli[i] == 0; i--);
-
-	return (i + 1);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		dest[i] = src[i];
 }
 
-/* Counts the number of bits required for vli. */
-static unsigned int vli_num_bits(const uint64_t *vli)
+/* Sets dest = src if mask is all ones, leaves dest alone if it is zero. */
+static void vli_select(uint64_t *dest, const uint64_t *src, uint64_t mask)
 {
-	unsigned int i, num_digits;
-	uint64_t digit;
-
-	num_digits = vli_num_digits(vli);
-	if (num_digits == 0)
-		return 0;
-
-	digit = vli[num_digits - 1];
-	for (i = 0; digit; i++)
-		digit >>= 1;
+	int i;
 
-	return ((num_digits - 1) * 64 + i);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		dest[i] = (dest[i] & ~mask) | (src[i] & mask);
 }
 
-/* Sets dest = src. */
-static void vli_set(uint64_t *dest, const uint64_t *src)
+/* Returns all ones if vli == 0 and zero otherwise, in constant time. */
+static uint64_t vli_zero_mask(const uint64_t *vli)
 {
+	uint64_t bits = 0;
 	int i;
 
 	for (i = 0; i < NUM_ECC_DIGITS; i++)
-		dest[i] = src[i];
+		bits |= vli[i];
+
+	return ((bits | -bits) >> 63) - 1;
 }
 
 /* Returns sign of left - right. */
@@ -183,25 +174,6 @@ static int vli_cmp(const uint64_t *left, const uint64_t *right)
     return 0;
 }
 
-/* Computes result = in << c, returning carry. Can modify in place
- * (if result == in). 0 < shift < 64.
- */
-static uint64_t vli_lshift(uint64_t *result, const uint64_t *in,
-							unsigned int shift)
-{
-	uint64_t carry = 0;
-	int i;
-
-	for (i = 0; i < NUM_ECC_DIGITS; i++) {
-		uint64_t temp = in[i];
-
-		result[i] = (temp << shift) | carry;
-		carry = temp >> (64 - shift);
-	}
-
-	return carry;
-}
-
 /* Computes vli = vli >> 1. */
 static void vli_rshift1(uint64_t *vli)
 {
@@ -228,8 +200,7 @@ static uint64_t vli_add(uint64_t *result, const uint64_t *left,
 		uint64_t sum;
 
 		sum = left[i] + right[i] + carry;
-		if (sum != left[i])
-			carry = (sum < left[i]);
+		carry = (sum < left[i]) | ((sum == left[i]) & carry);
 
 		result[i] = sum;
 	}
@@ -248,8 +219,7 @@ static uint64_t vli_sub(uint64_t *result, const uint64_t *left,
 		uint64_t diff;
 
 		diff = left[i] - right[i] - borrow;
-		if (diff != left[i])
-			borrow = (diff > left[i]);
+		borrow = (diff > left[i]) | ((diff == left[i]) & borrow);
 
 		result[i] = diff;
 	}
@@ -257,6 +227,91 @@ static uint64_t vli_sub(uint64_t *result, const uint64_t *left,
 	return borrow;
 }
 
+#ifdef __SIZEOF_INT128__
+/*
+ * Operand scanning with native 64x64->128 multiplies. Every step fits in
+ * 128 bits since (2^64 - 1)^2 + 2 * (2^64 - 1) = 2^128 - 1, so there are
+ * no data dependent carries. The compiler emits MUL or MULX depending on
+ * the target.
+ */
+static void vli_mult(uint64_t *result, const uint64_t *left,
+							const uint64_t *right)
+{
+	uint64_t r[NUM_ECC_DIGITS * 2];
+	int i, j;
+
+	for (i = 0; i < NUM_ECC_DIGITS * 2; i++)
+		r[i] = 0;
+
+	for (i = 0; i < NUM_ECC_DIGITS; i++) {
+		uint64_t carry = 0;
+
+		for (j = 0; j < NUM_ECC_DIGITS; j++) {
+			unsigned __int128 t;
+
+			t = (unsigned __int128) left[i] * right[j] +
+							r[i + j] + carry;
+			r[i + j] = t;
+			carry = t >> 64;
+		}
+
+		r[i + NUM_ECC_DIGITS] = carry;
+	}
+
+	for (i = 0; i < NUM_ECC_DIGITS * 2; i++)
+		result[i] = r[i];
+}
+
+/* Cross products are computed once and doubled, then the squares added */
+static void vli_square(uint64_t *result, const uint64_t *left)
+{
+	uint64_t r[NUM_ECC_DIGITS * 2];
+	uint64_t carry;
+	int i, j;
+
+	for (i = 0; i < NUM_ECC_DIGITS * 2; i++)
+		r[i] = 0;
+
+	for (i = 0; i < NUM_ECC_DIGITS - 1; i++) {
+		carry = 0;
+
+		for (j = i + 1; j < NUM_ECC_DIGITS; j++) {
+			unsigned __int128 t;
+
+			t = (unsigned __int128) left[i] * left[j] +
+							r[i + j] + carry;
+			r[i + j] = t;
+			carry = t >> 64;
+		}
+
+		r[i + NUM_ECC_DIGITS] = carry;
+	}
+
+	carry = 0;
+
+	for (i = 0; i < NUM_ECC_DIGITS * 2; i++) {
+		uint64_t temp = r[i];
+
+		r[i] = (temp << 1) | carry;
+		carry = temp >> 63;
+	}
+
+	carry = 0;
+
+	for (i = 0; i < NUM_ECC_DIGITS; i++) {
+		unsigned __int128 t;
+
+		t = (unsigned __int128) left[i] * left[i] + r[2 * i] + carry;
+		r[2 * i] = t;
+		t = (t >> 64) + r[2 * i + 1];
+		r[2 * i + 1] = t;
+		carry = t >> 64;
+	}
+
+	for (i = 0; i < NUM_ECC_DIGITS * 2; i++)
+		result[i] = r[i];
+}
+#else
 static uint128_t mul_64_64(uint64_t left, uint64_t right)
 {
 	uint64_t a0 = left & 0xffffffffull;
@@ -366,6 +421,7 @@ static void vli_square(uint64_t *result, const uint64_t *left)
 
 	result[NUM_ECC_DIGITS * 2 - 1] = r01.m_low;
 }
+#endif
 
 /* Computes result = (left + right) % mod.
  * Assumes that left < mod and right < mod, result != mod.
@@ -373,15 +429,17 @@ static void vli_square(uint64_t *result, const uint64_t *left)
 static void vli_mod_add(uint64_t *result, const uint64_t *left,
 				const uint64_t *right, const uint64_t *mod)
 {
-	uint64_t carry;
+	uint64_t tmp[NUM_ECC_DIGITS];
+	uint64_t carry, borrow;
 
 	carry = vli_add(result, left, right);
 
 	/* result > mod (result = mod + remainder), so subtract mod to
-	 * get remainder.
+	 * get remainder. Both candidates are computed to stay constant
+	 * time.
 	 */
-	if (carry || vli_cmp(result, mod) >= 0)
-		vli_sub(result, result, mod);
+	borrow = vli_sub(tmp, result, mod);
+	vli_select(result, tmp, -(carry | !borrow));
 }
 
 /* Computes result = (left - right) % mod.
@@ -390,91 +448,87 @@ static void vli_mod_add(uint64_t *result, const uint64_t *left,
 static void vli_mod_sub(uint64_t *result, const uint64_t *left,
 				const uint64_t *right, const uint64_t *mod)
 {
+	uint64_t tmp[NUM_ECC_DIGITS];
 	uint64_t borrow = vli_sub(result, left, right);
+	int i;
 
 	/* In this case, p_result == -diff == (max int) - diff.
 	 * Since -x % d == d - x, we can get the correct result from
 	 * result + mod (with overflow).
 	 */
-	if (borrow)
-		vli_add(result, result, mod);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		tmp[i] = mod[i] & -borrow;
+
+	vli_add(result, result, tmp);
 }
 
 /* Computes result = product % curve_p
-   from http://www.nsa.gov/ia/_files/nist-routines.pdf */
+ * from http://www.nsa.gov/ia/_files/nist-routines.pdf
+ *
+ * The NIST terms are summed per 32-bit word with signed 64-bit
+ * accumulators, which leaves a small signed carry above 2^256. That
+ * carry is folded back using 2^256 = 2^224 - 2^192 - 2^96 + 1 (mod p)
+ * and the remaining single correction is done by masking, so there are
+ * no data dependent branches.
+ */
 static void vli_mmod_fast(uint64_t *result, const uint64_t *product)
 {
-	uint64_t tmp[NUM_ECC_DIGITS];
-	int carry;
-
-	/* t */
-	vli_set(result, product);
-
-	/* s1 */
-	tmp[0] = 0;
-	tmp[1] = product[5] & 0xffffffff00000000ull;
-	tmp[2] = product[6];
-	tmp[3] = product[7];
-	carry = vli_lshift(tmp, tmp, 1);
-	carry += vli_add(result, result, tmp);
-
-	/* s2 */
-	tmp[1] = product[6] << 32;
-	tmp[2] = (product[6] >> 32) | (product[7] << 32);
-	tmp[3] = product[7] >> 32;
-	carry += vli_lshift(tmp, tmp, 1);
-	carry += vli_add(result, result, tmp);
-
-	/* s3 */
-	tmp[0] = product[4];
-	tmp[1] = product[5] & 0xffffffff;
-	tmp[2] = 0;
-	tmp[3] = product[7];
-	carry += vli_add(result, result, tmp);
-
-	/* s4 */
-	tmp[0] = (product[4] >> 32) | (product[5] << 32);
-	tmp[1] = (product[5] >> 32) | (product[6] & 0xffffffff00000000ull);
-	tmp[2] = product[7];
-	tmp[3] = (product[6] >> 32) | (product[4] << 32);
-	carry += vli_add(result, result, tmp);
-
-	/* d1 */
-	tmp[0] = (product[5] >> 32) | (product[6] << 32);
-	tmp[1] = (product[6] >> 32);
-	tmp[2] = 0;
-	tmp[3] = (product[4] & 0xffffffff) | (product[5] << 32);
-	carry -= vli_sub(result, result, tmp);
-
-	/* d2 */
-	tmp[0] = product[6];
-	tmp[1] = product[7];
-	tmp[2] = 0;
-	tmp[3] = (product[4] >> 32) | (product[5] & 0xffffffff00000000ull);
-	carry -= vli_sub(result, result, tmp);
-
-	/* d3 */
-	tmp[0] = (product[6] >> 32) | (product[7] << 32);
-	tmp[1] = (product[7] >> 32) | (product[4] << 32);
-	tmp[2] = (product[4] >> 32) | (product[5] << 32);
-	tmp[3] = (product[6] << 32);
-	carry -= vli_sub(result, result, tmp);
-
-	/* d4 */
-	tmp[0] = product[7];
-	tmp[1] = product[4] & 0xffffffff00000000ull;
-	tmp[2] = product[5];
-	tmp[3] = product[6] & 0xffffffff00000000ull;
-	carry -= vli_sub(result, result, tmp);
-
-	if (carry < 0) {
-		do {
-			carry += vli_add(result, result, curve_p);
-		} while (carry < 0);
-	} else {
-		while (carry || vli_cmp(curve_p, result) != 1)
-			carry -= vli_sub(result, result, curve_p);
+	int64_t a[16], w[8], acc;
+	uint64_t tsub[NUM_ECC_DIGITS], tadd[NUM_ECC_DIGITS];
+	uint64_t borrow, pos, neg;
+	uint32_t r[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		a[2 * i] = product[i] & 0xffffffff;
+		a[2 * i + 1] = product[i] >> 32;
+	}
+
+	/* T + 2 * S1 + 2 * S2 + S3 + S4 - D1 - D2 - D3 - D4 */
+	w[0] = a[0] + a[8] + a[9] - a[11] - a[12] - a[13] - a[14];
+	w[1] = a[1] + a[9] + a[10] - a[12] - a[13] - a[14] - a[15];
+	w[2] = a[2] + a[10] + a[11] - a[13] - a[14] - a[15];
+	w[3] = a[3] + 2 * (a[11] + a[12]) + a[13] - a[15] - a[8] - a[9];
+	w[4] = a[4] + 2 * (a[12] + a[13]) + a[14] - a[9] - a[10];
+	w[5] = a[5] + 2 * (a[13] + a[14]) + a[15] - a[10] - a[11];
+	w[6] = a[6] + 3 * a[14] + 2 * a[15] + a[13] - a[8] - a[9];
+	w[7] = a[7] + 3 * a[15] + a[8] - a[10] - a[11] - a[12] - a[13];
+
+	for (i = 0, acc = 0; i < 8; i++) {
+		acc += w[i];
+		r[i] = acc;
+		acc >>= 32;
+	}
+
+	/* Fold the carry, which is at most a few units either way */
+	for (i = 0; i < 8; i++)
+		w[i] = r[i];
+
+	w[0] += acc;
+	w[3] -= acc;
+	w[6] -= acc;
+	w[7] += acc;
+
+	for (i = 0, acc = 0; i < 8; i++) {
+		acc += w[i];
+		r[i] = acc;
+		acc >>= 32;
 	}
+
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		result[i] = (uint64_t) r[2 * i + 1] << 32 | r[2 * i];
+
+	/* The value is now result + acc * 2^256 with acc in [-1, 1] and
+	 * lies in (-p, 2p), so one subtraction or addition of p is enough.
+	 */
+	borrow = vli_sub(tsub, result, curve_p);
+	vli_add(tadd, result, curve_p);
+
+	pos = -(uint64_t) (acc == 1);
+	neg = -(uint64_t) (acc == -1);
+
+	vli_select(result, tsub, pos | (-(uint64_t) (acc == 0) & (borrow - 1)));
+	vli_select(result, tadd, neg);
 }
 
 /* Computes result = (left * right) % curve_p. */
@@ -496,83 +550,63 @@ static void vli_mod_square_fast(uint64_t *result, const uint64_t *left)
 	vli_mmod_fast(result, product);
 }
 
-#define EVEN(vli) (!(vli[0] & 1))
-/* Computes result = (1 / p_input) % mod. All VLIs are the same size.
- * See "From Euclid's GCD to Montgomery Multiplication to the Great Divide"
- * https://labs.oracle.com/techrep/2001/smli_tr-2001-95.pdf
- */
-static void vli_mod_inv(uint64_t *result, const uint64_t *input,
-							const uint64_t *mod)
+/* Computes result = left^(2^n) % curve_p. */
+static void vli_mod_square_n(uint64_t *result, const uint64_t *left,
+							unsigned int n)
 {
-	uint64_t a[NUM_ECC_DIGITS], b[NUM_ECC_DIGITS];
-	uint64_t u[NUM_ECC_DIGITS], v[NUM_ECC_DIGITS];
-	uint64_t carry;
-	int cmp_result;
-
-	if (vli_is_zero(input)) {
-		vli_clear(result);
-		return;
-	}
-
-	vli_set(a, input);
-	vli_set(b, mod);
-	vli_clear(u);
-	u[0] = 1;
-	vli_clear(v);
-
-	while ((cmp_result = vli_cmp(a, b)) != 0) {
-		carry = 0;
-
-		if (EVEN(a)) {
-			vli_rshift1(a);
-
-			if (!EVEN(u))
-				carry = vli_add(u, u, mod);
-
-			vli_rshift1(u);
-			if (carry)
-				u[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		} else if (EVEN(b)) {
-			vli_rshift1(b);
-
-			if (!EVEN(v))
-				carry = vli_add(v, v, mod);
+	vli_mod_square_fast(result, left);
 
-			vli_rshift1(v);
-			if (carry)
-				v[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		} else if (cmp_result > 0) {
-			vli_sub(a, a, b);
-			vli_rshift1(a);
-
-			if (vli_cmp(u, v) < 0)
-				vli_add(u, u, mod);
-
-			vli_sub(u, u, v);
-			if (!EVEN(u))
-				carry = vli_add(u, u, mod);
-
-			vli_rshift1(u);
-			if (carry)
-				u[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		} else {
-			vli_sub(b, b, a);
-			vli_rshift1(b);
-
-			if (vli_cmp(v, u) < 0)
-				vli_add(v, v, mod);
-
-			vli_sub(v, v, u);
-			if (!EVEN(v))
-				carry = vli_add(v, v, mod);
-
-			vli_rshift1(v);
-			if (carry)
-				v[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		}
-	}
+	while (--n)
+		vli_mod_square_fast(result, result);
+}
 
-	vli_set(result, u);
+/* Computes result = (1 / input) % curve_p as input^(p - 2).
+ *
+ * p - 2 is 32 ones, 31 zeros, a one, 96 zeros, 94 ones, a zero and a
+ * one from the top, so a fixed addition chain built from runs of ones
+ * x_k = input^(2^k - 1) needs 255 squarings and 12 multiplications. The
+ * sequence of operations does not depend on input.
+ */
+static void vli_mod_inv_fast(uint64_t *result, const uint64_t *input)
+{
+	uint64_t x2[NUM_ECC_DIGITS], x4[NUM_ECC_DIGITS];
+	uint64_t x8[NUM_ECC_DIGITS], x16[NUM_ECC_DIGITS];
+	uint64_t x30[NUM_ECC_DIGITS], x32[NUM_ECC_DIGITS];
+	uint64_t t[NUM_ECC_DIGITS];
+
+	vli_mod_square_fast(t, input);
+	vli_mod_mult_fast(x2, t, input);
+
+	vli_mod_square_n(t, x2, 2);
+	vli_mod_mult_fast(x4, t, x2);
+
+	vli_mod_square_n(t, x4, 4);
+	vli_mod_mult_fast(x8, t, x4);
+
+	vli_mod_square_n(t, x8, 8);
+	vli_mod_mult_fast(x16, t, x8);
+
+	vli_mod_square_n(t, x16, 16);
+	vli_mod_mult_fast(x32, t, x16);
+
+	vli_mod_square_n(t, x16, 8);
+	vli_mod_mult_fast(t, t, x8);		/* x24 */
+	vli_mod_square_n(t, t, 4);
+	vli_mod_mult_fast(t, t, x4);		/* x28 */
+	vli_mod_square_n(t, t, 2);
+	vli_mod_mult_fast(x30, t, x2);
+
+	vli_mod_square_n(t, x32, 32);
+	vli_mod_mult_fast(t, t, input);
+	vli_mod_square_n(t, t, 96);
+	vli_mod_square_n(t, t, 32);
+	vli_mod_mult_fast(t, t, x32);
+	vli_mod_square_n(t, t, 32);
+	vli_mod_mult_fast(t, t, x32);
+	vli_mod_square_n(t, t, 30);
+	vli_mod_mult_fast(t, t, x30);
+	vli_mod_square_n(t, t, 2);
+	vli_mod_mult_fast(result, t, input);
 }
 
 /* ------ Point operations ------ */
@@ -757,7 +791,7 @@ static void ecc_point_mult(struct ecc_point *result,
 	vli_mod_sub(z, rx[1], rx[0], curve_p); /* X1 - X0 */
 	vli_mod_mult_fast(z, z, ry[1 - nb]); /* Yb * (X1 - X0) */
 	vli_mod_mult_fast(z, z, point->x);   /* xP * Yb * (X1 - X0) */
-	vli_mod_inv(z, z, curve_p);          /* 1 / (xP * Yb * (X1 - X0)) */
+	vli_mod_inv_fast(z, z);              /* 1 / (xP * Yb * (X1 - X0)) */
 	vli_mod_mult_fast(z, z, point->y);   /* yP / (xP * Yb * (X1 - X0)) */
 	vli_mod_mult_fast(z, z, rx[1 - nb]); /* Xb * yP / (xP * Yb * (X1 - X0)) */
 	/* End 1/Z calculation */
@@ -770,6 +804,261 @@ static void ecc_point_mult(struct ecc_point *result,
 	vli_set(result->y, ry[0]);
 }
 
+/* Replaces scalar by scalar + n or scalar + 2n, whichever has bit 256
+ * set, so that ecc_point_mult runs the same number of steps for every
+ * key. Bit 256 itself is implied by num_bits and not stored.
+ */
+static void regularize_scalar(uint64_t *scalar)
+{
+	uint64_t t[NUM_ECC_DIGITS];
+	uint64_t carry;
+
+	carry = vli_add(scalar, scalar, curve_n);
+	vli_add(t, scalar, curve_n);
+	vli_select(scalar, t, carry - 1);
+}
+
+/* ------ Fixed-base comb for the generator ------ */
+
+/* The scalar is cut into COMB_TEETH rows of COMB_SPACING bits. Column t
+ * selects the sum of 2^(i * COMB_SPACING) * G over the rows i whose bit
+ * t is set, which is precomputed once, so a multiplication of G costs
+ * COMB_SPACING doublings and additions instead of a 256 step ladder.
+ */
+#define COMB_TEETH	6
+#define COMB_SPACING	((ECC_BYTES * 8 + COMB_TEETH - 1) / COMB_TEETH)
+#define COMB_POINTS	((1 << COMB_TEETH) - 1)
+
+struct jacobian_point {
+	uint64_t x[NUM_ECC_DIGITS];
+	uint64_t y[NUM_ECC_DIGITS];
+	uint64_t z[NUM_ECC_DIGITS];
+};
+
+/* comb_table[j - 1] holds the affine point for column value j */
+static struct ecc_point comb_table[COMB_POINTS];
+static bool comb_ready;
+
+/* Jacobian doubling for a = -3, dbl-2001-b */
+static void jacobian_double(struct jacobian_point *p)
+{
+	uint64_t delta[NUM_ECC_DIGITS], gamma[NUM_ECC_DIGITS];
+	uint64_t beta[NUM_ECC_DIGITS], alpha[NUM_ECC_DIGITS];
+	uint64_t t1[NUM_ECC_DIGITS], t2[NUM_ECC_DIGITS];
+
+	vli_mod_square_fast(delta, p->z);
+	vli_mod_square_fast(gamma, p->y);
+	vli_mod_mult_fast(beta, p->x, gamma);
+
+	vli_mod_sub(t1, p->x, delta, curve_p);
+	vli_mod_add(t2, p->x, delta, curve_p);
+	vli_mod_mult_fast(t1, t1, t2);
+	vli_mod_add(alpha, t1, t1, curve_p);
+	vli_mod_add(alpha, alpha, t1, curve_p);	/* 3 * (x - d) * (x + d) */
+
+	vli_mod_add(t1, p->y, p->z, curve_p);
+	vli_mod_square_fast(t1, t1);
+	vli_mod_sub(t1, t1, gamma, curve_p);
+	vli_mod_sub(p->z, t1, delta, curve_p);	/* (y + z)^2 - g - d */
+
+	vli_mod_add(beta, beta, beta, curve_p);
+	vli_mod_add(beta, beta, beta, curve_p);	/* 4 * beta */
+	vli_mod_square_fast(p->x, alpha);
+	vli_mod_sub(p->x, p->x, beta, curve_p);
+	vli_mod_sub(p->x, p->x, beta, curve_p);	/* alpha^2 - 8 * beta */
+
+	vli_mod_sub(t1, beta, p->x, curve_p);
+	vli_mod_mult_fast(t1, alpha, t1);
+	vli_mod_square_fast(gamma, gamma);
+	vli_mod_add(gamma, gamma, gamma, curve_p);
+	vli_mod_add(gamma, gamma, gamma, curve_p);
+	vli_mod_add(gamma, gamma, gamma, curve_p);	/* 8 * gamma^2 */
+	vli_mod_sub(p->y, t1, gamma, curve_p);
+}
+
+/* Mixed Jacobian-affine addition, madd-2007-bl. Returns all ones when
+ * the x coordinates match, in which case the formula does not apply.
+ */
+static uint64_t jacobian_add_affine(struct jacobian_point *r,
+					const struct jacobian_point *p,
+					const struct ecc_point *q)
+{
+	uint64_t z1z1[NUM_ECC_DIGITS], u2[NUM_ECC_DIGITS];
+	uint64_t s2[NUM_ECC_DIGITS], h[NUM_ECC_DIGITS];
+	uint64_t hh[NUM_ECC_DIGITS], i[NUM_ECC_DIGITS];
+	uint64_t j[NUM_ECC_DIGITS], rr[NUM_ECC_DIGITS];
+	uint64_t v[NUM_ECC_DIGITS], t[NUM_ECC_DIGITS];
+	uint64_t exceptional;
+
+	vli_mod_square_fast(z1z1, p->z);
+	vli_mod_mult_fast(u2, q->x, z1z1);
+	vli_mod_mult_fast(s2, q->y, p->z);
+	vli_mod_mult_fast(s2, s2, z1z1);
+	vli_mod_sub(h, u2, p->x, curve_p);
+	exceptional = vli_zero_mask(h);
+
+	vli_mod_square_fast(hh, h);
+	vli_mod_add(i, hh, hh, curve_p);
+	vli_mod_add(i, i, i, curve_p);		/* 4 * HH */
+	vli_mod_mult_fast(j, h, i);
+	vli_mod_sub(rr, s2, p->y, curve_p);
+	vli_mod_add(rr, rr, rr, curve_p);	/* 2 * (S2 - Y1) */
+	vli_mod_mult_fast(v, p->x, i);
+
+	vli_mod_add(t, p->z, h, curve_p);
+	vli_mod_square_fast(t, t);
+	vli_mod_sub(t, t, z1z1, curve_p);
+	vli_mod_sub(r->z, t, hh, curve_p);	/* (Z1 + H)^2 - Z1Z1 - HH */
+
+	vli_mod_mult_fast(t, p->y, j);
+	vli_mod_add(t, t, t, curve_p);		/* 2 * Y1 * J */
+
+	vli_mod_square_fast(r->x, rr);
+	vli_mod_sub(r->x, r->x, j, curve_p);
+	vli_mod_sub(r->x, r->x, v, curve_p);
+	vli_mod_sub(r->x, r->x, v, curve_p);	/* r^2 - J - 2 * V */
+
+	vli_mod_sub(v, v, r->x, curve_p);
+	vli_mod_mult_fast(v, rr, v);
+	vli_mod_sub(r->y, v, t, curve_p);	/* r * (V - X3) - 2 * Y1 * J */
+
+	return exceptional;
+}
+
+static void jacobian_to_affine(struct ecc_point *r,
+					const struct jacobian_point *p)
+{
+	uint64_t zinv[NUM_ECC_DIGITS], t[NUM_ECC_DIGITS];
+
+	vli_mod_inv_fast(zinv, p->z);
+	vli_mod_square_fast(t, zinv);
+	vli_mod_mult_fast(r->x, p->x, t);
+	vli_mod_mult_fast(t, t, zinv);
+	vli_mod_mult_fast(r->y, p->y, t);
+}
+
+static void jacobian_from_affine(struct jacobian_point *r,
+						const struct ecc_point *p)
+{
+	vli_set(r->x, p->x);
+	vli_set(r->y, p->y);
+	vli_clear(r->z);
+	r->z[0] = 1;
+}
+
+/* The table only depends on public values, so it is built with plain
+ * branches. None of the sums can hit the exceptional cases since they
+ * are distinct multiples of G well below the group order.
+ */
+static void comb_init(void)
+{
+	struct jacobian_point p;
+	int i, j;
+
+	if (comb_ready)
+		return;
+
+	comb_table[0] = curve_g;
+
+	for (i = 1; i < COMB_TEETH; i++) {
+		jacobian_from_affine(&p, &comb_table[(1 << (i - 1)) - 1]);
+
+		for (j = 0; j < COMB_SPACING; j++)
+			jacobian_double(&p);
+
+		jacobian_to_affine(&comb_table[(1 << i) - 1], &p);
+	}
+
+	for (j = 3; j <= COMB_POINTS; j++) {
+		int top = j & -j;
+
+		if (top == j)
+			continue;
+
+		/* j = (j - low) + low with low the lowest set bit */
+		jacobian_from_affine(&p, &comb_table[j - top - 1]);
+		jacobian_add_affine(&p, &p, &comb_table[top - 1]);
+		jacobian_to_affine(&comb_table[j - 1], &p);
+	}
+
+	comb_ready = true;
+}
+
+/* Constant time table lookup, every entry is read */
+static void comb_lookup(struct ecc_point *r, unsigned int column)
+{
+	unsigned int j;
+
+	vli_clear(r->x);
+	vli_clear(r->y);
+
+	for (j = 1; j <= COMB_POINTS; j++) {
+		uint64_t diff = column ^ j;
+		uint64_t mask = ((diff | -diff) >> 63) - 1;
+
+		vli_select(r->x, comb_table[j - 1].x, mask);
+		vli_select(r->y, comb_table[j - 1].y, mask);
+	}
+}
+
+/* Computes result = scalar * G. Returns false in the exceptional case of
+ * adding a point to itself or its inverse, which for a uniformly random
+ * scalar happens with negligible probability, and for a zero scalar.
+ */
+static bool ecc_point_mult_base(struct ecc_point *result,
+						const uint64_t *scalar)
+{
+	struct jacobian_point q, r;
+	struct ecc_point a;
+	uint64_t infinity = ~0ull, fail = 0;
+	int t, i;
+
+	comb_init();
+
+	memset(&q, 0, sizeof(q));
+
+	for (t = COMB_SPACING - 1; t >= 0; t--) {
+		unsigned int column = 0;
+		uint64_t zero, exceptional;
+
+		jacobian_double(&q);
+
+		for (i = 0; i < COMB_TEETH; i++) {
+			unsigned int bit = t + i * COMB_SPACING;
+
+			if (bit < ECC_BYTES * 8)
+				column |= (scalar[bit / 64] >>
+							(bit % 64) & 1) << i;
+		}
+
+		comb_lookup(&a, column);
+
+		/* A zero column adds nothing */
+		zero = vli_zero_mask(a.x);
+
+		exceptional = jacobian_add_affine(&r, &q, &a);
+		fail |= exceptional & ~infinity & ~zero;
+
+		/* Adding to the point at infinity yields the table entry */
+		vli_select(r.x, a.x, infinity);
+		vli_select(r.y, a.y, infinity);
+		vli_select(r.z, curve_one, infinity);
+
+		vli_select(q.x, r.x, ~zero);
+		vli_select(q.y, r.y, ~zero);
+		vli_select(q.z, r.z, ~zero);
+
+		infinity &= zero;
+	}
+
+	if (infinity | fail)
+		return false;
+
+	jacobian_to_affine(result, &q);
+
+	return true;
+}
+
 /* Little endian byte-array to native conversion */
 static void ecc_bytes2native(const uint8_t bytes[ECC_BYTES],
 						uint64_t native[NUM_ECC_DIGITS])
@@ -811,6 +1100,94 @@ static void ecc_native2bytes(const uint64_t native[NUM_ECC_DIGITS],
 	}
 }
 
+/* Computes result = scalar * point for the scalars 0, 1, 2, n - 2 and
+ * n - 1, returns false for all others. After regularization the co-Z
+ * ladder runs into the point at infinity or doubles through its addition
+ * formula for 0, 1, n - 2 and n - 1, so these go through here instead.
+ * The branch only leaks that the key is one of these trivial values.
+ */
+static bool ecc_point_mult_small(struct ecc_point *result,
+					const struct ecc_point *point,
+					const uint64_t *scalar)
+{
+	uint64_t t[NUM_ECC_DIGITS];
+	const uint64_t *small;
+	struct jacobian_point p;
+	bool negate;
+
+	vli_sub(t, curve_n, scalar);
+	negate = vli_cmp(scalar, t) > 0;
+	small = negate ? t : scalar;
+
+	if (small[1] || small[2] || small[3] || small[0] > 2)
+		return false;
+
+	switch (small[0]) {
+	case 0:
+		vli_clear(result->x);
+		vli_clear(result->y);
+		return true;
+	case 1:
+		*result = *point;
+		break;
+	case 2:
+		jacobian_from_affine(&p, point);
+		jacobian_double(&p);
+		jacobian_to_affine(result, &p);
+		break;
+	}
+
+	if (negate)
+		vli_sub(result->y, curve_p, result->y);
+
+	return true;
+}
+
+static void ecc_point_mult_ladder(struct ecc_point *result,
+					const struct ecc_point *point,
+					const uint64_t *scalar,
+					uint64_t *initial_z)
+{
+	uint64_t k[NUM_ECC_DIGITS];
+
+	if (ecc_point_mult_small(result, point, scalar))
+		return;
+
+	vli_set(k, scalar);
+	regularize_scalar(k);
+	ecc_point_mult(result, point, k, initial_z, ECC_BYTES * 8 + 1);
+}
+
+static void ecc_point_mult_g(struct ecc_point *pk, uint64_t *priv)
+{
+	if (ecc_point_mult_base(pk, priv))
+		return;
+
+	ecc_point_mult_ladder(pk, &curve_g, priv, NULL);
+}
+
+bool ecc_make_public_key(const uint8_t private_key[32],
+						uint8_t public_key[64])
+{
+	struct ecc_point pk;
+	uint64_t priv[NUM_ECC_DIGITS];
+
+	ecc_bytes2native(private_key, priv);
+
+	/* The private key must be in the range [1, n-1]. */
+	if (vli_is_zero(priv) || vli_cmp(curve_n, priv) != 1)
+		return false;
+
+	ecc_point_mult_g(&pk, priv);
+	if (ecc_point_is_zero(&pk))
+		return false;
+
+	ecc_native2bytes(pk.x, public_key);
+	ecc_native2bytes(pk.y, &public_key[32]);
+
+	return true;
+}
+
 bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
 {
 	struct ecc_point pk;
@@ -828,7 +1205,7 @@ bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
 		if (vli_cmp(curve_n, priv) != 1)
 			continue;
 
-		ecc_point_mult(&pk, &curve_g, priv, NULL, vli_num_bits(priv));
+		ecc_point_mult_g(&pk, priv);
 	} while (ecc_point_is_zero(&pk));
 
 	ecc_native2bytes(priv, private_key);
@@ -853,7 +1230,11 @@ bool ecdh_shared_secret(const uint8_t public_key[64],
 	ecc_bytes2native(&public_key[32], pk.y);
 	ecc_bytes2native(private_key, priv);
 
-	ecc_point_mult(&product, &pk, priv, rand, vli_num_bits(priv));
+	/* The private key must be in the range [1, n-1]. */
+	if (vli_is_zero(priv) || vli_cmp(curve_n, priv) != 1)
+		return false;
+
+	ecc_point_mult_ladder(&product, &pk, priv, rand);
 
 	ecc_native2bytes(product.x, secret);
 
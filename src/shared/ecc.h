@@ -37,6 +37,19 @@
  */
 bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32]);
 
+/* Compute the public key belonging to a private key.
+ * Inputs:
+ *	private_key - The private key, in the range [1, n-1].
+ *
+ * Outputs:
+ *	public_key  - Will be filled in with the public key.
+ *
+ * Returns true if the public key was computed successfully, false if
+ * the private key is out of range. The keys are with the LSB first.
+ */
+bool ecc_make_public_key(const uint8_t private_key[32],
+						uint8_t public_key[64]);
+
 /* Compute a shared secret given your secret key and someone else's
  * public key.
  * Note: It is recommended that you hash the result of ecdh_shared_secret
@@ -0,0 +1,575 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+
+/*
+ * Binary cache of a client-role GATT database. All values are little
+ * endian and the file is read in place after mapping it.
+ *
+ * Header:
+ *	4 octets: magic "GATC"
+ *	1 octet: version
+ *	1 octet: reserved
+ *	2 octets: number of services
+ *	4 octets: total length, including the header
+ *
+ * Each service is followed by the records of its attributes:
+ *	1 octet: record type
+ *	1 octet: UUID length (0, 2 or 16)
+ *	2 octets: handle
+ *	Primary/secondary service: 2 octets end handle, 2 octets number of
+ *	attribute records that follow, UUID
+ *	Include: 2 octets start and 2 octets end handle of the included
+ *	service
+ *	Characteristic: 2 octets value handle, 1 octet properties, UUID
+ *	Descriptor: UUID
+ */
+
+#define CACHE_MAGIC		0x43544147
+#define CACHE_VERSION		1
+#define CACHE_HDR_LEN		12
+
+#define CACHE_PRIMARY		0x01
+#define CACHE_SECONDARY		0x02
+#define CACHE_INCLUDE		0x03
+#define CACHE_CHRC		0x04
+#define CACHE_DESC		0x05
+
+struct encode_data {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+	bool failed;
+	uint16_t num_svcs;
+	size_t num_attrs_off;		/* Where the current count goes */
+	uint16_t num_attrs;
+	uint16_t value_handle;		/* Value of the last characteristic */
+	const bt_uuid_t *chrc_type;
+	const bt_uuid_t *incl_type;
+};
+
+static uint8_t *encode_reserve(struct encode_data *data, size_t len)
+{
+	uint8_t *ptr;
+
+	if (data->failed)
+		return NULL;
+
+	if (data->len + len > data->size) {
+		size_t size = data->size ? data->size * 2 : 512;
+
+		while (size < data->len + len)
+			size *= 2;
+
+		ptr = realloc(data->buf, size);
+		if (!ptr) {
+			data->failed = true;
+			return NULL;
+		}
+
+		data->buf = ptr;
+		data->size = size;
+	}
+
+	ptr = data->buf + data->len;
+	data->len += len;
+
+	return ptr;
+}
+
+static uint8_t uuid_len(const bt_uuid_t *uuid)
+{
+	return uuid->type == BT_UUID16 ? 2 : 16;
+}
+
+static void put_uuid(const bt_uuid_t *uuid, uint8_t *dst)
+{
+	bt_uuid_t uuid128;
+
+	if (uuid->type == BT_UUID16) {
+		put_le16(uuid->value.u16, dst);
+		return;
+	}
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+	bswap_128(&uuid128.value.u128, dst);
+}
+
+static bool get_uuid(const uint8_t *src, uint8_t len, bt_uuid_t *uuid)
+{
+	uint128_t u128;
+
+	if (len == 2) {
+		bt_uuid16_create(uuid, get_le16(src));
+		return true;
+	}
+
+	if (len != 16)
+		return false;
+
+	bswap_128(src, &u128);
+	bt_uuid128_create(uuid, u128);
+
+	return true;
+}
+
+static uint8_t *encode_record(struct encode_data *data, uint8_t type,
+						uint16_t handle,
+						const bt_uuid_t *uuid,
+						size_t len)
+{
+	uint8_t ulen = uuid ? uuid_len(uuid) : 0;
+	uint8_t *ptr;
+
+	ptr = encode_reserve(data, 4 + len + ulen);
+	if (!ptr)
+		return NULL;
+
+	ptr[0] = type;
+	ptr[1] = ulen;
+	put_le16(handle, ptr + 2);
+
+	if (uuid)
+		put_uuid(uuid, ptr + 4 + len);
+
+	return ptr + 4;
+}
+
+static void encode_attr(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct encode_data *data = user_data;
+	const bt_uuid_t *type = gatt_db_attribute_get_type(attr);
+	uint16_t handle = gatt_db_attribute_get_handle(attr);
+	uint16_t value_handle, start, end;
+	uint8_t props;
+	bt_uuid_t uuid;
+	uint8_t *ptr;
+
+	/* The declaration is part of the service record */
+	if (gatt_db_attribute_get_service_data(attr, &start, NULL, NULL,
+							NULL) && start == handle)
+		return;
+
+	/* Characteristic values are implied by their declaration */
+	if (handle == data->value_handle)
+		return;
+
+	if (!bt_uuid_cmp(type, data->incl_type)) {
+		if (!gatt_db_attribute_get_incl_data(attr, NULL, &start,
+									&end))
+			goto fail;
+
+		ptr = encode_record(data, CACHE_INCLUDE, handle, NULL, 4);
+		if (!ptr)
+			return;
+
+		put_le16(start, ptr);
+		put_le16(end, ptr + 2);
+	} else if (!bt_uuid_cmp(type, data->chrc_type)) {
+		if (!gatt_db_attribute_get_char_data(attr, NULL, &value_handle,
+								&props, &uuid))
+			goto fail;
+
+		ptr = encode_record(data, CACHE_CHRC, handle, &uuid, 3);
+		if (!ptr)
+			return;
+
+		put_le16(value_handle, ptr);
+		ptr[2] = props;
+
+		data->value_handle = value_handle;
+	} else if (!encode_record(data, CACHE_DESC, handle, type, 0))
+		return;
+
+	data->num_attrs++;
+	return;
+
+fail:
+	data->failed = true;
+}
+
+static void encode_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct encode_data *data = user_data;
+	uint16_t start, end;
+	bool primary;
+	bt_uuid_t uuid;
+	uint8_t *ptr;
+
+	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
+								&uuid)) {
+		data->failed = true;
+		return;
+	}
+
+	ptr = encode_record(data, primary ? CACHE_PRIMARY : CACHE_SECONDARY,
+							start, &uuid, 4);
+	if (!ptr)
+		return;
+
+	put_le16(end, ptr);
+
+	data->num_attrs_off = ptr + 2 - data->buf;
+	data->num_attrs = 0;
+	data->value_handle = 0;
+
+	gatt_db_service_foreach(attr, NULL, encode_attr, data);
+
+	if (data->failed)
+		return;
+
+	put_le16(data->num_attrs, data->buf + data->num_attrs_off);
+	data->num_svcs++;
+}
+
+/*
+ * Encodes db into a newly allocated buffer returned in data. Returns the
+ * length of the encoded data or a negative error.
+ */
+ssize_t gatt_cache_encode(struct gatt_db *db, uint8_t **data)
+{
+	struct encode_data encode;
+	bt_uuid_t chrc_type, incl_type;
+
+	if (!db || !data)
+		return -EINVAL;
+
+	memset(&encode, 0, sizeof(encode));
+
+	bt_uuid16_create(&chrc_type, GATT_CHARAC_UUID);
+	bt_uuid16_create(&incl_type, GATT_INCLUDE_UUID);
+	encode.chrc_type = &chrc_type;
+	encode.incl_type = &incl_type;
+
+	encode_reserve(&encode, CACHE_HDR_LEN);
+
+	gatt_db_foreach_service(db, NULL, encode_service, &encode);
+
+	if (encode.failed) {
+		free(encode.buf);
+		return -ENOMEM;
+	}
+
+	put_le32(CACHE_MAGIC, encode.buf);
+	encode.buf[4] = CACHE_VERSION;
+	encode.buf[5] = 0;
+	put_le16(encode.num_svcs, encode.buf + 6);
+	put_le32(encode.len, encode.buf + 8);
+
+	*data = encode.buf;
+
+	return encode.len;
+}
+
+struct record {
+	uint8_t type;
+	uint16_t handle;
+	const uint8_t *params;
+	bt_uuid_t uuid;
+};
+
+static const uint8_t *decode_record(const uint8_t *ptr, const uint8_t *end,
+							struct record *rec)
+{
+	size_t len;
+
+	if (end - ptr < 4)
+		return NULL;
+
+	rec->type = ptr[0];
+	rec->handle = get_le16(ptr + 2);
+	rec->params = ptr + 4;
+
+	switch (rec->type) {
+	case CACHE_PRIMARY:
+	case CACHE_SECONDARY:
+	case CACHE_INCLUDE:
+		len = 4;
+		break;
+	case CACHE_CHRC:
+		len = 3;
+		break;
+	case CACHE_DESC:
+		len = 0;
+		break;
+	default:
+		return NULL;
+	}
+
+	if ((size_t) (end - rec->params) < len + ptr[1])
+		return NULL;
+
+	if (rec->type == CACHE_INCLUDE) {
+		if (ptr[1])
+			return NULL;
+	} else if (!get_uuid(rec->params + len, ptr[1], &rec->uuid))
+		return NULL;
+
+	return rec->params + len + ptr[1];
+}
+
+static bool decode_attr(struct gatt_db *db, struct gatt_db_attribute *svc,
+						const struct record *rec)
+{
+	struct gatt_db_attribute *attr;
+
+	switch (rec->type) {
+	case CACHE_INCLUDE:
+		attr = gatt_db_get_attribute(db, get_le16(rec->params));
+		if (!attr)
+			return false;
+
+		attr = gatt_db_service_add_included(svc, attr);
+		break;
+	case CACHE_CHRC:
+		attr = gatt_db_service_insert_characteristic(svc,
+						get_le16(rec->params),
+						&rec->uuid, 0, rec->params[2],
+						NULL, NULL, NULL);
+		if (attr && gatt_db_attribute_get_handle(attr) - 1 !=
+								rec->handle)
+			return false;
+
+		return attr != NULL;
+	case CACHE_DESC:
+		attr = gatt_db_service_insert_descriptor(svc, rec->handle,
+							&rec->uuid, 0, NULL,
+							NULL, NULL);
+		break;
+	default:
+		return false;
+	}
+
+	return attr && gatt_db_attribute_get_handle(attr) == rec->handle;
+}
+
+static void activate_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	gatt_db_service_set_active(attr, true);
+}
+
+/*
+ * Checks the layout of every record before anything is inserted: services
+ * must be sorted and must not overlap and the attributes of a service must
+ * be sorted and lie within its range.
+ */
+static bool validate(const uint8_t *data, size_t len)
+{
+	const uint8_t *ptr = data + CACHE_HDR_LEN, *end = data + len;
+	uint16_t num_svcs, i, j, num_attrs, svc_end, last;
+	unsigned int next = 1;
+	struct record rec;
+
+	num_svcs = get_le16(data + 6);
+
+	for (i = 0; i < num_svcs; i++) {
+		ptr = decode_record(ptr, end, &rec);
+		if (!ptr || (rec.type != CACHE_PRIMARY &&
+					rec.type != CACHE_SECONDARY))
+			return false;
+
+		svc_end = get_le16(rec.params);
+		num_attrs = get_le16(rec.params + 2);
+
+		if (rec.handle < next || svc_end < rec.handle)
+			return false;
+
+		last = rec.handle;
+		next = svc_end + 1;
+
+		for (j = 0; j < num_attrs; j++) {
+			ptr = decode_record(ptr, end, &rec);
+			if (!ptr || rec.type == CACHE_PRIMARY ||
+					rec.type == CACHE_SECONDARY)
+				return false;
+
+			if (rec.handle <= last || rec.handle > svc_end)
+				return false;
+
+			last = rec.handle;
+
+			/* The value follows the declaration */
+			if (rec.type == CACHE_CHRC) {
+				if (rec.handle == svc_end ||
+					get_le16(rec.params) != rec.handle + 1)
+					return false;
+
+				last++;
+			}
+		}
+	}
+
+	return ptr == end;
+}
+
+/*
+ * Populates an empty db from encoded data. The whole buffer is validated
+ * first, services are then inserted before their attributes so that
+ * includes can refer to services at higher handles. If the db still
+ * rejects an attribute it is cleared again.
+ */
+bool gatt_cache_decode(struct gatt_db *db, const uint8_t *data, size_t len)
+{
+	const uint8_t *ptr;
+	uint16_t num_svcs, i, j, num_attrs;
+	struct record rec;
+	int pass;
+
+	if (!db || !data || !gatt_db_isempty(db))
+		return false;
+
+	if (len < CACHE_HDR_LEN || get_le32(data) != CACHE_MAGIC ||
+					data[4] != CACHE_VERSION ||
+					get_le32(data + 8) != len)
+		return false;
+
+	if (!validate(data, len))
+		return false;
+
+	num_svcs = get_le16(data + 6);
+
+	for (pass = 0; pass < 2; pass++) {
+		ptr = data + CACHE_HDR_LEN;
+
+		for (i = 0; i < num_svcs; i++) {
+			struct gatt_db_attribute *svc;
+			uint16_t svc_end;
+
+			ptr = decode_record(ptr, data + len, &rec);
+
+			svc_end = get_le16(rec.params);
+			num_attrs = get_le16(rec.params + 2);
+
+			if (!pass) {
+				svc = gatt_db_insert_service(db, rec.handle,
+						&rec.uuid,
+						rec.type == CACHE_PRIMARY,
+						svc_end - rec.handle + 1);
+				if (!svc)
+					goto fail;
+			} else
+				svc = gatt_db_get_attribute(db, rec.handle);
+
+			for (j = 0; j < num_attrs; j++) {
+				ptr = decode_record(ptr, data + len, &rec);
+
+				if (pass && !decode_attr(db, svc, &rec))
+					goto fail;
+			}
+		}
+	}
+
+	gatt_db_foreach_service(db, NULL, activate_service, NULL);
+
+	return true;
+
+fail:
+	gatt_db_clear(db);
+	return false;
+}
+
+bool gatt_cache_store(struct gatt_db *db, const char *filename)
+{
+	char tmpname[PATH_MAX];
+	uint8_t *data;
+	ssize_t len, written;
+	int fd;
+
+	len = gatt_cache_encode(db, &data);
+	if (len < 0)
+		return false;
+
+	/* Write a new file and move it in place so readers never see a
+	 * partially written cache.
+	 */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		free(data);
+		return false;
+	}
+
+	written = write(fd, data, len);
+	close(fd);
+	free(data);
+
+	if (written != len || rename(tmpname, filename) < 0) {
+		unlink(tmpname);
+		return false;
+	}
+
+	return true;
+}
+
+bool gatt_cache_load(struct gatt_db *db, const char *filename)
+{
+	struct stat st;
+	void *data;
+	bool ret;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || st.st_size < CACHE_HDR_LEN) {
+		close(fd);
+		return false;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	ret = gatt_cache_decode(db, data, st.st_size);
+
+	munmap(data, st.st_size);
+
+	return ret;
+}
@@ -32,6 +32,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <time.h>
 #include <sys/uio.h>
 
 #ifndef MAX
@@ -47,6 +48,8 @@
 #define GATT_SVC_UUID	0x1801
 #define SVC_CHNGD_UUID	0x2a05
 
+#define READ_BATCH_MAX	32
+
 struct bt_gatt_client {
 	struct bt_att *att;
 	int ref_count;
@@ -103,15 +106,58 @@ struct bt_gatt_client {
 	struct queue *pending_requests;
 	unsigned int next_request_id;
 
+	/*
+	 * Reads of single values are scheduled by the client: reads waiting
+	 * for the bearer are kept in read_queue, the ones on the wire in
+	 * read_batches.
+	 */
+	struct queue *read_queue;
+	struct queue *read_batches;
+	bool read_multiple_unsupported;
+
+	/*
+	 * Handles whose value was read on its own and turned out to have the
+	 * size fixed by its specification. Only these are packed into Read
+	 * Multiple requests.
+	 */
+	struct queue *sized_values;
+
 	struct bt_gatt_request *discovery_req;
 	unsigned int mtu_req_id;
+
+	/* Discovery statistics, the start values are reset once ready */
+	uint64_t disc_start;
+	uint64_t disc_start_pdus;
+	struct bt_gatt_client_discovery_stats disc_stats;
 };
 
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t get_tx_pdus(struct bt_gatt_client *client)
+{
+	struct bt_att_stats stats;
+
+	if (!bt_att_get_stats(client->att, &stats))
+		return 0;
+
+	return stats.tx_pdus;
+}
+
+struct pending_read;
+
 struct request {
 	struct bt_gatt_client *client;
 	bool long_write;
 	bool prep_write;
 	bool removed;
+	struct pending_read *read;
 	int ref_count;
 	unsigned int id;
 	unsigned int att_id;
@@ -126,7 +172,12 @@ static struct request *request_ref(struct request *req)
 	return req;
 }
 
-static struct request *request_create(struct bt_gatt_client *client)
+static void read_sched_flush(struct bt_gatt_client *client);
+static void read_batch_cancel(void *data);
+static void read_batch_free(void *data);
+static void pending_read_free(void *data);
+
+static struct request *request_new(struct bt_gatt_client *client)
 {
 	struct request *req;
 
@@ -137,13 +188,24 @@ static struct request *request_create(struct bt_gatt_client *client)
 	if (client->next_request_id < 1)
 		client->next_request_id = 1;
 
-	queue_push_tail(client->pending_requests, req);
 	req->client = client;
 	req->id = client->next_request_id++;
+	queue_push_tail(client->pending_requests, req);
 
 	return request_ref(req);
 }
 
+static struct request *request_create(struct bt_gatt_client *client)
+{
+	/*
+	 * Scheduled reads must not be overtaken by requests made after them,
+	 * so get them on the wire first.
+	 */
+	read_sched_flush(client);
+
+	return request_new(client);
+}
+
 static void request_unref(void *data)
 {
 	struct request *req = data;
@@ -278,14 +340,6 @@ static void notify_chrc_free(void *data)
 	free(chrc);
 }
 
-static bool match_notify_data_id(const void *a, const void *b)
-{
-	const struct notify_data *notify_data = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify_data->id == id;
-}
-
 struct handle_range {
 	uint16_t start;
 	uint16_t end;
@@ -336,6 +390,27 @@ static void gatt_client_remove_notify_chrcs_in_range(
 						&range, notify_chrc_free);
 }
 
+static bool match_sized_value_handle_range(const void *a, const void *b)
+{
+	unsigned int handle = PTR_TO_UINT(a);
+	const struct handle_range *range = b;
+
+	return handle >= range->start && handle <= range->end;
+}
+
+static void gatt_client_remove_sized_values_in_range(
+				struct bt_gatt_client *client,
+				uint16_t start_handle, uint16_t end_handle)
+{
+	struct handle_range range;
+
+	range.start = start_handle;
+	range.end = end_handle;
+
+	queue_remove_all(client->sized_values, match_sized_value_handle_range,
+								&range, NULL);
+}
+
 struct discovery_op;
 
 typedef void (*discovery_op_complete_func_t)(struct discovery_op *op,
@@ -343,12 +418,30 @@ typedef void (*discovery_op_complete_func_t)(struct discovery_op *op,
 							uint8_t att_ecode);
 typedef void (*discovery_op_fail_func_t)(struct discovery_op *op);
 
+struct discovery_svc {
+	uint16_t start;
+	uint16_t end;
+	struct gatt_db_attribute *attr;
+};
+
+struct desc_range {
+	uint16_t start;
+	uint16_t end;
+	struct gatt_db_attribute *svc;
+};
+
 struct discovery_op {
 	struct bt_gatt_client *client;
 	struct queue *pending_svcs;
 	struct queue *pending_chrcs;
-	struct queue *tmp_queue;
-	struct gatt_db_attribute *cur_svc;
+	struct discovery_svc *svcs;	/* Sorted by start handle */
+	unsigned int num_svcs;
+	uint16_t svc_start;
+	uint16_t svc_end;
+	struct desc_range *descs;
+	unsigned int num_descs;
+	unsigned int desc_first;	/* First range of the request in flight */
+	unsigned int desc_next;		/* First range not requested yet */
 	bool success;
 	uint16_t start;
 	uint16_t end;
@@ -361,7 +454,8 @@ static void discovery_op_free(struct discovery_op *op)
 {
 	queue_destroy(op->pending_svcs, NULL);
 	queue_destroy(op->pending_chrcs, free);
-	queue_destroy(op->tmp_queue, NULL);
+	free(op->svcs);
+	free(op->descs);
 	free(op);
 }
 
@@ -384,10 +478,6 @@ static struct discovery_op *discovery_op_create(struct bt_gatt_client *client,
 	if (!op->pending_chrcs)
 		goto fail;
 
-	op->tmp_queue = queue_new();
-	if (!op->tmp_queue)
-		goto fail;
-
 	op->client = client;
 	op->complete_func = complete_func;
 	op->failure_func = failure_func;
@@ -421,6 +511,79 @@ static void discovery_op_unref(void *data)
 	discovery_op_free(op);
 }
 
+static int discovery_svc_cmp(const void *a, const void *b)
+{
+	const struct discovery_svc *svc_a = a;
+	const struct discovery_svc *svc_b = b;
+
+	return svc_a->start - svc_b->start;
+}
+
+/*
+ * Move the discovered services into an array sorted by handle so that the
+ * results of the range wide requests below can be matched to their service.
+ */
+static bool discovery_op_sort_svcs(struct discovery_op *op)
+{
+	struct gatt_db_attribute *attr;
+	struct discovery_svc *svc;
+	unsigned int i;
+
+	op->svcs = new0(struct discovery_svc, queue_length(op->pending_svcs));
+	if (!op->svcs)
+		return false;
+
+	for (i = 0; (attr = queue_pop_head(op->pending_svcs)); i++) {
+		svc = &op->svcs[i];
+		svc->attr = attr;
+
+		if (!gatt_db_attribute_get_service_handles(attr, &svc->start,
+								&svc->end))
+			return false;
+	}
+
+	op->num_svcs = i;
+
+	qsort(op->svcs, op->num_svcs, sizeof(*op->svcs), discovery_svc_cmp);
+
+	op->svc_start = op->svcs[0].start;
+	op->svc_end = op->svcs[0].end;
+
+	for (i = 1; i < op->num_svcs; i++)
+		op->svc_end = MAX(op->svc_end, op->svcs[i].end);
+
+	return true;
+}
+
+static struct gatt_db_attribute *discovery_op_find_svc(struct discovery_op *op,
+							uint16_t handle,
+							uint16_t *end)
+{
+	unsigned int lo = 0, hi = op->num_svcs;
+	struct discovery_svc *svc;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (op->svcs[mid].start <= handle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!lo)
+		return NULL;
+
+	svc = &op->svcs[lo - 1];
+	if (handle > svc->end)
+		return NULL;
+
+	if (end)
+		*end = svc->end;
+
+	return svc->attr;
+}
+
 static void discovery_req_clear(struct bt_gatt_client *client)
 {
 	if (!client->discovery_req)
@@ -430,10 +593,41 @@ static void discovery_req_clear(struct bt_gatt_client *client)
 	client->discovery_req = NULL;
 }
 
+static void discovery_req_cancel(struct bt_gatt_client *client)
+{
+	bt_gatt_request_cancel(client->discovery_req);
+	discovery_req_clear(client);
+}
+
 static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
 						void *user_data);
 
+static bool discover_chrcs(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+
+	/*
+	 * Characteristic declarations are requested across all services at
+	 * once instead of service by service, so every response is filled up
+	 * to the MTU and there is a single terminating round trip.
+	 */
+	client->discovery_req = bt_gatt_discover_characteristics(client->att,
+							op->svc_start,
+							op->svc_end,
+							discover_chrcs_cb,
+							discovery_op_ref(op),
+							discovery_op_unref);
+	if (client->discovery_req)
+		return true;
+
+	util_debug(client->debug_callback, client->debug_data,
+				"Failed to start characteristic discovery");
+	discovery_op_unref(op);
+
+	return false;
+}
+
 static void discover_incl_cb(bool success, uint8_t att_ecode,
 				struct bt_gatt_result *result, void *user_data)
 {
@@ -456,11 +650,6 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 		goto failed;
 	}
 
-	/* Get the currently processed service */
-	attr = op->cur_svc;
-	if (!attr)
-		goto failed;
-
 	if (!result || !bt_gatt_iter_init(&iter, result))
 		goto failed;
 
@@ -485,6 +674,10 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 				"handle: 0x%04x, start: 0x%04x, end: 0x%04x,"
 				"uuid: %s", handle, start, end, uuid_str);
 
+		attr = discovery_op_find_svc(op, handle, NULL);
+		if (!attr)
+			goto failed;
+
 		tmp = gatt_db_get_attribute(client->db, start);
 		if (!tmp)
 			goto failed;
@@ -504,53 +697,26 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 	}
 
 next:
-	/* Move on to the next service */
-	attr = queue_pop_head(op->pending_svcs);
-	if (!attr) {
-		struct queue *tmp_queue;
-
-		tmp_queue = op->pending_svcs;
-		op->pending_svcs = op->tmp_queue;
-		op->tmp_queue = tmp_queue;
-
-		/*
-		 * We have processed all include definitions. Move on to
-		 * characteristics.
-		 */
-		attr = queue_pop_head(op->pending_svcs);
-		if (!attr)
-			goto failed;
-
-		if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
-			goto failed;
-
-		op->cur_svc = attr;
+	/* We have processed all include definitions */
+	if (discover_chrcs(op))
+		return;
 
-		client->discovery_req = bt_gatt_discover_characteristics(
-							client->att,
-							start, end,
-							discover_chrcs_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-		if (client->discovery_req)
-			return;
+failed:
+	op->success = false;
+	op->complete_func(op, false, att_ecode);
+}
 
-		util_debug(client->debug_callback, client->debug_data,
-				"Failed to start characteristic discovery");
-		discovery_op_unref(op);
-		goto failed;
-	}
+static void discover_includes(struct discovery_op *op, uint8_t att_ecode)
+{
+	struct bt_gatt_client *client = op->client;
 
-	queue_push_tail(op->tmp_queue, attr);
-	op->cur_svc = attr;
-	if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
+	if (!discovery_op_sort_svcs(op))
 		goto failed;
 
-	if (start == end)
-		goto next;
-
+	/* Include definitions of all services are fetched in one sweep too */
 	client->discovery_req = bt_gatt_discover_included_services(client->att,
-							start, end,
+							op->svc_start,
+							op->svc_end,
 							discover_incl_cb,
 							discovery_op_ref(op),
 							discovery_op_unref);
@@ -558,7 +724,7 @@ next:
 		return;
 
 	util_debug(client->debug_callback, client->debug_data,
-					"Failed to start included discovery");
+				"Failed to start included services discovery");
 	discovery_op_unref(op);
 
 failed:
@@ -572,66 +738,116 @@ struct chrc {
 	uint16_t value_handle;
 	uint8_t properties;
 	bt_uuid_t uuid;
+	struct gatt_db_attribute *svc;
 };
 
-static void discover_descs_cb(bool success, uint8_t att_ecode,
-						struct bt_gatt_result *result,
-						void *user_data);
-
-static bool discover_descs(struct discovery_op *op, bool *discovering)
+/*
+ * The database expects the attributes of a service to be inserted in handle
+ * order, so characteristics are held back until the descriptors preceding
+ * them are known.
+ */
+static bool insert_chrcs(struct discovery_op *op, unsigned int until)
 {
-	struct bt_gatt_client *client = op->client;
-	struct gatt_db_attribute *attr;
 	struct chrc *chrc_data;
-	uint16_t desc_start;
+	struct gatt_db_attribute *attr;
+	uint16_t value;
+
+	while ((chrc_data = queue_peek_head(op->pending_chrcs))) {
+		if (chrc_data->value_handle >= until)
+			break;
 
-	*discovering = false;
+		queue_pop_head(op->pending_chrcs);
 
-	while ((chrc_data = queue_pop_head(op->pending_chrcs))) {
-		attr = gatt_db_service_insert_characteristic(op->cur_svc,
+		attr = gatt_db_service_insert_characteristic(chrc_data->svc,
 							chrc_data->value_handle,
 							&chrc_data->uuid, 0,
 							chrc_data->properties,
 							NULL, NULL, NULL);
+		value = chrc_data->value_handle;
+		free(chrc_data);
 
-		if (!attr)
-			goto failed;
+		if (!attr || gatt_db_attribute_get_handle(attr) != value)
+			return false;
+	}
 
-		if (gatt_db_attribute_get_handle(attr) !=
-							chrc_data->value_handle)
-			goto failed;
+	return true;
+}
 
-		desc_start = chrc_data->value_handle + 1;
+static void discovery_complete(struct discovery_op *op)
+{
+	unsigned int i;
 
-		if (desc_start > chrc_data->end_handle) {
-			free(chrc_data);
-			continue;
-		}
+	if (!insert_chrcs(op, UINT16_MAX + 1)) {
+		op->success = false;
+		op->complete_func(op, false, 0);
+		return;
+	}
+
+	for (i = 0; i < op->num_svcs; i++)
+		gatt_db_service_set_active(op->svcs[i].attr, true);
+
+	op->success = true;
+	op->complete_func(op, true, 0);
+}
+
+static void discover_descs_cb(bool success, uint8_t att_ecode,
+						struct bt_gatt_result *result,
+						void *user_data);
+
+/* Number of Find Information PDUs needed for a range of 16-bit UUIDs */
+static unsigned int find_info_pdus(uint16_t mtu, uint16_t start, uint16_t end)
+{
+	unsigned int per_pdu = (mtu - 2) / 4;
+
+	return (end - start + per_pdu) / per_pdu;
+}
 
-		client->discovery_req = bt_gatt_discover_descriptors(
-							client->att, desc_start,
-							chrc_data->end_handle,
+static bool discover_descs(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+	uint16_t mtu = bt_att_get_mtu(client->att);
+	struct desc_range *range;
+	uint16_t start, end;
+
+	if (op->desc_next == op->num_descs)
+		return true;
+
+	op->desc_first = op->desc_next;
+
+	range = &op->descs[op->desc_next++];
+	start = range->start;
+	end = range->end;
+
+	/*
+	 * Extend the request over the following descriptor ranges for as long
+	 * as that doesn't take more PDUs than requesting them separately. The
+	 * characteristic declarations and values in between are skipped when
+	 * the response is processed.
+	 */
+	while (op->desc_next < op->num_descs) {
+		range = &op->descs[op->desc_next];
+
+		if (find_info_pdus(mtu, start, range->end) >
+				find_info_pdus(mtu, start, end) +
+				find_info_pdus(mtu, range->start, range->end))
+			break;
+
+		end = range->end;
+		op->desc_next++;
+	}
+
+	client->discovery_req = bt_gatt_discover_descriptors(client->att,
+							start, end,
 							discover_descs_cb,
 							discovery_op_ref(op),
 							discovery_op_unref);
-		if (client->discovery_req) {
-			*discovering = true;
-			goto done;
-		}
+	if (client->discovery_req)
+		return true;
 
-		util_debug(client->debug_callback, client->debug_data,
+	util_debug(client->debug_callback, client->debug_data,
 					"Failed to start descriptor discovery");
-		discovery_op_unref(op);
-
-		goto failed;
-	}
-
-done:
-	free(chrc_data);
-	return true;
+	discovery_op_unref(op);
 
-failed:
-	free(chrc_data);
 	return false;
 }
 
@@ -641,37 +857,45 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
 {
 	struct discovery_op *op = user_data;
 	struct bt_gatt_client *client = op->client;
+	unsigned int first = op->desc_first;
+	unsigned int last = op->desc_next;
 	struct bt_gatt_iter iter;
 	struct gatt_db_attribute *attr;
-	uint16_t handle, start, end;
+	uint16_t handle;
 	uint128_t u128;
 	bt_uuid_t uuid;
 	char uuid_str[MAX_LEN_UUID_STR];
-	unsigned int desc_count;
-	bool discovering;
 
 	discovery_req_clear(client);
 
 	if (!success) {
-		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-			success = true;
-			goto next;
-		}
-
-		goto done;
-	}
-
-	if (!result || !bt_gatt_iter_init(&iter, result))
+		if (att_ecode != BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
+			goto failed;
+	} else if (!result || !bt_gatt_iter_init(&iter, result))
 		goto failed;
 
-	desc_count = bt_gatt_result_descriptor_count(result);
-	if (desc_count == 0)
+	/* Keep the bearer busy while this response is being processed */
+	if (!discover_descs(op))
 		goto failed;
 
+	if (!success)
+		goto next;
+
 	util_debug(client->debug_callback, client->debug_data,
-					"Descriptors found: %u", desc_count);
+					"Descriptors found: %u",
+					bt_gatt_result_descriptor_count(result));
 
 	while (bt_gatt_iter_next_descriptor(&iter, &handle, u128.data)) {
+		/* Skip anything that isn't within a descriptor range */
+		while (first < last && handle > op->descs[first].end)
+			first++;
+
+		if (first == last)
+			break;
+
+		if (handle < op->descs[first].start)
+			continue;
+
 		bt_uuid128_create(&uuid, u128);
 
 		/* Log debug message */
@@ -680,57 +904,36 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
 						"handle: 0x%04x, uuid: %s",
 						handle, uuid_str);
 
-		attr = gatt_db_service_insert_descriptor(op->cur_svc, handle,
-							&uuid, 0, NULL, NULL,
-							NULL);
+		if (!insert_chrcs(op, handle))
+			goto cancel;
+
+		attr = gatt_db_service_insert_descriptor(op->descs[first].svc,
+							handle, &uuid, 0, NULL,
+							NULL, NULL);
 		if (!attr)
-			goto failed;
+			goto cancel;
 
 		if (gatt_db_attribute_get_handle(attr) != handle)
-			goto failed;
+			goto cancel;
 	}
 
-next:
-	if (!discover_descs(op, &discovering))
-		goto failed;
-
-	if (discovering)
-		return;
+	/* Everything up to the end of this request is known now */
+	if (!insert_chrcs(op, op->descs[last - 1].end + 1))
+		goto cancel;
 
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
-
-	attr = queue_pop_head(op->pending_svcs);
-	if (!attr)
-		goto done;
-
-	if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
-		goto failed;
-
-	if (start == end)
-		goto next;
-
-	/* Move on to the next service */
-	op->cur_svc = attr;
-
-	client->discovery_req = bt_gatt_discover_characteristics(client->att,
-							start, end,
-							discover_chrcs_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
+next:
 	if (client->discovery_req)
 		return;
 
-	util_debug(client->debug_callback, client->debug_data,
-				"Failed to start characteristic discovery");
-	discovery_op_unref(op);
+	discovery_complete(op);
+	return;
 
-failed:
-	success = false;
+cancel:
+	discovery_req_cancel(client);
 
-done:
-	op->success = success;
-	op->complete_func(op, success, att_ecode);
+failed:
+	op->success = false;
+	op->complete_func(op, false, att_ecode);
 }
 
 static void discover_chrcs_cb(bool success, uint8_t att_ecode,
@@ -740,28 +943,28 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 	struct discovery_op *op = user_data;
 	struct bt_gatt_client *client = op->client;
 	struct bt_gatt_iter iter;
-	struct gatt_db_attribute *attr;
+	struct gatt_db_attribute *svc;
 	struct chrc *chrc_data;
-	uint16_t start, end, value;
+	struct desc_range *range;
+	uint16_t start, end, value, svc_end;
 	uint8_t properties;
 	uint128_t u128;
 	bt_uuid_t uuid;
 	char uuid_str[MAX_LEN_UUID_STR];
 	unsigned int chrc_count;
-	bool discovering;
 
 	discovery_req_clear(client);
 
 	if (!success) {
 		if (att_ecode == BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND) {
-			success = true;
-			goto next;
+			discovery_complete(op);
+			return;
 		}
 
-		goto done;
+		goto failed;
 	}
 
-	if (!op->cur_svc || !result || !bt_gatt_iter_init(&iter, result))
+	if (!result || !bt_gatt_iter_init(&iter, result))
 		goto failed;
 
 	chrc_count = bt_gatt_result_characteristic_count(result);
@@ -771,10 +974,25 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 	if (chrc_count == 0)
 		goto failed;
 
+	op->descs = new0(struct desc_range, chrc_count);
+	if (!op->descs)
+		goto failed;
+
 	while (bt_gatt_iter_next_characteristic(&iter, &start, &end, &value,
 						&properties, u128.data)) {
 		bt_uuid128_create(&uuid, u128);
 
+		svc = discovery_op_find_svc(op, start, &svc_end);
+		if (!svc) {
+			util_debug(client->debug_callback, client->debug_data,
+					"Characteristic 0x%04x outside of any "
+					"service", start);
+			continue;
+		}
+
+		/* The last one of each service ends with the service */
+		end = MIN(end, svc_end);
+
 		/* Log debug message */
 		bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
 		util_debug(client->debug_callback, client->debug_data,
@@ -791,55 +1009,35 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 		chrc_data->value_handle = value;
 		chrc_data->properties = properties;
 		chrc_data->uuid = uuid;
+		chrc_data->svc = svc;
 
 		queue_push_tail(op->pending_chrcs, chrc_data);
+
+		if (value >= end)
+			continue;
+
+		range = &op->descs[op->num_descs++];
+		range->start = value + 1;
+		range->end = end;
+		range->svc = svc;
 	}
 
 	/*
-	 * Sequentially discover descriptors for each characteristic and insert
-	 * the characteristics into the database as we proceed.
+	 * The characteristics are inserted as their descriptors come in, get
+	 * the first descriptor request on the wire right away.
 	 */
-	if (!discover_descs(op, &discovering))
+	if (!discover_descs(op))
 		goto failed;
 
-	if (discovering)
-		return;
-
-next:
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
-
-	attr = queue_pop_head(op->pending_svcs);
-	if (!attr)
-		goto done;
-
-	if (!gatt_db_attribute_get_service_handles(attr, &start, &end))
-		goto failed;
-
-	if (start == end)
-		goto next;
-
-	/* Move on to the next service */
-	op->cur_svc = attr;
-
-	client->discovery_req = bt_gatt_discover_characteristics(client->att,
-							start, end,
-							discover_chrcs_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
 	if (client->discovery_req)
 		return;
 
-	util_debug(client->debug_callback, client->debug_data,
-				"Failed to start characteristic discovery");
-	discovery_op_unref(op);
+	discovery_complete(op);
+	return;
 
 failed:
-	success = false;
-
-done:
-	op->success = success;
-	op->complete_func(op, success, att_ecode);
+	op->success = false;
+	op->complete_func(op, false, att_ecode);
 }
 
 static void discover_secondary_cb(bool success, uint8_t att_ecode,
@@ -896,42 +1094,18 @@ static void discover_secondary_cb(bool success, uint8_t att_ecode,
 						"Failed to create service");
 			success = false;
 			goto done;
-		}
-
-		queue_push_tail(op->pending_svcs, attr);
-	}
-
-next:
-	/* Sequentially discover included services */
-	attr = queue_pop_head(op->pending_svcs);
-
-	/* Complete with success if queue is empty */
-	if (!attr)
-		goto done;
-
-	/*
-	 * Store the service in the tmp queue to be reused during
-	 * characteristics discovery later.
-	 */
-	queue_push_tail(op->tmp_queue, attr);
-	op->cur_svc = attr;
-
-	if (!gatt_db_attribute_get_service_handles(attr, &start, &end)) {
-		success = false;
-		goto done;
-	}
-
-	client->discovery_req = bt_gatt_discover_included_services(client->att,
-							start, end,
-							discover_incl_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-	if (client->discovery_req)
-		return;
+		}
 
-	util_debug(client->debug_callback, client->debug_data,
-				"Failed to start included services discovery");
-	discovery_op_unref(op);
+		queue_push_tail(op->pending_svcs, attr);
+	}
+
+next:
+	/* Complete with success if no service was found */
+	if (queue_isempty(op->pending_svcs))
+		goto done;
+
+	discover_includes(op, att_ecode);
+	return;
 
 done:
 	op->success = success;
@@ -1013,6 +1187,18 @@ done:
 static void notify_client_ready(struct bt_gatt_client *client, bool success,
 							uint8_t att_ecode)
 {
+	struct bt_gatt_client_discovery_stats *stats = &client->disc_stats;
+
+	stats->duration = get_usec() - client->disc_start;
+	stats->requests = get_tx_pdus(client) - client->disc_start_pdus;
+
+	util_debug(client->debug_callback, client->debug_data,
+			"Discovery %s in %llu ms using %llu requests%s",
+			success ? "completed" : "failed",
+			(unsigned long long) stats->duration / 1000,
+			(unsigned long long) stats->requests,
+			stats->cached ? " (cached)" : "");
+
 	if (!client->ready_callback)
 		return;
 
@@ -1046,6 +1232,7 @@ static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 
 	/* Don't do discovery if the database was pre-populated */
 	if (!gatt_db_isempty(client->db)) {
+		client->disc_stats.cached = true;
 		op->complete_func(op, true, 0);
 		return;
 	}
@@ -1182,6 +1369,8 @@ static void process_service_changed(struct bt_gatt_client *client,
 								end_handle);
 	gatt_client_remove_notify_chrcs_in_range(client, start_handle,
 								end_handle);
+	gatt_client_remove_sized_values_in_range(client, start_handle,
+								end_handle);
 
 	/* Remove all services that overlap the modified range since we'll
 	 * rediscover them
@@ -1346,6 +1535,10 @@ static bool gatt_client_init(struct bt_gatt_client *client, uint16_t mtu)
 	if (!op)
 		return false;
 
+	memset(&client->disc_stats, 0, sizeof(client->disc_stats));
+	client->disc_start = get_usec();
+	client->disc_start_pdus = get_tx_pdus(client);
+
 	/* Configure the MTU */
 	client->mtu_req_id = bt_gatt_exchange_mtu(client->att,
 						MAX(BT_ATT_DEFAULT_LE_MTU, mtu),
@@ -1590,6 +1783,9 @@ static void bt_gatt_client_free(struct bt_gatt_client *client)
 	queue_destroy(client->svc_chngd_queue, free);
 	queue_destroy(client->long_write_queue, request_unref);
 	queue_destroy(client->notify_chrcs, notify_chrc_free);
+	queue_destroy(client->read_queue, pending_read_free);
+	queue_destroy(client->read_batches, NULL);
+	queue_destroy(client->sized_values, NULL);
 	queue_destroy(client->pending_requests, request_unref);
 
 	free(client);
@@ -1638,7 +1834,7 @@ struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
 	if (!client->svc_chngd_queue)
 		goto fail;
 
-	client->notify_list = queue_new();
+	client->notify_list = queue_new_keyed(offsetof(struct notify_data, id));
 	if (!client->notify_list)
 		goto fail;
 
@@ -1646,10 +1842,23 @@ struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
 	if (!client->notify_chrcs)
 		goto fail;
 
-	client->pending_requests = queue_new();
+	client->pending_requests = queue_new_keyed(offsetof(struct request,
+									id));
 	if (!client->pending_requests)
 		goto fail;
 
+	client->read_queue = queue_new();
+	if (!client->read_queue)
+		goto fail;
+
+	client->read_batches = queue_new();
+	if (!client->read_batches)
+		goto fail;
+
+	client->sized_values = queue_new();
+	if (!client->sized_values)
+		goto fail;
+
 	client->notify_id = bt_att_register(att, BT_ATT_OP_HANDLE_VAL_NOT,
 						notify_cb, client, NULL);
 	if (!client->notify_id)
@@ -1760,164 +1969,568 @@ uint16_t bt_gatt_client_get_mtu(struct bt_gatt_client *client)
 	return bt_att_get_mtu(client->att);
 }
 
-struct gatt_db *bt_gatt_client_get_db(struct bt_gatt_client *client)
+bool bt_gatt_client_get_discovery_stats(struct bt_gatt_client *client,
+				struct bt_gatt_client_discovery_stats *stats)
+{
+	if (!client || !stats)
+		return false;
+
+	*stats = client->disc_stats;
+
+	return true;
+}
+
+struct gatt_db *bt_gatt_client_get_db(struct bt_gatt_client *client)
+{
+	if (!client || !client->db)
+		return NULL;
+
+	return client->db;
+}
+
+static void cancel_long_write_cb(uint8_t opcode, const void *pdu, uint16_t len,
+								void *user_data)
+{
+	struct bt_gatt_client *client = user_data;
+
+	if (queue_isempty(client->long_write_queue))
+		client->in_long_write = false;
+}
+
+static bool cancel_long_write_req(struct bt_gatt_client *client,
+							struct request *req)
+{
+	uint8_t pdu = 0x00;
+
+	/*
+	 * att_id == 0 means that request has been queued and no prepare write
+	 * has been sent so far.Let's just remove if from the queue.
+	 * Otherwise execute write needs to be send.
+	 */
+	if (!req->att_id)
+		return queue_remove(client->long_write_queue, req);
+
+	return !!bt_att_send(client->att, BT_ATT_OP_EXEC_WRITE_REQ, &pdu,
+							sizeof(pdu),
+							cancel_long_write_cb,
+							client, NULL);
+
+}
+
+static void cancel_prep_write_cb(uint8_t opcode, const void *pdu, uint16_t len,
+								void *user_data)
+{
+	struct request *req = user_data;
+	struct bt_gatt_client *client = req->client;
+
+	client->reliable_write_session_id = 0;
+}
+
+static bool cancel_prep_write_session(struct bt_gatt_client *client,
+							struct request *req)
+{
+	uint8_t pdu = 0x00;
+
+	return !!bt_att_send(client->att, BT_ATT_OP_EXEC_WRITE_REQ, &pdu,
+							sizeof(pdu),
+							cancel_prep_write_cb,
+							req, request_unref);
+}
+
+static bool cancel_read(struct request *req);
+
+static bool cancel_request(struct request *req)
+{
+	req->removed = true;
+
+	if (req->read)
+		return cancel_read(req);
+
+	if (req->long_write)
+		return cancel_long_write_req(req->client, req);
+
+	if (req->prep_write)
+		return cancel_prep_write_session(req->client, req);
+
+	return bt_att_cancel(req->client->att, req->att_id);
+}
+
+bool bt_gatt_client_cancel(struct bt_gatt_client *client, unsigned int id)
+{
+	struct request *req;
+
+	if (!client || !id || !client->att)
+		return false;
+
+	req = queue_remove_by_key(client->pending_requests, id);
+	if (!req)
+		return false;
+
+	return cancel_request(req);
+}
+
+bool bt_gatt_client_cancel_all(struct bt_gatt_client *client)
+{
+	if (!client || !client->att)
+		return false;
+
+	queue_remove_all(client->pending_requests, NULL, NULL,
+					(queue_destroy_func_t) cancel_request);
+
+	queue_remove_all(client->read_batches, NULL, NULL, read_batch_cancel);
+
+	discovery_req_cancel(client);
+
+	if (client->mtu_req_id)
+		bt_att_cancel(client->att, client->mtu_req_id);
+
+	return true;
+}
+
+struct read_op {
+	bt_gatt_client_read_callback_t callback;
+	void *user_data;
+	bt_gatt_client_destroy_func_t destroy;
+};
+
+static void destroy_read_op(void *data)
+{
+	struct read_op *op = data;
+
+	if (op->destroy)
+		op->destroy(op->user_data);
+
+	free(op);
+}
+
+/*
+ * Characteristics and descriptors whose values have a size fixed by their
+ * specification. Only these can be packed into a Read Multiple request since
+ * its response doesn't carry the length of the individual values.
+ */
+static const struct {
+	uint16_t uuid;
+	uint16_t size;
+} fixed_values[] = {
+	{ GATT_CHARAC_APPEARANCE,		2 },
+	{ GATT_CHARAC_PERIPHERAL_PRIV_FLAG,	1 },
+	{ GATT_CHARAC_PERIPHERAL_PREF_CONN,	8 },
+	{ GATT_CHARAC_SYSTEM_ID,		8 },
+	{ GATT_CHARAC_PNP_ID,			7 },
+	{ 0x2a19,				1 },	/* Battery Level */
+	{ 0x2a4a,				4 },	/* HID Information */
+	{ 0x2a4e,				1 },	/* Protocol Mode */
+	{ GATT_CHARAC_EXT_PROPER_UUID,		2 },
+	{ GATT_CLIENT_CHARAC_CFG_UUID,		2 },
+	{ GATT_SERVER_CHARAC_CFG_UUID,		2 },
+	{ GATT_CHARAC_FMT_UUID,			7 },
+	{ GATT_REPORT_REFERENCE,		2 },
+};
+
+/*
+ * Returns the size a value is expected to have according to the type of its
+ * attribute, 0 if the type doesn't define one.
+ */
+static uint16_t get_fixed_size(struct bt_gatt_client *client,
+							uint16_t handle)
+{
+	struct gatt_db_attribute *attr;
+	const bt_uuid_t *type;
+	unsigned int i;
+
+	attr = gatt_db_get_attribute(client->db, handle);
+	if (!attr)
+		return 0;
+
+	type = gatt_db_attribute_get_type(attr);
+
+	for (i = 0; i < sizeof(fixed_values) / sizeof(fixed_values[0]); i++) {
+		bt_uuid_t uuid;
+
+		bt_uuid16_create(&uuid, fixed_values[i].uuid);
+
+		if (!bt_uuid_cmp(&uuid, type))
+			return fixed_values[i].size;
+	}
+
+	return 0;
+}
+
+/* Read of a single handle, shared by all requests waiting for its value */
+struct pending_read {
+	uint16_t handle;
+	uint16_t size;		/* Confirmed value size, 0 if unknown */
+	bool single;		/* Not to be packed into Read Multiple */
+	struct queue *reqs;
+};
+
+/* Read or Read Multiple request on the wire */
+struct read_batch {
+	struct bt_gatt_client *client;
+	unsigned int att_id;
+	bool joinable;
+	bool delivering;
+	bool freed;
+	uint16_t len;
+	unsigned int num_reads;
+	struct pending_read *reads[READ_BATCH_MAX];
+};
+
+static void pending_read_free(void *data)
+{
+	struct pending_read *pr = data;
+
+	queue_destroy(pr->reqs, request_unref);
+	free(pr);
+}
+
+static void pending_read_complete(struct pending_read *pr, bool success,
+					uint8_t att_ecode, const uint8_t *value,
+					uint16_t length)
+{
+	struct request *req;
+
+	while ((req = queue_pop_head(pr->reqs))) {
+		struct read_op *op = req->data;
+
+		req->read = NULL;
+
+		if (op->callback)
+			op->callback(success, att_ecode, value, length,
+								op->user_data);
+
+		request_unref(req);
+	}
+}
+
+static bool match_pending_read(const void *a, const void *b)
+{
+	const struct pending_read *pr = a;
+
+	return pr->handle == PTR_TO_UINT(b);
+}
+
+static struct pending_read *find_pending_read(struct bt_gatt_client *client,
+							uint16_t handle)
+{
+	const struct queue_entry *entry;
+	struct pending_read *pr;
+	unsigned int i;
+
+	pr = queue_find(client->read_queue, match_pending_read,
+							UINT_TO_PTR(handle));
+	if (pr)
+		return pr;
+
+	for (entry = queue_get_entries(client->read_batches); entry;
+							entry = entry->next) {
+		struct read_batch *batch = entry->data;
+
+		if (!batch->joinable)
+			continue;
+
+		for (i = 0; i < batch->num_reads; i++) {
+			pr = batch->reads[i];
+
+			if (pr && pr->handle == handle)
+				return pr;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Value sizes implied by the attribute type are only trusted once a read of
+ * the value alone confirmed them.
+ */
+static uint16_t get_value_size(struct bt_gatt_client *client,
+							uint16_t handle)
+{
+	if (!queue_find(client->sized_values, NULL, UINT_TO_PTR(handle)))
+		return 0;
+
+	return get_fixed_size(client, handle);
+}
+
+static void value_size_seen(struct bt_gatt_client *client,
+				struct pending_read *pr, uint16_t length)
+{
+	if (pr->size || !length || length != get_fixed_size(client, pr->handle))
+		return;
+
+	if (queue_find(client->sized_values, NULL, UINT_TO_PTR(pr->handle)))
+		return;
+
+	queue_push_tail(client->sized_values, UINT_TO_PTR(pr->handle));
+}
+
+static void read_batch_cb(uint8_t opcode, const void *pdu, uint16_t length,
+								void *user_data)
+{
+	struct read_batch *batch = user_data;
+	struct bt_gatt_client *client = batch->client;
+	struct pending_read *pr;
+	const uint8_t *value = pdu;
+	uint8_t att_ecode = 0;
+	unsigned int i;
+
+	if (!client)
+		return;
+
+	/*
+	 * The value may be stale by the time the callbacks run, reads they
+	 * issue have to go to the peer again.
+	 */
+	batch->joinable = false;
+
+	/*
+	 * Callbacks may cancel all requests or drop the last reference to
+	 * the client, which releases the batch. Keep it around until all
+	 * callbacks have returned.
+	 */
+	batch->delivering = true;
+
+	if (batch->num_reads == 1) {
+		pr = batch->reads[0];
+
+		if (opcode == BT_ATT_OP_ERROR_RSP) {
+			att_ecode = process_error(pdu, length);
+			pending_read_complete(pr, false, att_ecode, NULL, 0);
+		} else if (opcode != BT_ATT_OP_READ_RSP || (!pdu && length))
+			pending_read_complete(pr, false, 0, NULL, 0);
+		else {
+			value_size_seen(client, pr, length);
+			pending_read_complete(pr, true, 0, length ? pdu : NULL,
+									length);
+		}
+
+		goto done;
+	}
+
+	if (opcode != BT_ATT_OP_READ_MULT_RSP || length != batch->len) {
+		if (opcode == BT_ATT_OP_ERROR_RSP &&
+				process_error(pdu, length) ==
+					BT_ATT_ERROR_REQUEST_NOT_SUPPORTED)
+			client->read_multiple_unsupported = true;
+
+		util_debug(client->debug_callback, client->debug_data,
+				"Read Multiple failed, reading values one by one");
+
+		/*
+		 * The error belongs to a single handle or the peer didn't honor
+		 * the value sizes, retry individually so that every request
+		 * gets its own result.
+		 */
+		for (i = batch->num_reads; i > 0; i--) {
+			pr = batch->reads[i - 1];
+			batch->reads[i - 1] = NULL;
+
+			queue_remove(client->sized_values,
+						UINT_TO_PTR(pr->handle));
+
+			pr->single = true;
+			queue_push_head(client->read_queue, pr);
+		}
+
+		goto done;
+	}
+
+	/* Once cancelled the remaining reads have no one to go to */
+	for (i = 0; i < batch->num_reads && batch->client; i++) {
+		pr = batch->reads[i];
+
+		pending_read_complete(pr, true, 0, value, pr->size);
+		value += pr->size;
+	}
+
+done:
+	batch->delivering = false;
+
+	if (batch->freed)
+		read_batch_free(batch);
+}
+
+static bool read_batch_send(struct bt_gatt_client *client);
+
+static void read_queue_fail(struct bt_gatt_client *client)
 {
-	if (!client || !client->db)
-		return NULL;
+	struct pending_read *pr;
 
-	return client->db;
+	while ((pr = queue_pop_head(client->read_queue))) {
+		pending_read_complete(pr, false, 0, NULL, 0);
+		pending_read_free(pr);
+	}
 }
 
-static bool match_req_id(const void *a, const void *b)
+static void read_sched_run(struct bt_gatt_client *client)
 {
-	const struct request *req = a;
-	unsigned int id = PTR_TO_UINT(b);
+	/* Let reads pile up while one is on the wire so they can be packed */
+	if (!queue_isempty(client->read_batches))
+		return;
+
+	if (queue_isempty(client->read_queue))
+		return;
 
-	return req->id == id;
+	if (!read_batch_send(client))
+		read_queue_fail(client);
 }
 
-static void cancel_long_write_cb(uint8_t opcode, const void *pdu, uint16_t len,
-								void *user_data)
+static void read_sched_flush(struct bt_gatt_client *client)
 {
-	struct bt_gatt_client *client = user_data;
+	const struct queue_entry *entry;
 
-	if (queue_isempty(client->long_write_queue))
-		client->in_long_write = false;
+	while (!queue_isempty(client->read_queue)) {
+		if (!read_batch_send(client)) {
+			read_queue_fail(client);
+			break;
+		}
+	}
+
+	/* Reads issued from now on must not be answered by older requests */
+	for (entry = queue_get_entries(client->read_batches); entry;
+							entry = entry->next) {
+		struct read_batch *batch = entry->data;
+
+		batch->joinable = false;
+	}
 }
 
-static bool cancel_long_write_req(struct bt_gatt_client *client,
-							struct request *req)
+static void read_batch_free(void *data)
 {
-	uint8_t pdu = 0x00;
+	struct read_batch *batch = data;
+	struct bt_gatt_client *client = batch->client;
+	unsigned int i;
 
-	/*
-	 * att_id == 0 means that request has been queued and no prepare write
-	 * has been sent so far.Let's just remove if from the queue.
-	 * Otherwise execute write needs to be send.
-	 */
-	if (!req->att_id)
-		return queue_remove(client->long_write_queue, req);
+	if (batch->delivering) {
+		batch->freed = true;
+		return;
+	}
 
-	return !!bt_att_send(client->att, BT_ATT_OP_EXEC_WRITE_REQ, &pdu,
-							sizeof(pdu),
-							cancel_long_write_cb,
-							client, NULL);
+	for (i = 0; i < batch->num_reads; i++) {
+		if (batch->reads[i])
+			pending_read_free(batch->reads[i]);
+	}
 
-}
+	if (client)
+		queue_remove(client->read_batches, batch);
 
-static void cancel_prep_write_cb(uint8_t opcode, const void *pdu, uint16_t len,
-								void *user_data)
-{
-	struct request *req = user_data;
-	struct bt_gatt_client *client = req->client;
+	free(batch);
 
-	client->reliable_write_session_id = 0;
+	if (client)
+		read_sched_run(client);
 }
 
-static bool cancel_prep_write_session(struct bt_gatt_client *client,
-							struct request *req)
+static void read_batch_cancel(void *data)
 {
-	uint8_t pdu = 0x00;
+	struct read_batch *batch = data;
+	struct bt_gatt_client *client = batch->client;
 
-	return !!bt_att_send(client->att, BT_ATT_OP_EXEC_WRITE_REQ, &pdu,
-							sizeof(pdu),
-							cancel_prep_write_cb,
-							req, request_unref);
+	batch->client = NULL;
+	bt_att_cancel(client->att, batch->att_id);
 }
 
-static bool cancel_request(struct request *req)
+static bool read_batch_send(struct bt_gatt_client *client)
 {
-	req->removed = true;
+	const struct queue_entry *entry;
+	struct read_batch *batch;
+	struct pending_read *pr;
+	uint8_t pdu[READ_BATCH_MAX * 2];
+	uint8_t opcode;
+	int max_len;
+	unsigned int i;
 
-	if (req->long_write)
-		return cancel_long_write_req(req->client, req);
+	pr = queue_pop_head(client->read_queue);
+	if (!pr)
+		return true;
 
-	if (req->prep_write)
-		return cancel_prep_write_session(req->client, req);
+	batch = new0(struct read_batch, 1);
+	if (!batch) {
+		queue_push_head(client->read_queue, pr);
+		return false;
+	}
 
-	return bt_att_cancel(req->client->att, req->att_id);
-}
+	batch->client = client;
+	batch->joinable = true;
+	batch->len = pr->size;
+	batch->reads[batch->num_reads++] = pr;
 
-bool bt_gatt_client_cancel(struct bt_gatt_client *client, unsigned int id)
-{
-	struct request *req;
+	max_len = bt_att_get_mtu(client->att) - 1;
 
-	if (!client || !id || !client->att)
-		return false;
+	/*
+	 * Pack the values of known size waiting behind this one into the same
+	 * request, as long as both the request and the response fit the MTU.
+	 */
+	entry = queue_get_entries(client->read_queue);
 
-	req = queue_remove_if(client->pending_requests, match_req_id,
-							UINT_TO_PTR(id));
-	if (!req)
-		return false;
+	while (pr->size && !pr->single && !client->read_multiple_unsupported &&
+				entry && batch->num_reads < READ_BATCH_MAX) {
+		struct pending_read *next = entry->data;
 
-	return cancel_request(req);
-}
+		entry = entry->next;
 
-bool bt_gatt_client_cancel_all(struct bt_gatt_client *client)
-{
-	if (!client || !client->att)
-		return false;
+		if (!next->size || next->single)
+			continue;
 
-	queue_remove_all(client->pending_requests, NULL, NULL,
-					(queue_destroy_func_t) cancel_request);
+		if ((int) (batch->num_reads + 1) * 2 > max_len ||
+					batch->len + next->size > max_len)
+			break;
 
-	if (client->discovery_req) {
-		bt_gatt_request_cancel(client->discovery_req);
-		bt_gatt_request_unref(client->discovery_req);
-		client->discovery_req = NULL;
+		queue_remove(client->read_queue, next);
+		batch->reads[batch->num_reads++] = next;
+		batch->len += next->size;
 	}
 
-	if (client->mtu_req_id)
-		bt_att_cancel(client->att, client->mtu_req_id);
+	for (i = 0; i < batch->num_reads; i++)
+		put_le16(batch->reads[i]->handle, pdu + (2 * i));
 
-	return true;
-}
+	if (batch->num_reads > 1) {
+		opcode = BT_ATT_OP_READ_MULT_REQ;
+		util_debug(client->debug_callback, client->debug_data,
+					"Packing %u reads into Read Multiple",
+					batch->num_reads);
+	} else
+		opcode = BT_ATT_OP_READ_REQ;
 
-struct read_op {
-	bt_gatt_client_read_callback_t callback;
-	void *user_data;
-	bt_gatt_client_destroy_func_t destroy;
-};
+	queue_push_tail(client->read_batches, batch);
 
-static void destroy_read_op(void *data)
-{
-	struct read_op *op = data;
+	batch->att_id = bt_att_send(client->att, opcode, pdu,
+						batch->num_reads * 2,
+						read_batch_cb, batch,
+						read_batch_free);
+	if (batch->att_id)
+		return true;
 
-	if (op->destroy)
-		op->destroy(op->user_data);
+	queue_remove(client->read_batches, batch);
 
-	free(op);
+	for (i = batch->num_reads; i > 0; i--)
+		queue_push_head(client->read_queue, batch->reads[i - 1]);
+
+	free(batch);
+
+	return false;
 }
 
-static void read_cb(uint8_t opcode, const void *pdu, uint16_t length,
-								void *user_data)
+static bool cancel_read(struct request *req)
 {
-	struct request *req = user_data;
-	struct read_op *op = req->data;
-	bool success;
-	uint8_t att_ecode = 0;
-	const uint8_t *value = NULL;
-	uint16_t value_len = 0;
+	struct pending_read *pr = req->read;
+	struct bt_gatt_client *client = req->client;
 
-	if (opcode == BT_ATT_OP_ERROR_RSP) {
-		success = false;
-		att_ecode = process_error(pdu, length);
-		goto done;
-	}
+	req->read = NULL;
 
-	if (opcode != BT_ATT_OP_READ_RSP || (!pdu && length)) {
-		success = false;
-		goto done;
-	}
+	if (!queue_remove(pr->reqs, req))
+		return false;
 
-	success = true;
-	value_len = length;
-	if (value_len)
-		value = pdu;
+	/*
+	 * Reads already on the wire are left alone, their response just has no
+	 * one to go to anymore.
+	 */
+	if (queue_isempty(pr->reqs) && queue_remove(client->read_queue, pr))
+		pending_read_free(pr);
 
-done:
-	if (op->callback)
-		op->callback(success, att_ecode, value, length, op->user_data);
+	request_unref(req);
+
+	return true;
 }
 
 unsigned int bt_gatt_client_read_value(struct bt_gatt_client *client,
@@ -1928,7 +2541,7 @@ unsigned int bt_gatt_client_read_value(struct bt_gatt_client *client,
 {
 	struct request *req;
 	struct read_op *op;
-	uint8_t pdu[2];
+	struct pending_read *pr;
 
 	if (!client)
 		return 0;
@@ -1937,7 +2550,7 @@ unsigned int bt_gatt_client_read_value(struct bt_gatt_client *client,
 	if (!op)
 		return 0;
 
-	req = request_create(client);
+	req = request_new(client);
 	if (!req) {
 		free(op);
 		return 0;
@@ -1950,19 +2563,46 @@ unsigned int bt_gatt_client_read_value(struct bt_gatt_client *client,
 	req->data = op;
 	req->destroy = destroy_read_op;
 
-	put_le16(value_handle, pdu);
+	/* Concurrent reads of the same value share a single request */
+	pr = find_pending_read(client, value_handle);
+	if (pr) {
+		req->read = pr;
+		queue_push_tail(pr->reqs, req);
+		return req->id;
+	}
 
-	req->att_id = bt_att_send(client->att, BT_ATT_OP_READ_REQ,
-							pdu, sizeof(pdu),
-							read_cb, req,
-							request_unref);
-	if (!req->att_id) {
-		op->destroy = NULL;
-		request_unref(req);
-		return 0;
+	pr = new0(struct pending_read, 1);
+	if (!pr)
+		goto fail;
+
+	pr->reqs = queue_new();
+	if (!pr->reqs) {
+		free(pr);
+		goto fail;
 	}
 
-	return req->id;
+	pr->handle = value_handle;
+	pr->size = get_value_size(client, value_handle);
+
+	req->read = pr;
+	queue_push_tail(pr->reqs, req);
+	queue_push_tail(client->read_queue, pr);
+
+	if (!queue_isempty(client->read_batches))
+		return req->id;
+
+	if (read_batch_send(client))
+		return req->id;
+
+	queue_remove(client->read_queue, pr);
+	queue_destroy(pr->reqs, NULL);
+	free(pr);
+	req->read = NULL;
+
+fail:
+	op->destroy = NULL;
+	request_unref(req);
+	return 0;
 }
 
 static void read_multiple_cb(uint8_t opcode, const void *pdu, uint16_t length,
@@ -2045,13 +2685,94 @@ unsigned int bt_gatt_client_read_multiple(struct bt_gatt_client *client,
 	return req->id;
 }
 
+/*
+ * Value assembled from chunks. Received data is never moved, only the array of
+ * chunks grows, so building up a long value stays linear in its length.
+ */
+struct value_buf {
+	struct iovec *iov;
+	int iovcnt;
+	int iovmax;
+	size_t len;
+};
+
+static bool value_buf_append(struct value_buf *buf, const void *data,
+								size_t len)
+{
+	void *chunk;
+
+	if (buf->iovcnt == buf->iovmax) {
+		int iovmax = buf->iovmax ? buf->iovmax * 2 : 4;
+		struct iovec *iov;
+
+		iov = realloc(buf->iov, iovmax * sizeof(*iov));
+		if (!iov)
+			return false;
+
+		buf->iov = iov;
+		buf->iovmax = iovmax;
+	}
+
+	chunk = malloc(len);
+	if (!chunk)
+		return false;
+
+	memcpy(chunk, data, len);
+
+	buf->iov[buf->iovcnt].iov_base = chunk;
+	buf->iov[buf->iovcnt].iov_len = len;
+	buf->iovcnt++;
+	buf->len += len;
+
+	return true;
+}
+
+/* Merge all chunks into the first one, a single chunk is left untouched */
+static bool value_buf_flatten(struct value_buf *buf)
+{
+	uint8_t *data;
+	size_t offset = 0;
+	int i;
+
+	if (buf->iovcnt < 2)
+		return true;
+
+	data = malloc(buf->len);
+	if (!data)
+		return false;
+
+	for (i = 0; i < buf->iovcnt; i++) {
+		memcpy(data + offset, buf->iov[i].iov_base, buf->iov[i].iov_len);
+		offset += buf->iov[i].iov_len;
+		free(buf->iov[i].iov_base);
+	}
+
+	buf->iov[0].iov_base = data;
+	buf->iov[0].iov_len = buf->len;
+	buf->iovcnt = 1;
+
+	return true;
+}
+
+static void value_buf_clear(struct value_buf *buf)
+{
+	int i;
+
+	for (i = 0; i < buf->iovcnt; i++)
+		free(buf->iov[i].iov_base);
+
+	free(buf->iov);
+	memset(buf, 0, sizeof(*buf));
+}
+
 struct read_long_op {
 	struct bt_gatt_client *client;
 	int ref_count;
 	uint16_t value_handle;
 	uint16_t offset;
-	struct iovec iov;
+	struct value_buf buf;
 	bt_gatt_client_read_callback_t callback;
+	bt_gatt_client_read_iov_callback_t iov_callback;
 	void *user_data;
 	bt_gatt_client_destroy_func_t destroy;
 };
@@ -2063,33 +2784,49 @@ static void destroy_read_long_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->iov.iov_base);
+	value_buf_clear(&op->buf);
 	free(op);
 }
 
 static bool append_chunk(struct read_long_op *op, const uint8_t *data,
 								uint16_t len)
 {
-	void *buf;
-
 	/* Truncate if the data would exceed maximum length */
 	if (op->offset + len > BT_ATT_MAX_VALUE_LEN)
 		len = BT_ATT_MAX_VALUE_LEN - op->offset;
 
-	buf = realloc(op->iov.iov_base, op->iov.iov_len + len);
-	if (!buf)
+	if (!value_buf_append(&op->buf, data, len))
 		return false;
 
-	op->iov.iov_base = buf;
-
-	memcpy(op->iov.iov_base + op->iov.iov_len, data, len);
-
-	op->iov.iov_len += len;
 	op->offset += len;
 
 	return true;
 }
 
+static void read_long_complete(struct read_long_op *op, bool success,
+							uint8_t att_ecode)
+{
+	const uint8_t *value = NULL;
+	uint16_t length = 0;
+
+	if (op->iov_callback) {
+		op->iov_callback(success, att_ecode, op->buf.iov,
+					op->buf.iovcnt, op->user_data);
+		return;
+	}
+
+	if (!op->callback)
+		return;
+
+	if (value_buf_flatten(&op->buf) && op->buf.iovcnt) {
+		value = op->buf.iov[0].iov_base;
+		length = op->buf.iov[0].iov_len;
+	} else if (op->buf.iovcnt)
+		success = false;
+
+	op->callback(success, att_ecode, value, length, op->user_data);
+}
+
 static void read_long_cb(uint8_t opcode, const void *pdu,
 					uint16_t length, void *user_data)
 {
@@ -2144,14 +2881,13 @@ success:
 	success = true;
 
 done:
-	if (op->callback)
-		op->callback(success, att_ecode, op->iov.iov_base,
-						op->iov.iov_len, op->user_data);
+	read_long_complete(op, success, att_ecode);
 }
 
-unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client *client,
+static unsigned int read_long_value(struct bt_gatt_client *client,
 					uint16_t value_handle, uint16_t offset,
 					bt_gatt_client_read_callback_t callback,
+					bt_gatt_client_read_iov_callback_t iov_callback,
 					void *user_data,
 					bt_gatt_client_destroy_func_t destroy)
 {
@@ -2176,6 +2912,7 @@ unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client *client,
 	op->value_handle = value_handle;
 	op->offset = offset;
 	op->callback = callback;
+	op->iov_callback = iov_callback;
 	op->user_data = user_data;
 	op->destroy = destroy;
 
@@ -2198,6 +2935,26 @@ unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client *client,
 	return req->id;
 }
 
+unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client *client,
+					uint16_t value_handle, uint16_t offset,
+					bt_gatt_client_read_callback_t callback,
+					void *user_data,
+					bt_gatt_client_destroy_func_t destroy)
+{
+	return read_long_value(client, value_handle, offset, callback, NULL,
+							user_data, destroy);
+}
+
+unsigned int bt_gatt_client_read_long_value_iov(struct bt_gatt_client *client,
+				uint16_t value_handle, uint16_t offset,
+				bt_gatt_client_read_iov_callback_t callback,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy)
+{
+	return read_long_value(client, value_handle, offset, NULL, callback,
+							user_data, destroy);
+}
+
 unsigned int bt_gatt_client_write_without_response(
 					struct bt_gatt_client *client,
 					uint16_t value_handle,
@@ -2355,43 +3112,38 @@ static void prepare_write_cb(uint8_t opcode, const void *pdu, uint16_t length,
 static void complete_write_long_op(struct request *req, bool success,
 					uint8_t att_ecode, bool reliable_error);
 
-static void handle_next_prep_write(struct request *req)
+/*
+ * Send the current part of the value straight from the buffer of the
+ * operation, without assembling the PDU first.
+ */
+static unsigned int send_prep_write(struct request *req)
 {
 	struct long_write_op *op = req->data;
-	bool success = true;
-	uint8_t *pdu;
-
-	pdu = malloc(op->cur_length + 4);
-	if (!pdu) {
-		success = false;
-		goto done;
-	}
+	uint8_t hdr[4];
+	struct iovec iov[2];
 
-	put_le16(op->value_handle, pdu);
-	put_le16(op->offset + op->index, pdu + 2);
-	memcpy(pdu + 4, op->value + op->index, op->cur_length);
+	put_le16(op->value_handle, hdr);
+	put_le16(op->offset + op->index, hdr + 2);
 
-	req->att_id = bt_att_send(op->client->att, BT_ATT_OP_PREP_WRITE_REQ,
-							pdu, op->cur_length + 4,
-							prepare_write_cb,
-							request_ref(req),
-							request_unref);
-	if (!req->att_id) {
-		request_unref(req);
-		success = false;
-	}
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = op->value + op->index;
+	iov[1].iov_len = op->cur_length;
 
-	free(pdu);
+	return bt_att_send_iov(op->client->att, BT_ATT_OP_PREP_WRITE_REQ,
+						iov, 2, prepare_write_cb, req,
+						request_unref);
+}
 
-	/* If so far successful, then the operation should continue.
-	 * Otherwise, there was an error and the procedure should be
-	 * completed.
-	 */
-	if (success)
+static void handle_next_prep_write(struct request *req)
+{
+	req->att_id = send_prep_write(request_ref(req));
+	if (req->att_id)
 		return;
 
-done:
-	complete_write_long_op(req, success, 0, false);
+	/* The operation can't continue, complete the procedure */
+	request_unref(req);
+	complete_write_long_op(req, false, 0, false);
 }
 
 static void start_next_long_write(struct bt_gatt_client *client)
@@ -2550,7 +3302,6 @@ unsigned int bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 {
 	struct request *req;
 	struct long_write_op *op;
-	uint8_t *pdu;
 
 	if (!client)
 		return 0;
@@ -2602,23 +3353,7 @@ unsigned int bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 		return req->id;
 	}
 
-	pdu = malloc(op->cur_length + 4);
-	if (!pdu) {
-		free(op->value);
-		free(op);
-		return 0;
-	}
-
-	put_le16(value_handle, pdu);
-	put_le16(offset, pdu + 2);
-	memcpy(pdu + 4, op->value, op->cur_length);
-
-	req->att_id = bt_att_send(client->att, BT_ATT_OP_PREP_WRITE_REQ,
-							pdu, op->cur_length + 4,
-							prepare_write_cb, req,
-							request_unref);
-	free(pdu);
-
+	req->att_id = send_prep_write(req);
 	if (!req->att_id) {
 		op->destroy = NULL;
 		request_unref(req);
@@ -2701,8 +3436,7 @@ static struct request *get_reliable_request(struct bt_gatt_client *client,
 
 	/* Following prepare writes */
 	if (id != 0)
-		req = queue_find(client->pending_requests, match_req_id,
-							UINT_TO_PTR(id));
+		req = queue_find_by_key(client->pending_requests, id);
 	else
 		req = request_create(client);
 
@@ -2859,8 +3593,7 @@ unsigned int bt_gatt_client_write_execute(struct bt_gatt_client *client,
 	if (!op)
 		return 0;
 
-	req = queue_find(client->pending_requests, match_req_id,
-							UINT_TO_PTR(id));
+	req = queue_find_by_key(client->pending_requests, id);
 	if (!req) {
 		free(op);
 		return 0;
@@ -2942,15 +3675,15 @@ unsigned int bt_gatt_client_register_notify(struct bt_gatt_client *client,
 	notify_data->user_data = user_data;
 	notify_data->destroy = destroy;
 
-	/* Add the handler to the bt_gatt_client's general list */
-	queue_push_tail(client->notify_list, notify_data);
-
 	/* Assign an ID to the handler. */
 	if (client->next_reg_id < 1)
 		client->next_reg_id = 1;
 
 	notify_data->id = client->next_reg_id++;
 
+	/* Add the handler to the bt_gatt_client's general list */
+	queue_push_tail(client->notify_list, notify_data);
+
 	/*
 	 * If a write to the CCC descriptor is in progress, then queue this
 	 * request.
@@ -2986,8 +3719,7 @@ bool bt_gatt_client_unregister_notify(struct bt_gatt_client *client,
 	if (!client || !id)
 		return false;
 
-	notify_data = queue_remove_if(client->notify_list, match_notify_data_id,
-							UINT_TO_PTR(id));
+	notify_data = queue_remove_by_key(client->notify_list, id);
 	if (!notify_data)
 		return false;
 
@@ -24,6 +24,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 #define BT_GATT_UUID_SIZE 16
 
@@ -43,6 +44,10 @@ typedef void (*bt_gatt_client_debug_func_t)(const char *str, void *user_data);
 typedef void (*bt_gatt_client_read_callback_t)(bool success, uint8_t att_ecode,
 					const uint8_t *value, uint16_t length,
 					void *user_data);
+typedef void (*bt_gatt_client_read_iov_callback_t)(bool success,
+					uint8_t att_ecode,
+					const struct iovec *iov, int iovcnt,
+					void *user_data);
 typedef void (*bt_gatt_client_write_long_callback_t)(bool success,
 					bool reliable_error, uint8_t att_ecode,
 					void *user_data);
@@ -72,6 +77,15 @@ bool bt_gatt_client_set_debug(struct bt_gatt_client *client,
 uint16_t bt_gatt_client_get_mtu(struct bt_gatt_client *client);
 struct gatt_db *bt_gatt_client_get_db(struct bt_gatt_client *client);
 
+struct bt_gatt_client_discovery_stats {
+	uint64_t duration;	/* Microseconds from creation until ready */
+	uint64_t requests;	/* ATT PDUs sent in the meantime */
+	bool cached;		/* Discovery skipped, database pre-populated */
+};
+
+bool bt_gatt_client_get_discovery_stats(struct bt_gatt_client *client,
+				struct bt_gatt_client_discovery_stats *stats);
+
 bool bt_gatt_client_cancel(struct bt_gatt_client *client, unsigned int id);
 bool bt_gatt_client_cancel_all(struct bt_gatt_client *client);
 
@@ -85,6 +99,11 @@ unsigned int bt_gatt_client_read_long_value(struct bt_gatt_client *client,
 					bt_gatt_client_read_callback_t callback,
 					void *user_data,
 					bt_gatt_client_destroy_func_t destroy);
+unsigned int bt_gatt_client_read_long_value_iov(struct bt_gatt_client *client,
+				uint16_t value_handle, uint16_t offset,
+				bt_gatt_client_read_iov_callback_t callback,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy);
 unsigned int bt_gatt_client_read_multiple(struct bt_gatt_client *client,
 					uint16_t *handles, uint8_t num_handles,
 					bt_gatt_client_read_callback_t callback,
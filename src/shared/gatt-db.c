@@ -54,6 +54,15 @@ struct gatt_db {
 	uint16_t next_handle;
 	struct queue *services;
 
+	/* Services sorted by handle range, for handle lookups */
+	struct gatt_db_service **index;
+	unsigned int index_len;
+	unsigned int index_size;
+
+	/* Attributes of each type sorted by handle, for type queries */
+	struct queue *types;		/* Bluetooth Base UUIDs, keyed */
+	struct queue *types128;		/* Any other UUIDs */
+
 	struct queue *notify_list;
 	unsigned int next_notify_id;
 };
@@ -103,12 +112,21 @@ struct gatt_db_attribute {
 
 struct gatt_db_service {
 	struct gatt_db *db;
+	unsigned int handle;		/* Start handle, key in db->services */
 	bool active;
 	bool claimed;
 	uint16_t num_handles;
 	struct gatt_db_attribute **attributes;
 };
 
+struct attr_type {
+	unsigned int key;		/* 32-bit value of Base UUIDs */
+	bt_uuid_t uuid;			/* Always 128-bit */
+	struct gatt_db_attribute **attrs;
+	unsigned int len;
+	unsigned int size;
+};
+
 static void pending_read_result(struct pending_read *p, int err,
 					const uint8_t *data, size_t length)
 {
@@ -214,22 +232,35 @@ struct gatt_db *gatt_db_new(void)
 	if (!db)
 		return NULL;
 
-	db->services = queue_new();
+	db->services = queue_new_keyed(offsetof(struct gatt_db_service,
+								handle));
 	if (!db->services) {
 		free(db);
 		return NULL;
 	}
 
-	db->notify_list = queue_new();
-	if (!db->notify_list) {
-		queue_destroy(db->services, NULL);
-		free(db);
-		return NULL;
-	}
+	db->notify_list = queue_new_keyed(offsetof(struct notify, id));
+	if (!db->notify_list)
+		goto fail;
+
+	db->types = queue_new_keyed(offsetof(struct attr_type, key));
+	if (!db->types)
+		goto fail;
+
+	db->types128 = queue_new();
+	if (!db->types128)
+		goto fail;
 
 	db->next_handle = 0x0001;
 
 	return gatt_db_ref(db);
+
+fail:
+	queue_destroy(db->types, NULL);
+	queue_destroy(db->notify_list, NULL);
+	queue_destroy(db->services, NULL);
+	free(db);
+	return NULL;
 }
 
 static void notify_destroy(void *data)
@@ -242,14 +273,6 @@ static void notify_destroy(void *data)
 	free(notify);
 }
 
-static bool match_notify_id(const void *a, const void *b)
-{
-	const struct notify *notify = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify->id == id;
-}
-
 struct notify_data {
 	struct gatt_db_attribute *attr;
 	bool added;
@@ -285,16 +308,289 @@ static void notify_service_changed(struct gatt_db *db,
 	gatt_db_unref(db);
 }
 
+static void attr_type_free(void *data)
+{
+	struct attr_type *type = data;
+
+	free(type->attrs);
+	free(type);
+}
+
+static bool match_attr_type(const void *a, const void *b)
+{
+	const struct attr_type *type = a;
+	const bt_uuid_t *uuid = b;
+
+	return !bt_uuid_cmp(&type->uuid, uuid);
+}
+
+static bool uuid_to_key(const bt_uuid_t *uuid128, unsigned int *key)
+{
+	bt_uuid_t base;
+
+	*key = get_be32(&uuid128->value.u128.data[0]);
+
+	bt_uuid32_create(&base, *key);
+	bt_uuid_to_uuid128(&base, &base);
+
+	return !bt_uuid_cmp(&base, uuid128);
+}
+
+static struct attr_type *find_attr_type(struct gatt_db *db,
+					const bt_uuid_t *uuid, bool create)
+{
+	struct attr_type *type;
+	bt_uuid_t uuid128;
+	unsigned int key;
+	bool based;
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+
+	based = uuid_to_key(&uuid128, &key);
+	if (based)
+		type = queue_find_by_key(db->types, key);
+	else
+		type = queue_find(db->types128, match_attr_type, &uuid128);
+
+	if (type || !create)
+		return type;
+
+	type = new0(struct attr_type, 1);
+	if (!type)
+		return NULL;
+
+	type->key = key;
+	type->uuid = uuid128;
+
+	if (!queue_push_tail(based ? db->types : db->types128, type)) {
+		free(type);
+		return NULL;
+	}
+
+	return type;
+}
+
+/* Returns the position of the first attribute at or after handle */
+static unsigned int attr_type_lower_bound(const struct attr_type *type,
+							unsigned int handle)
+{
+	unsigned int lo = 0, hi = type->len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (type->attrs[mid]->handle < handle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static bool type_index_add(struct gatt_db *db,
+					struct gatt_db_attribute *attr)
+{
+	struct attr_type *type;
+	unsigned int pos;
+
+	type = find_attr_type(db, &attr->uuid, true);
+	if (!type)
+		return false;
+
+	if (type->len == type->size) {
+		struct gatt_db_attribute **attrs;
+		unsigned int size = type->size ? type->size * 2 : 4;
+
+		attrs = realloc(type->attrs, size * sizeof(*attrs));
+		if (!attrs)
+			return false;
+
+		type->attrs = attrs;
+		type->size = size;
+	}
+
+	/* Attributes are mostly added in handle order */
+	if (!type->len || type->attrs[type->len - 1]->handle < attr->handle)
+		pos = type->len;
+	else
+		pos = attr_type_lower_bound(type, attr->handle);
+
+	memmove(&type->attrs[pos + 1], &type->attrs[pos],
+				(type->len - pos) * sizeof(*type->attrs));
+	type->attrs[pos] = attr;
+	type->len++;
+
+	return true;
+}
+
+static void type_index_remove(struct gatt_db *db,
+					struct gatt_db_attribute *attr)
+{
+	struct attr_type *type;
+	unsigned int pos;
+
+	type = find_attr_type(db, &attr->uuid, false);
+	if (!type)
+		return;
+
+	pos = attr_type_lower_bound(type, attr->handle);
+	if (pos == type->len || type->attrs[pos] != attr)
+		return;
+
+	memmove(&type->attrs[pos], &type->attrs[pos + 1],
+			(type->len - pos - 1) * sizeof(*type->attrs));
+	type->len--;
+}
+
+static void attr_type_remove_range(void *data, void *user_data)
+{
+	struct attr_type *type = data;
+	const unsigned int *range = user_data;
+	unsigned int lo, hi;
+
+	lo = attr_type_lower_bound(type, range[0]);
+	hi = attr_type_lower_bound(type, range[1] + 1);
+
+	memmove(&type->attrs[lo], &type->attrs[hi],
+				(type->len - hi) * sizeof(*type->attrs));
+	type->len -= hi - lo;
+}
+
+static void attr_type_clear(void *data, void *user_data)
+{
+	struct attr_type *type = data;
+
+	type->len = 0;
+}
+
+/* Removes the attributes within a handle range from all type lists at once */
+static void type_index_remove_range(struct gatt_db *db, uint16_t start,
+								uint16_t end)
+{
+	unsigned int range[2] = { start, end };
+
+	queue_foreach(db->types, attr_type_remove_range, range);
+	queue_foreach(db->types128, attr_type_remove_range, range);
+}
+
+static void gatt_db_service_get_handles(const struct gatt_db_service *service,
+							uint16_t *start_handle,
+							uint16_t *end_handle)
+{
+	if (start_handle)
+		*start_handle = service->attributes[0]->handle;
+
+	if (end_handle)
+		*end_handle = service->attributes[0]->handle +
+						service->num_handles - 1;
+}
+
+/* Returns the position of the first service that ends at or after handle */
+static unsigned int index_lower_bound(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int lo = 0, hi = db->index_len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		uint16_t end;
+
+		gatt_db_service_get_handles(db->index[mid], NULL, &end);
+
+		if (end < handle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static struct gatt_db_service *index_find(struct gatt_db *db, uint16_t handle)
+{
+	unsigned int pos;
+	uint16_t start;
+
+	pos = index_lower_bound(db, handle);
+	if (pos == db->index_len)
+		return NULL;
+
+	gatt_db_service_get_handles(db->index[pos], &start, NULL);
+
+	return start <= handle ? db->index[pos] : NULL;
+}
+
+static bool index_insert(struct gatt_db *db, unsigned int pos,
+					struct gatt_db_service *service)
+{
+	if (db->index_len == db->index_size) {
+		struct gatt_db_service **index;
+		unsigned int size = db->index_size ? db->index_size * 2 : 16;
+
+		index = realloc(db->index, size * sizeof(*index));
+		if (!index)
+			return false;
+
+		db->index = index;
+		db->index_size = size;
+	}
+
+	memmove(&db->index[pos + 1], &db->index[pos],
+				(db->index_len - pos) * sizeof(*db->index));
+	db->index[pos] = service;
+	db->index_len++;
+
+	return true;
+}
+
+/* Services don't overlap so the ones within a range are contiguous */
+static void index_range(struct gatt_db *db, uint16_t start, uint16_t end,
+					unsigned int *lo, unsigned int *hi)
+{
+	*lo = index_lower_bound(db, start);
+
+	for (*hi = *lo; *hi < db->index_len; (*hi)++) {
+		uint16_t svc_start;
+
+		gatt_db_service_get_handles(db->index[*hi], &svc_start, NULL);
+		if (svc_start > end)
+			break;
+	}
+}
+
+static void index_remove(struct gatt_db *db, struct gatt_db_service *service)
+{
+	unsigned int pos;
+	uint16_t start;
+
+	gatt_db_service_get_handles(service, &start, NULL);
+
+	pos = index_lower_bound(db, start);
+	if (pos == db->index_len || db->index[pos] != service)
+		return;
+
+	memmove(&db->index[pos], &db->index[pos + 1],
+			(db->index_len - pos - 1) * sizeof(*db->index));
+	db->index_len--;
+}
+
 static void gatt_db_service_destroy(void *data)
 {
 	struct gatt_db_service *service = data;
 	int i;
 
+	if (service->db)
+		index_remove(service->db, service);
+
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
-	for (i = 0; i < service->num_handles; i++)
+	for (i = 0; i < service->num_handles; i++) {
+		if (service->db && service->attributes[i])
+			type_index_remove(service->db, service->attributes[i]);
+
 		attribute_destroy(service->attributes[i]);
+	}
 
 	free(service->attributes);
 	free(service);
@@ -312,7 +608,13 @@ static void gatt_db_destroy(struct gatt_db *db)
 	queue_destroy(db->notify_list, notify_destroy);
 	db->notify_list = NULL;
 
+	db->index_len = 0;
+	queue_foreach(db->types, attr_type_clear, NULL);
+	queue_foreach(db->types128, attr_type_clear, NULL);
 	queue_destroy(db->services, gatt_db_service_destroy);
+	queue_destroy(db->types, attr_type_free);
+	queue_destroy(db->types128, attr_type_free);
+	free(db->index);
 	free(db);
 }
 
@@ -389,6 +691,8 @@ static struct gatt_db_service *gatt_db_service_create(const bt_uuid_t *uuid,
 	if (!service)
 		return NULL;
 
+	service->handle = handle;
+
 	service->attributes = new0(struct gatt_db_attribute *, num_handles);
 	if (!service->attributes) {
 		free(service);
@@ -435,6 +739,9 @@ bool gatt_db_clear(struct gatt_db *db)
 	if (!db)
 		return false;
 
+	db->index_len = 0;
+	queue_foreach(db->types, attr_type_clear, NULL);
+	queue_foreach(db->types128, attr_type_clear, NULL);
 	queue_remove_all(db->services, NULL, NULL, gatt_db_service_destroy);
 
 	db->next_handle = 0;
@@ -442,80 +749,69 @@ bool gatt_db_clear(struct gatt_db *db)
 	return true;
 }
 
-static void gatt_db_service_get_handles(const struct gatt_db_service *service,
-							uint16_t *start_handle,
-							uint16_t *end_handle)
+bool gatt_db_clear_range(struct gatt_db *db, uint16_t start_handle,
+							uint16_t end_handle)
 {
-	if (start_handle)
-		*start_handle = service->attributes[0]->handle;
+	unsigned int lo, hi, i;
+	unsigned int *handles;
+	uint16_t start, end;
 
-	if (end_handle)
-		*end_handle = service->attributes[0]->handle +
-						service->num_handles - 1;
-}
+	if (!db || start_handle > end_handle)
+		return false;
 
-struct clear_range {
-	uint16_t start, end;
-};
+	index_range(db, start_handle, end_handle, &lo, &hi);
+	if (lo == hi)
+		return true;
 
-static bool match_range(const void *a, const void *b)
-{
-	const struct gatt_db_service *service = a;
-	const struct clear_range *range = b;
-	uint16_t svc_start, svc_end;
+	handles = new0(unsigned int, hi - lo);
+	if (!handles)
+		return false;
 
-	gatt_db_service_get_handles(service, &svc_start, &svc_end);
+	for (i = lo; i < hi; i++)
+		handles[i - lo] = db->index[i]->handle;
 
-	return svc_start <= range->end && svc_end >= range->start;
-}
+	/* Services may extend beyond the range being cleared */
+	gatt_db_service_get_handles(db->index[lo], &start, NULL);
+	gatt_db_service_get_handles(db->index[hi - 1], NULL, &end);
+	type_index_remove_range(db, start, end);
 
-bool gatt_db_clear_range(struct gatt_db *db, uint16_t start_handle,
-							uint16_t end_handle)
-{
-	struct clear_range range;
+	memmove(&db->index[lo], &db->index[hi],
+				(db->index_len - hi) * sizeof(*db->index));
+	db->index_len -= hi - lo;
 
-	if (!db || start_handle > end_handle)
-		return false;
+	/*
+	 * Look the services up again by their start handle, since removal
+	 * notifications may have already removed some of them.
+	 */
+	for (i = 0; i < hi - lo; i++) {
+		struct gatt_db_service *service;
 
-	range.start = start_handle;
-	range.end = end_handle;
+		service = queue_remove_by_key(db->services, handles[i]);
+		if (service)
+			gatt_db_service_destroy(service);
+	}
 
-	queue_remove_all(db->services, match_range, &range,
-						gatt_db_service_destroy);
+	free(handles);
 
 	return true;
 }
 
 static bool find_insert_loc(struct gatt_db *db, uint16_t start, uint16_t end,
+						unsigned int *pos,
 						struct gatt_db_service **after)
 {
-	const struct queue_entry *services_entry;
-	struct gatt_db_service *service;
-	uint16_t cur_start, cur_end;
-
-	*after = NULL;
-
-	services_entry = queue_get_entries(db->services);
-
-	while (services_entry) {
-		service = services_entry->data;
+	uint16_t cur_start;
 
-		gatt_db_service_get_handles(service, &cur_start, &cur_end);
+	*pos = index_lower_bound(db, start);
+	*after = *pos ? db->index[*pos - 1] : NULL;
 
-		if (start >= cur_start && start <= cur_end)
-			return false;
-
-		if (end >= cur_start && end <= cur_end)
-			return false;
-
-		if (end < cur_start)
-			return true;
+	if (*pos == db->index_len)
+		return true;
 
-		*after = service;
-		services_entry = services_entry->next;
-	}
+	/* The next service must start after the new range ends */
+	gatt_db_service_get_handles(db->index[*pos], &cur_start, NULL);
 
-	return true;
+	return end < cur_start;
 }
 
 struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
@@ -525,6 +821,7 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 							uint16_t num_handles)
 {
 	struct gatt_db_service *service, *after;
+	unsigned int pos;
 
 	after = NULL;
 
@@ -534,7 +831,8 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	if (num_handles < 1 || (handle + num_handles - 1) > UINT16_MAX)
 		return NULL;
 
-	if (!find_insert_loc(db, handle, handle + num_handles - 1, &after))
+	if (!find_insert_loc(db, handle, handle + num_handles - 1, &pos,
+								&after))
 		return NULL;
 
 	service = gatt_db_service_create(uuid, handle, primary, num_handles);
@@ -549,10 +847,22 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 		goto fail;
 	}
 
-	service->db = db;
 	service->attributes[0]->handle = handle;
 	service->num_handles = num_handles;
 
+	if (!index_insert(db, pos, service)) {
+		queue_remove(db->services, service);
+		goto fail;
+	}
+
+	if (!type_index_add(db, service->attributes[0])) {
+		index_remove(db, service);
+		queue_remove(db->services, service);
+		goto fail;
+	}
+
+	service->db = db;
+
 	/* Fast-forward next_handle if the new service was added to the end */
 	db->next_handle = MAX(handle + num_handles, db->next_handle);
 
@@ -612,11 +922,10 @@ bool gatt_db_unregister(struct gatt_db *db, unsigned int id)
 	if (!db || !id)
 		return false;
 
-	notify = queue_find(db->notify_list, match_notify_id, UINT_TO_PTR(id));
+	notify = queue_remove_by_key(db->notify_list, id);
 	if (!notify)
 		return false;
 
-	queue_remove(db->notify_list, notify);
 	notify_destroy(notify);
 
 	return true;
@@ -655,6 +964,19 @@ attribute_update(struct gatt_db_service *service, int index)
 	return service->attributes[index];
 }
 
+/* Makes a newly added attribute visible to type queries */
+static bool service_index_attribute(struct gatt_db_service *service, int index)
+{
+	if (!service->db || type_index_add(service->db,
+						service->attributes[index]))
+		return true;
+
+	attribute_destroy(service->attributes[index]);
+	service->attributes[index] = NULL;
+
+	return false;
+}
+
 static void set_attribute_data(struct gatt_db_attribute *attribute,
 						gatt_db_read_t read_func,
 						gatt_db_write_t write_func,
@@ -709,15 +1031,29 @@ service_insert_characteristic(struct gatt_db_service *service,
 	i++;
 
 	service->attributes[i] = new_attribute(service, handle, uuid, NULL, 0);
-	if (!service->attributes[i]) {
-		free(service->attributes[i - 1]);
+	if (!service->attributes[i])
+		goto fail;
+
+	if (!service_index_attribute(service, i - 1)) {
+		attribute_destroy(service->attributes[i]);
+		service->attributes[i] = NULL;
 		return NULL;
 	}
 
+	if (!service_index_attribute(service, i)) {
+		type_index_remove(service->db, service->attributes[i - 1]);
+		goto fail;
+	}
+
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
 	return service->attributes[i];
+
+fail:
+	attribute_destroy(service->attributes[i - 1]);
+	service->attributes[i - 1] = NULL;
+	return NULL;
 }
 
 struct gatt_db_attribute *
@@ -783,6 +1119,9 @@ service_insert_descriptor(struct gatt_db_service *service,
 	if (!service->attributes[i])
 		return NULL;
 
+	if (!service_index_attribute(service, i))
+		return NULL;
+
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
@@ -874,7 +1213,12 @@ gatt_db_service_add_included(struct gatt_db_attribute *attrib,
 	 */
 	set_attribute_data(service->attributes[index], NULL, NULL, 0, NULL);
 
-	return attribute_update(service, index);
+	attribute_update(service, index);
+
+	if (!service_index_attribute(service, index))
+		return NULL;
+
+	return service->attributes[index];
 }
 
 bool gatt_db_service_set_active(struct gatt_db_attribute *attrib, bool active)
@@ -928,41 +1272,34 @@ void gatt_db_read_by_group_type(struct gatt_db *db, uint16_t start_handle,
 							const bt_uuid_t type,
 							struct queue *queue)
 {
-	const struct queue_entry *services_entry;
-	struct gatt_db_service *service;
-	uint16_t grp_start, grp_end, uuid_size;
+	struct attr_type *attr_type;
+	unsigned int i;
+	uint16_t uuid_size;
 
 	uuid_size = 0;
 
-	services_entry = queue_get_entries(db->services);
-
-	while (services_entry) {
-		service = services_entry->data;
-
-		if (!service->active)
-			goto next_service;
-
-		if (bt_uuid_cmp(&type, &service->attributes[0]->uuid))
-			goto next_service;
+	attr_type = find_attr_type(db, &type, false);
+	if (!attr_type)
+		return;
 
-		grp_start = service->attributes[0]->handle;
-		grp_end = grp_start + service->num_handles - 1;
+	for (i = attr_type_lower_bound(attr_type, start_handle);
+						i < attr_type->len; i++) {
+		struct gatt_db_attribute *attr = attr_type->attrs[i];
+		struct gatt_db_service *service = attr->service;
 
-		if (grp_end < start_handle || grp_start > end_handle)
-			goto next_service;
+		if (attr->handle > end_handle)
+			break;
 
-		if (grp_start < start_handle || grp_start > end_handle)
-			goto next_service;
+		/* Only service declarations can start a group */
+		if (!service->active || attr != service->attributes[0])
+			continue;
 
 		if (!uuid_size)
-			uuid_size = service->attributes[0]->value_len;
-		else if (uuid_size != service->attributes[0]->value_len)
+			uuid_size = attr->value_len;
+		else if (uuid_size != attr->value_len)
 			return;
 
-		queue_push_tail(queue, service->attributes[0]);
-
-next_service:
-		services_entry = services_entry->next;
+		queue_push_tail(queue, attr);
 	}
 }
 
@@ -977,27 +1314,24 @@ struct find_by_type_value_data {
 	unsigned int num_of_res;
 };
 
-static void find_by_type(void *data, void *user_data)
+static void find_by_type(struct gatt_db *db,
+				struct find_by_type_value_data *search_data)
 {
-	struct find_by_type_value_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-	struct gatt_db_attribute *attribute;
-	int i;
+	struct attr_type *type;
+	unsigned int i;
 
-	if (!service->active)
+	type = find_attr_type(db, &search_data->uuid, false);
+	if (!type)
 		return;
 
-	for (i = 0; i < service->num_handles; i++) {
-		attribute = service->attributes[i];
-
-		if (!attribute)
-			continue;
+	for (i = attr_type_lower_bound(type, search_data->start_handle);
+							i < type->len; i++) {
+		struct gatt_db_attribute *attribute = type->attrs[i];
 
-		if ((attribute->handle < search_data->start_handle) ||
-				(attribute->handle > search_data->end_handle))
-			continue;
+		if (attribute->handle > search_data->end_handle)
+			break;
 
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
+		if (!attribute->service->active)
 			continue;
 
 		/* TODO: fix for read-callback based attributes */
@@ -1027,7 +1361,7 @@ unsigned int gatt_db_find_by_type(struct gatt_db *db, uint16_t start_handle,
 	data.func = func;
 	data.user_data = user_data;
 
-	queue_foreach(db->services, find_by_type, &data);
+	find_by_type(db, &data);
 
 	return data.num_of_res;
 }
@@ -1051,7 +1385,7 @@ unsigned int gatt_db_find_by_type_value(struct gatt_db *db,
 	data.value = value;
 	data.value_len = value_len;
 
-	queue_foreach(db->services, find_by_type, &data);
+	find_by_type(db, &data);
 
 	return data.num_of_res;
 }
@@ -1063,28 +1397,24 @@ struct read_by_type_data {
 	uint16_t end_handle;
 };
 
-static void read_by_type(void *data, void *user_data)
+static void read_by_type(struct gatt_db *db,
+				struct read_by_type_data *search_data)
 {
-	struct read_by_type_data *search_data = user_data;
-	struct gatt_db_service *service = data;
-	struct gatt_db_attribute *attribute;
-	int i;
+	struct attr_type *type;
+	unsigned int i;
 
-	if (!service->active)
+	type = find_attr_type(db, &search_data->uuid, false);
+	if (!type)
 		return;
 
-	for (i = 0; i < service->num_handles; i++) {
-		attribute = service->attributes[i];
-		if (!attribute)
-			continue;
-
-		if (attribute->handle < search_data->start_handle)
-			continue;
+	for (i = attr_type_lower_bound(type, search_data->start_handle);
+							i < type->len; i++) {
+		struct gatt_db_attribute *attribute = type->attrs[i];
 
 		if (attribute->handle > search_data->end_handle)
-			return;
+			break;
 
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
+		if (!attribute->service->active)
 			continue;
 
 		queue_push_tail(search_data->queue, attribute);
@@ -1102,7 +1432,7 @@ void gatt_db_read_by_type(struct gatt_db *db, uint16_t start_handle,
 	data.end_handle = end_handle;
 	data.queue = queue;
 
-	queue_foreach(db->services, read_by_type, &data);
+	read_by_type(db, &data);
 }
 
 
@@ -1293,31 +1623,26 @@ void gatt_db_service_foreach_incl(struct gatt_db_attribute *attrib,
 								user_data);
 }
 
-static bool find_service_for_handle(const void *data, const void *user_data)
-{
-	const struct gatt_db_service *service = data;
-	uint16_t handle = PTR_TO_UINT(user_data);
-	uint16_t start, end;
-
-	gatt_db_service_get_handles(service, &start, &end);
-
-	return (start <= handle) && (handle <= end);
-}
-
 struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 							uint16_t handle)
 {
 	struct gatt_db_service *service;
+	struct gatt_db_attribute *attr;
 	int i;
 
 	if (!db || !handle)
 		return NULL;
 
-	service = queue_find(db->services, find_service_for_handle,
-							UINT_TO_PTR(handle));
+	service = index_find(db, handle);
 	if (!service)
 		return NULL;
 
+	/* Attributes are usually laid out without gaps */
+	i = handle - service->attributes[0]->handle;
+	attr = service->attributes[i];
+	if (attr && attr->handle == handle)
+		return attr;
+
 	for (i = 0; i < service->num_handles; i++) {
 		if (!service->attributes[i])
 			continue;
@@ -47,6 +47,9 @@
  */
 #define DEFAULT_MAX_PREP_QUEUE_LEN 30
 
+#define RSP_CACHE_BUCKETS	64
+#define RSP_CACHE_MAX		512
+
 struct async_read_op {
 	struct bt_gatt_server *server;
 	uint8_t opcode;
@@ -55,6 +58,12 @@ struct async_read_op {
 	size_t pdu_len;
 	size_t value_len;
 	struct queue *db_data;
+
+	/* Set if the response can be cached */
+	bool cache;
+	uint16_t start;
+	uint16_t end;
+	bt_uuid_t type;
 };
 
 struct async_write_op {
@@ -78,6 +87,197 @@ static void prep_write_data_destroy(void *user_data)
 	free(data);
 }
 
+/*
+ * Discovery responses only depend on the layout of the database, which every
+ * connection served from the same database shares. Once encoded they are kept
+ * until a service is added or removed.
+ */
+struct rsp_cache_entry {
+	uint8_t opcode;
+	uint16_t start;
+	uint16_t end;
+	uint16_t mtu;
+	bt_uuid_t type;
+	uint16_t len;
+	uint8_t pdu[0];
+};
+
+struct rsp_cache {
+	struct gatt_db *db;
+	int ref_count;
+	unsigned int db_id;
+	unsigned int num_entries;
+	struct queue *buckets[RSP_CACHE_BUCKETS];
+};
+
+static struct queue *rsp_caches;
+
+static void rsp_cache_clear(struct rsp_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < RSP_CACHE_BUCKETS; i++) {
+		queue_destroy(cache->buckets[i], free);
+		cache->buckets[i] = NULL;
+	}
+
+	cache->num_entries = 0;
+}
+
+static void rsp_cache_service_changed(struct gatt_db_attribute *attrib,
+							void *user_data)
+{
+	rsp_cache_clear(user_data);
+}
+
+static bool match_rsp_cache_db(const void *a, const void *b)
+{
+	const struct rsp_cache *cache = a;
+
+	return cache->db == b;
+}
+
+static struct rsp_cache *rsp_cache_get(struct gatt_db *db)
+{
+	struct rsp_cache *cache;
+
+	cache = queue_find(rsp_caches, match_rsp_cache_db, db);
+	if (cache)
+		goto done;
+
+	if (!rsp_caches) {
+		rsp_caches = queue_new();
+		if (!rsp_caches)
+			return NULL;
+	}
+
+	cache = new0(struct rsp_cache, 1);
+	if (!cache)
+		return NULL;
+
+	cache->db_id = gatt_db_register(db, rsp_cache_service_changed,
+						rsp_cache_service_changed,
+						cache, NULL);
+	if (!cache->db_id) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->db = gatt_db_ref(db);
+	queue_push_tail(rsp_caches, cache);
+
+done:
+	cache->ref_count++;
+
+	return cache;
+}
+
+static void rsp_cache_put(struct rsp_cache *cache)
+{
+	if (!cache || --cache->ref_count)
+		return;
+
+	queue_remove(rsp_caches, cache);
+
+	if (queue_isempty(rsp_caches)) {
+		queue_destroy(rsp_caches, NULL);
+		rsp_caches = NULL;
+	}
+
+	gatt_db_unregister(cache->db, cache->db_id);
+	gatt_db_unref(cache->db);
+	rsp_cache_clear(cache);
+	free(cache);
+}
+
+static unsigned int rsp_cache_hash(uint8_t opcode, uint16_t start,
+						uint16_t end, uint16_t mtu)
+{
+	return (opcode * 31 + start * 7 + end + mtu) % RSP_CACHE_BUCKETS;
+}
+
+struct rsp_cache_key {
+	uint8_t opcode;
+	uint16_t start;
+	uint16_t end;
+	uint16_t mtu;
+	const bt_uuid_t *type;
+};
+
+static bool match_rsp_cache_entry(const void *a, const void *b)
+{
+	const struct rsp_cache_entry *entry = a;
+	const struct rsp_cache_key *key = b;
+
+	if (entry->opcode != key->opcode || entry->start != key->start ||
+			entry->end != key->end || entry->mtu != key->mtu)
+		return false;
+
+	if (!key->type)
+		return true;
+
+	return !bt_uuid_cmp(&entry->type, key->type);
+}
+
+static const struct rsp_cache_entry *rsp_cache_lookup(struct rsp_cache *cache,
+						uint8_t opcode, uint16_t start,
+						uint16_t end,
+						const bt_uuid_t *type,
+						uint16_t mtu)
+{
+	struct rsp_cache_key key = { opcode, start, end, mtu, type };
+
+	if (!cache)
+		return NULL;
+
+	return queue_find(cache->buckets[rsp_cache_hash(opcode, start, end,
+								mtu)],
+						match_rsp_cache_entry, &key);
+}
+
+static void rsp_cache_store(struct rsp_cache *cache, uint8_t opcode,
+					uint16_t start, uint16_t end,
+					const bt_uuid_t *type, uint16_t mtu,
+					const uint8_t *pdu, uint16_t len)
+{
+	struct rsp_cache_entry *entry;
+	unsigned int hash;
+
+	if (!cache)
+		return;
+
+	/* Start over rather than tracking the age of entries */
+	if (cache->num_entries >= RSP_CACHE_MAX)
+		rsp_cache_clear(cache);
+
+	hash = rsp_cache_hash(opcode, start, end, mtu);
+
+	if (!cache->buckets[hash]) {
+		cache->buckets[hash] = queue_new();
+		if (!cache->buckets[hash])
+			return;
+	}
+
+	entry = malloc(sizeof(*entry) + len);
+	if (!entry)
+		return;
+
+	entry->opcode = opcode;
+	entry->start = start;
+	entry->end = end;
+	entry->mtu = mtu;
+	entry->len = len;
+	memcpy(entry->pdu, pdu, len);
+
+	if (type)
+		entry->type = *type;
+	else
+		memset(&entry->type, 0, sizeof(entry->type));
+
+	queue_push_tail(cache->buckets[hash], entry);
+	cache->num_entries++;
+}
+
 struct bt_gatt_server {
 	struct gatt_db *db;
 	struct bt_att *att;
@@ -100,6 +300,9 @@ struct bt_gatt_server {
 	struct queue *prep_queue;
 	unsigned int max_prep_queue_len;
 
+	struct rsp_cache *rsp_cache;
+	struct bt_gatt_server_cache_stats cache_stats;
+
 	struct async_read_op *pending_read_op;
 	struct async_write_op *pending_write_op;
 
@@ -134,11 +337,32 @@ static void bt_gatt_server_free(struct bt_gatt_server *server)
 
 	queue_destroy(server->prep_queue, prep_write_data_destroy);
 
+	rsp_cache_put(server->rsp_cache);
+
 	gatt_db_unref(server->db);
 	bt_att_unref(server->att);
 	free(server);
 }
 
+static const struct rsp_cache_entry *cache_lookup(
+						struct bt_gatt_server *server,
+						uint8_t opcode, uint16_t start,
+						uint16_t end,
+						const bt_uuid_t *type,
+						uint16_t mtu)
+{
+	const struct rsp_cache_entry *entry;
+
+	entry = rsp_cache_lookup(server->rsp_cache, opcode, start, end, type,
+									mtu);
+	if (entry)
+		server->cache_stats.hits++;
+	else
+		server->cache_stats.misses++;
+
+	return entry;
+}
+
 static bool get_uuid_le(const uint8_t *uuid, size_t len, bt_uuid_t *out_uuid)
 {
 	uint128_t u128;
@@ -241,6 +465,7 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 	uint8_t ecode = 0;
 	uint16_t ehandle = 0;
 	struct queue *q = NULL;
+	const struct rsp_cache_entry *entry;
 
 	if (length != 6 && length != 20) {
 		ecode = BT_ATT_ERROR_INVALID_PDU;
@@ -286,6 +511,15 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	entry = cache_lookup(server, opcode, start, end, &type, mtu);
+	if (entry) {
+		queue_destroy(q, NULL);
+		bt_att_send(server->att, BT_ATT_OP_READ_BY_GRP_TYPE_RSP,
+						entry->pdu, entry->len,
+						NULL, NULL, NULL);
+		return;
+	}
+
 	gatt_db_read_by_group_type(server->db, start, end, type, q);
 
 	if (queue_isempty(q)) {
@@ -301,6 +535,9 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 
 	queue_destroy(q, NULL);
 
+	rsp_cache_store(server->rsp_cache, opcode, start, end, &type, mtu,
+							rsp_pdu, rsp_len);
+
 	bt_att_send(server->att, BT_ATT_OP_READ_BY_GRP_TYPE_RSP,
 							rsp_pdu, rsp_len,
 							NULL, NULL, NULL);
@@ -414,6 +651,12 @@ static void process_read_by_type(struct async_read_op *op)
 	attr = queue_pop_head(op->db_data);
 
 	if (op->done || !attr) {
+		if (op->cache)
+			rsp_cache_store(server->rsp_cache, op->opcode,
+						op->start, op->end, &op->type,
+						bt_att_get_mtu(server->att),
+						op->pdu, op->pdu_len);
+
 		bt_att_send(server->att, BT_ATT_OP_READ_BY_TYPE_RSP, op->pdu,
 								op->pdu_len,
 								NULL, NULL,
@@ -440,6 +683,19 @@ error:
 	async_read_op_destroy(op);
 }
 
+static bool is_declaration(const bt_uuid_t *type)
+{
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, GATT_INCLUDE_UUID);
+	if (!bt_uuid_cmp(type, &uuid))
+		return true;
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_UUID);
+
+	return !bt_uuid_cmp(type, &uuid);
+}
+
 static void read_by_type_cb(uint8_t opcode, const void *pdu,
 					uint16_t length, void *user_data)
 {
@@ -450,6 +706,8 @@ static void read_by_type_cb(uint8_t opcode, const void *pdu,
 	uint8_t ecode;
 	struct queue *q = NULL;
 	struct async_read_op *op;
+	const struct rsp_cache_entry *entry = NULL;
+	bool cache;
 
 	if (length != 6 && length != 20) {
 		ecode = BT_ATT_ERROR_INVALID_PDU;
@@ -482,6 +740,22 @@ static void read_by_type_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	/*
+	 * Include and characteristic declarations are static and readable
+	 * regardless of security, unlike the values other types may refer to.
+	 */
+	cache = is_declaration(&type);
+	if (cache)
+		entry = cache_lookup(server, opcode, start, end, &type,
+						bt_att_get_mtu(server->att));
+	if (entry) {
+		queue_destroy(q, NULL);
+		bt_att_send(server->att, BT_ATT_OP_READ_BY_TYPE_RSP,
+						entry->pdu, entry->len,
+						NULL, NULL, NULL);
+		return;
+	}
+
 	gatt_db_read_by_type(server->db, start, end, type, q);
 
 	if (queue_isempty(q)) {
@@ -510,6 +784,10 @@ static void read_by_type_cb(uint8_t opcode, const void *pdu,
 	op->opcode = opcode;
 	op->server = server;
 	op->db_data = q;
+	op->cache = cache;
+	op->start = start;
+	op->end = end;
+	op->type = type;
 	server->pending_read_op = op;
 
 	process_read_by_type(op);
@@ -586,6 +864,7 @@ static void find_info_cb(uint8_t opcode, const void *pdu,
 	uint8_t ecode = 0;
 	uint16_t ehandle = 0;
 	struct queue *q = NULL;
+	const struct rsp_cache_entry *entry;
 
 	if (length != 4) {
 		ecode = BT_ATT_ERROR_INVALID_PDU;
@@ -617,6 +896,14 @@ static void find_info_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	entry = cache_lookup(server, opcode, start, end, NULL, mtu);
+	if (entry) {
+		queue_destroy(q, NULL);
+		bt_att_send(server->att, BT_ATT_OP_FIND_INFO_RSP, entry->pdu,
+						entry->len, NULL, NULL, NULL);
+		return;
+	}
+
 	gatt_db_find_information(server->db, start, end, q);
 
 	if (queue_isempty(q)) {
@@ -629,6 +916,9 @@ static void find_info_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	rsp_cache_store(server->rsp_cache, opcode, start, end, NULL, mtu,
+							rsp_pdu, rsp_len);
+
 	bt_att_send(server->att, BT_ATT_OP_FIND_INFO_RSP, rsp_pdu, rsp_len,
 							NULL, NULL, NULL);
 	queue_destroy(q, NULL);
@@ -1432,6 +1722,9 @@ struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
 		return NULL;
 	}
 
+	/* Not fatal, responses are just encoded every time without it */
+	server->rsp_cache = rsp_cache_get(db);
+
 	if (!gatt_server_register_att_handlers(server)) {
 		bt_gatt_server_free(server);
 		return NULL;
@@ -1461,6 +1754,17 @@ void bt_gatt_server_unref(struct bt_gatt_server *server)
 	bt_gatt_server_free(server);
 }
 
+bool bt_gatt_server_get_cache_stats(struct bt_gatt_server *server,
+				struct bt_gatt_server_cache_stats *stats)
+{
+	if (!server || !stats)
+		return false;
+
+	*stats = server->cache_stats;
+
+	return true;
+}
+
 bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 					bt_gatt_server_debug_func_t callback,
 					void *user_data,
@@ -1479,30 +1783,36 @@ bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 	return true;
 }
 
+/*
+ * The PDU is assembled by bt_att straight from the value of the caller, no
+ * intermediate copy is made when sending one value to many bearers.
+ */
+static void encode_value_pdu(struct bt_gatt_server *server, uint16_t handle,
+					const uint8_t *value, uint16_t length,
+					uint8_t hdr[2], struct iovec iov[2])
+{
+	put_le16(handle, hdr);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = 2;
+	iov[1].iov_base = (void *) value;
+	iov[1].iov_len = MIN(bt_att_get_mtu(server->att) - 3, length);
+}
+
 bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length)
 {
-	uint16_t pdu_len;
-	uint8_t *pdu;
-	bool result;
+	uint8_t hdr[2];
+	struct iovec iov[2];
 
 	if (!server || (length && !value))
 		return false;
 
-	pdu_len = MIN(bt_att_get_mtu(server->att) - 1, length + 2);
-	pdu = malloc(pdu_len);
-	if (!pdu)
-		return false;
-
-	put_le16(handle, pdu);
-	memcpy(pdu + 2, value, pdu_len - 2);
-
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_VAL_NOT, pdu,
-						pdu_len, NULL, NULL, NULL);
-	free(pdu);
+	encode_value_pdu(server, handle, value, length, hdr, iov);
 
-	return result;
+	return !!bt_att_send_iov(server->att, BT_ATT_OP_HANDLE_VAL_NOT, iov, 2,
+							NULL, NULL, NULL);
 }
 
 struct ind_data {
@@ -1537,39 +1847,29 @@ bool bt_gatt_server_send_indication(struct bt_gatt_server *server,
 					void *user_data,
 					bt_gatt_server_destroy_func_t destroy)
 {
-	uint16_t pdu_len;
-	uint8_t *pdu;
+	uint8_t hdr[2];
+	struct iovec iov[2];
 	struct ind_data *data;
 	bool result;
 
 	if (!server || (length && !value))
 		return false;
 
-	pdu_len = MIN(bt_att_get_mtu(server->att) - 1, length + 2);
-	pdu = malloc(pdu_len);
-	if (!pdu)
-		return false;
-
 	data = new0(struct ind_data, 1);
-	if (!data) {
-		free(pdu);
+	if (!data)
 		return false;
-	}
 
 	data->callback = callback;
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	put_le16(handle, pdu);
-	memcpy(pdu + 2, value, pdu_len - 2);
+	encode_value_pdu(server, handle, value, length, hdr, iov);
 
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_VAL_IND, pdu,
-							pdu_len, conf_cb,
+	result = !!bt_att_send_iov(server->att, BT_ATT_OP_HANDLE_VAL_IND, iov,
+							2, conf_cb,
 							data, destroy_ind_data);
 	if (!result)
 		destroy_ind_data(data);
 
-	free(pdu);
-
 	return result;
 }
@@ -40,6 +40,14 @@ bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 					void *user_data,
 					bt_gatt_server_destroy_func_t destroy);
 
+struct bt_gatt_server_cache_stats {
+	uint64_t hits;		/* Responses copied from the cache */
+	uint64_t misses;	/* Cacheable requests looked up in the db */
+};
+
+bool bt_gatt_server_get_cache_stats(struct bt_gatt_server *server,
+				struct bt_gatt_server_cache_stats *stats);
+
 bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length);
@@ -26,6 +26,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -55,6 +56,17 @@ struct hci_filter {
 	uint16_t opcode;
 };
 
+#define HCI_WRITE_BATCH		16
+#define HCI_MAX_FRAME_SIZE	(1 + 4 + 4096)
+
+#define NUM_BUF_POOLS		3
+
+struct buf_pool {
+	uint16_t mtu;
+	uint16_t count;
+	uint16_t avail;
+};
+
 struct bt_hci {
 	int ref_count;
 	struct io *io;
@@ -66,6 +78,21 @@ struct bt_hci {
 	struct queue *cmd_queue;
 	struct queue *rsp_queue;
 	struct queue *evt_list;
+	struct queue *data_list;
+	struct queue *conn_list;
+	struct queue *tx_conns;
+	struct buf_pool pools[NUM_BUF_POOLS];
+
+	/*
+	 * On stream transports packets are reassembled in rx_buf, and the
+	 * rest of a packet that was written only partially is kept in
+	 * tx_rest, which has to go out before anything else.
+	 */
+	uint8_t *rx_buf;
+	uint16_t rx_len;
+	uint8_t *tx_rest;
+	uint16_t tx_rest_off;
+	uint16_t tx_rest_len;
 };
 
 struct cmd {
@@ -86,6 +113,37 @@ struct evt {
 	void *user_data;
 };
 
+struct data {
+	unsigned int id;
+	uint8_t type;
+	bt_hci_data_func_t callback;
+	bt_hci_destroy_func_t destroy;
+	void *user_data;
+};
+
+/*
+ * Outgoing data is queued per connection handle. Connections with queued
+ * packets sit on tx_conns and are served round robin, one packet per turn,
+ * as long as their buffer pool has credits left.
+ */
+struct conn {
+	unsigned int handle;
+	uint8_t pool;
+	bool scheduled;
+	unsigned int sent;
+	struct queue *tx_queue;
+};
+
+struct pkt {
+	uint16_t len;
+	uint8_t data[0];
+};
+
+struct tx {
+	struct conn *conn;
+	struct pkt *pkt;
+};
+
 static void cmd_free(void *data)
 {
 	struct cmd *cmd = data;
@@ -107,49 +165,383 @@ static void evt_free(void *data)
 	free(evt);
 }
 
-static void send_command(struct bt_hci *hci, uint16_t opcode,
+static void data_free(void *data)
+{
+	struct data *handler = data;
+
+	if (handler->destroy)
+		handler->destroy(handler->user_data);
+
+	free(handler);
+}
+
+static void conn_free(void *data)
+{
+	struct conn *conn = data;
+
+	queue_destroy(conn->tx_queue, free);
+	free(conn);
+}
+
+static struct buf_pool *conn_pool(struct bt_hci *hci, struct conn *conn)
+{
+	/* Without dedicated LE buffers, LE links share the ACL buffers */
+	if (conn->pool == BT_HCI_BUF_LE && !hci->pools[BT_HCI_BUF_LE].count)
+		return &hci->pools[BT_HCI_BUF_ACL];
+
+	return &hci->pools[conn->pool];
+}
+
+static struct conn *conn_get(struct bt_hci *hci, uint16_t handle,
+								uint8_t pool)
+{
+	struct conn *conn;
+
+	conn = queue_find_by_key(hci->conn_list, handle);
+	if (conn)
+		return conn;
+
+	conn = new0(struct conn, 1);
+	if (!conn)
+		return NULL;
+
+	conn->handle = handle;
+	conn->pool = pool;
+
+	conn->tx_queue = queue_new();
+	if (!conn->tx_queue) {
+		free(conn);
+		return NULL;
+	}
+
+	if (!queue_push_tail(hci->conn_list, conn)) {
+		conn_free(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+static void conn_schedule(struct bt_hci *hci, struct conn *conn)
+{
+	if (conn->scheduled || queue_isempty(conn->tx_queue))
+		return;
+
+	if (queue_push_tail(hci->tx_conns, conn))
+		conn->scheduled = true;
+}
+
+static void conn_remove(struct bt_hci *hci, uint16_t handle)
+{
+	struct conn *conn;
+	struct buf_pool *pool;
+
+	conn = queue_remove_by_key(hci->conn_list, handle);
+	if (!conn)
+		return;
+
+	if (conn->scheduled)
+		queue_remove(hci->tx_conns, conn);
+
+	/* The controller flushes whatever was pending for the handle */
+	pool = conn_pool(hci, conn);
+	pool->avail += conn->sent;
+	if (pool->avail > pool->count)
+		pool->avail = pool->count;
+
+	conn_free(conn);
+}
+
+static void conn_flush(void *data, void *user_data)
+{
+	struct conn *conn = data;
+
+	conn->scheduled = false;
+	queue_remove_all(conn->tx_queue, NULL, NULL, free);
+}
+
+static bool can_send_data(struct bt_hci *hci)
+{
+	const struct queue_entry *entry;
+
+	for (entry = queue_get_entries(hci->tx_conns); entry;
+							entry = entry->next) {
+		if (conn_pool(hci, entry->data)->avail)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Writes one packet per iovec to a stream. Returns the number of packets
+ * that went out, including one that was written partially and whose rest
+ * is now pending in tx_rest.
+ */
+static int stream_send(struct bt_hci *hci, const struct iovec *iov,
+								int iovcnt)
+{
+	ssize_t ret;
+	size_t left;
+	int i;
+
+	ret = io_send(hci->io, iov, iovcnt);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < iovcnt && (size_t) ret >= iov[i].iov_len; i++)
+		ret -= iov[i].iov_len;
+
+	if (i == iovcnt || !ret)
+		return i;
+
+	left = iov[i].iov_len - ret;
+
+	hci->tx_rest = malloc(left);
+	if (!hci->tx_rest)
+		return -ENOMEM;
+
+	memcpy(hci->tx_rest, iov[i].iov_base + ret, left);
+	hci->tx_rest_off = 0;
+	hci->tx_rest_len = left;
+
+	return i + 1;
+}
+
+static int flush_rest(struct bt_hci *hci)
+{
+	struct iovec iov;
+	ssize_t ret;
+
+	if (!hci->tx_rest)
+		return 0;
+
+	iov.iov_base = hci->tx_rest + hci->tx_rest_off;
+	iov.iov_len = hci->tx_rest_len - hci->tx_rest_off;
+
+	ret = io_send(hci->io, &iov, 1);
+	if (ret < 0)
+		return ret;
+
+	hci->tx_rest_off += ret;
+	if (hci->tx_rest_off < hci->tx_rest_len)
+		return -EAGAIN;
+
+	free(hci->tx_rest);
+	hci->tx_rest = NULL;
+
+	return 0;
+}
+
+static int send_command(struct bt_hci *hci, uint16_t opcode,
 						void *data, uint8_t size)
 {
-	uint8_t type = BT_H4_CMD_PKT;
+	uint8_t buf[1 + sizeof(struct bt_hci_cmd_hdr) + UINT8_MAX];
 	struct bt_hci_cmd_hdr hdr;
-	struct iovec iov[3];
-	int iovcnt;
+	struct iovec iov;
+	int ret;
 
 	if (hci->num_cmds < 1)
-		return;
+		return -EBUSY;
 
 	hdr.opcode = cpu_to_le16(opcode);
 	hdr.plen = size;
 
-	iov[0].iov_base = &type;
-	iov[0].iov_len  = 1;
-	iov[1].iov_base = &hdr;
-	iov[1].iov_len  = sizeof(hdr);
+	buf[0] = BT_H4_CMD_PKT;
+	memcpy(buf + 1, &hdr, sizeof(hdr));
+	if (size > 0)
+		memcpy(buf + 1 + sizeof(hdr), data, size);
 
-	if (size > 0) {
-		iov[2].iov_base = data;
-		iov[2].iov_len  = size;
-		iovcnt = 3;
+	iov.iov_base = buf;
+	iov.iov_len = 1 + sizeof(hdr) + size;
+
+	if (hci->is_stream) {
+		ret = stream_send(hci, &iov, 1);
+		if (!ret)
+			ret = -EAGAIN;
 	} else
-		iovcnt = 2;
+		ret = io_send(hci->io, &iov, 1);
 
-	if (io_send(hci->io, iov, iovcnt) < 0)
-		return;
+	if (ret < 0)
+		return ret;
 
 	hci->num_cmds--;
+
+	return 0;
+}
+
+/* Takes up to max packets off the connection queues, round robin */
+static unsigned int pick_data(struct bt_hci *hci, struct tx *batch,
+							unsigned int max)
+{
+	unsigned int count = 0, misses = 0;
+
+	while (count < max && misses < queue_length(hci->tx_conns)) {
+		struct conn *conn;
+		struct buf_pool *pool;
+
+		conn = queue_pop_head(hci->tx_conns);
+		pool = conn_pool(hci, conn);
+
+		if (!pool->avail) {
+			queue_push_tail(hci->tx_conns, conn);
+			misses++;
+			continue;
+		}
+
+		misses = 0;
+
+		batch[count].conn = conn;
+		batch[count].pkt = queue_pop_head(conn->tx_queue);
+		count++;
+
+		pool->avail--;
+		conn->sent++;
+
+		if (queue_isempty(conn->tx_queue))
+			conn->scheduled = false;
+		else
+			queue_push_tail(hci->tx_conns, conn);
+	}
+
+	return count;
+}
+
+/* Puts a picked packet back in front of its connection queue */
+static void unpick_data(struct bt_hci *hci, struct tx *tx)
+{
+	struct conn *conn = tx->conn;
+
+	queue_push_head(conn->tx_queue, tx->pkt);
+
+	conn_pool(hci, conn)->avail++;
+	conn->sent--;
+
+	if (!conn->scheduled && queue_push_head(hci->tx_conns, conn))
+		conn->scheduled = true;
+}
+
+static int write_data(struct bt_hci *hci, struct tx *batch,
+							unsigned int count)
+{
+	struct mmsghdr msgs[HCI_WRITE_BATCH];
+	struct iovec iov[HCI_WRITE_BATCH];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = batch[i].pkt->data;
+		iov[i].iov_len = batch[i].pkt->len;
+	}
+
+	/* A stream has no packet boundaries to keep, so the whole batch
+	 * can go out with a single writev.
+	 */
+	if (hci->is_stream)
+		return stream_send(hci, iov, count);
+
+	if (count == 1) {
+		ret = io_send(hci->io, iov, count);
+		return ret < 0 ? ret : 1;
+	}
+
+	memset(msgs, 0, count * sizeof(*msgs));
+
+	for (i = 0; i < count; i++) {
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		ret = sendmmsg(io_get_fd(hci->io), msgs, count, MSG_DONTWAIT);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+static bool send_data(struct bt_hci *hci)
+{
+	struct tx batch[HCI_WRITE_BATCH];
+	unsigned int count, i;
+	int ret;
+
+	count = pick_data(hci, batch, HCI_WRITE_BATCH);
+	if (!count)
+		return true;
+
+	ret = write_data(hci, batch, count);
+	if (ret == -EAGAIN || ret == -EWOULDBLOCK)
+		ret = 0;
+
+	if (ret < 0) {
+		/* The transport failed, drop what has been picked */
+		for (i = 0; i < count; i++) {
+			conn_pool(hci, batch[i].conn)->avail++;
+			batch[i].conn->sent--;
+			free(batch[i].pkt);
+		}
+
+		return false;
+	}
+
+	for (i = count; i > (unsigned int) ret; i--)
+		unpick_data(hci, &batch[i - 1]);
+
+	for (i = 0; i < (unsigned int) ret; i++)
+		free(batch[i].pkt);
+
+	return true;
 }
 
 static bool io_write_callback(struct io *io, void *user_data)
 {
 	struct bt_hci *hci = user_data;
 	struct cmd *cmd;
+	int ret;
 
-	cmd = queue_pop_head(hci->cmd_queue);
-	if (cmd) {
-		send_command(hci, cmd->opcode, cmd->data, cmd->size);
+	ret = flush_rest(hci);
+	if (ret == -EAGAIN || ret == -EWOULDBLOCK)
+		return true;
+
+	if (ret < 0)
+		goto done;
+
+	/* Commands go first, as many as the controller allows */
+	while (hci->num_cmds > 0) {
+		cmd = queue_peek_head(hci->cmd_queue);
+		if (!cmd)
+			break;
+
+		ret = send_command(hci, cmd->opcode, cmd->data, cmd->size);
+		if (ret == -EAGAIN || ret == -EWOULDBLOCK)
+			return true;
+
+		if (ret < 0)
+			goto done;
+
+		queue_pop_head(hci->cmd_queue);
 		queue_push_tail(hci->rsp_queue, cmd);
+
+		if (hci->tx_rest)
+			return true;
 	}
 
+	if (!send_data(hci))
+		goto done;
+
+	if (hci->tx_rest)
+		return true;
+
+	if (hci->num_cmds > 0 && !queue_isempty(hci->cmd_queue))
+		return true;
+
+	if (can_send_data(hci))
+		return true;
+
+done:
 	hci->writer_active = false;
 
 	return false;
@@ -160,11 +552,11 @@ static void wakeup_writer(struct bt_hci *hci)
 	if (hci->writer_active)
 		return;
 
-	if (hci->num_cmds < 1)
-		return;
-
-	if (queue_isempty(hci->cmd_queue))
-		return;
+	if (!hci->tx_rest && (hci->num_cmds < 1 ||
+					queue_isempty(hci->cmd_queue))) {
+		if (!can_send_data(hci))
+			return;
+	}
 
 	if (!io_set_write_handler(hci->io, io_write_callback, hci, NULL))
 		return;
@@ -202,6 +594,145 @@ done:
 	wakeup_writer(hci);
 }
 
+static void set_pool(struct bt_hci *hci, uint8_t index, uint16_t mtu,
+							uint16_t count)
+{
+	struct buf_pool *pool = &hci->pools[index];
+	uint16_t used = pool->count - pool->avail;
+
+	pool->mtu = mtu;
+	pool->count = count;
+	pool->avail = count > used ? count - used : 0;
+}
+
+static void process_buffer_size(struct bt_hci *hci, uint16_t opcode,
+					const void *data, size_t size)
+{
+	const struct bt_hci_rsp_read_buffer_size *rbs = data;
+	const struct bt_hci_rsp_le_read_buffer_size *lrbs = data;
+	const struct bt_hci_rsp_le_read_buffer_size_v2 *lrbs2 = data;
+
+	switch (opcode) {
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		if (size < sizeof(*rbs) || rbs->status)
+			return;
+		set_pool(hci, BT_HCI_BUF_ACL, le16_to_cpu(rbs->acl_mtu),
+					le16_to_cpu(rbs->acl_max_pkt));
+		break;
+
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		if (size < sizeof(*lrbs) || lrbs->status)
+			return;
+		set_pool(hci, BT_HCI_BUF_LE, le16_to_cpu(lrbs->le_mtu),
+							lrbs->le_max_pkt);
+		break;
+
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE_V2:
+		if (size < sizeof(*lrbs2) || lrbs2->status)
+			return;
+		set_pool(hci, BT_HCI_BUF_LE, le16_to_cpu(lrbs2->acl_mtu),
+							lrbs2->acl_max_pkt);
+		set_pool(hci, BT_HCI_BUF_ISO, le16_to_cpu(lrbs2->iso_mtu),
+							lrbs2->iso_max_pkt);
+		break;
+	}
+}
+
+static void process_num_completed(struct bt_hci *hci, const void *data,
+								size_t size)
+{
+	const uint8_t *ptr = data;
+	uint8_t num_handles;
+	int i;
+
+	if (size < 1)
+		return;
+
+	num_handles = ptr[0];
+	ptr++;
+
+	if (size - 1 < num_handles * 4u)
+		return;
+
+	for (i = 0; i < num_handles; i++, ptr += 4) {
+		uint16_t handle = get_le16(ptr) & 0x0fff;
+		uint16_t count = get_le16(ptr + 2);
+		struct buf_pool *pool;
+		struct conn *conn;
+
+		conn = queue_find_by_key(hci->conn_list, handle);
+		if (!conn)
+			continue;
+
+		if (count > conn->sent)
+			count = conn->sent;
+
+		conn->sent -= count;
+
+		pool = conn_pool(hci, conn);
+		pool->avail += count;
+		if (pool->avail > pool->count)
+			pool->avail = pool->count;
+	}
+
+	wakeup_writer(hci);
+}
+
+static void conn_add(struct bt_hci *hci, uint16_t handle, uint8_t pool)
+{
+	struct conn *conn;
+
+	conn = conn_get(hci, handle, pool);
+	if (conn && !conn->sent)
+		conn->pool = pool;
+}
+
+static void process_link(struct bt_hci *hci, uint8_t event,
+					const void *data, size_t size)
+{
+	const struct bt_hci_evt_conn_complete *cc = data;
+	const struct bt_hci_evt_disconnect_complete *dc = data;
+	const struct bt_hci_evt_le_conn_complete *lcc = data + 1;
+	const struct bt_hci_evt_le_enhanced_conn_complete *lecc = data + 1;
+	const uint8_t *subevent = data;
+
+	switch (event) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+		/* Only ACL links, SCO data does not go through here */
+		if (size < sizeof(*cc) || cc->status || cc->link_type != 0x01)
+			return;
+		conn_add(hci, le16_to_cpu(cc->handle), BT_HCI_BUF_ACL);
+		break;
+
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		if (size < sizeof(*dc) || dc->status)
+			return;
+		conn_remove(hci, le16_to_cpu(dc->handle));
+		wakeup_writer(hci);
+		break;
+
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		process_num_completed(hci, data, size);
+		break;
+
+	case BT_HCI_EVT_LE_META_EVENT:
+		if (size < 1)
+			return;
+
+		if (subevent[0] == BT_HCI_EVT_LE_CONN_COMPLETE) {
+			if (size - 1 < sizeof(*lcc) || lcc->status)
+				return;
+			conn_add(hci, le16_to_cpu(lcc->handle), BT_HCI_BUF_LE);
+		} else if (subevent[0] == BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE) {
+			if (size - 1 < sizeof(*lecc) || lecc->status)
+				return;
+			conn_add(hci, le16_to_cpu(lecc->handle),
+							BT_HCI_BUF_LE);
+		}
+		break;
+	}
+}
+
 static void process_notify(void *data, void *user_data)
 {
 	struct bt_hci_evt_hdr *hdr = user_data;
@@ -233,6 +764,9 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 			return;
 		cc = data;
 		hci->num_cmds = cc->ncmd;
+		process_buffer_size(hci, le16_to_cpu(cc->opcode),
+						data + sizeof(*cc),
+						size - sizeof(*cc));
 		process_response(hci, le16_to_cpu(cc->opcode),
 						data + sizeof(*cc),
 						size - sizeof(*cc));
@@ -247,15 +781,156 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 		break;
 
 	default:
+		process_link(hci, hdr->evt, data, size);
 		queue_foreach(hci->evt_list, process_notify, (void *) hdr);
 		break;
 	}
 }
 
+struct data_notify {
+	uint8_t type;
+	uint16_t handle;
+	uint8_t flags;
+	const void *data;
+	uint16_t size;
+};
+
+static void process_data_notify(void *data, void *user_data)
+{
+	struct data *handler = data;
+	struct data_notify *notify = user_data;
+
+	if (handler->type == notify->type)
+		handler->callback(notify->handle, notify->flags, notify->data,
+					notify->size, handler->user_data);
+}
+
+static void process_data(struct bt_hci *hci, uint8_t type,
+					const void *data, size_t size)
+{
+	const struct bt_hci_acl_hdr *hdr = data;
+	struct data_notify notify;
+	uint16_t handle, dlen;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	handle = le16_to_cpu(hdr->handle);
+	dlen = le16_to_cpu(hdr->dlen);
+
+	/* ISO packets carry the same header with a 14 bit length */
+	if (type == BT_H4_ISO_PKT)
+		dlen &= 0x3fff;
+
+	if (dlen != size - sizeof(*hdr))
+		return;
+
+	notify.type = type;
+	notify.handle = handle & 0x0fff;
+	notify.flags = handle >> 12;
+	notify.data = data + sizeof(*hdr);
+	notify.size = dlen;
+
+	queue_foreach(hci->data_list, process_data_notify, &notify);
+}
+
+static void process_packet(struct bt_hci *hci, const uint8_t *buf,
+								size_t len)
+{
+	switch (buf[0]) {
+	case BT_H4_EVT_PKT:
+		process_event(hci, buf + 1, len - 1);
+		break;
+	case BT_H4_ACL_PKT:
+	case BT_H4_ISO_PKT:
+		process_data(hci, buf[0], buf + 1, len - 1);
+		break;
+	}
+}
+
+/*
+ * Returns the length of the H:4 packet at the start of buf, 0 if its header
+ * is not complete yet or a negative error if the type is unknown.
+ */
+static int packet_len(const uint8_t *buf, size_t len)
+{
+	uint16_t dlen;
+
+	switch (buf[0]) {
+	case BT_H4_EVT_PKT:
+		if (len < 1 + sizeof(struct bt_hci_evt_hdr))
+			return 0;
+		return 1 + sizeof(struct bt_hci_evt_hdr) + buf[2];
+	case BT_H4_ACL_PKT:
+	case BT_H4_ISO_PKT:
+		if (len < 1 + sizeof(struct bt_hci_acl_hdr))
+			return 0;
+		dlen = get_le16(buf + 3);
+		if (buf[0] == BT_H4_ISO_PKT)
+			dlen &= 0x3fff;
+		return 1 + sizeof(struct bt_hci_acl_hdr) + dlen;
+	case BT_H4_SCO_PKT:
+		if (len < 1 + sizeof(struct bt_hci_sco_hdr))
+			return 0;
+		return 1 + sizeof(struct bt_hci_sco_hdr) + buf[3];
+	}
+
+	return -EPROTO;
+}
+
+static bool read_stream(struct bt_hci *hci, int fd)
+{
+	ssize_t len;
+	size_t off = 0;
+	int pkt_len;
+
+	if (!hci->rx_buf) {
+		hci->rx_buf = malloc(HCI_MAX_FRAME_SIZE);
+		if (!hci->rx_buf)
+			return false;
+	}
+
+	len = read(fd, hci->rx_buf + hci->rx_len,
+					HCI_MAX_FRAME_SIZE - hci->rx_len);
+	if (len < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	if (!len)
+		return false;
+
+	hci->rx_len += len;
+
+	/* Handlers may drop the last reference */
+	bt_hci_ref(hci);
+
+	while (off < hci->rx_len) {
+		pkt_len = packet_len(hci->rx_buf + off, hci->rx_len - off);
+
+		/* Without packet boundaries there is no way to resync */
+		if (pkt_len < 0 || pkt_len > HCI_MAX_FRAME_SIZE) {
+			bt_hci_unref(hci);
+			return false;
+		}
+
+		if (!pkt_len || (size_t) pkt_len > hci->rx_len - off)
+			break;
+
+		process_packet(hci, hci->rx_buf + off, pkt_len);
+		off += pkt_len;
+	}
+
+	hci->rx_len -= off;
+	memmove(hci->rx_buf, hci->rx_buf + off, hci->rx_len);
+
+	bt_hci_unref(hci);
+
+	return true;
+}
+
 static bool io_read_callback(struct io *io, void *user_data)
 {
 	struct bt_hci *hci = user_data;
-	uint8_t buf[512];
+	uint8_t buf[HCI_MAX_FRAME_SIZE];
 	ssize_t len;
 	int fd;
 
@@ -264,7 +939,7 @@ static bool io_read_callback(struct io *io, void *user_data)
 		return false;
 
 	if (hci->is_stream)
-		return false;
+		return read_stream(hci, fd);
 
 	len = read(fd, buf, sizeof(buf));
 	if (len < 0)
@@ -273,11 +948,7 @@ static bool io_read_callback(struct io *io, void *user_data)
 	if (len < 1)
 		return true;
 
-	switch (buf[0]) {
-	case BT_H4_EVT_PKT:
-		process_event(hci, buf + 1, len - 1);
-		break;
-	}
+	process_packet(hci, buf, len);
 
 	return true;
 }
@@ -305,40 +976,45 @@ static struct bt_hci *create_hci(int fd)
 	hci->next_cmd_id = 1;
 	hci->next_evt_id = 1;
 
-	hci->cmd_queue = queue_new();
-	if (!hci->cmd_queue) {
-		io_destroy(hci->io);
-		free(hci);
-		return NULL;
-	}
+	hci->cmd_queue = queue_new_keyed(offsetof(struct cmd, id));
+	if (!hci->cmd_queue)
+		goto fail;
 
-	hci->rsp_queue = queue_new();
-	if (!hci->rsp_queue) {
-		queue_destroy(hci->cmd_queue, NULL);
-		io_destroy(hci->io);
-		free(hci);
-		return NULL;
-	}
+	hci->rsp_queue = queue_new_keyed(offsetof(struct cmd, id));
+	if (!hci->rsp_queue)
+		goto fail;
 
-	hci->evt_list = queue_new();
-	if (!hci->evt_list) {
-		queue_destroy(hci->rsp_queue, NULL);
-		queue_destroy(hci->cmd_queue, NULL);
-		io_destroy(hci->io);
-		free(hci);
-		return NULL;
-	}
+	hci->evt_list = queue_new_keyed(offsetof(struct evt, id));
+	if (!hci->evt_list)
+		goto fail;
 
-	if (!io_set_read_handler(hci->io, io_read_callback, hci, NULL)) {
-		queue_destroy(hci->evt_list, NULL);
-		queue_destroy(hci->rsp_queue, NULL);
-		queue_destroy(hci->cmd_queue, NULL);
-		io_destroy(hci->io);
-		free(hci);
-		return NULL;
-	}
+	hci->data_list = queue_new_keyed(offsetof(struct data, id));
+	if (!hci->data_list)
+		goto fail;
+
+	hci->conn_list = queue_new_keyed(offsetof(struct conn, handle));
+	if (!hci->conn_list)
+		goto fail;
+
+	hci->tx_conns = queue_new();
+	if (!hci->tx_conns)
+		goto fail;
+
+	if (!io_set_read_handler(hci->io, io_read_callback, hci, NULL))
+		goto fail;
 
 	return bt_hci_ref(hci);
+
+fail:
+	queue_destroy(hci->tx_conns, NULL);
+	queue_destroy(hci->conn_list, NULL);
+	queue_destroy(hci->data_list, NULL);
+	queue_destroy(hci->evt_list, NULL);
+	queue_destroy(hci->rsp_queue, NULL);
+	queue_destroy(hci->cmd_queue, NULL);
+	io_destroy(hci->io);
+	free(hci);
+	return NULL;
 }
 
 struct bt_hci *bt_hci_new(int fd)
@@ -449,11 +1125,16 @@ void bt_hci_unref(struct bt_hci *hci)
 		return;
 
 	queue_destroy(hci->evt_list, evt_free);
+	queue_destroy(hci->data_list, data_free);
 	queue_destroy(hci->cmd_queue, cmd_free);
 	queue_destroy(hci->rsp_queue, cmd_free);
+	queue_destroy(hci->tx_conns, NULL);
+	queue_destroy(hci->conn_list, conn_free);
 
 	io_destroy(hci->io);
 
+	free(hci->rx_buf);
+	free(hci->tx_rest);
 	free(hci);
 }
 
@@ -512,14 +1193,6 @@ unsigned int bt_hci_send(struct bt_hci *hci, uint16_t opcode,
 	return cmd->id;
 }
 
-static bool match_cmd_id(const void *a, const void *b)
-{
-	const struct cmd *cmd = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return cmd->id == id;
-}
-
 bool bt_hci_cancel(struct bt_hci *hci, unsigned int id)
 {
 	struct cmd *cmd;
@@ -527,10 +1200,9 @@ bool bt_hci_cancel(struct bt_hci *hci, unsigned int id)
 	if (!hci || !id)
 		return false;
 
-	cmd = queue_remove_if(hci->cmd_queue, match_cmd_id, UINT_TO_PTR(id));
+	cmd = queue_remove_by_key(hci->cmd_queue, id);
 	if (!cmd) {
-		cmd = queue_remove_if(hci->rsp_queue, match_cmd_id,
-							UINT_TO_PTR(id));
+		cmd = queue_remove_by_key(hci->rsp_queue, id);
 		if (!cmd)
 			return false;
 	}
@@ -555,6 +1227,12 @@ bool bt_hci_flush(struct bt_hci *hci)
 	queue_remove_all(hci->cmd_queue, NULL, NULL, cmd_free);
 	queue_remove_all(hci->rsp_queue, NULL, NULL, cmd_free);
 
+	/* Queued data is dropped, but packets already handed to the
+	 * controller keep their buffers until they are completed.
+	 */
+	queue_remove_all(hci->tx_conns, NULL, NULL, NULL);
+	queue_foreach(hci->conn_list, conn_flush, NULL);
+
 	return true;
 }
 
@@ -590,26 +1268,192 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 	return evt->id;
 }
 
-static bool match_evt_id(const void *a, const void *b)
+bool bt_hci_unregister(struct bt_hci *hci, unsigned int id)
 {
-	const struct evt *evt = a;
-	unsigned int id = PTR_TO_UINT(b);
+	struct evt *evt;
+
+	if (!hci || !id)
+		return false;
 
-	return evt->id == id;
+	evt = queue_remove_by_key(hci->evt_list, id);
+	if (!evt) {
+		struct data *handler;
+
+		handler = queue_remove_by_key(hci->data_list, id);
+		if (!handler)
+			return false;
+
+		data_free(handler);
+		return true;
+	}
+
+	evt_free(evt);
+
+	return true;
 }
 
-bool bt_hci_unregister(struct bt_hci *hci, unsigned int id)
+bool bt_hci_set_buffer_size(struct bt_hci *hci, uint8_t pool, uint16_t mtu,
+							uint16_t count)
 {
-	struct evt *evt;
+	if (!hci || pool >= NUM_BUF_POOLS)
+		return false;
 
-	if (!hci || !id)
+	set_pool(hci, pool, mtu, count);
+
+	wakeup_writer(hci);
+
+	return true;
+}
+
+bool bt_hci_set_link_pool(struct bt_hci *hci, uint16_t handle, uint8_t pool)
+{
+	struct conn *conn;
+
+	if (!hci || handle > 0x0eff || pool >= NUM_BUF_POOLS)
 		return false;
 
-	evt = queue_remove_if(hci->evt_list, match_evt_id, UINT_TO_PTR(id));
-	if (!evt)
+	conn = conn_get(hci, handle, pool);
+	if (!conn || conn->sent)
 		return false;
 
-	evt_free(evt);
+	conn->pool = pool;
+
+	wakeup_writer(hci);
+
+	return true;
+}
+
+static struct pkt *pkt_new(uint8_t type, uint16_t handle, uint8_t flags,
+					const void *data, uint16_t size)
+{
+	struct bt_hci_acl_hdr hdr;
+	struct pkt *pkt;
+
+	pkt = malloc(sizeof(*pkt) + 1 + sizeof(hdr) + size);
+	if (!pkt)
+		return NULL;
+
+	hdr.handle = cpu_to_le16(handle | flags << 12);
+	hdr.dlen = cpu_to_le16(size);
+
+	pkt->len = 1 + sizeof(hdr) + size;
+	pkt->data[0] = type;
+	memcpy(pkt->data + 1, &hdr, sizeof(hdr));
+	if (size)
+		memcpy(pkt->data + 1 + sizeof(hdr), data, size);
+
+	return pkt;
+}
+
+/* Packet boundary flags of fragment n out of last + 1 */
+static uint8_t fragment_flags(uint8_t type, uint8_t flags, unsigned int n,
+							unsigned int last)
+{
+	if (type == BT_H4_ACL_PKT)
+		return n ? (flags & 0x0c) | 0x01 : flags;
+
+	/* ISO: complete, first, continuation or last, time stamp first */
+	if (!last)
+		return (flags & 0x04) | 0x02;
+
+	if (!n)
+		return (flags & 0x04) | 0x00;
+
+	return n < last ? 0x01 : 0x03;
+}
+
+bool bt_hci_send_data(struct bt_hci *hci, uint8_t type, uint16_t handle,
+				uint8_t flags, const void *data, uint16_t size)
+{
+	struct queue *frags;
+	struct conn *conn;
+	struct pkt *pkt;
+	uint16_t mtu;
+	unsigned int n, last;
+
+	if (!hci || handle > 0x0eff)
+		return false;
+
+	switch (type) {
+	case BT_H4_ACL_PKT:
+		conn = conn_get(hci, handle, hci->pools[BT_HCI_BUF_ACL].count ?
+					BT_HCI_BUF_ACL : BT_HCI_BUF_LE);
+		break;
+	case BT_H4_ISO_PKT:
+		conn = conn_get(hci, handle, BT_HCI_BUF_ISO);
+		break;
+	default:
+		return false;
+	}
+
+	if (!conn)
+		return false;
+
+	mtu = conn_pool(hci, conn)->mtu;
+	if (!mtu)
+		mtu = size;
+
+	if (type == BT_H4_ISO_PKT && mtu > 0x3fff)
+		return false;
+
+	last = size ? (size - 1) / mtu : 0;
+
+	frags = queue_new();
+	if (!frags)
+		return false;
+
+	for (n = 0; n <= last; n++) {
+		uint16_t len = n < last ? mtu : size - n * mtu;
+
+		pkt = pkt_new(type, handle,
+				fragment_flags(type, flags, n, last),
+				data + n * mtu, len);
+		if (!pkt || !queue_push_tail(frags, pkt)) {
+			free(pkt);
+			queue_destroy(frags, free);
+			return false;
+		}
+	}
+
+	while ((pkt = queue_pop_head(frags)))
+		queue_push_tail(conn->tx_queue, pkt);
+
+	queue_destroy(frags, NULL);
+
+	conn_schedule(hci, conn);
+	wakeup_writer(hci);
 
 	return true;
 }
+
+unsigned int bt_hci_register_data(struct bt_hci *hci, uint8_t type,
+				bt_hci_data_func_t callback,
+				void *user_data, bt_hci_destroy_func_t destroy)
+{
+	struct data *handler;
+
+	if (!hci || !callback)
+		return 0;
+
+	handler = new0(struct data, 1);
+	if (!handler)
+		return 0;
+
+	handler->type = type;
+
+	if (hci->next_evt_id < 1)
+		hci->next_evt_id = 1;
+
+	handler->id = hci->next_evt_id++;
+
+	handler->callback = callback;
+	handler->destroy = destroy;
+	handler->user_data = user_data;
+
+	if (!queue_push_tail(hci->data_list, handler)) {
+		free(handler);
+		return 0;
+	}
+
+	return handler->id;
+}
@@ -51,3 +51,27 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 				bt_hci_callback_func_t callback,
 				void *user_data, bt_hci_destroy_func_t destroy);
 bool bt_hci_unregister(struct bt_hci *hci, unsigned int id);
+
+/*
+ * Data packets are queued per connection handle and sent as buffers of
+ * the matching controller pool become available. The pool sizes are
+ * picked up from the Read Buffer Size commands sent through bt_hci_send,
+ * or can be set explicitly. Without LE buffers, LE links use ACL ones.
+ */
+#define BT_HCI_BUF_ACL		0x00
+#define BT_HCI_BUF_LE		0x01
+#define BT_HCI_BUF_ISO		0x02
+
+typedef void (*bt_hci_data_func_t)(uint16_t handle, uint8_t flags,
+					const void *data, uint16_t size,
+					void *user_data);
+
+bool bt_hci_set_buffer_size(struct bt_hci *hci, uint8_t pool, uint16_t mtu,
+							uint16_t count);
+bool bt_hci_set_link_pool(struct bt_hci *hci, uint16_t handle, uint8_t pool);
+
+bool bt_hci_send_data(struct bt_hci *hci, uint8_t type, uint16_t handle,
+				uint8_t flags, const void *data, uint16_t size);
+unsigned int bt_hci_register_data(struct bt_hci *hci, uint8_t type,
+				bt_hci_data_func_t callback,
+				void *user_data, bt_hci_destroy_func_t destroy);
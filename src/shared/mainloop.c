@@ -27,6 +27,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -37,8 +38,12 @@
 #include <sys/epoll.h>
 
 #include "mainloop.h"
+#include "queue.h"
 
-#define MAX_EPOLL_EVENTS 10
+#define MIN_EPOLL_EVENTS 16
+#define MAX_EPOLL_EVENTS 1024
+
+#define MIN_MAINLOOP_ENTRIES 128
 
 static int epoll_fd;
 static int epoll_terminate;
@@ -47,14 +52,35 @@ static int exit_status;
 struct mainloop_data {
 	int fd;
 	uint32_t events;
+	bool removed;
 	mainloop_event_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
+	struct mainloop_data *next;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+/*
+ * The fd registry is indexed directly by file descriptor and grows on
+ * demand, so there is no fixed ceiling on the number of watched fds.
+ */
+static struct mainloop_data **mainloop_list;
+static unsigned int mainloop_list_size;
+static unsigned int mainloop_count;
+
+/*
+ * Events are drained in batches. The batch grows whenever epoll_wait()
+ * fills it completely and shrinks again once the load goes away.
+ */
+static struct epoll_event *epoll_events;
+static unsigned int epoll_events_size;
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+/*
+ * Entries removed while a batch is being dispatched may still be
+ * referenced by pending events of the same batch. They are kept on
+ * this list and released once the batch has been processed.
+ */
+static struct mainloop_data *removed_list;
+static bool dispatching;
 
 struct timeout_data {
 	int fd;
@@ -75,16 +101,108 @@ static struct signal_data *signal_data;
 
 void mainloop_init(void)
 {
-	unsigned int i;
-
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	free(mainloop_list);
+	mainloop_list = calloc(MIN_MAINLOOP_ENTRIES, sizeof(*mainloop_list));
+	mainloop_list_size = mainloop_list ? MIN_MAINLOOP_ENTRIES : 0;
+	mainloop_count = 0;
+
+	free(epoll_events);
+	epoll_events = calloc(MIN_EPOLL_EVENTS, sizeof(*epoll_events));
+	epoll_events_size = epoll_events ? MIN_EPOLL_EVENTS : 0;
 
 	epoll_terminate = 0;
 }
 
+static bool mainloop_list_grow(int fd)
+{
+	struct mainloop_data **list;
+	unsigned int size = mainloop_list_size ? : MIN_MAINLOOP_ENTRIES;
+
+	while (size <= (unsigned int) fd)
+		size <<= 1;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return false;
+
+	memset(list + mainloop_list_size, 0,
+			(size - mainloop_list_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_list_size = size;
+
+	return true;
+}
+
+static struct mainloop_data *mainloop_lookup(int fd)
+{
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
+		return NULL;
+
+	return mainloop_list[fd];
+}
+
+static void epoll_events_resize(unsigned int size)
+{
+	struct epoll_event *events;
+
+	if (size < MIN_EPOLL_EVENTS)
+		size = MIN_EPOLL_EVENTS;
+	else if (size > MAX_EPOLL_EVENTS)
+		size = MAX_EPOLL_EVENTS;
+
+	if (size == epoll_events_size)
+		return;
+
+	events = realloc(epoll_events, size * sizeof(*events));
+	if (!events)
+		return;
+
+	epoll_events = events;
+	epoll_events_size = size;
+}
+
+static void mainloop_data_release(struct mainloop_data *data)
+{
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+}
+
+static void flush_removed_list(void)
+{
+	while (removed_list) {
+		struct mainloop_data *data = removed_list;
+
+		removed_list = data->next;
+		free(data);
+	}
+}
+
+static void dispatch_events(int nfds)
+{
+	int n;
+
+	dispatching = true;
+
+	for (n = 0; n < nfds; n++) {
+		struct mainloop_data *data = epoll_events[n].data.ptr;
+
+		if (data->removed)
+			continue;
+
+		data->callback(data->fd, epoll_events[n].events,
+							data->user_data);
+	}
+
+	dispatching = false;
+
+	flush_removed_list();
+}
+
 void mainloop_quit(void)
 {
 	epoll_terminate = 1;
@@ -125,6 +243,9 @@ int mainloop_run(void)
 {
 	unsigned int i;
 
+	if (!mainloop_list || !epoll_events)
+		return EXIT_FAILURE;
+
 	if (signal_data) {
 		if (sigprocmask(SIG_BLOCK, &signal_data->mask, NULL) < 0)
 			return EXIT_FAILURE;
@@ -144,19 +265,25 @@ int mainloop_run(void)
 	exit_status = EXIT_SUCCESS;
 
 	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
-		int n, nfds;
+		int nfds;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		nfds = epoll_wait(epoll_fd, epoll_events, epoll_events_size, -1);
 		if (nfds < 0)
 			continue;
 
-		for (n = 0; n < nfds; n++) {
-			struct mainloop_data *data = events[n].data.ptr;
-
-			data->callback(data->fd, events[n].events,
-							data->user_data);
-		}
+		dispatch_events(nfds);
+
+		/*
+		 * A full batch means more events are likely pending, so
+		 * double the batch size. Shrink it again when it stays
+		 * mostly empty, but never below the number of watched fds
+		 * needed to drain everything in a single call.
+		 */
+		if ((unsigned int) nfds == epoll_events_size)
+			epoll_events_resize(epoll_events_size << 1);
+		else if ((unsigned int) nfds < epoll_events_size / 4 &&
+					mainloop_count < epoll_events_size / 2)
+			epoll_events_resize(epoll_events_size >> 1);
 	}
 
 	if (signal_data) {
@@ -167,7 +294,7 @@ int mainloop_run(void)
 			signal_data->destroy(signal_data->user_data);
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	for (i = 0; i < mainloop_list_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
@@ -175,16 +302,24 @@ int mainloop_run(void)
 		if (data) {
 			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
-			if (data->destroy)
-				data->destroy(data->user_data);
-
-			free(data);
+			mainloop_data_release(data);
 		}
 	}
 
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+	mainloop_count = 0;
+
+	free(epoll_events);
+	epoll_events = NULL;
+	epoll_events_size = 0;
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
+	queue_cache_flush();
+
 	return exit_status;
 }
 
@@ -195,9 +330,16 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if ((unsigned int) fd >= mainloop_list_size &&
+						!mainloop_list_grow(fd))
+		return -ENOMEM;
+
+	if (mainloop_list[fd])
+		return -EEXIST;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -220,6 +362,7 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	}
 
 	mainloop_list[fd] = data;
+	mainloop_count++;
 
 	return 0;
 }
@@ -230,10 +373,10 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_lookup(fd);
 	if (!data)
 		return -ENXIO;
 
@@ -255,21 +398,30 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_lookup(fd);
 	if (!data)
 		return -ENXIO;
 
 	mainloop_list[fd] = NULL;
+	mainloop_count--;
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
 
+	if (!dispatching) {
+		mainloop_data_release(data);
+		return err;
+	}
+
+	data->removed = true;
+
 	if (data->destroy)
 		data->destroy(data->user_data);
 
-	free(data);
+	data->next = removed_list;
+	removed_list = data;
 
 	return err;
 }
@@ -283,6 +435,8 @@ static void timeout_destroy(void *user_data)
 
 	if (data->destroy)
 		data->destroy(data->user_data);
+
+	free(data);
 }
 
 static void timeout_callback(int fd, uint32_t events, void *user_data)
@@ -311,7 +465,7 @@ static inline int timeout_set(int fd, unsigned int msec)
 	itimer.it_interval.tv_sec = 0;
 	itimer.it_interval.tv_nsec = 0;
 	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000;
+	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
 
 	return timerfd_settime(fd, 0, &itimer, NULL);
 }
@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "lib/bluetooth.h"
 #include "lib/mgmt.h"
@@ -39,16 +40,21 @@
 #include "src/shared/util.h"
 #include "src/shared/mgmt.h"
 
+#define MGMT_LATENCY_BUCKETS	12
+#define MGMT_LATENCY_BASE	128	/* usec, upper bound of bucket 0 */
+
 struct mgmt {
 	int ref_count;
 	int fd;
 	bool close_on_unref;
 	struct io *io;
 	bool writer_active;
-	struct queue *request_queue;
+	struct queue *index_list;
+	struct queue *ready_list;
 	struct queue *reply_queue;
 	struct queue *pending_list;
 	struct queue *notify_list;
+	struct queue *latency_list;
 	unsigned int next_request_id;
 	unsigned int next_notify_id;
 	void *buf;
@@ -64,11 +70,32 @@ struct mgmt_request {
 	uint16_t index;
 	void *buf;
 	uint16_t len;
+	struct timespec sent;
 	mgmt_request_func_t callback;
 	mgmt_destroy_func_t destroy;
 	void *user_data;
 };
 
+/*
+ * Requests are queued per controller index. Each index may have one
+ * command in flight, and the indexes that are ready to send sit on
+ * ready_list so that they are served round robin.
+ */
+struct mgmt_index {
+	unsigned int index;
+	struct queue *request_queue;
+	unsigned int pending;
+	bool scheduled;
+};
+
+struct mgmt_latency {
+	unsigned int opcode;
+	unsigned int count;
+	uint64_t total;
+	uint64_t max;
+	unsigned int buckets[MGMT_LATENCY_BUCKETS];
+};
+
 struct mgmt_notify {
 	unsigned int id;
 	uint16_t event;
@@ -89,20 +116,81 @@ static void destroy_request(void *data)
 	free(request);
 }
 
-static bool match_request_id(const void *a, const void *b)
+static bool match_request_index(const void *a, const void *b)
 {
 	const struct mgmt_request *request = a;
-	unsigned int id = PTR_TO_UINT(b);
+	uint16_t index = PTR_TO_UINT(b);
 
-	return request->id == id;
+	return request->index == index;
 }
 
-static bool match_request_index(const void *a, const void *b)
+static void destroy_index(void *data)
 {
-	const struct mgmt_request *request = a;
-	uint16_t index = PTR_TO_UINT(b);
+	struct mgmt_index *idx = data;
 
-	return request->index == index;
+	queue_destroy(idx->request_queue, destroy_request);
+	free(idx);
+}
+
+static struct mgmt_index *get_index(struct mgmt *mgmt, uint16_t index)
+{
+	struct mgmt_index *idx;
+
+	idx = queue_find_by_key(mgmt->index_list, index);
+	if (idx)
+		return idx;
+
+	idx = new0(struct mgmt_index, 1);
+	if (!idx)
+		return NULL;
+
+	idx->index = index;
+
+	idx->request_queue = queue_new_keyed(offsetof(struct mgmt_request,
+								id));
+	if (!idx->request_queue) {
+		free(idx);
+		return NULL;
+	}
+
+	if (!queue_push_tail(mgmt->index_list, idx)) {
+		destroy_index(idx);
+		return NULL;
+	}
+
+	return idx;
+}
+
+static void schedule_index(struct mgmt *mgmt, struct mgmt_index *idx)
+{
+	if (idx->scheduled || idx->pending)
+		return;
+
+	if (queue_isempty(idx->request_queue))
+		return;
+
+	if (queue_push_tail(mgmt->ready_list, idx))
+		idx->scheduled = true;
+}
+
+/* Called once a request has been taken off the pending list */
+static void request_done(struct mgmt *mgmt, struct mgmt_request *request)
+{
+	struct mgmt_index *idx;
+
+	idx = queue_find_by_key(mgmt->index_list, request->index);
+	if (!idx || !idx->pending)
+		return;
+
+	idx->pending--;
+	schedule_index(mgmt, idx);
+}
+
+static void clear_pending(void *data, void *user_data)
+{
+	struct mgmt_index *idx = data;
+
+	idx->pending = 0;
 }
 
 static void destroy_notify(void *data)
@@ -115,14 +203,6 @@ static void destroy_notify(void *data)
 	free(notify);
 }
 
-static bool match_notify_id(const void *a, const void *b)
-{
-	const struct mgmt_notify *notify = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify->id == id;
-}
-
 static bool match_notify_index(const void *a, const void *b)
 {
 	const struct mgmt_notify *notify = a;
@@ -140,6 +220,7 @@ static void write_watch_destroy(void *user_data)
 
 static bool send_request(struct mgmt *mgmt, struct mgmt_request *request)
 {
+	struct mgmt_index *idx;
 	struct iovec iov;
 	ssize_t ret;
 
@@ -164,46 +245,65 @@ static bool send_request(struct mgmt *mgmt, struct mgmt_request *request)
 	util_hexdump('<', request->buf, ret, mgmt->debug_callback,
 							mgmt->debug_data);
 
+	if (mgmt->debug_callback)
+		clock_gettime(CLOCK_MONOTONIC, &request->sent);
+
 	queue_push_tail(mgmt->pending_list, request);
 
+	idx = get_index(mgmt, request->index);
+	if (idx)
+		idx->pending++;
+
 	return true;
 }
 
+/* Takes the next request of the indexes without one in flight */
+static struct mgmt_request *pick_request(struct mgmt *mgmt)
+{
+	struct mgmt_index *idx;
+
+	while ((idx = queue_pop_head(mgmt->ready_list))) {
+		struct mgmt_request *request;
+
+		idx->scheduled = false;
+
+		/* A reply or an unqueued command may have been sent since */
+		if (idx->pending)
+			continue;
+
+		request = queue_pop_head(idx->request_queue);
+		if (request)
+			return request;
+	}
+
+	return NULL;
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct mgmt *mgmt = user_data;
 	struct mgmt_request *request;
-	bool can_write;
 
+	/* reply commands jump the queue */
 	request = queue_pop_head(mgmt->reply_queue);
 	if (!request) {
-		/* only reply commands can jump the queue */
-		if (!queue_isempty(mgmt->pending_list))
-			return false;
-
-		request = queue_pop_head(mgmt->request_queue);
+		request = pick_request(mgmt);
 		if (!request)
 			return false;
-
-		can_write = false;
-	} else {
-		/* allow multiple replies to jump the queue */
-		can_write = !queue_isempty(mgmt->reply_queue);
 	}
 
 	if (!send_request(mgmt, request))
 		return true;
 
-	return can_write;
+	return !queue_isempty(mgmt->reply_queue) ||
+					!queue_isempty(mgmt->ready_list);
 }
 
 static void wakeup_writer(struct mgmt *mgmt)
 {
-	if (!queue_isempty(mgmt->pending_list)) {
-		/* only queued reply commands trigger wakeup */
-		if (queue_isempty(mgmt->reply_queue))
-			return;
-	}
+	if (queue_isempty(mgmt->reply_queue) &&
+					queue_isempty(mgmt->ready_list))
+		return;
 
 	if (mgmt->writer_active)
 		return;
@@ -228,6 +328,64 @@ static bool match_request_opcode_index(const void *a, const void *b)
 					request->index == match->index;
 }
 
+static unsigned int latency_bucket(uint64_t usec)
+{
+	uint64_t limit = MGMT_LATENCY_BASE;
+	unsigned int i;
+
+	for (i = 0; i < MGMT_LATENCY_BUCKETS - 1; i++, limit <<= 1) {
+		if (usec < limit)
+			break;
+	}
+
+	return i;
+}
+
+static void record_latency(struct mgmt *mgmt, struct mgmt_request *request)
+{
+	struct mgmt_latency *latency;
+	struct timespec now;
+	uint64_t usec;
+
+	if (!mgmt->debug_callback)
+		return;
+
+	/* Sent before debugging got enabled */
+	if (!request->sent.tv_sec && !request->sent.tv_nsec)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	usec = (now.tv_sec - request->sent.tv_sec) * 1000000ull +
+			(now.tv_nsec - request->sent.tv_nsec) / 1000;
+
+	latency = queue_find_by_key(mgmt->latency_list, request->opcode);
+	if (!latency) {
+		latency = new0(struct mgmt_latency, 1);
+		if (!latency)
+			return;
+
+		latency->opcode = request->opcode;
+
+		if (!queue_push_tail(mgmt->latency_list, latency)) {
+			free(latency);
+			return;
+		}
+	}
+
+	latency->count++;
+	latency->total += usec;
+	if (usec > latency->max)
+		latency->max = usec;
+
+	latency->buckets[latency_bucket(usec)]++;
+
+	util_debug(mgmt->debug_callback, mgmt->debug_data,
+				"[0x%04x] command 0x%04x took %llu usec",
+				request->index, request->opcode,
+				(unsigned long long) usec);
+}
+
 static void request_complete(struct mgmt *mgmt, uint8_t status,
 					uint16_t opcode, uint16_t index,
 					uint16_t length, const void *param)
@@ -238,6 +396,9 @@ static void request_complete(struct mgmt *mgmt, uint8_t status,
 	request = queue_remove_if(mgmt->pending_list,
 					match_request_opcode_index, &match);
 	if (request) {
+		request_done(mgmt, request);
+		record_latency(mgmt, request);
+
 		if (request->callback)
 			request->callback(status, length, param,
 							request->user_data);
@@ -373,58 +534,51 @@ struct mgmt *mgmt_new(int fd)
 		return NULL;
 	}
 
-	mgmt->request_queue = queue_new();
-	if (!mgmt->request_queue) {
-		io_destroy(mgmt->io);
-		free(mgmt->buf);
-		free(mgmt);
-		return NULL;
-	}
+	mgmt->index_list = queue_new_keyed(offsetof(struct mgmt_index, index));
+	if (!mgmt->index_list)
+		goto fail;
 
-	mgmt->reply_queue = queue_new();
-	if (!mgmt->reply_queue) {
-		queue_destroy(mgmt->request_queue, NULL);
-		io_destroy(mgmt->io);
-		free(mgmt->buf);
-		free(mgmt);
-		return NULL;
-	}
+	mgmt->ready_list = queue_new();
+	if (!mgmt->ready_list)
+		goto fail;
 
-	mgmt->pending_list = queue_new();
-	if (!mgmt->pending_list) {
-		queue_destroy(mgmt->reply_queue, NULL);
-		queue_destroy(mgmt->request_queue, NULL);
-		io_destroy(mgmt->io);
-		free(mgmt->buf);
-		free(mgmt);
-		return NULL;
-	}
+	mgmt->reply_queue = queue_new_keyed(offsetof(struct mgmt_request,
+								id));
+	if (!mgmt->reply_queue)
+		goto fail;
 
-	mgmt->notify_list = queue_new();
-	if (!mgmt->notify_list) {
-		queue_destroy(mgmt->pending_list, NULL);
-		queue_destroy(mgmt->reply_queue, NULL);
-		queue_destroy(mgmt->request_queue, NULL);
-		io_destroy(mgmt->io);
-		free(mgmt->buf);
-		free(mgmt);
-		return NULL;
-	}
+	mgmt->pending_list = queue_new_keyed(offsetof(struct mgmt_request,
+								id));
+	if (!mgmt->pending_list)
+		goto fail;
 
-	if (!io_set_read_handler(mgmt->io, can_read_data, mgmt, NULL)) {
-		queue_destroy(mgmt->notify_list, NULL);
-		queue_destroy(mgmt->pending_list, NULL);
-		queue_destroy(mgmt->reply_queue, NULL);
-		queue_destroy(mgmt->request_queue, NULL);
-		io_destroy(mgmt->io);
-		free(mgmt->buf);
-		free(mgmt);
-		return NULL;
-	}
+	mgmt->notify_list = queue_new_keyed(offsetof(struct mgmt_notify, id));
+	if (!mgmt->notify_list)
+		goto fail;
+
+	mgmt->latency_list = queue_new_keyed(offsetof(struct mgmt_latency,
+								opcode));
+	if (!mgmt->latency_list)
+		goto fail;
+
+	if (!io_set_read_handler(mgmt->io, can_read_data, mgmt, NULL))
+		goto fail;
 
 	mgmt->writer_active = false;
 
 	return mgmt_ref(mgmt);
+
+fail:
+	queue_destroy(mgmt->latency_list, NULL);
+	queue_destroy(mgmt->notify_list, NULL);
+	queue_destroy(mgmt->pending_list, NULL);
+	queue_destroy(mgmt->reply_queue, NULL);
+	queue_destroy(mgmt->ready_list, NULL);
+	queue_destroy(mgmt->index_list, NULL);
+	io_destroy(mgmt->io);
+	free(mgmt->buf);
+	free(mgmt);
+	return NULL;
 }
 
 struct mgmt *mgmt_new_default(void)
@@ -484,7 +638,8 @@ void mgmt_unref(struct mgmt *mgmt)
 	mgmt_cancel_all(mgmt);
 
 	queue_destroy(mgmt->reply_queue, NULL);
-	queue_destroy(mgmt->request_queue, NULL);
+	queue_destroy(mgmt->ready_list, NULL);
+	queue_destroy(mgmt->index_list, destroy_index);
 
 	io_set_write_handler(mgmt->io, NULL, NULL, NULL);
 	io_set_read_handler(mgmt->io, NULL, NULL, NULL);
@@ -503,6 +658,7 @@ void mgmt_unref(struct mgmt *mgmt)
 
 	queue_destroy(mgmt->notify_list, NULL);
 	queue_destroy(mgmt->pending_list, NULL);
+	queue_destroy(mgmt->latency_list, free);
 	free(mgmt);
 
 	return;
@@ -524,6 +680,51 @@ bool mgmt_set_debug(struct mgmt *mgmt, mgmt_debug_func_t callback,
 	return true;
 }
 
+static void print_latency(void *data, void *user_data)
+{
+	struct mgmt_latency *latency = data;
+	struct mgmt *mgmt = user_data;
+	char str[MGMT_LATENCY_BUCKETS * 24];
+	uint64_t limit = MGMT_LATENCY_BASE;
+	unsigned int i;
+	int len = 0;
+
+	util_debug(mgmt->debug_callback, mgmt->debug_data,
+			"command 0x%04x (%s): %u, avg %llu usec, max %llu usec",
+			latency->opcode, mgmt_opstr(latency->opcode),
+			latency->count,
+			(unsigned long long) (latency->total / latency->count),
+			(unsigned long long) latency->max);
+
+	for (i = 0; i < MGMT_LATENCY_BUCKETS; i++, limit <<= 1) {
+		if (!latency->buckets[i])
+			continue;
+
+		if (i < MGMT_LATENCY_BUCKETS - 1)
+			len += snprintf(str + len, sizeof(str) - len,
+					" <%llu:%u", (unsigned long long) limit,
+					latency->buckets[i]);
+		else
+			len += snprintf(str + len, sizeof(str) - len,
+					" >=%llu:%u",
+					(unsigned long long) (limit >> 1),
+					latency->buckets[i]);
+	}
+
+	util_debug(mgmt->debug_callback, mgmt->debug_data,
+					"  histogram (usec):%s", str);
+}
+
+bool mgmt_print_latency(struct mgmt *mgmt)
+{
+	if (!mgmt || !mgmt->debug_callback)
+		return false;
+
+	queue_foreach(mgmt->latency_list, print_latency, mgmt);
+
+	return true;
+}
+
 bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 {
 	if (!mgmt)
@@ -583,6 +784,7 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				void *user_data, mgmt_destroy_func_t destroy)
 {
 	struct mgmt_request *request;
+	struct mgmt_index *idx;
 
 	if (!mgmt)
 		return 0;
@@ -597,12 +799,14 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 
 	request->id = mgmt->next_request_id++;
 
-	if (!queue_push_tail(mgmt->request_queue, request)) {
+	idx = get_index(mgmt, index);
+	if (!idx || !queue_push_tail(idx->request_queue, request)) {
 		free(request->buf);
 		free(request);
 		return 0;
 	}
 
+	schedule_index(mgmt, idx);
 	wakeup_writer(mgmt);
 
 	return request->id;
@@ -667,26 +871,31 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 
 bool mgmt_cancel(struct mgmt *mgmt, unsigned int id)
 {
+	const struct queue_entry *entry;
 	struct mgmt_request *request;
 
 	if (!mgmt || !id)
 		return false;
 
-	request = queue_remove_if(mgmt->request_queue, match_request_id,
-							UINT_TO_PTR(id));
-	if (request)
-		goto done;
+	for (entry = queue_get_entries(mgmt->index_list); entry;
+							entry = entry->next) {
+		struct mgmt_index *idx = entry->data;
+
+		request = queue_remove_by_key(idx->request_queue, id);
+		if (request)
+			goto done;
+	}
 
-	request = queue_remove_if(mgmt->reply_queue, match_request_id,
-							UINT_TO_PTR(id));
+	request = queue_remove_by_key(mgmt->reply_queue, id);
 	if (request)
 		goto done;
 
-	request = queue_remove_if(mgmt->pending_list, match_request_id,
-							UINT_TO_PTR(id));
+	request = queue_remove_by_key(mgmt->pending_list, id);
 	if (!request)
 		return false;
 
+	request_done(mgmt, request);
+
 done:
 	destroy_request(request);
 
@@ -695,29 +904,61 @@ done:
 	return true;
 }
 
+static void cancel_index_requests(void *data, void *user_data)
+{
+	struct mgmt_index *idx = data;
+
+	queue_remove_all(idx->request_queue, NULL, NULL, destroy_request);
+}
+
 bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index)
 {
+	struct mgmt_index *idx;
+
 	if (!mgmt)
 		return false;
 
-	queue_remove_all(mgmt->request_queue, match_request_index,
-					UINT_TO_PTR(index), destroy_request);
+	idx = queue_find_by_key(mgmt->index_list, index);
+	if (idx)
+		cancel_index_requests(idx, NULL);
+
 	queue_remove_all(mgmt->reply_queue, match_request_index,
 					UINT_TO_PTR(index), destroy_request);
 	queue_remove_all(mgmt->pending_list, match_request_index,
 					UINT_TO_PTR(index), destroy_request);
 
+	/* The destroy callbacks may have queued new requests */
+	idx = queue_find_by_key(mgmt->index_list, index);
+	if (idx) {
+		clear_pending(idx, NULL);
+		schedule_index(mgmt, idx);
+		wakeup_writer(mgmt);
+	}
+
 	return true;
 }
 
+static void reschedule_index(void *data, void *user_data)
+{
+	struct mgmt_index *idx = data;
+	struct mgmt *mgmt = user_data;
+
+	clear_pending(idx, NULL);
+	schedule_index(mgmt, idx);
+}
+
 bool mgmt_cancel_all(struct mgmt *mgmt)
 {
 	if (!mgmt)
 		return false;
 
-	queue_remove_all(mgmt->pending_list, NULL, NULL, destroy_request);
+	queue_foreach(mgmt->index_list, cancel_index_requests, NULL);
 	queue_remove_all(mgmt->reply_queue, NULL, NULL, destroy_request);
-	queue_remove_all(mgmt->request_queue, NULL, NULL, destroy_request);
+	queue_remove_all(mgmt->pending_list, NULL, NULL, destroy_request);
+
+	/* The destroy callbacks may have queued new requests */
+	queue_foreach(mgmt->index_list, reschedule_index, mgmt);
+	wakeup_writer(mgmt);
 
 	return true;
 }
@@ -762,8 +1003,7 @@ bool mgmt_unregister(struct mgmt *mgmt, unsigned int id)
 	if (!mgmt || !id)
 		return false;
 
-	notify = queue_remove_if(mgmt->notify_list, match_notify_id,
-							UINT_TO_PTR(id));
+	notify = queue_remove_by_key(mgmt->notify_list, id);
 	if (!notify)
 		return false;
 
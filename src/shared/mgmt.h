@@ -41,6 +41,11 @@ typedef void (*mgmt_debug_func_t)(const char *str, void *user_data);
 bool mgmt_set_debug(struct mgmt *mgmt, mgmt_debug_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
 
+/* Prints per opcode command latencies through the debug callback. They
+ * are only collected while a debug callback is set.
+ */
+bool mgmt_print_latency(struct mgmt *mgmt);
+
 bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close);
 
 typedef void (*mgmt_request_func_t)(uint8_t status, uint16_t length,
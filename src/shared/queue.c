@@ -25,6 +25,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 
@@ -33,8 +35,23 @@ struct queue {
 	struct queue_entry *head;
 	struct queue_entry *tail;
 	unsigned int entries;
+	size_t key_offset;
+	struct queue_entry **index;
+	unsigned int index_size;
 };
 
+/*
+ * Released entries are kept in a per thread cache and reused by the next
+ * push, so a queue that is constantly filled and drained does not hit the
+ * allocator at all once it reached its working set size.
+ */
+#define ENTRY_CACHE_MAX 512
+
+static __thread struct queue_entry *entry_cache;
+static __thread unsigned int entry_cache_len;
+
+#define INDEX_MIN_SIZE 16
+
 static struct queue *queue_ref(struct queue *queue)
 {
 	if (!queue)
@@ -50,6 +67,7 @@ static void queue_unref(struct queue *queue)
 	if (__sync_sub_and_fetch(&queue->ref_count, 1))
 		return;
 
+	free(queue->index);
 	free(queue);
 }
 
@@ -68,6 +86,26 @@ struct queue *queue_new(void)
 	return queue_ref(queue);
 }
 
+struct queue *queue_new_keyed(size_t key_offset)
+{
+	struct queue *queue;
+
+	queue = queue_new();
+	if (!queue)
+		return NULL;
+
+	queue->index = new0(struct queue_entry *, INDEX_MIN_SIZE);
+	if (!queue->index) {
+		queue_unref(queue);
+		return NULL;
+	}
+
+	queue->index_size = INDEX_MIN_SIZE;
+	queue->key_offset = key_offset;
+
+	return queue;
+}
+
 void queue_destroy(struct queue *queue, queue_destroy_func_t destroy)
 {
 	if (!queue)
@@ -78,6 +116,150 @@ void queue_destroy(struct queue *queue, queue_destroy_func_t destroy)
 	queue_unref(queue);
 }
 
+/*
+ * Keyed queues keep an open addressing hash table with linear probing
+ * that maps the unsigned int key found at key_offset inside each queued
+ * element to its list entry. Deletion uses backward shifting, so no
+ * tombstones are needed and lookups stay short.
+ */
+static unsigned int entry_key(struct queue *queue,
+					const struct queue_entry *entry)
+{
+	const uint8_t *data = entry->data;
+
+	return *((const unsigned int *) (data + queue->key_offset));
+}
+
+static unsigned int index_slot(struct queue *queue, unsigned int key)
+{
+	return (key * 0x9e3779b1u) & (queue->index_size - 1);
+}
+
+static void index_insert(struct queue *queue, struct queue_entry *entry)
+{
+	unsigned int mask = queue->index_size - 1;
+	unsigned int i;
+
+	for (i = index_slot(queue, entry_key(queue, entry));
+					queue->index[i]; i = (i + 1) & mask);
+
+	queue->index[i] = entry;
+}
+
+static bool index_resize(struct queue *queue, unsigned int size)
+{
+	struct queue_entry **old_index = queue->index;
+	unsigned int old_size = queue->index_size;
+	unsigned int i;
+
+	queue->index = new0(struct queue_entry *, size);
+	if (!queue->index) {
+		queue->index = old_index;
+		return false;
+	}
+
+	queue->index_size = size;
+
+	for (i = 0; i < old_size; i++) {
+		if (old_index[i])
+			index_insert(queue, old_index[i]);
+	}
+
+	free(old_index);
+
+	return true;
+}
+
+/*
+ * Makes room for one more entry before anything gets linked, so that a
+ * push can fail cleanly when the index can't grow. Inserting into a full
+ * index would never find a free slot.
+ */
+static bool index_reserve(struct queue *queue)
+{
+	if (!queue->index)
+		return true;
+
+	/* Keep the load factor below one half */
+	if (queue->entries * 2 < queue->index_size)
+		return true;
+
+	return index_resize(queue, queue->index_size * 2);
+}
+
+static void index_add(struct queue *queue, struct queue_entry *entry)
+{
+	if (!queue->index || !entry->data)
+		return;
+
+	index_insert(queue, entry);
+}
+
+static void index_del(struct queue *queue, struct queue_entry *entry)
+{
+	unsigned int mask, i, j;
+
+	if (!queue->index || !entry->data)
+		return;
+
+	mask = queue->index_size - 1;
+
+	for (i = index_slot(queue, entry_key(queue, entry));
+				queue->index[i] != entry; i = (i + 1) & mask) {
+		if (!queue->index[i])
+			return;
+	}
+
+	for (j = (i + 1) & mask; queue->index[j]; j = (j + 1) & mask) {
+		unsigned int k = index_slot(queue,
+					entry_key(queue, queue->index[j]));
+
+		/* Skip entries whose home slot lies within (i, j] */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		queue->index[i] = queue->index[j];
+		i = j;
+	}
+
+	queue->index[i] = NULL;
+}
+
+static struct queue_entry *index_find(struct queue *queue, unsigned int key)
+{
+	unsigned int mask = queue->index_size - 1;
+	unsigned int i;
+
+	for (i = index_slot(queue, key); queue->index[i]; i = (i + 1) & mask) {
+		if (entry_key(queue, queue->index[i]) == key)
+			return queue->index[i];
+	}
+
+	return NULL;
+}
+
+static struct queue_entry *find_entry(struct queue *queue, const void *data)
+{
+	struct queue_entry *entry;
+
+	/* Elements of keyed queues can be looked up by their own key */
+	if (queue->index && data) {
+		const uint8_t *key = data;
+
+		entry = index_find(queue, *((const unsigned int *)
+						(key + queue->key_offset)));
+
+		return entry && entry->data == data ? entry : NULL;
+	}
+
+	for (entry = queue->head; entry; entry = entry->next) {
+		if (entry->data == data)
+			return entry;
+	}
+
+	return NULL;
+}
+
 static struct queue_entry *queue_entry_ref(struct queue_entry *entry)
 {
 	if (!entry)
@@ -93,33 +275,89 @@ static void queue_entry_unref(struct queue_entry *entry)
 	if (__sync_sub_and_fetch(&entry->ref_count, 1))
 		return;
 
-	free(entry);
+	if (entry_cache_len >= ENTRY_CACHE_MAX) {
+		free(entry);
+		return;
+	}
+
+	entry->next = entry_cache;
+	entry_cache = entry;
+	entry_cache_len++;
+}
+
+/*
+ * Releases the entries cached by the calling thread. Each thread that used
+ * a queue should call this before it exits, the main thread is covered by
+ * the destructor below.
+ */
+void queue_cache_flush(void)
+{
+	while (entry_cache) {
+		struct queue_entry *entry = entry_cache;
+
+		entry_cache = entry->next;
+		free(entry);
+	}
+
+	entry_cache_len = 0;
+}
+
+static void __attribute__((destructor)) queue_cache_cleanup(void)
+{
+	queue_cache_flush();
 }
 
 static struct queue_entry *queue_entry_new(void *data)
 {
 	struct queue_entry *entry;
 
-	entry = new0(struct queue_entry, 1);
-	if (!entry)
-		return NULL;
+	if (entry_cache) {
+		entry = entry_cache;
+		entry_cache = entry->next;
+		entry_cache_len--;
+	} else {
+		entry = malloc(sizeof(*entry));
+		if (!entry)
+			return NULL;
+	}
 
+	entry->ref_count = 0;
 	entry->data = data;
+	entry->next = NULL;
+	entry->prev = NULL;
 
 	return queue_entry_ref(entry);
 }
 
-bool queue_push_tail(struct queue *queue, void *data)
+void queue_entry_init(struct queue_entry *entry, void *data)
 {
-	struct queue_entry *entry;
+	if (!entry)
+		return;
 
-	if (!queue)
-		return false;
+	/* The reference held by the owner keeps the entry from being freed */
+	entry->ref_count = 1;
+	entry->data = data;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
 
-	entry = queue_entry_new(data);
-	if (!entry)
+static bool queue_entry_link(struct queue_entry *entry)
+{
+	/* Embedded entries can only be linked into a single queue */
+	if (!entry || entry->ref_count != 1)
 		return false;
 
+	queue_entry_ref(entry);
+	entry->next = NULL;
+	entry->prev = NULL;
+
+	return true;
+}
+
+static void push_tail(struct queue *queue, struct queue_entry *entry)
+{
+	entry->prev = queue->tail;
+
 	if (queue->tail)
 		queue->tail->next = entry;
 
@@ -128,7 +366,61 @@ bool queue_push_tail(struct queue *queue, void *data)
 	if (!queue->head)
 		queue->head = entry;
 
+	index_add(queue, entry);
+	queue->entries++;
+}
+
+static void push_head(struct queue *queue, struct queue_entry *entry)
+{
+	entry->next = queue->head;
+
+	if (queue->head)
+		queue->head->prev = entry;
+
+	queue->head = entry;
+
+	if (!queue->tail)
+		queue->tail = entry;
+
+	index_add(queue, entry);
 	queue->entries++;
+}
+
+/*
+ * The next pointer of an unlinked entry is left untouched, so that
+ * queue_foreach() can continue with it after the entry was removed by
+ * its callback.
+ */
+static void unlink_entry(struct queue *queue, struct queue_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		queue->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		queue->tail = entry->prev;
+
+	index_del(queue, entry);
+	queue->entries--;
+
+	queue_entry_unref(entry);
+}
+
+bool queue_push_tail(struct queue *queue, void *data)
+{
+	struct queue_entry *entry;
+
+	if (!queue || !index_reserve(queue))
+		return false;
+
+	entry = queue_entry_new(data);
+	if (!entry)
+		return false;
+
+	push_tail(queue, entry);
 
 	return true;
 }
@@ -137,42 +429,47 @@ bool queue_push_head(struct queue *queue, void *data)
 {
 	struct queue_entry *entry;
 
-	if (!queue)
+	if (!queue || !index_reserve(queue))
 		return false;
 
 	entry = queue_entry_new(data);
 	if (!entry)
 		return false;
 
-	entry->next = queue->head;
+	push_head(queue, entry);
 
-	queue->head = entry;
+	return true;
+}
 
-	if (!queue->tail)
-		queue->tail = entry;
+bool queue_push_tail_entry(struct queue *queue, struct queue_entry *entry)
+{
+	if (!queue || !index_reserve(queue) || !queue_entry_link(entry))
+		return false;
 
-	queue->entries++;
+	push_tail(queue, entry);
 
 	return true;
 }
 
-bool queue_push_after(struct queue *queue, void *entry, void *data)
+bool queue_push_head_entry(struct queue *queue, struct queue_entry *entry)
 {
-	struct queue_entry *qentry, *tmp, *new_entry;
+	if (!queue || !index_reserve(queue) || !queue_entry_link(entry))
+		return false;
+
+	push_head(queue, entry);
 
-	qentry = NULL;
+	return true;
+}
+
+bool queue_push_after(struct queue *queue, void *entry, void *data)
+{
+	struct queue_entry *qentry, *new_entry;
 
 	if (!queue)
 		return false;
 
-	for (tmp = queue->head; tmp; tmp = tmp->next) {
-		if (tmp->data == entry) {
-			qentry = tmp;
-			break;
-		}
-	}
-
-	if (!qentry)
+	qentry = find_entry(queue, entry);
+	if (!qentry || !index_reserve(queue))
 		return false;
 
 	new_entry = queue_entry_new(data);
@@ -180,11 +477,16 @@ bool queue_push_after(struct queue *queue, void *entry, void *data)
 		return false;
 
 	new_entry->next = qentry->next;
+	new_entry->prev = qentry;
 
 	if (!qentry->next)
 		queue->tail = new_entry;
+	else
+		qentry->next->prev = new_entry;
 
 	qentry->next = new_entry;
+
+	index_add(queue, new_entry);
 	queue->entries++;
 
 	return true;
@@ -199,17 +501,9 @@ void *queue_pop_head(struct queue *queue)
 		return NULL;
 
 	entry = queue->head;
-
-	if (!queue->head->next) {
-		queue->head = NULL;
-		queue->tail = NULL;
-	} else
-		queue->head = queue->head->next;
-
 	data = entry->data;
 
-	queue_entry_unref(entry);
-	queue->entries--;
+	unlink_entry(queue, entry);
 
 	return data;
 }
@@ -282,72 +576,79 @@ void *queue_find(struct queue *queue, queue_match_func_t function,
 	return NULL;
 }
 
-bool queue_remove(struct queue *queue, void *data)
+void *queue_find_by_key(struct queue *queue, unsigned int key)
 {
-	struct queue_entry *entry, *prev;
+	struct queue_entry *entry;
 
-	if (!queue)
-		return false;
+	if (!queue || !queue->index)
+		return NULL;
 
-	for (entry = queue->head, prev = NULL; entry;
-					prev = entry, entry = entry->next) {
-		if (entry->data != data)
-			continue;
+	entry = index_find(queue, key);
+	if (!entry)
+		return NULL;
 
-		if (prev)
-			prev->next = entry->next;
-		else
-			queue->head = entry->next;
+	return entry->data;
+}
 
-		if (!entry->next)
-			queue->tail = prev;
+bool queue_remove(struct queue *queue, void *data)
+{
+	struct queue_entry *entry;
 
-		queue_entry_unref(entry);
-		queue->entries--;
+	if (!queue)
+		return false;
 
-		return true;
-	}
+	entry = find_entry(queue, data);
+	if (!entry)
+		return false;
+
+	unlink_entry(queue, entry);
 
-	return false;
+	return true;
 }
 
 void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 							void *user_data)
 {
-	struct queue_entry *entry, *prev = NULL;
+	struct queue_entry *entry;
 
 	if (!queue || !function)
 		return NULL;
 
-	entry = queue->head;
-
-	while (entry) {
-		if (function(entry->data, user_data)) {
-			void *data;
-
-			if (prev)
-				prev->next = entry->next;
-			else
-				queue->head = entry->next;
+	for (entry = queue->head; entry; entry = entry->next) {
+		void *data;
 
-			if (!entry->next)
-				queue->tail = prev;
+		if (!function(entry->data, user_data))
+			continue;
 
-			data = entry->data;
+		data = entry->data;
 
-			queue_entry_unref(entry);
-			queue->entries--;
+		unlink_entry(queue, entry);
 
-			return data;
-		} else {
-			prev = entry;
-			entry = entry->next;
-		}
+		return data;
 	}
 
 	return NULL;
 }
 
+void *queue_remove_by_key(struct queue *queue, unsigned int key)
+{
+	struct queue_entry *entry;
+	void *data;
+
+	if (!queue || !queue->index)
+		return NULL;
+
+	entry = index_find(queue, key);
+	if (!entry)
+		return NULL;
+
+	data = entry->data;
+
+	unlink_entry(queue, entry);
+
+	return data;
+}
+
 unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 				void *user_data, queue_destroy_func_t destroy)
 {
@@ -378,15 +679,25 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 		queue->tail = NULL;
 		queue->entries = 0;
 
+		if (queue->index)
+			memset(queue->index, 0, queue->index_size *
+						sizeof(*queue->index));
+
 		while (entry) {
 			struct queue_entry *tmp = entry;
+			void *data = tmp->data;
 
 			entry = entry->next;
 
+			/*
+			 * Drop the reference first since destroy may free
+			 * the memory of an embedded entry.
+			 */
+			queue_entry_unref(tmp);
+
 			if (destroy)
-				destroy(tmp->data);
+				destroy(data);
 
-			queue_entry_unref(tmp);
 			count++;
 		}
 	}
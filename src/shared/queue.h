@@ -22,6 +22,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef void (*queue_destroy_func_t)(void *data);
 
@@ -31,14 +32,34 @@ struct queue_entry {
 	int ref_count;
 	void *data;
 	struct queue_entry *next;
+	struct queue_entry *prev;
 };
 
 struct queue *queue_new(void);
+
+/*
+ * A keyed queue additionally indexes its elements by the unsigned int
+ * found at key_offset inside each of them, which turns the find and
+ * remove by key operations into O(1). Keys are expected to be unique and
+ * must not change while an element is queued.
+ */
+struct queue *queue_new_keyed(size_t key_offset);
 void queue_destroy(struct queue *queue, queue_destroy_func_t destroy);
 
 bool queue_push_tail(struct queue *queue, void *data);
 bool queue_push_head(struct queue *queue, void *data);
 bool queue_push_after(struct queue *queue, void *entry, void *data);
+
+/*
+ * Entries can also be embedded into the queued object itself to avoid the
+ * allocation per push. Such an entry is owned by the caller, can be part
+ * of only one queue at a time and must not be freed while it is queued or
+ * from within a queue_foreach() callback iterating over it.
+ */
+void queue_entry_init(struct queue_entry *entry, void *data);
+bool queue_push_tail_entry(struct queue *queue, struct queue_entry *entry);
+bool queue_push_head_entry(struct queue *queue, struct queue_entry *entry);
+
 void *queue_pop_head(struct queue *queue);
 void *queue_peek_head(struct queue *queue);
 void *queue_peek_tail(struct queue *queue);
@@ -52,10 +73,12 @@ typedef bool (*queue_match_func_t)(const void *data, const void *match_data);
 
 void *queue_find(struct queue *queue, queue_match_func_t function,
 							const void *match_data);
+void *queue_find_by_key(struct queue *queue, unsigned int key);
 
 bool queue_remove(struct queue *queue, void *data);
 void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 							void *user_data);
+void *queue_remove_by_key(struct queue *queue, unsigned int key);
 unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 				void *user_data, queue_destroy_func_t destroy);
 
@@ -63,3 +86,5 @@ const struct queue_entry *queue_get_entries(struct queue *queue);
 
 unsigned int queue_length(struct queue *queue);
 bool queue_isempty(struct queue *queue);
+
+void queue_cache_flush(void);
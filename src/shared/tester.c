@@ -36,6 +36,7 @@
 #include <glib.h>
 
 #include "src/shared/util.h"
+#include "src/shared/queue.h"
 #include "src/shared/tester.h"
 
 #define COLOR_OFF	"\x1B[0m"
@@ -838,5 +839,7 @@ int tester_run(void)
 
 	g_list_free_full(test_list, test_destroy);
 
+	queue_cache_flush();
+
 	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
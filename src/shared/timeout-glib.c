@@ -69,6 +69,38 @@ unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
 	return id;
 }
 
+unsigned int timeout_add_slack(unsigned int timeout, unsigned int slack,
+				timeout_func_t func, void *user_data,
+				timeout_destroy_func_t destroy)
+{
+	struct timeout_data *data;
+	guint id;
+
+	/*
+	 * Second granularity timeouts are coalesced by GLib itself, so use
+	 * them whenever the caller allows for enough slack.
+	 */
+	if (slack < 1000 || timeout < 1000)
+		return timeout_add(timeout, func, user_data, destroy);
+
+	data = g_try_new0(struct timeout_data, 1);
+	if (!data)
+		return 0;
+
+	data->func = func;
+	data->destroy = destroy;
+	data->user_data = user_data;
+
+	id = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT,
+					(timeout + 999) / 1000,
+					timeout_callback, data,
+					timeout_destroy);
+	if (!id)
+		g_free(data);
+
+	return id;
+}
+
 void timeout_remove(unsigned int id)
 {
 	GSource *source = g_main_context_find_source_by_id(NULL, id);
@@ -18,33 +18,231 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "mainloop.h"
 #include "util.h"
 #include "timeout.h"
 
+/*
+ * All timeouts are multiplexed onto a single timerfd using a hierarchical
+ * timer wheel with a resolution of one millisecond. Level 0 holds timers
+ * that expire within the next WHEEL_SLOTS ticks, every further level
+ * covers WHEEL_SLOTS times the range of the previous one. Timers on the
+ * upper levels are cascaded down when the wheel reaches their slot, so
+ * adding and removing a timer is O(1) and no syscall is needed unless
+ * the earliest expiry changes.
+ */
+#define WHEEL_BITS	6
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_RANGE	(UINT64_C(1) << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define ID_INDEX_BITS	20
+#define ID_INDEX_MASK	((1 << ID_INDEX_BITS) - 1)
+#define ID_GEN_MASK	((1 << (32 - ID_INDEX_BITS)) - 1)
+
 struct timeout_data {
-	int id;
+	unsigned int id;
 	timeout_func_t func;
 	timeout_destroy_func_t destroy;
 	unsigned int timeout;
+	unsigned int slack;
 	void *user_data;
+	uint64_t expires;
+	bool running;
+	bool removed;
+	unsigned int level;
+	unsigned int slot;
+	struct timeout_data *next;
+	struct timeout_data **pprev;
 };
 
-static void timeout_callback(int id, void *user_data)
+struct timeout_slot {
+	struct timeout_data *data;
+	unsigned int gen;
+};
+
+struct timeout_wheel {
+	int fd;
+	uint64_t clk;
+	uint64_t armed;
+	unsigned int count;
+	uint64_t pending[WHEEL_LEVELS];
+	struct timeout_data *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	struct timeout_slot *ids;
+	unsigned int ids_size;
+	unsigned int *free_ids;
+	unsigned int free_count;
+};
+
+static struct timeout_wheel wheel = { .fd = -1 };
+
+static uint64_t wheel_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void wheel_link(struct timeout_data *data)
+{
+	uint64_t expires = data->expires;
+	uint64_t delta;
+	unsigned int level, slot;
+
+	if (expires < wheel.clk)
+		expires = wheel.clk;
+
+	delta = expires - wheel.clk;
+
+	/*
+	 * Timers beyond the range of the wheel are parked in the furthest
+	 * slot of the last level and simply get re-linked when that slot
+	 * is cascaded.
+	 */
+	if (delta >= WHEEL_RANGE) {
+		delta = WHEEL_RANGE - 1;
+		expires = wheel.clk + delta;
+	}
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < (UINT64_C(1) << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	data->level = level;
+	data->slot = slot;
+	data->next = wheel.slots[level][slot];
+	if (data->next)
+		data->next->pprev = &data->next;
+	data->pprev = &wheel.slots[level][slot];
+	wheel.slots[level][slot] = data;
+
+	wheel.pending[level] |= UINT64_C(1) << slot;
+}
+
+static void wheel_unlink(struct timeout_data *data)
 {
-	struct timeout_data *data = user_data;
+	if (!data->pprev)
+		return;
+
+	*data->pprev = data->next;
+	if (data->next)
+		data->next->pprev = data->pprev;
+
+	data->next = NULL;
+	data->pprev = NULL;
 
-	if (data->func(data->user_data) &&
-			!mainloop_modify_timeout(data->id, data->timeout))
+	/* Timers on the expiry list are not part of any slot */
+	if (data->level >= WHEEL_LEVELS)
 		return;
 
-	mainloop_remove_timeout(data->id);
+	if (!wheel.slots[data->level][data->slot])
+		wheel.pending[data->level] &= ~(UINT64_C(1) << data->slot);
 }
 
-static void timeout_destroy(void *user_data)
+static bool wheel_has_pending(void)
 {
-	struct timeout_data *data = user_data;
+	unsigned int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		if (wheel.pending[level])
+			return true;
+	}
+
+	return false;
+}
+
+static unsigned int first_pending(uint64_t pending, unsigned int start)
+{
+	uint64_t rotated;
+
+	start &= WHEEL_MASK;
+	rotated = start ? (pending >> start) | (pending << (WHEEL_SLOTS - start))
+								: pending;
+
+	return __builtin_ctzll(rotated);
+}
+
+/*
+ * Find the next tick at which either a level 0 slot with timers is
+ * reached or a non-empty slot of an upper level needs to be cascaded.
+ */
+static uint64_t wheel_next(void)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned int shift = WHEEL_BITS * level;
+		uint64_t block, tick;
+
+		if (!wheel.pending[level])
+			continue;
+
+		block = (wheel.clk + (UINT64_C(1) << shift) - 1) >> shift;
+		block += first_pending(wheel.pending[level], block);
+		tick = block << shift;
+
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void wheel_cascade(unsigned int level, unsigned int slot)
+{
+	struct timeout_data *list = wheel.slots[level][slot];
+
+	wheel.slots[level][slot] = NULL;
+	wheel.pending[level] &= ~(UINT64_C(1) << slot);
+
+	while (list) {
+		struct timeout_data *data = list;
+
+		list = data->next;
+		data->next = NULL;
+		data->pprev = NULL;
+
+		wheel_link(data);
+	}
+}
+
+static void wheel_arm(uint64_t now)
+{
+	uint64_t next;
+
+	if (!wheel.count || wheel.fd < 0)
+		return;
+
+	next = wheel_next();
+	if (next == UINT64_MAX || next == wheel.armed)
+		return;
+
+	if (next <= now)
+		next = now + 1;
+
+	if (mainloop_modify_timeout(wheel.fd, next - now) < 0)
+		return;
+
+	wheel.armed = next;
+}
+
+static void timeout_free(struct timeout_data *data)
+{
+	unsigned int index = (data->id & ID_INDEX_MASK) - 1;
+
+	wheel.ids[index].data = NULL;
+	wheel.free_ids[wheel.free_count++] = index;
+	wheel.count--;
 
 	if (data->destroy)
 		data->destroy(data->user_data);
@@ -52,34 +250,266 @@ static void timeout_destroy(void *user_data)
 	free(data);
 }
 
-unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
-			void *user_data, timeout_destroy_func_t destroy)
+static void timeout_schedule(struct timeout_data *data, uint64_t now)
+{
+	data->expires = now + data->timeout;
+
+	/*
+	 * Round the expiry up to the coarsest power of two boundary that
+	 * still lies within the allowed slack, so that timers with similar
+	 * deadlines share a single wakeup.
+	 */
+	if (data->slack) {
+		uint64_t slack = (uint64_t) data->slack + 1;
+		uint64_t mask;
+
+		/* Widened so that a slack of UINT_MAX doesn't wrap to zero */
+		mask = (UINT64_C(1) << (63 - __builtin_clzll(slack))) - 1;
+		data->expires = (data->expires + mask) & ~mask;
+	}
+
+	wheel_link(data);
+}
+
+static void timeout_run(struct timeout_data *data)
+{
+	data->running = true;
+
+	if (data->func(data->user_data) && !data->removed) {
+		data->running = false;
+		timeout_schedule(data, wheel_now());
+		return;
+	}
+
+	timeout_free(data);
+}
+
+static void wheel_expire(uint64_t now)
+{
+	while (wheel.clk <= now) {
+		struct timeout_data *expired, *data;
+		uint64_t tick = wheel_next();
+		unsigned int level, slot;
+
+		if (tick > now) {
+			wheel.clk = now + 1;
+			break;
+		}
+
+		wheel.clk = tick;
+
+		for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+			unsigned int shift = WHEEL_BITS * level;
+
+			if (tick & ((UINT64_C(1) << shift) - 1))
+				continue;
+
+			wheel_cascade(level, (tick >> shift) & WHEEL_MASK);
+		}
+
+		/*
+		 * Move the expired timers onto a private list and advance the
+		 * clock before running the callbacks, so that timers added or
+		 * re-armed from within them never end up on that list.
+		 */
+		slot = tick & WHEEL_MASK;
+		expired = wheel.slots[0][slot];
+		wheel.slots[0][slot] = NULL;
+		wheel.pending[0] &= ~(UINT64_C(1) << slot);
+		wheel.clk = tick + 1;
+
+		if (!expired)
+			continue;
+
+		expired->pprev = &expired;
+
+		for (data = expired; data; data = data->next)
+			data->level = WHEEL_LEVELS;
+
+		while (expired) {
+			data = expired;
+
+			wheel_unlink(data);
+			timeout_run(data);
+		}
+	}
+}
+
+static void wheel_callback(int id, void *user_data)
+{
+	uint64_t now = wheel_now();
+
+	wheel.armed = UINT64_MAX;
+
+	wheel_expire(now);
+	wheel_arm(wheel_now());
+}
+
+static void wheel_destroy(void *user_data)
 {
+	unsigned int level, slot;
+
+	wheel.fd = -1;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < WHEEL_SLOTS; slot++) {
+			while (wheel.slots[level][slot]) {
+				struct timeout_data *data;
+
+				data = wheel.slots[level][slot];
+				wheel_unlink(data);
+				timeout_free(data);
+			}
+		}
+	}
+
+	free(wheel.ids);
+	free(wheel.free_ids);
+
+	memset(&wheel, 0, sizeof(wheel));
+	wheel.fd = -1;
+}
+
+static bool wheel_setup(void)
+{
+	if (wheel.fd >= 0)
+		return true;
+
+	wheel.fd = mainloop_add_timeout(0, wheel_callback, NULL, wheel_destroy);
+	if (wheel.fd < 0) {
+		wheel.fd = -1;
+		return false;
+	}
+
+	wheel.clk = wheel_now();
+	wheel.armed = UINT64_MAX;
+
+	return true;
+}
+
+static bool alloc_id(struct timeout_data *data)
+{
+	struct timeout_slot *slot;
+	unsigned int index;
+
+	if (!wheel.free_count) {
+		unsigned int size = wheel.ids_size ? wheel.ids_size * 2 : 64;
+		struct timeout_slot *ids;
+		unsigned int *free_ids;
+
+		if (size > ID_INDEX_MASK)
+			return false;
+
+		ids = realloc(wheel.ids, size * sizeof(*ids));
+		if (!ids)
+			return false;
+
+		wheel.ids = ids;
+
+		free_ids = realloc(wheel.free_ids, size * sizeof(*free_ids));
+		if (!free_ids)
+			return false;
+
+		wheel.free_ids = free_ids;
+
+		memset(ids + wheel.ids_size, 0,
+				(size - wheel.ids_size) * sizeof(*ids));
+
+		for (index = size; index > wheel.ids_size; index--)
+			wheel.free_ids[wheel.free_count++] = index - 1;
+
+		wheel.ids_size = size;
+	}
+
+	index = wheel.free_ids[--wheel.free_count];
+	slot = &wheel.ids[index];
+
+	slot->gen = (slot->gen + 1) & ID_GEN_MASK;
+	slot->data = data;
+
+	data->id = (slot->gen << ID_INDEX_BITS) | (index + 1);
+	wheel.count++;
+
+	return true;
+}
+
+static struct timeout_data *lookup_id(unsigned int id)
+{
+	unsigned int index = (id & ID_INDEX_MASK);
 	struct timeout_data *data;
 
+	if (!index || index > wheel.ids_size)
+		return NULL;
+
+	data = wheel.ids[index - 1].data;
+	if (!data || data->id != id)
+		return NULL;
+
+	return data;
+}
+
+unsigned int timeout_add_slack(unsigned int timeout, unsigned int slack,
+				timeout_func_t func, void *user_data,
+				timeout_destroy_func_t destroy)
+{
+	struct timeout_data *data;
+	uint64_t now;
+
+	if (!func || !wheel_setup())
+		return 0;
+
 	data = new0(struct timeout_data, 1);
 	if (!data)
 		return 0;
 
 	data->func = func;
 	data->user_data = user_data;
-	data->timeout = timeout;
+	data->timeout = timeout ? : 1;
+	data->slack = slack;
 	data->destroy = destroy;
 
-	data->id = mainloop_add_timeout(timeout, timeout_callback, data,
-							timeout_destroy);
-	if (data->id < 0) {
+	if (!alloc_id(data)) {
 		free(data);
 		return 0;
 	}
 
-	return (unsigned int) data->id;
+	now = wheel_now();
+
+	/* Fast forward an idle wheel so new timers land on low levels */
+	if (!wheel_has_pending() && wheel.clk < now)
+		wheel.clk = now;
+
+	timeout_schedule(data, now);
+
+	if (data->expires < wheel.armed)
+		wheel_arm(now);
+
+	return data->id;
+}
+
+unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
+			void *user_data, timeout_destroy_func_t destroy)
+{
+	return timeout_add_slack(timeout, 0, func, user_data, destroy);
 }
 
 void timeout_remove(unsigned int id)
 {
+	struct timeout_data *data;
+
 	if (!id)
 		return;
 
-	mainloop_remove_timeout((int) id);
+	data = lookup_id(id);
+	if (!data || data->removed)
+		return;
+
+	/* Callbacks removing their own timeout are released on return */
+	if (data->running) {
+		data->removed = true;
+		return;
+	}
+
+	wheel_unlink(data);
+	timeout_free(data);
 }
@@ -24,4 +24,7 @@ typedef void (*timeout_destroy_func_t)(void *user_data);
 
 unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
 			void *user_data, timeout_destroy_func_t destroy);
+unsigned int timeout_add_slack(unsigned int timeout, unsigned int slack,
+				timeout_func_t func, void *user_data,
+				timeout_destroy_func_t destroy);
 void timeout_remove(unsigned int id);
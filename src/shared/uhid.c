@@ -132,7 +132,7 @@ struct bt_uhid *bt_uhid_new(int fd)
 	if (!uhid->io)
 		goto failed;
 
-	uhid->notify_list = queue_new();
+	uhid->notify_list = queue_new_keyed(offsetof(struct uhid_notify, id));
 	if (!uhid->notify_list)
 		goto failed;
 
@@ -202,14 +202,6 @@ unsigned int bt_uhid_register(struct bt_uhid *uhid, uint32_t event,
 	return notify->id;
 }
 
-static bool match_notify_id(const void *a, const void *b)
-{
-	const struct uhid_notify *notify = a;
-	unsigned int id = PTR_TO_UINT(b);
-
-	return notify->id == id;
-}
-
 bool bt_uhid_unregister(struct bt_uhid *uhid, unsigned int id)
 {
 	struct uhid_notify *notify;
@@ -217,8 +209,7 @@ bool bt_uhid_unregister(struct bt_uhid *uhid, unsigned int id)
 	if (!uhid || !id)
 		return false;
 
-	notify = queue_remove_if(uhid->notify_list, match_notify_id,
-							UINT_TO_PTR(id));
+	notify = queue_remove_by_key(uhid->notify_list, id);
 	if (!notify)
 		return false;
 
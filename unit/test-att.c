@@ -0,0 +1,381 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/mainloop.h"
+#include "src/shared/att.h"
+#include "src/shared/tester.h"
+
+#define MAX_OPS 16
+
+struct context {
+	struct bt_att *att;
+	int fd;
+	uint8_t ops[MAX_OPS];
+	unsigned int num_ops;
+	unsigned int num_rsp;
+	unsigned int expected;
+	unsigned int received;
+	uint64_t bytes;
+	uint8_t last[512];
+	ssize_t last_len;
+	unsigned int sent;
+	unsigned int handled;
+	unsigned int reg_id;
+};
+
+static struct context test_context;
+
+static void context_create(struct context *context)
+{
+	int sv[2];
+
+	memset(context, 0, sizeof(*context));
+
+	mainloop_init();
+
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+						SOCK_CLOEXEC, 0, sv) == 0);
+
+	context->att = bt_att_new(sv[0], false);
+	g_assert(context->att != NULL);
+
+	bt_att_set_close_on_unref(context->att, true);
+
+	context->fd = sv[1];
+}
+
+static void context_destroy(struct context *context)
+{
+	mainloop_remove_fd(context->fd);
+	close(context->fd);
+
+	bt_att_unref(context->att);
+}
+
+static void read_rsp_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct context *context = user_data;
+
+	g_assert(opcode == BT_ATT_OP_READ_RSP);
+
+	if (++context->num_rsp == 2)
+		mainloop_quit();
+}
+
+static void peer_read_cb(int fd, uint32_t events, void *user_data)
+{
+	struct context *context = user_data;
+	uint8_t rsp[] = { BT_ATT_OP_READ_RSP, 0x01, 0x02 };
+	uint8_t buf[512];
+	ssize_t len;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		context->received++;
+		context->bytes += len;
+
+		memcpy(context->last, buf, len);
+		context->last_len = len;
+
+		if (context->num_ops < MAX_OPS)
+			context->ops[context->num_ops++] = buf[0];
+
+		if (buf[0] == BT_ATT_OP_READ_REQ)
+			g_assert(write(fd, rsp, sizeof(rsp)) == sizeof(rsp));
+
+		if (context->expected && context->received == context->expected)
+			mainloop_quit();
+	}
+}
+
+static void test_sequencing(const void *data)
+{
+	struct context *context = &test_context;
+	uint8_t req[] = { 0x03, 0x00 };
+	uint8_t not[] = { 0x03, 0x00, 0xaa };
+	const uint8_t expected[] = {
+		BT_ATT_OP_HANDLE_VAL_NOT, BT_ATT_OP_HANDLE_VAL_NOT,
+		BT_ATT_OP_HANDLE_VAL_NOT, BT_ATT_OP_READ_REQ,
+		BT_ATT_OP_READ_REQ,
+	};
+	unsigned int i;
+
+	context_create(context);
+
+	g_assert(mainloop_add_fd(context->fd, EPOLLIN, peer_read_cb,
+							context, NULL) == 0);
+
+	/*
+	 * Only one request may be outstanding, so the second one must wait
+	 * for the first response while the notifications go out together
+	 * with the first request.
+	 */
+	for (i = 0; i < 2; i++)
+		g_assert(bt_att_send(context->att, BT_ATT_OP_READ_REQ, req,
+						sizeof(req), read_rsp_cb,
+						context, NULL));
+
+	for (i = 0; i < 3; i++)
+		g_assert(bt_att_send(context->att, BT_ATT_OP_HANDLE_VAL_NOT,
+						not, sizeof(not), NULL,
+						NULL, NULL));
+
+	mainloop_run();
+
+	g_assert(context->num_rsp == 2);
+	g_assert(context->num_ops == sizeof(expected));
+	g_assert(memcmp(context->ops, expected, sizeof(expected)) == 0);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+static void test_send_iov(const void *data)
+{
+	struct context *context = &test_context;
+	uint8_t handle[] = { 0x03, 0x00 };
+	uint8_t value[] = { 0x01, 0x02, 0x03, 0x04 };
+	const uint8_t expected[] = { BT_ATT_OP_HANDLE_VAL_NOT, 0x03, 0x00,
+						0x01, 0x02, 0x03, 0x04 };
+	struct iovec iov[3];
+	uint8_t big[BT_ATT_DEFAULT_LE_MTU];
+
+	context_create(context);
+
+	g_assert(mainloop_add_fd(context->fd, EPOLLIN, peer_read_cb,
+							context, NULL) == 0);
+
+	iov[0].iov_base = handle;
+	iov[0].iov_len = sizeof(handle);
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = value;
+	iov[2].iov_len = sizeof(value);
+
+	/* Payloads exceeding the MTU are rejected */
+	memset(big, 0, sizeof(big));
+	iov[1].iov_base = big;
+	iov[1].iov_len = sizeof(big);
+	g_assert(!bt_att_send_iov(context->att, BT_ATT_OP_HANDLE_VAL_NOT,
+						iov, 3, NULL, NULL, NULL));
+
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	g_assert(bt_att_send_iov(context->att, BT_ATT_OP_HANDLE_VAL_NOT,
+						iov, 3, NULL, NULL, NULL));
+
+	context->expected = 1;
+	mainloop_run();
+
+	g_assert(context->last_len == sizeof(expected));
+	g_assert(memcmp(context->last, expected, sizeof(expected)) == 0);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+static void test_throughput(const void *data)
+{
+	struct context *context = &test_context;
+	unsigned int count = 100000, i;
+	uint8_t not[22];
+	struct bt_att_stats stats;
+	struct timespec start, end;
+	double elapsed;
+
+	context_create(context);
+
+	g_assert(mainloop_add_fd(context->fd, EPOLLIN, peer_read_cb,
+							context, NULL) == 0);
+
+	memset(not, 0x42, sizeof(not));
+	context->expected = count;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < count; i++)
+		g_assert(bt_att_send(context->att, BT_ATT_OP_HANDLE_VAL_NOT,
+						not, sizeof(not), NULL,
+						NULL, NULL));
+
+	mainloop_run();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	g_assert(context->received == count);
+	g_assert(bt_att_get_stats(context->att, &stats));
+	g_assert(stats.tx_pdus == count);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	tester_print("%u notifications in %.3f s (%.0f PDUs/s)", count,
+				elapsed, elapsed > 0 ? count / elapsed : 0);
+	tester_print("%" PRIu64 " writer wakeups, %" PRIu64 " syscalls "
+				"(%.1f PDUs per wakeup)", stats.tx_wakeups,
+				stats.tx_syscalls, stats.tx_wakeups ?
+				(double) stats.tx_pdus / stats.tx_wakeups : 0);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+static void dispatch_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct context *context = user_data;
+
+	if (++context->handled == context->expected)
+		mainloop_quit();
+}
+
+static void unregister_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	struct context *context = user_data;
+
+	/* Removing a handler that is yet to be called must skip it */
+	g_assert(bt_att_unregister(context->att, context->reg_id));
+	g_assert(!bt_att_unregister(context->att, context->reg_id));
+
+	mainloop_quit();
+}
+
+static void test_unregister(const void *data)
+{
+	struct context *context = &test_context;
+	uint8_t not[] = { BT_ATT_OP_HANDLE_VAL_NOT, 0x03, 0x00 };
+
+	context_create(context);
+
+	g_assert(bt_att_register(context->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					unregister_cb, context, NULL));
+	context->reg_id = bt_att_register(context->att,
+						BT_ATT_OP_HANDLE_VAL_NOT,
+						dispatch_cb, context, NULL);
+	g_assert(context->reg_id);
+	g_assert(bt_att_register(context->att, BT_ATT_OP_HANDLE_VAL_NOT,
+					dispatch_cb, context, NULL));
+
+	context->expected = 2;
+	g_assert(write(context->fd, not, sizeof(not)) == sizeof(not));
+
+	mainloop_run();
+
+	g_assert(context->handled == 1);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+static void peer_write_cb(int fd, uint32_t events, void *user_data)
+{
+	struct context *context = user_data;
+	uint8_t cmd[] = { BT_ATT_OP_WRITE_CMD, 0x03, 0x00, 0x01, 0x02 };
+	uint8_t not[] = { BT_ATT_OP_HANDLE_VAL_NOT, 0x05, 0x00, 0x01, 0x02 };
+
+	while (context->sent < context->expected) {
+		uint8_t *pdu = context->sent % 2 ? cmd : not;
+
+		if (write(fd, pdu, sizeof(cmd)) < 0)
+			return;
+
+		context->sent++;
+	}
+
+	mainloop_modify_fd(fd, 0);
+}
+
+static void test_dispatch(const void *data)
+{
+	struct context *context = &test_context;
+	/* Roughly what a GATT server and client register on a bearer */
+	const uint8_t opcodes[] = {
+		BT_ATT_OP_MTU_REQ, BT_ATT_OP_FIND_INFO_REQ,
+		BT_ATT_OP_FIND_BY_TYPE_VAL_REQ, BT_ATT_OP_READ_BY_TYPE_REQ,
+		BT_ATT_OP_READ_REQ, BT_ATT_OP_READ_BLOB_REQ,
+		BT_ATT_OP_READ_MULT_REQ, BT_ATT_OP_READ_BY_GRP_TYPE_REQ,
+		BT_ATT_OP_WRITE_REQ, BT_ATT_OP_SIGNED_WRITE_CMD,
+		BT_ATT_OP_PREP_WRITE_REQ, BT_ATT_OP_EXEC_WRITE_REQ,
+		BT_ATT_OP_HANDLE_VAL_IND, BT_ATT_OP_WRITE_CMD,
+		BT_ATT_OP_HANDLE_VAL_NOT,
+	};
+	unsigned int count = 200000, i;
+	struct timespec start, end;
+	double elapsed;
+
+	context_create(context);
+
+	for (i = 0; i < sizeof(opcodes); i++)
+		g_assert(bt_att_register(context->att, opcodes[i], dispatch_cb,
+							context, NULL));
+
+	context->expected = count;
+
+	g_assert(mainloop_add_fd(context->fd, EPOLLOUT, peer_write_cb,
+							context, NULL) == 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	mainloop_run();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	g_assert(context->handled == count);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	tester_print("%u PDUs dispatched to %zu handlers in %.3f s "
+				"(%.0f PDUs/s)", count, sizeof(opcodes), elapsed,
+				elapsed > 0 ? count / elapsed : 0);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/att/sequencing", NULL, NULL, test_sequencing, NULL);
+	tester_add("/att/send_iov", NULL, NULL, test_send_iov, NULL);
+	tester_add("/att/throughput", NULL, NULL, test_throughput, NULL);
+	tester_add("/att/unregister", NULL, NULL, test_unregister, NULL);
+	tester_add("/att/dispatch", NULL, NULL, test_dispatch, NULL);
+
+	return tester_run();
+}
@@ -0,0 +1,657 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/tester.h"
+
+#define HDR_SIZE	16
+#define PKT_SIZE	24
+#define DATA_SIZE	200
+#define MAX_SIZE	4096
+
+/* Number of packets that fit into one rotated file of MAX_SIZE */
+#define PKTS_PER_FILE	((MAX_SIZE - HDR_SIZE) / (PKT_SIZE + DATA_SIZE))
+
+struct test_dir {
+	char dir[32];
+	char path[64];
+};
+
+static void dir_setup(struct test_dir *td)
+{
+	snprintf(td->dir, sizeof(td->dir), "/tmp/test-btsnoop-XXXXXX");
+	g_assert(mkdtemp(td->dir));
+
+	snprintf(td->path, sizeof(td->path), "%s/trace", td->dir);
+}
+
+static void dir_cleanup(struct test_dir *td)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dp;
+
+	dp = opendir(td->dir);
+	g_assert(dp);
+
+	while ((d = readdir(dp))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", td->dir, d->d_name);
+		unlink(path);
+	}
+
+	closedir(dp);
+	rmdir(td->dir);
+}
+
+/* Returns the size of <path>.n or -1 if there is no such file */
+static off_t file_size(const char *path, int n)
+{
+	char name[PATH_MAX];
+	struct stat st;
+
+	if (n < 0)
+		snprintf(name, sizeof(name), "%s", path);
+	else
+		snprintf(name, sizeof(name), "%s.%d", path, n);
+
+	if (stat(name, &st) < 0)
+		return -1;
+
+	return st.st_size;
+}
+
+static off_t entry_size(const struct test_dir *td, const char *name)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", td->dir, name);
+
+	return file_size(path, -1);
+}
+
+static void touch(const struct test_dir *td, const char *name)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", td->dir, name);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	g_assert(fd >= 0);
+	close(fd);
+}
+
+static void write_packets(struct btsnoop *btsnoop, unsigned int count)
+{
+	uint8_t data[DATA_SIZE];
+	struct timeval tv = { 1000000000, 0 };
+	unsigned int i;
+
+	memset(data, 0x42, sizeof(data));
+
+	for (i = 0; i < count; i++) {
+		tv.tv_usec = i;
+		g_assert(btsnoop_write_hci(btsnoop, &tv, 0,
+						BTSNOOP_OPCODE_ACL_TX_PKT,
+						data, sizeof(data)));
+	}
+}
+
+static void test_rotate_size(const void *data)
+{
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+	int i;
+
+	dir_setup(&td);
+
+	btsnoop = btsnoop_create(td.path, MAX_SIZE, 0, 3,
+						BTSNOOP_TYPE_MONITOR);
+	g_assert(btsnoop);
+
+	/* Five full files and a sixth one with 10 packets in it */
+	write_packets(btsnoop, 5 * PKTS_PER_FILE + 10);
+	btsnoop_unref(btsnoop);
+
+	g_assert(file_size(td.path, -1) < 0);
+
+	for (i = 0; i < 3; i++)
+		g_assert(file_size(td.path, i) < 0);
+
+	for (i = 3; i < 5; i++)
+		g_assert(file_size(td.path, i) == HDR_SIZE +
+				PKTS_PER_FILE * (PKT_SIZE + DATA_SIZE));
+
+	g_assert(file_size(td.path, 5) == HDR_SIZE +
+					10 * (PKT_SIZE + DATA_SIZE));
+	g_assert(file_size(td.path, 6) < 0);
+
+	for (i = 3; i <= 5; i++)
+		g_assert(file_size(td.path, i) <= MAX_SIZE);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+static void test_rotate_restart(const void *data)
+{
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+	int i;
+
+	dir_setup(&td);
+
+	/* Left behind by an earlier run, with unrelated files next to them */
+	touch(&td, "trace.2");
+	touch(&td, "trace.7");
+	touch(&td, "trace.8");
+	touch(&td, "trace.9x");
+	touch(&td, "trace.");
+	touch(&td, "other.20");
+
+	btsnoop = btsnoop_create(td.path, MAX_SIZE, 0, 3,
+						BTSNOOP_TYPE_MONITOR);
+	g_assert(btsnoop);
+
+	/* Numbering continues and only the ring survives */
+	g_assert(file_size(td.path, 2) < 0);
+	g_assert(file_size(td.path, 7) == 0);
+	g_assert(file_size(td.path, 8) == 0);
+	g_assert(file_size(td.path, 9) == HDR_SIZE);
+	g_assert(file_size(td.path, 0) < 0);
+
+	write_packets(btsnoop, 2 * PKTS_PER_FILE + 1);
+	btsnoop_unref(btsnoop);
+
+	for (i = 0; i < 9; i++)
+		g_assert(file_size(td.path, i) < 0);
+
+	for (i = 9; i < 11; i++)
+		g_assert(file_size(td.path, i) == HDR_SIZE +
+				PKTS_PER_FILE * (PKT_SIZE + DATA_SIZE));
+
+	g_assert(file_size(td.path, 11) == HDR_SIZE + PKT_SIZE + DATA_SIZE);
+
+	g_assert(entry_size(&td, "trace.9x") == 0);
+	g_assert(entry_size(&td, "trace.") == 0);
+	g_assert(entry_size(&td, "other.20") == 0);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+static void test_write_through(const void *data)
+{
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+
+	dir_setup(&td);
+
+	btsnoop = btsnoop_create(td.path, 0, 0, 0, BTSNOOP_TYPE_MONITOR);
+	g_assert(btsnoop);
+
+	g_assert(file_size(td.path, -1) == HDR_SIZE);
+
+	/* Every packet hits the file right away */
+	write_packets(btsnoop, 1);
+	g_assert(file_size(td.path, -1) == HDR_SIZE + PKT_SIZE + DATA_SIZE);
+
+	write_packets(btsnoop, 1);
+	g_assert(file_size(td.path, -1) == HDR_SIZE +
+						2 * (PKT_SIZE + DATA_SIZE));
+
+	btsnoop_unref(btsnoop);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+static void test_buffered(const void *data)
+{
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+
+	dir_setup(&td);
+
+	btsnoop = btsnoop_create(td.path, 0, 0, 0, BTSNOOP_TYPE_MONITOR);
+	g_assert(btsnoop);
+
+	/* Too small to hold a maximum sized packet */
+	g_assert(!btsnoop_set_buffer(btsnoop, PKT_SIZE, 0));
+
+	g_assert(btsnoop_set_buffer(btsnoop, 8192, 0));
+
+	/* Nothing reaches the file until the buffer is flushed */
+	write_packets(btsnoop, 10);
+	g_assert(file_size(td.path, -1) == HDR_SIZE);
+
+	g_assert(btsnoop_flush(btsnoop));
+	g_assert(file_size(td.path, -1) == HDR_SIZE +
+					10 * (PKT_SIZE + DATA_SIZE));
+
+	/* A full buffer gets written out before taking more packets */
+	write_packets(btsnoop, 40);
+	g_assert(file_size(td.path, -1) > HDR_SIZE +
+					10 * (PKT_SIZE + DATA_SIZE));
+	g_assert(file_size(td.path, -1) < HDR_SIZE +
+					50 * (PKT_SIZE + DATA_SIZE));
+
+	/* Whatever is left gets written when the trace is closed */
+	btsnoop_unref(btsnoop);
+	g_assert(file_size(td.path, -1) == HDR_SIZE +
+					50 * (PKT_SIZE + DATA_SIZE));
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+static void test_buffered_interval(const void *data)
+{
+	uint8_t pkt[DATA_SIZE];
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+	struct timeval tv = { 1000000000, 0 };
+
+	dir_setup(&td);
+
+	memset(pkt, 0, sizeof(pkt));
+
+	btsnoop = btsnoop_create(td.path, 0, 0, 0, BTSNOOP_TYPE_MONITOR);
+	g_assert(btsnoop);
+
+	g_assert(btsnoop_set_buffer(btsnoop, 8192, 100));
+
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_ACL_TX_PKT,
+							pkt, sizeof(pkt)));
+	tv.tv_usec = 99000;
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_ACL_TX_PKT,
+							pkt, sizeof(pkt)));
+	g_assert(file_size(td.path, -1) == HDR_SIZE);
+
+	/* The flush interval is measured from the oldest buffered packet */
+	tv.tv_usec = 100000;
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_ACL_TX_PKT,
+							pkt, sizeof(pkt)));
+	g_assert(file_size(td.path, -1) == HDR_SIZE +
+					3 * (PKT_SIZE + DATA_SIZE));
+
+	/* Dropping the buffer writes out what is pending */
+	g_assert(btsnoop_write_hci(btsnoop, &tv, 0, BTSNOOP_OPCODE_ACL_TX_PKT,
+							pkt, sizeof(pkt)));
+	g_assert(btsnoop_set_buffer(btsnoop, 0, 0));
+	g_assert(file_size(td.path, -1) == HDR_SIZE +
+					4 * (PKT_SIZE + DATA_SIZE));
+
+	btsnoop_unref(btsnoop);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+#define SEEK_PKTS	5000
+#define SEEK_BASE	1000000000
+
+/* Packet n carries its number and is stamped n ms after SEEK_BASE. From
+ * packet jump on the clock restarts 2 s after SEEK_BASE.
+ */
+static void write_trace(const char *path, unsigned int jump, long nsec)
+{
+	struct btsnoop *btsnoop;
+	struct timespec times[2];
+	unsigned int i;
+
+	btsnoop = btsnoop_create(path, 0, 0, 0, BTSNOOP_TYPE_MONITOR);
+	g_assert(btsnoop);
+
+	for (i = 0; i < SEEK_PKTS; i++) {
+		unsigned int msec = i < jump ? i : 2000 + i - jump;
+		struct timeval tv;
+		uint8_t data[4];
+
+		tv.tv_sec = SEEK_BASE + msec / 1000;
+		tv.tv_usec = (msec % 1000) * 1000;
+
+		put_le32(i, data);
+
+		g_assert(btsnoop_write_hci(btsnoop, &tv, 0,
+						BTSNOOP_OPCODE_ACL_RX_PKT,
+						data, sizeof(data)));
+	}
+
+	btsnoop_unref(btsnoop);
+
+	/* Pin the modification time down to the nanosecond */
+	times[0].tv_sec = SEEK_BASE;
+	times[0].tv_nsec = nsec;
+	times[1] = times[0];
+	g_assert(!utimensat(AT_FDCWD, path, times, 0));
+}
+
+static int next_packet(struct btsnoop *btsnoop, struct timeval *tv)
+{
+	uint16_t index, opcode, size;
+	const void *data;
+
+	if (!btsnoop_next_hci(btsnoop, tv, &index, &opcode, &data, &size))
+		return -1;
+
+	g_assert(size == 4);
+
+	return get_le32(data);
+}
+
+/* The first packet at or after tv in file order, found the slow way */
+static int linear_find(const char *path, const struct timeval *tv)
+{
+	struct btsnoop *btsnoop;
+	struct timeval pkt_tv;
+	int n;
+
+	btsnoop = btsnoop_open(path, 0);
+	g_assert(btsnoop);
+
+	while ((n = next_packet(btsnoop, &pkt_tv)) >= 0) {
+		if (!timercmp(&pkt_tv, tv, <))
+			break;
+	}
+
+	btsnoop_unref(btsnoop);
+
+	return n;
+}
+
+static int check_seek(struct btsnoop *btsnoop, const char *path,
+						unsigned int msec)
+{
+	struct timeval tv, pkt_tv;
+	int n;
+
+	tv.tv_sec = SEEK_BASE + msec / 1000;
+	tv.tv_usec = (msec % 1000) * 1000;
+
+	g_assert(btsnoop_seek(btsnoop, &tv));
+
+	n = next_packet(btsnoop, &pkt_tv);
+	g_assert(n == linear_find(path, &tv));
+
+	return n;
+}
+
+static void test_seek(const void *data)
+{
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+	struct timeval tv;
+
+	dir_setup(&td);
+
+	write_trace(td.path, SEEK_PKTS, 0);
+
+	btsnoop = btsnoop_open(td.path, 0);
+	g_assert(btsnoop);
+
+	/* Start, including a target before the first packet */
+	g_assert(check_seek(btsnoop, td.path, 0) == 0);
+	tv.tv_sec = SEEK_BASE - 1;
+	tv.tv_usec = 0;
+	g_assert(btsnoop_seek(btsnoop, &tv));
+	g_assert(next_packet(btsnoop, &tv) == 0);
+
+	/* Middle, on and across index entries */
+	g_assert(check_seek(btsnoop, td.path, 2500) == 2500);
+	g_assert(check_seek(btsnoop, td.path, 1024) == 1024);
+	g_assert(check_seek(btsnoop, td.path, 1023) == 1023);
+	g_assert(check_seek(btsnoop, td.path, 4096) == 4096);
+
+	/* Reading carries on after the packet that was seeked to */
+	g_assert(next_packet(btsnoop, &tv) == 4097);
+
+	/* End and beyond */
+	g_assert(check_seek(btsnoop, td.path, SEEK_PKTS - 1) ==
+							SEEK_PKTS - 1);
+	g_assert(next_packet(btsnoop, &tv) < 0);
+	g_assert(check_seek(btsnoop, td.path, SEEK_PKTS) < 0);
+	g_assert(check_seek(btsnoop, td.path, 100000) < 0);
+
+	/* Going back after running off the end */
+	g_assert(check_seek(btsnoop, td.path, 10) == 10);
+
+	btsnoop_unref(btsnoop);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+static void test_seek_clock_back(const void *data)
+{
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+	unsigned int msec;
+
+	dir_setup(&td);
+
+	/* Packets 0 to 2999 cover 0 to 2999 ms, 3000 and on 2000 to 3999 ms */
+	write_trace(td.path, 3000, 0);
+
+	btsnoop = btsnoop_open(td.path, 0);
+	g_assert(btsnoop);
+
+	g_assert(check_seek(btsnoop, td.path, 500) == 500);
+	g_assert(check_seek(btsnoop, td.path, 2500) == 2500);
+	g_assert(check_seek(btsnoop, td.path, 3500) == 4500);
+	g_assert(check_seek(btsnoop, td.path, 4000) < 0);
+
+	for (msec = 0; msec < 4000; msec += 37)
+		check_seek(btsnoop, td.path, msec);
+
+	btsnoop_unref(btsnoop);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+static void test_seek_truncated(const void *data)
+{
+	struct btsnoop *btsnoop;
+	struct test_dir td;
+	struct timeval tv;
+	off_t size;
+
+	dir_setup(&td);
+
+	write_trace(td.path, SEEK_PKTS, 0);
+
+	/* Cut the last packet in half */
+	size = file_size(td.path, -1);
+	g_assert(!truncate(td.path, size - 14));
+
+	btsnoop = btsnoop_open(td.path, 0);
+	g_assert(btsnoop);
+
+	g_assert(check_seek(btsnoop, td.path, 0) == 0);
+	g_assert(check_seek(btsnoop, td.path, 2500) == 2500);
+	g_assert(check_seek(btsnoop, td.path, SEEK_PKTS - 2) ==
+							SEEK_PKTS - 2);
+	g_assert(next_packet(btsnoop, &tv) < 0);
+	g_assert(check_seek(btsnoop, td.path, SEEK_PKTS - 1) < 0);
+
+	g_assert(check_seek(btsnoop, td.path, 100) == 100);
+
+	btsnoop_unref(btsnoop);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+struct idx_entry {
+	uint64_t ts;
+	uint64_t offset;
+} __attribute__ ((packed));
+
+#define IDX_HDR_SIZE	32
+
+static void read_index(const char *path, uint8_t *buf, size_t *len)
+{
+	char name[PATH_MAX];
+	ssize_t ret;
+	int fd;
+
+	snprintf(name, sizeof(name), "%s.idx", path);
+
+	fd = open(name, O_RDONLY);
+	g_assert(fd >= 0);
+
+	ret = read(fd, buf, *len);
+	g_assert(ret > IDX_HDR_SIZE);
+	close(fd);
+
+	*len = ret;
+}
+
+static void write_index(const char *path, const uint8_t *buf, size_t len)
+{
+	char name[PATH_MAX];
+	int fd;
+
+	snprintf(name, sizeof(name), "%s.idx", path);
+
+	fd = open(name, O_WRONLY | O_TRUNC);
+	g_assert(fd >= 0);
+	g_assert(write(fd, buf, len) == (ssize_t) len);
+	close(fd);
+}
+
+static void seek_all(const char *path)
+{
+	struct btsnoop *btsnoop;
+	unsigned int msec;
+
+	btsnoop = btsnoop_open(path, 0);
+	g_assert(btsnoop);
+
+	for (msec = 0; msec < 6000; msec += 250)
+		check_seek(btsnoop, path, msec);
+
+	btsnoop_unref(btsnoop);
+}
+
+static void test_index(const void *data)
+{
+	uint8_t orig[1024], buf[1024];
+	struct idx_entry *entry = (void *) (buf + IDX_HDR_SIZE);
+	struct test_dir td;
+	size_t len = sizeof(orig);
+	uint64_t tmp;
+
+	dir_setup(&td);
+
+	write_trace(td.path, SEEK_PKTS, 100);
+
+	/* The first seek stores an index next to the trace */
+	seek_all(td.path);
+	read_index(td.path, orig, &len);
+	g_assert(len == IDX_HDR_SIZE + 5 * sizeof(struct idx_entry));
+
+	/* Later ones use it */
+	seek_all(td.path);
+
+	/* First entry not pointing at the first packet */
+	memcpy(buf, orig, len);
+	entry[0].offset = entry[1].offset;
+	write_index(td.path, buf, len);
+	seek_all(td.path);
+
+	/* Unsorted offsets */
+	memcpy(buf, orig, len);
+	tmp = entry[1].offset;
+	entry[1].offset = entry[3].offset;
+	entry[3].offset = tmp;
+	write_index(td.path, buf, len);
+	seek_all(td.path);
+
+	/* Unsorted timestamps */
+	memcpy(buf, orig, len);
+	entry[3].ts = entry[0].ts;
+	write_index(td.path, buf, len);
+	seek_all(td.path);
+
+	/* A trace rewritten within the same second with the same size */
+	write_index(td.path, orig, len);
+	write_trace(td.path, 1500, 200);
+	seek_all(td.path);
+
+	dir_cleanup(&td);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/btsnoop/rotate/size", NULL, NULL, test_rotate_size, NULL);
+	tester_add("/btsnoop/rotate/restart", NULL, NULL,
+						test_rotate_restart, NULL);
+	tester_add("/btsnoop/write/through", NULL, NULL,
+						test_write_through, NULL);
+	tester_add("/btsnoop/write/buffered", NULL, NULL,
+						test_buffered, NULL);
+	tester_add("/btsnoop/write/interval", NULL, NULL,
+						test_buffered_interval, NULL);
+	tester_add("/btsnoop/seek/basic", NULL, NULL, test_seek, NULL);
+	tester_add("/btsnoop/seek/clock_back", NULL, NULL,
+						test_seek_clock_back, NULL);
+	tester_add("/btsnoop/seek/truncated", NULL, NULL,
+						test_seek_truncated, NULL);
+	tester_add("/btsnoop/seek/index", NULL, NULL, test_index, NULL);
+
+	return tester_run();
+}
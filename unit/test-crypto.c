@@ -29,11 +29,32 @@
 #include "src/shared/util.h"
 #include "src/shared/tester.h"
 
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <glib.h>
 
+#ifdef HAVE_LINUX_IF_ALG_H
+#include <linux/if_alg.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG		279
+#endif
+#endif
+
+#define BENCH_OPS	100000
+#define BENCH_ALG_OPS	10000
+#define BENCH_IRKS	10000
+#define BENCH_RESOLVE	20
+
 static struct bt_crypto *crypto;
 
+/* The known answer tests run against every available AES implementation */
+static struct bt_crypto *backends[2];
+static unsigned int num_backends;
+
 struct test_data {
 	const uint8_t *msg;
 	uint16_t msg_len;
@@ -109,6 +130,56 @@ static const struct test_data test_data_4 = {
 	.t = t_msg_4
 };
 
+static const uint8_t e_key[] = {
+	0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08, 0x07, 0x06, 0x05, 0x04,
+	0x03, 0x02, 0x01, 0x00
+};
+
+static const uint8_t e_plaintext[] = {
+	0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44,
+	0x33, 0x22, 0x11, 0x00
+};
+
+static const uint8_t e_encrypted[] = {
+	0x5a, 0xc5, 0xb4, 0x70, 0x80, 0xb7, 0xcd, 0xd8, 0x30, 0x04, 0x7b, 0x6a,
+	0xd8, 0xe0, 0xc4, 0x69
+};
+
+static const uint8_t ah_irk[] = {
+	0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34, 0x05, 0xad, 0xc8, 0x57,
+	0xa3, 0x34, 0x02, 0xec
+};
+
+static const uint8_t ah_r[] = {
+	0x94, 0x81, 0x70
+};
+
+static const uint8_t ah_hash[] = {
+	0xaa, 0xfb, 0x0d
+};
+
+static const uint8_t f4_u[] = {
+	0xe6, 0x9d, 0x35, 0x0e, 0x48, 0x01, 0x03, 0xcc, 0xdb, 0xfd, 0xf4, 0xac,
+	0x11, 0x91, 0xf4, 0xef, 0xb9, 0xa5, 0xf9, 0xe9, 0xa7, 0x83, 0x2c, 0x5e,
+	0x2c, 0xbe, 0x97, 0xf2, 0xd2, 0x03, 0xb0, 0x20
+};
+
+static const uint8_t f4_v[] = {
+	0xfd, 0xc5, 0x7f, 0xf4, 0x49, 0xdd, 0x4f, 0x6b, 0xfb, 0x7c, 0x9d, 0xf1,
+	0xc2, 0x9a, 0xcb, 0x59, 0x2a, 0xe7, 0xd4, 0xee, 0xfb, 0xfc, 0x0a, 0x90,
+	0x9a, 0xbb, 0xf6, 0x32, 0x3d, 0x8b, 0x18, 0x55
+};
+
+static const uint8_t f4_x[] = {
+	0xab, 0xae, 0x2b, 0x71, 0xec, 0xb2, 0xff, 0xff, 0x3e, 0x73, 0x77, 0xd1,
+	0x54, 0x84, 0xcb, 0xd5
+};
+
+static const uint8_t f4_res[] = {
+	0x2d, 0x87, 0x74, 0xa9, 0xbe, 0xa1, 0xed, 0xf1, 0x1c, 0xbd, 0xa9, 0x07,
+	0xf1, 0x16, 0xc9, 0xf2
+};
+
 static void print_debug(const char *str, void *user_data)
 {
 	tester_debug("%s", str);
@@ -124,7 +195,26 @@ static bool result_compare(const uint8_t exp[12], uint8_t res[12])
 	return true;
 }
 
-static void test_sign(gconstpointer data)
+static void run_backends(void (*check)(gconstpointer data),
+							gconstpointer data)
+{
+	struct bt_crypto *def = crypto;
+	unsigned int i;
+
+	for (i = 0; i < num_backends; i++) {
+		crypto = backends[i];
+
+		tester_debug("AES implementation: %s",
+					bt_crypto_get_aes_impl(crypto));
+		check(data);
+	}
+
+	crypto = def;
+
+	tester_test_passed();
+}
+
+static void check_sign(gconstpointer data)
 {
 	uint8_t t[12];
 	const struct test_data *d = data;
@@ -139,7 +229,476 @@ static void test_sign(gconstpointer data)
 	util_hexdump(' ', d->t, 12, print_debug, NULL);
 
 	g_assert(result_compare(d->t, t));
+}
+
+static void test_sign(gconstpointer data)
+{
+	run_backends(check_sign, data);
+}
+
+static void check_e(gconstpointer data)
+{
+	uint8_t res[16];
+
+	g_assert(bt_crypto_e(crypto, e_key, e_plaintext, res));
+	g_assert(memcmp(res, e_encrypted, 16) == 0);
+}
+
+static void test_e(gconstpointer data)
+{
+	run_backends(check_e, data);
+}
+
+static void check_ah(gconstpointer data)
+{
+	uint8_t res[3];
+
+	g_assert(bt_crypto_ah(crypto, ah_irk, ah_r, res));
+	g_assert(memcmp(res, ah_hash, 3) == 0);
+}
+
+static void test_ah(gconstpointer data)
+{
+	run_backends(check_ah, data);
+}
+
+static void check_f4(gconstpointer data)
+{
+	uint8_t u[32], v[32], x[16], res[16];
+
+	memcpy(u, f4_u, 32);
+	memcpy(v, f4_v, 32);
+	memcpy(x, f4_x, 16);
+
+	g_assert(bt_crypto_f4(crypto, u, v, x, 0, res));
+	g_assert(memcmp(res, f4_res, 16) == 0);
+}
+
+static void test_f4(gconstpointer data)
+{
+	run_backends(check_f4, data);
+}
+
+static void make_rpa(const uint8_t irk[16], uint8_t rpa[6])
+{
+	g_assert(bt_crypto_random_bytes(crypto, rpa + 3, 3));
+
+	/* Resolvable private addresses have 0b01 as top two bits */
+	rpa[5] = (rpa[5] & 0x3f) | 0x40;
+
+	g_assert(bt_crypto_ah(crypto, irk, rpa + 3, rpa));
+}
+
+static uint8_t (*make_irks(unsigned int num_irks))[16]
+{
+	uint8_t (*irks)[16];
+	unsigned int i;
+
+	irks = calloc(num_irks, 16);
+	g_assert(irks);
+
+	for (i = 0; i < num_irks; i++)
+		g_assert(bt_crypto_random_bytes(crypto, irks[i], 16));
+
+	return irks;
+}
+
+static void check_resolve_batch(gconstpointer data)
+{
+	uint8_t (*irks)[16] = make_irks(37);
+	uint8_t rpa[6];
+	unsigned int i;
+
+	/* Cover every lane position plus the partial tail batch */
+	for (i = 0; i < 37; i++) {
+		make_rpa(irks[i], rpa);
+		g_assert(bt_crypto_resolve_batch(crypto,
+					(const uint8_t (*)[16]) irks, 37,
+					rpa) == (int) i);
+
+		rpa[0] ^= 0x01;
+		g_assert(bt_crypto_resolve_batch(crypto,
+					(const uint8_t (*)[16]) irks, 37,
+					rpa) < 0);
+	}
+
+	make_rpa(irks[36], rpa);
+	g_assert(bt_crypto_resolve_batch(crypto, (const uint8_t (*)[16]) irks,
+							36, rpa) < 0);
+
+	free(irks);
+}
+
+static void test_resolve_batch(gconstpointer data)
+{
+	run_backends(check_resolve_batch, data);
+}
+
+static void check_resolver(gconstpointer data)
+{
+	static const uint8_t addr[3][6] = {
+		{ 0x01, 0x00, 0x00, 0x00, 0x00, 0xc0 },
+		{ 0x02, 0x00, 0x00, 0x00, 0x00, 0xc0 },
+		{ 0x03, 0x00, 0x00, 0x00, 0x00, 0xc0 },
+	};
+	struct bt_crypto_resolver *resolver;
+	uint8_t (*irks)[16] = make_irks(3);
+	uint8_t rpa[3][6], id[6], type;
+	unsigned int i;
+
+	resolver = bt_crypto_resolver_new(crypto, 2);
+	g_assert(resolver);
+
+	for (i = 0; i < 3; i++)
+		make_rpa(irks[i], rpa[i]);
+
+	/* Not yet known, negative result gets cached */
+	g_assert(!bt_crypto_resolver_resolve(resolver, rpa[2], id, &type));
+
+	for (i = 0; i < 3; i++)
+		g_assert(bt_crypto_resolver_add(resolver, irks[i], addr[i],
+									i));
+
+	g_assert(bt_crypto_resolver_count(resolver) == 3);
+
+	/* Adding an IRK must drop the cached negative result */
+	for (i = 0; i < 3; i++) {
+		g_assert(bt_crypto_resolver_resolve(resolver, rpa[i], id,
+								&type));
+		g_assert(!memcmp(id, addr[i], 6) && type == i);
+	}
+
+	/* Removal moves the last IRK, cached entries must follow it */
+	g_assert(bt_crypto_resolver_remove(resolver, addr[0], 0));
+	g_assert(!bt_crypto_resolver_remove(resolver, addr[0], 0));
+	g_assert(!bt_crypto_resolver_resolve(resolver, rpa[0], NULL, NULL));
+
+	for (i = 1; i < 3; i++) {
+		g_assert(bt_crypto_resolver_resolve(resolver, rpa[i], id,
+								&type));
+		g_assert(!memcmp(id, addr[i], 6) && type == i);
+	}
+
+	/* Non resolvable addresses are never looked up */
+	rpa[1][5] &= 0x3f;
+	g_assert(!bt_crypto_resolver_resolve(resolver, rpa[1], NULL, NULL));
+
+	bt_crypto_resolver_clear(resolver);
+	g_assert(!bt_crypto_resolver_resolve(resolver, rpa[2], NULL, NULL));
+
+	bt_crypto_resolver_free(resolver);
+	free(irks);
+}
 
+static void test_resolver(gconstpointer data)
+{
+	run_backends(check_resolver, data);
+}
+
+/* Random inputs must give the same results on every implementation */
+static void test_backends(gconstpointer data)
+{
+	uint8_t (*irks)[16] = make_irks(64);
+	uint8_t k[16], in[64], out[2][16], rpa[6];
+	unsigned int i, j;
+
+	if (num_backends < 2) {
+		tester_print("Only %s AES implementation available",
+					bt_crypto_get_aes_impl(crypto));
+		free(irks);
+		tester_test_passed();
+		return;
+	}
+
+	for (i = 0; i < 10000; i++) {
+		g_assert(bt_crypto_random_bytes(crypto, k, 16));
+		g_assert(bt_crypto_random_bytes(crypto, in, sizeof(in)));
+
+		for (j = 0; j < 2; j++)
+			g_assert(bt_crypto_e(backends[j], k, in, out[j]));
+
+		g_assert(memcmp(out[0], out[1], 16) == 0);
+
+		for (j = 0; j < 2; j++)
+			g_assert(bt_crypto_sign_att(backends[j], k, in,
+							i % sizeof(in), i,
+							out[j]));
+
+		g_assert(memcmp(out[0], out[1], 12) == 0);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		int idx[2];
+
+		if (i & 1) {
+			make_rpa(irks[i % 64], rpa);
+		} else {
+			g_assert(bt_crypto_random_bytes(crypto, rpa, 6));
+			rpa[5] = (rpa[5] & 0x3f) | 0x40;
+		}
+
+		for (j = 0; j < 2; j++)
+			idx[j] = bt_crypto_resolve_batch(backends[j],
+					(const uint8_t (*)[16]) irks,
+					64 - i % 8, rpa);
+
+		g_assert(idx[0] == idx[1]);
+	}
+
+	free(irks);
+	tester_test_passed();
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) +
+				(end.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static double bench_report(const char *name, unsigned int ops,
+							double elapsed)
+{
+	double rate = elapsed > 0 ? ops / elapsed : 0;
+
+	tester_print("%s: %u ops in %.3f s (%.0f ops/s)", name, ops,
+							elapsed, rate);
+
+	return rate;
+}
+
+/*
+ * Reference path equivalent to what bt_crypto used to do for every block:
+ * set the key on the transform socket, accept an operation socket and run
+ * a single sendmsg/read round trip on it.
+ */
+static int alg_setup(const char *type, const char *name)
+{
+#ifdef HAVE_LINUX_IF_ALG_H
+	struct sockaddr_alg salg;
+	int fd;
+
+	fd = socket(PF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&salg, 0, sizeof(salg));
+	salg.salg_family = AF_ALG;
+	strcpy((char *) salg.salg_type, type);
+	strcpy((char *) salg.salg_name, name);
+
+	if (bind(fd, (struct sockaddr *) &salg, sizeof(salg)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+static bool alg_run(int fd, bool encrypt, const uint8_t key[16],
+				const uint8_t *in, size_t in_len, uint8_t out[16])
+{
+#ifdef HAVE_LINUX_IF_ALG_H
+	uint32_t alg_op = ALG_OP_ENCRYPT;
+	char cbuf[CMSG_SPACE(sizeof(alg_op))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int op;
+
+	if (setsockopt(fd, SOL_ALG, ALG_SET_KEY, key, 16) < 0)
+		return false;
+
+	op = accept(fd, NULL, 0);
+	if (op < 0)
+		return false;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *) in;
+	iov.iov_len = in_len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (encrypt) {
+		memset(cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_ALG;
+		cmsg->cmsg_type = ALG_SET_OP;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(alg_op));
+		memcpy(CMSG_DATA(cmsg), &alg_op, sizeof(alg_op));
+	}
+
+	if (sendmsg(op, &msg, 0) < 0 || read(op, out, 16) != 16) {
+		close(op);
+		return false;
+	}
+
+	close(op);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void bench_compare(double rate, int fd, bool encrypt,
+				const uint8_t key[16], const uint8_t *in,
+				size_t in_len)
+{
+	struct timespec start;
+	uint8_t out[16];
+	unsigned int i;
+	double alg_rate;
+
+	if (fd < 0) {
+		tester_print("AF_ALG not available, skipping comparison");
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_ALG_OPS; i++)
+		g_assert(alg_run(fd, encrypt, key, in, in_len, out));
+
+	alg_rate = bench_report("AF_ALG", BENCH_ALG_OPS, elapsed_since(&start));
+
+	if (alg_rate > 0)
+		tester_print("Speedup %.1fx", rate / alg_rate);
+
+	close(fd);
+}
+
+static void test_bench_e(gconstpointer data)
+{
+	struct timespec start;
+	uint8_t in[16], out[16], key_msb[16], in_msb[16];
+	unsigned int i;
+	double rate;
+	int fd;
+
+	memcpy(in, e_plaintext, 16);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_OPS; i++) {
+		g_assert(bt_crypto_e(crypto, e_key, in, out));
+		in[0] = out[0];
+	}
+
+	rate = bench_report(bt_crypto_get_aes_impl(crypto), BENCH_OPS,
+							elapsed_since(&start));
+
+	/* AF_ALG takes key and data with the most significant octet first */
+	for (i = 0; i < 16; i++) {
+		key_msb[i] = e_key[15 - i];
+		in_msb[i] = e_plaintext[15 - i];
+	}
+
+	fd = alg_setup("skcipher", "ecb(aes)");
+	if (fd >= 0) {
+		g_assert(alg_run(fd, true, key_msb, in_msb, 16, out));
+
+		for (i = 0; i < 16; i++)
+			g_assert(out[i] == e_encrypted[15 - i]);
+	}
+
+	bench_compare(rate, fd, true, key_msb, in_msb, 16);
+
+	tester_test_passed();
+}
+
+static void test_bench_sign(gconstpointer data)
+{
+	struct timespec start;
+	uint8_t t[12];
+	unsigned int i;
+	double rate;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_OPS; i++)
+		g_assert(bt_crypto_sign_att(crypto, key, msg_4, 64, i, t));
+
+	rate = bench_report(bt_crypto_get_aes_impl(crypto), BENCH_OPS,
+							elapsed_since(&start));
+
+	bench_compare(rate, alg_setup("hash", "cmac(aes)"), false, key,
+							msg_4, 64);
+
+	tester_test_passed();
+}
+
+static void test_bench_resolve(gconstpointer data)
+{
+	struct bt_crypto_resolver *resolver;
+	uint8_t (*irks)[16] = make_irks(BENCH_IRKS);
+	uint8_t addr[6], rpa[6], hash[3];
+	struct timespec start;
+	unsigned int i, j;
+	double rate, batch_rate;
+
+	/* Worst case, the matching IRK is the last one to be tried */
+	make_rpa(irks[BENCH_IRKS - 1], rpa);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_RESOLVE; i++) {
+		for (j = 0; j < BENCH_IRKS; j++) {
+			g_assert(bt_crypto_ah(crypto, irks[j], rpa + 3, hash));
+			if (!memcmp(hash, rpa, 3))
+				break;
+		}
+
+		g_assert(j == BENCH_IRKS - 1);
+	}
+
+	rate = bench_report("bt_crypto_ah", BENCH_RESOLVE,
+							elapsed_since(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_RESOLVE; i++)
+		g_assert(bt_crypto_resolve_batch(crypto,
+					(const uint8_t (*)[16]) irks,
+					BENCH_IRKS, rpa) == BENCH_IRKS - 1);
+
+	batch_rate = bench_report("bt_crypto_resolve_batch", BENCH_RESOLVE,
+							elapsed_since(&start));
+
+	if (rate > 0)
+		tester_print("Speedup %.1fx with %u IRKs (%s)",
+					batch_rate / rate, BENCH_IRKS,
+					bt_crypto_get_aes_impl(crypto));
+
+	resolver = bt_crypto_resolver_new(crypto, 256);
+	g_assert(resolver);
+
+	memset(addr, 0, sizeof(addr));
+
+	for (i = 0; i < BENCH_IRKS; i++) {
+		put_le32(i, addr);
+		g_assert(bt_crypto_resolver_add(resolver, irks[i], addr, 1));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_OPS; i++)
+		g_assert(bt_crypto_resolver_resolve(resolver, rpa, NULL, NULL));
+
+	bench_report("bt_crypto_resolver cached", BENCH_OPS,
+							elapsed_since(&start));
+
+	bt_crypto_resolver_free(resolver);
+	free(irks);
 	tester_test_passed();
 }
 
@@ -151,16 +710,43 @@ int main(int argc, char *argv[])
 	if (!crypto)
 		return 0;
 
+	backends[num_backends++] = crypto;
+
+	/* Force the portable implementation for a second instance */
+	setenv("BT_CRYPTO_AES", "portable", 1);
+	backends[num_backends] = bt_crypto_new();
+	unsetenv("BT_CRYPTO_AES");
+
+	if (backends[num_backends] &&
+			strcmp(bt_crypto_get_aes_impl(crypto),
+				bt_crypto_get_aes_impl(backends[num_backends])))
+		num_backends++;
+	else
+		bt_crypto_unref(backends[num_backends]);
+
 	tester_init(&argc, &argv);
 
 	tester_add("/crypto/sign_att_1", &test_data_1, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_2", &test_data_2, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_3", &test_data_3, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_4", &test_data_4, NULL, test_sign, NULL);
+	tester_add("/crypto/e", NULL, NULL, test_e, NULL);
+	tester_add("/crypto/ah", NULL, NULL, test_ah, NULL);
+	tester_add("/crypto/f4", NULL, NULL, test_f4, NULL);
+	tester_add("/crypto/resolve_batch", NULL, NULL, test_resolve_batch,
+									NULL);
+	tester_add("/crypto/resolver", NULL, NULL, test_resolver, NULL);
+	tester_add("/crypto/backends", NULL, NULL, test_backends, NULL);
+	tester_add("/crypto/benchmark/e", NULL, NULL, test_bench_e, NULL);
+	tester_add("/crypto/benchmark/sign_att", NULL, NULL, test_bench_sign,
+									NULL);
+	tester_add("/crypto/benchmark/resolve", NULL, NULL,
+						test_bench_resolve, NULL);
 
 	exit_status = tester_run();
 
-	bt_crypto_unref(crypto);
+	while (num_backends)
+		bt_crypto_unref(backends[--num_backends]);
 
 	return exit_status;
 }
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "src/shared/ecc.h"
 #include "src/shared/util.h"
@@ -53,6 +54,7 @@ static void print_buf(const char *label, uint8_t *buf, size_t len)
 }
 
 #define PAIR_COUNT 200
+#define BENCH_OPS 2000
 
 static void test_multi(const void *data)
 {
@@ -94,6 +96,20 @@ static int test_sample(uint8_t priv_a[32], uint8_t priv_b[32],
 	uint8_t dhkey_a[32], dhkey_b[32];
 	int fails = 0;
 
+	uint8_t pub[64];
+
+	g_assert(ecc_make_public_key(priv_a, pub));
+	if (memcmp(pub, pub_a, 64)) {
+		tester_debug("Public key A doesn't match!");
+		fails++;
+	}
+
+	g_assert(ecc_make_public_key(priv_b, pub));
+	if (memcmp(pub, pub_b, 64)) {
+		tester_debug("Public key B doesn't match!");
+		fails++;
+	}
+
 	ecdh_shared_secret(pub_b, priv_a, dhkey_a);
 	ecdh_shared_secret(pub_a, priv_b, dhkey_b);
 
@@ -243,6 +259,171 @@ static void test_sample_3(const void *data)
 	tester_test_passed();
 }
 
+static void test_public_key_range(const void *data)
+{
+	/* Generator G and the group order n, little endian */
+	static const uint8_t g[64] = {
+				0x96, 0xc2, 0x98, 0xd8, 0x45, 0x39, 0xa1, 0xf4,
+				0xa0, 0x33, 0xeb, 0x2d, 0x81, 0x7d, 0x03, 0x77,
+				0xf2, 0x40, 0xa4, 0x63, 0xe5, 0xe6, 0xbc, 0xf8,
+				0x47, 0x42, 0x2c, 0xe1, 0xf2, 0xd1, 0x17, 0x6b,
+
+				0xf5, 0x51, 0xbf, 0x37, 0x68, 0x40, 0xb6, 0xcb,
+				0xce, 0x5e, 0x31, 0x6b, 0x57, 0x33, 0xce, 0x2b,
+				0x16, 0x9e, 0x0f, 0x7c, 0x4a, 0xeb, 0xe7, 0x8e,
+				0x9b, 0x7f, 0x1a, 0xfe, 0xe2, 0x42, 0xe3, 0x4f,
+	};
+	static const uint8_t n[32] = {
+				0x51, 0x25, 0x63, 0xfc, 0xc2, 0xca, 0xb9, 0xf3,
+				0x84, 0x9e, 0x17, 0xa7, 0xad, 0xfa, 0xe6, 0xbc,
+				0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+				0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+	};
+	uint8_t priv[32], pub[64];
+	int i;
+
+	/* 1 * G */
+	memset(priv, 0, sizeof(priv));
+	priv[0] = 0x01;
+	g_assert(ecc_make_public_key(priv, pub));
+	g_assert(memcmp(pub, g, 64) == 0);
+
+	/* (n - 1) * G = -G, same x and y = p - y */
+	memcpy(priv, n, sizeof(priv));
+	priv[0]--;
+	g_assert(ecc_make_public_key(priv, pub));
+	g_assert(memcmp(pub, g, 32) == 0);
+	g_assert(memcmp(&pub[32], &g[32], 32) != 0);
+
+	/* 0 and n are not valid private keys */
+	memset(priv, 0, sizeof(priv));
+	g_assert(!ecc_make_public_key(priv, pub));
+	g_assert(!ecc_make_public_key(n, pub));
+
+	/* Single bits exercise sparse comb columns */
+	for (i = 1; i < 256; i += 37) {
+		uint8_t shared[32];
+
+		memset(priv, 0, sizeof(priv));
+		priv[i / 8] = 1 << (i % 8);
+		g_assert(ecc_make_public_key(priv, pub));
+
+		/* k * G must agree with the generic ladder on G */
+		g_assert(ecdh_shared_secret(g, priv, shared));
+		g_assert(memcmp(shared, pub, 32) == 0);
+	}
+
+	tester_test_passed();
+}
+
+/*
+ * After regularization the ladder passes through the point at infinity
+ * for the scalars next to 0 and n. Check them against the comb and, for
+ * a random public key B = b * G, against x(b * G) and x(b * 2G).
+ */
+static void test_shared_secret_range(const void *data)
+{
+	static const uint8_t n[32] = {
+				0x51, 0x25, 0x63, 0xfc, 0xc2, 0xca, 0xb9, 0xf3,
+				0x84, 0x9e, 0x17, 0xa7, 0xad, 0xfa, 0xe6, 0xbc,
+				0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+				0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+	};
+	uint8_t priv[32], pub[64], g[64], g2[64];
+	uint8_t priv_b[32], pub_b[64], b2[32], shared[32];
+	unsigned int i;
+
+	memset(priv, 0, sizeof(priv));
+	priv[0] = 1;
+	g_assert(ecc_make_public_key(priv, g));
+	priv[0] = 2;
+	g_assert(ecc_make_public_key(priv, g2));
+
+	g_assert(ecc_make_key(pub_b, priv_b));
+	g_assert(ecdh_shared_secret(g2, priv_b, b2));
+
+	/* k = 1, 2, n - 2 and n - 1, k * P only depends on k = +-1 or +-2 */
+	for (i = 0; i < 4; i++) {
+		bool single = (i == 0 || i == 3);
+
+		if (i < 2) {
+			memset(priv, 0, sizeof(priv));
+			priv[0] = i + 1;
+		} else {
+			memcpy(priv, n, sizeof(priv));
+			priv[0] -= 4 - i;
+		}
+
+		g_assert(ecc_make_public_key(priv, pub));
+		g_assert(memcmp(pub, single ? g : g2, 32) == 0);
+
+		g_assert(ecdh_shared_secret(g, priv, shared));
+		g_assert(memcmp(shared, pub, 32) == 0);
+
+		g_assert(ecdh_shared_secret(pub_b, priv, shared));
+		g_assert(memcmp(shared, single ? pub_b : b2, 32) == 0);
+	}
+
+	/* 0 and n are not valid private keys */
+	memset(priv, 0, sizeof(priv));
+	g_assert(!ecdh_shared_secret(pub_b, priv, shared));
+	g_assert(!ecdh_shared_secret(pub_b, n, shared));
+
+	tester_test_passed();
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) +
+				(end.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static void test_bench_make_key(const void *data)
+{
+	uint8_t public_key[64], private_key[32];
+	struct timespec start;
+	double elapsed;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_OPS; i++)
+		g_assert(ecc_make_key(public_key, private_key));
+
+	elapsed = elapsed_since(&start);
+
+	tester_print("%u keys in %.3f s (%.0f keys/s)", BENCH_OPS, elapsed,
+					elapsed > 0 ? BENCH_OPS / elapsed : 0);
+
+	tester_test_passed();
+}
+
+static void test_bench_shared_secret(const void *data)
+{
+	uint8_t public_key[64], private_key[32], secret[32];
+	struct timespec start;
+	double elapsed;
+	int i;
+
+	g_assert(ecc_make_key(public_key, private_key));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_OPS; i++)
+		g_assert(ecdh_shared_secret(public_key, private_key, secret));
+
+	elapsed = elapsed_since(&start);
+
+	tester_print("%u secrets in %.3f s (%.0f secrets/s)", BENCH_OPS,
+				elapsed, elapsed > 0 ? BENCH_OPS / elapsed : 0);
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -253,5 +434,15 @@ int main(int argc, char *argv[])
 	tester_add("/ecdh/sample/2", NULL, NULL, test_sample_2, NULL);
 	tester_add("/ecdh/sample/3", NULL, NULL, test_sample_3, NULL);
 
+	tester_add("/ecdh/public_key/range", NULL, NULL,
+						test_public_key_range, NULL);
+
+	tester_add("/ecdh/shared_secret/range", NULL, NULL,
+					test_shared_secret_range, NULL);
+	tester_add("/ecdh/benchmark/make_key", NULL, NULL,
+						test_bench_make_key, NULL);
+	tester_add("/ecdh/benchmark/shared_secret", NULL, NULL,
+					test_bench_shared_secret, NULL);
+
 	return tester_run();
 }
@@ -0,0 +1,508 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-cache.h"
+#include "src/shared/tester.h"
+
+static double elapsed_time(const struct timespec *start,
+						const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+				(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/* Fills a service with alternating characteristics and descriptors */
+static struct gatt_db_attribute *add_service(struct gatt_db *db,
+							uint16_t handle,
+							uint16_t num_handles)
+{
+	struct gatt_db_attribute *svc;
+	bt_uuid_t uuid;
+	int i;
+
+	bt_uuid16_create(&uuid, 0x1800 + handle % 0x100);
+
+	svc = gatt_db_insert_service(db, handle, &uuid, true, num_handles);
+	if (!svc)
+		return NULL;
+
+	i = 1;
+
+	while (i + 1 < num_handles) {
+		bt_uuid16_create(&uuid, 0x2a00 + i % 0x100);
+		g_assert(gatt_db_service_add_characteristic(svc, &uuid,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL));
+		i += 2;
+
+		if (i == num_handles)
+			break;
+
+		bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+		g_assert(gatt_db_service_add_descriptor(svc, &uuid,
+						BT_ATT_PERM_READ,
+						NULL, NULL, NULL));
+		i++;
+	}
+
+	gatt_db_service_set_active(svc, true);
+
+	return svc;
+}
+
+static void check_handle(struct gatt_db *db, uint16_t handle, bool present)
+{
+	struct gatt_db_attribute *attr;
+
+	attr = gatt_db_get_attribute(db, handle);
+
+	if (!present) {
+		g_assert(attr == NULL);
+		return;
+	}
+
+	g_assert(attr != NULL);
+	g_assert(gatt_db_attribute_get_handle(attr) == handle);
+}
+
+static void test_lookup(const void *data)
+{
+	struct gatt_db *db;
+	struct gatt_db_attribute *svc;
+	uint16_t handle;
+
+	db = gatt_db_new();
+	g_assert(db);
+
+	/* Insert out of order, leaving gaps between services */
+	g_assert(add_service(db, 0x0020, 7));
+	g_assert(add_service(db, 0x0001, 4));
+	svc = add_service(db, 0x0010, 7);
+	g_assert(svc);
+	g_assert(add_service(db, 0xfff0, 16));
+
+	/* Overlapping ranges must be rejected */
+	g_assert(!add_service(db, 0x0003, 4));
+	g_assert(!add_service(db, 0x000e, 4));
+	g_assert(!add_service(db, 0x000f, 32));
+
+	for (handle = 0x0001; handle < 0x0030; handle++) {
+		bool present = (handle >= 0x0001 && handle <= 0x0004) ||
+				(handle >= 0x0010 && handle <= 0x0016) ||
+				(handle >= 0x0020 && handle <= 0x0026);
+
+		check_handle(db, handle, present);
+	}
+
+	check_handle(db, 0xffff, true);
+
+	gatt_db_remove_service(db, svc);
+
+	for (handle = 0x0010; handle <= 0x0016; handle++)
+		check_handle(db, handle, false);
+
+	/* The freed range can be reused */
+	g_assert(add_service(db, 0x0008, 16));
+	check_handle(db, 0x0017, true);
+
+	gatt_db_clear_range(db, 0x0004, 0x0020);
+
+	for (handle = 0x0001; handle <= 0x0026; handle++)
+		check_handle(db, handle, false);
+
+	check_handle(db, 0xfff0, true);
+
+	gatt_db_clear(db);
+	check_handle(db, 0xfff0, false);
+	g_assert(gatt_db_isempty(db));
+
+	g_assert(add_service(db, 0x0001, 4));
+	check_handle(db, 0x0004, true);
+
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static void count_attr(struct gatt_db_attribute *attr, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
+/* Compares type queries against a walk over every handle in range */
+static void check_type_query(struct gatt_db *db, uint16_t start, uint16_t end,
+							const bt_uuid_t *type)
+{
+	struct queue *q;
+	unsigned int count = 0, found = 0;
+	uint32_t handle;
+
+	q = queue_new();
+
+	gatt_db_read_by_type(db, start, end, *type, q);
+	g_assert(gatt_db_find_by_type(db, start, end, type, count_attr,
+							&found) ==
+							queue_length(q));
+
+	for (handle = start; handle <= end; handle++) {
+		struct gatt_db_attribute *attr;
+
+		attr = gatt_db_get_attribute(db, handle);
+		if (!attr || !gatt_db_service_get_active(attr))
+			continue;
+
+		if (bt_uuid_cmp(type, gatt_db_attribute_get_type(attr)))
+			continue;
+
+		g_assert(queue_pop_head(q) == attr);
+		count++;
+	}
+
+	g_assert(queue_isempty(q));
+	g_assert(found == count);
+
+	queue_destroy(q, NULL);
+}
+
+static void test_type_queries(const void *data)
+{
+	struct gatt_db *db;
+	struct gatt_db_attribute *svc;
+	struct queue *q;
+	bt_uuid_t chrc, ccc, prim, vendor;
+	uint128_t u128;
+	uint16_t handle;
+
+	db = gatt_db_new();
+	g_assert(db);
+
+	bt_uuid16_create(&chrc, GATT_CHARAC_UUID);
+	bt_uuid16_create(&ccc, GATT_CLIENT_CHARAC_CFG_UUID);
+	bt_uuid16_create(&prim, GATT_PRIM_SVC_UUID);
+
+	memset(&u128, 0x42, sizeof(u128));
+	bt_uuid128_create(&vendor, u128);
+
+	for (handle = 0x0100; handle > 0x0001; handle -= 0x10)
+		g_assert(add_service(db, handle, 9));
+
+	/* Inactive services must not show up */
+	svc = add_service(db, 0x0200, 9);
+	g_assert(svc);
+	gatt_db_service_set_active(svc, false);
+
+	/* Vendor UUIDs are indexed too, also when given as 128-bit */
+	svc = gatt_db_insert_service(db, 0x0300, &vendor, true, 2);
+	g_assert(svc);
+	g_assert(gatt_db_service_add_characteristic(svc, &vendor,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL) == NULL);
+	gatt_db_remove_service(db, svc);
+
+	svc = gatt_db_insert_service(db, 0x0300, &vendor, true, 3);
+	g_assert(svc);
+	gatt_db_service_set_active(svc, true);
+	g_assert(gatt_db_service_add_characteristic(svc, &vendor,
+						BT_ATT_PERM_READ,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL));
+
+	check_type_query(db, 0x0001, 0xffff, &chrc);
+	check_type_query(db, 0x0001, 0xffff, &ccc);
+	check_type_query(db, 0x0001, 0xffff, &vendor);
+	check_type_query(db, 0x0033, 0x0075, &ccc);
+	check_type_query(db, 0x0035, 0x0035, &chrc);
+
+	bt_uuid_to_uuid128(&ccc, &ccc);
+	check_type_query(db, 0x0001, 0xffff, &ccc);
+
+	q = queue_new();
+	/* Results stop at the first service with a different UUID size */
+	gatt_db_read_by_group_type(db, 0x0001, 0xffff, prim, q);
+	g_assert(queue_length(q) == 16);
+	queue_remove_all(q, NULL, NULL, NULL);
+
+	gatt_db_clear_range(db, 0x0035, 0x0075);
+	check_type_query(db, 0x0001, 0xffff, &ccc);
+	check_type_query(db, 0x0001, 0xffff, &chrc);
+
+	gatt_db_read_by_group_type(db, 0x0001, 0xffff, prim, q);
+	g_assert(queue_length(q) == 11);
+	queue_destroy(q, NULL);
+
+	/* Re-adding the cleared range must show up again */
+	g_assert(add_service(db, 0x0040, 16));
+	check_type_query(db, 0x0001, 0xffff, &ccc);
+
+	gatt_db_clear(db);
+	check_type_query(db, 0x0001, 0xffff, &ccc);
+
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static void compare_db(struct gatt_db *a, struct gatt_db *b)
+{
+	uint32_t handle;
+
+	for (handle = 0x0001; handle <= 0xffff; handle++) {
+		struct gatt_db_attribute *attr_a, *attr_b;
+
+		attr_a = gatt_db_get_attribute(a, handle);
+		attr_b = gatt_db_get_attribute(b, handle);
+
+		if (!attr_a) {
+			g_assert(!attr_b);
+			continue;
+		}
+
+		g_assert(attr_b);
+		g_assert(!bt_uuid_cmp(gatt_db_attribute_get_type(attr_a),
+					gatt_db_attribute_get_type(attr_b)));
+		g_assert(gatt_db_service_get_active(attr_b));
+	}
+}
+
+/* Descriptor record of the CCC at 0x0025 */
+static const uint8_t ccc_record[] = { 0x05, 0x02, 0x25, 0x00, 0x02, 0x29 };
+
+static void test_cache(const void *data)
+{
+	struct gatt_db *db, *loaded;
+	struct gatt_db_attribute *svc, *incl;
+	uint8_t *buf, *buf2, *desc;
+	ssize_t len, len2;
+	char filename[] = "/tmp/gatt-cache-XXXXXX";
+	bt_uuid_t uuid;
+	uint128_t u128;
+	int fd;
+
+	db = gatt_db_new();
+	loaded = gatt_db_new();
+	g_assert(db && loaded);
+
+	memset(&u128, 0x42, sizeof(u128));
+	bt_uuid128_create(&uuid, u128);
+
+	/* Secondary service at a higher handle, included from below */
+	incl = gatt_db_insert_service(db, 0x0100, &uuid, false, 3);
+	g_assert(incl);
+	g_assert(gatt_db_service_add_characteristic(incl, &uuid, 0,
+						BT_GATT_CHRC_PROP_READ,
+						NULL, NULL, NULL));
+
+	svc = add_service(db, 0x0001, 4);
+	g_assert(svc);
+	g_assert(add_service(db, 0x0010, 16));
+
+	bt_uuid16_create(&uuid, 0x180f);
+	svc = gatt_db_insert_service(db, 0x0020, &uuid, true, 6);
+	g_assert(gatt_db_service_add_included(svc, incl));
+	bt_uuid16_create(&uuid, 0x2a19);
+	g_assert(gatt_db_service_insert_characteristic(svc, 0x0023, &uuid, 0,
+						BT_GATT_CHRC_PROP_NOTIFY,
+						NULL, NULL, NULL));
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	g_assert(gatt_db_service_insert_descriptor(svc, 0x0025, &uuid, 0,
+							NULL, NULL, NULL));
+
+	len = gatt_cache_encode(db, &buf);
+	g_assert(len > 0);
+
+	/* Truncated or corrupted data must leave the db empty */
+	g_assert(!gatt_cache_decode(loaded, buf, len - 1));
+	g_assert(gatt_db_isempty(loaded));
+
+	/* First record type, right after the header */
+	buf[12] ^= 0xff;
+	g_assert(!gatt_cache_decode(loaded, buf, len));
+	g_assert(gatt_db_isempty(loaded));
+	buf[12] ^= 0xff;
+
+	/* Descriptor moved out of its service, found in the last service */
+	desc = memmem(buf, len, ccc_record, sizeof(ccc_record));
+	g_assert(desc);
+	desc[2] = 0x30;
+	g_assert(!gatt_cache_decode(loaded, buf, len));
+	g_assert(gatt_db_isempty(loaded));
+	desc[2] = 0x25;
+
+	g_assert(gatt_cache_decode(loaded, buf, len));
+	compare_db(db, loaded);
+
+	len2 = gatt_cache_encode(loaded, &buf2);
+	g_assert(len2 == len);
+	g_assert(memcmp(buf, buf2, len) == 0);
+
+	free(buf);
+	free(buf2);
+
+	/* Round trip through the file system */
+	fd = mkstemp(filename);
+	g_assert(fd >= 0);
+	close(fd);
+
+	gatt_db_clear(loaded);
+	g_assert(gatt_cache_store(db, filename));
+	g_assert(gatt_cache_load(loaded, filename));
+	compare_db(db, loaded);
+
+	unlink(filename);
+
+	gatt_db_unref(loaded);
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+static void type_query_benchmark(struct gatt_db *db)
+{
+	struct timespec start, end;
+	struct queue *q;
+	bt_uuid_t ccc;
+	unsigned int found = 0, queries = 0, round;
+	uint32_t handle;
+	double elapsed;
+
+	bt_uuid16_create(&ccc, GATT_CLIENT_CHARAC_CFG_UUID);
+
+	q = queue_new();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Discovery style paging through the database */
+	for (round = 0; round < 16; round++) {
+		for (handle = 0x0001; handle <= 0xffff; handle += 64) {
+			gatt_db_read_by_type(db, handle, handle + 63, ccc, q);
+
+			found += queue_length(q);
+			queries++;
+
+			queue_remove_all(q, NULL, NULL, NULL);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = elapsed_time(&start, &end);
+
+	tester_print("%u Read By Type queries found %u CCCs in %.3f s "
+				"(%.0f queries/s)", queries, found, elapsed,
+				elapsed > 0 ? queries / elapsed : 0);
+
+	queue_destroy(q, NULL);
+}
+
+static void test_lookup_benchmark(const void *data)
+{
+	struct gatt_db *db;
+	struct timespec start, end;
+	unsigned int lookups = 0, round;
+	uint32_t handle;
+	double elapsed;
+
+	db = gatt_db_new();
+	g_assert(db);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Populate all 0xffff handles with 4 handle services */
+	for (handle = 0x0001; handle + 3 <= 0xffff; handle += 4)
+		g_assert(add_service(db, handle, 4));
+
+	g_assert(add_service(db, handle, 0xffff - handle + 1));
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	tester_print("Inserted %u handles in %.3f s", 0xffff,
+						elapsed_time(&start, &end));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (round = 0; round < 16; round++) {
+		for (handle = 0x0001; handle <= 0xffff; handle++) {
+			g_assert(gatt_db_get_attribute(db, handle));
+			lookups++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = elapsed_time(&start, &end);
+
+	tester_print("%u lookups in %.3f s (%.0f lookups/s)", lookups,
+				elapsed, elapsed > 0 ? lookups / elapsed : 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	gatt_db_clear_range(db, 0x8000, 0xffff);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	tester_print("Cleared %u handles in %.3f s", 0x8000,
+						elapsed_time(&start, &end));
+
+	type_query_benchmark(db);
+
+	check_handle(db, 0x7ffc, true);
+	check_handle(db, 0x8000, false);
+
+	gatt_db_unref(db);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/gatt-db/lookup", NULL, NULL, test_lookup, NULL);
+	tester_add("/gatt-db/type_queries", NULL, NULL, test_type_queries,
+									NULL);
+	tester_add("/gatt-db/cache", NULL, NULL, test_cache, NULL);
+	tester_add("/gatt-db/lookup_benchmark", NULL, NULL,
+					test_lookup_benchmark, NULL);
+
+	return tester_run();
+}
@@ -129,24 +129,19 @@ struct context {
 		raw_pdu(0x01, 0x10, 0x09, 0x00, 0x0a),			\
 		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x01, 0x28),	\
 		raw_pdu(0x01, 0x10, 0x01, 0x00, 0x0a),			\
-		raw_pdu(0x08, 0x01, 0x00, 0x04, 0x00, 0x02, 0x28),	\
+		raw_pdu(0x08, 0x01, 0x00, 0x08, 0x00, 0x02, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x01, 0x00, 0x0a),			\
-		raw_pdu(0x08, 0x05, 0x00, 0x08, 0x00, 0x02, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x05, 0x00, 0x0a),			\
-		raw_pdu(0x08, 0x01, 0x00, 0x04, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x08, 0x01, 0x00, 0x08, 0x00, 0x03, 0x28),	\
 		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,	\
-				0x2a),					\
-		raw_pdu(0x08, 0x03, 0x00, 0x04, 0x00, 0x03, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x03, 0x00, 0x0a),			\
-		raw_pdu(0x04, 0x04, 0x00, 0x04, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29),		\
-		raw_pdu(0x08, 0x05, 0x00, 0x08, 0x00, 0x03, 0x28),	\
-		raw_pdu(0x09, 0x07, 0x06, 0x00, 0x0a, 0x07, 0x00, 0x29,	\
-				0x2a),					\
+				0x2a, 0x06, 0x00, 0x0a, 0x07, 0x00,	\
+				0x29, 0x2a),				\
 		raw_pdu(0x08, 0x07, 0x00, 0x08, 0x00, 0x03, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x07, 0x00, 0x0a),			\
-		raw_pdu(0x04, 0x08, 0x00, 0x08, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x08, 0x00, 0x01, 0x29)
+		raw_pdu(0x04, 0x04, 0x00, 0x08, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29, 0x05, 0x00,	\
+				0x00, 0x28, 0x06, 0x00, 0x03, 0x28,	\
+				0x07, 0x00, 0x29, 0x2a, 0x08, 0x00,	\
+				0x01, 0x29)
 
 #define SERVICE_DATA_2_PDUS						\
 		MTU_EXCHANGE_CLIENT_PDUS,				\
@@ -158,24 +153,19 @@ struct context {
 		raw_pdu(0x01, 0x10, 0x0b, 0x00, 0x0a),			\
 		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x01, 0x28),	\
 		raw_pdu(0x01, 0x10, 0x01, 0x00, 0x0a),			\
-		raw_pdu(0x08, 0x01, 0x00, 0x04, 0x00, 0x02, 0x28),	\
+		raw_pdu(0x08, 0x01, 0x00, 0x0a, 0x00, 0x02, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x01, 0x00, 0x0a),			\
-		raw_pdu(0x08, 0x05, 0x00, 0x0a, 0x00, 0x02, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x05, 0x00, 0x0a),			\
-		raw_pdu(0x08, 0x01, 0x00, 0x04, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x08, 0x01, 0x00, 0x0a, 0x00, 0x03, 0x28),	\
 		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,	\
-				0x2a),					\
-		raw_pdu(0x08, 0x03, 0x00, 0x04, 0x00, 0x03, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x03, 0x00, 0x0a),			\
-		raw_pdu(0x04, 0x04, 0x00, 0x04, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29),		\
-		raw_pdu(0x08, 0x05, 0x00, 0x0a, 0x00, 0x03, 0x28),	\
-		raw_pdu(0x09, 0x07, 0x07, 0x00, 0x0a, 0x08, 0x00, 0x29,	\
-				0x2a),					\
+				0x2a, 0x07, 0x00, 0x0a, 0x08, 0x00,	\
+				0x29, 0x2a),				\
 		raw_pdu(0x08, 0x08, 0x00, 0x0a, 0x00, 0x03, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x08, 0x00, 0x0a),			\
-		raw_pdu(0x04, 0x09, 0x00, 0x0a, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x0a, 0x00, 0x01, 0x29)
+		raw_pdu(0x04, 0x04, 0x00, 0x0a, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29, 0x05, 0x00,	\
+				0x00, 0x28, 0x07, 0x00, 0x03, 0x28,	\
+				0x08, 0x00, 0x29, 0x2a, 0x0a, 0x00,	\
+				0x01, 0x29)
 
 #define SERVICE_DATA_3_PDUS						\
 		MTU_EXCHANGE_CLIENT_PDUS,				\
@@ -188,25 +178,178 @@ struct context {
 		raw_pdu(0x01, 0x10, 0x21, 0x03, 0x0a),			\
 		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x01, 0x28),	\
 		raw_pdu(0x01, 0x10, 0x01, 0x00, 0x0a),			\
-		raw_pdu(0x08, 0x00, 0x01, 0x21, 0x01, 0x02, 0x28),	\
+		raw_pdu(0x08, 0x00, 0x01, 0x20, 0x03, 0x02, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x00, 0x01, 0x0a),			\
-		raw_pdu(0x08, 0x00, 0x03, 0x20, 0x03, 0x02, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x00, 0x03, 0x0a),			\
-		raw_pdu(0x08, 0x00, 0x01, 0x21, 0x01, 0x03, 0x28),	\
+		raw_pdu(0x08, 0x00, 0x01, 0x20, 0x03, 0x03, 0x28),	\
 		raw_pdu(0x09, 0x07, 0x10, 0x01, 0x02, 0x11, 0x01, 0x00,	\
-			0x2a, 0x20, 0x01, 0x02, 0x21, 0x01, 0x01, 0x2a),\
-		raw_pdu(0x08, 0x21, 0x01, 0x21, 0x01, 0x03, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x21, 0x01, 0x0a),			\
-		raw_pdu(0x04, 0x12, 0x01, 0x1f, 0x01),			\
-		raw_pdu(0x01, 0x04, 0x12, 0x01, 0x0a),			\
-		raw_pdu(0x08, 0x00, 0x03, 0x20, 0x03, 0x03, 0x28),	\
-		raw_pdu(0x09, 0x07, 0x10, 0x03, 0x0a, 0x11, 0x03, 0x29,	\
-			0x2a),						\
+			0x2a, 0x20, 0x01, 0x02, 0x21, 0x01, 0x01, 0x2a,	\
+			0x10, 0x03, 0x0a, 0x11, 0x03, 0x29, 0x2a),	\
 		raw_pdu(0x08, 0x11, 0x03, 0x20, 0x03, 0x03, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x11, 0x03, 0x0a),			\
+		raw_pdu(0x04, 0x12, 0x01, 0x1f, 0x01),			\
+		raw_pdu(0x01, 0x04, 0x12, 0x01, 0x0a),			\
 		raw_pdu(0x04, 0x12, 0x03, 0x20, 0x03),			\
 		raw_pdu(0x05, 0x01, 0x20, 0x03, 0x02, 0x29)
 
+/* Battery Service with two Battery Level values, each with a CCC */
+#define BATTERY_DATA_PDUS						\
+		MTU_EXCHANGE_CLIENT_PDUS,				\
+		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x11, 0x06, 0x01, 0x00, 0x07, 0x00, 0x0f, 0x18),\
+		raw_pdu(0x10, 0x08, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x01, 0x10, 0x08, 0x00, 0x0a),			\
+		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x01, 0x28),	\
+		raw_pdu(0x01, 0x10, 0x01, 0x00, 0x0a),			\
+		raw_pdu(0x08, 0x01, 0x00, 0x07, 0x00, 0x02, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x01, 0x00, 0x0a),			\
+		raw_pdu(0x08, 0x01, 0x00, 0x07, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x12, 0x03, 0x00, 0x19,	\
+				0x2a, 0x05, 0x00, 0x12, 0x06, 0x00,	\
+				0x19, 0x2a),				\
+		raw_pdu(0x08, 0x06, 0x00, 0x07, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x06, 0x00, 0x0a),			\
+		raw_pdu(0x04, 0x04, 0x00, 0x07, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x02, 0x29, 0x05, 0x00,	\
+				0x03, 0x28, 0x06, 0x00, 0x19, 0x2a,	\
+				0x07, 0x00, 0x02, 0x29)
+
+/* Each value read on its own, confirming the sizes implied by the types */
+#define BATTERY_READ_SINGLE_PDUS					\
+		raw_pdu(0x0a, 0x03, 0x00),				\
+		raw_pdu(0x0b, 0x01),					\
+		raw_pdu(0x0a, 0x04, 0x00),				\
+		raw_pdu(0x0b, 0x01, 0x00),				\
+		raw_pdu(0x0a, 0x06, 0x00),				\
+		raw_pdu(0x0b, 0x02),					\
+		raw_pdu(0x0a, 0x07, 0x00),				\
+		raw_pdu(0x0b, 0x02, 0x00)
+
+/* Discovery of the battery service as seen by the server, at MTU 23 */
+#define CACHE_DISCOVERY_PDUS						\
+		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x11, 0x06, 0x01, 0x00, 0x07, 0x00, 0x0f, 0x18),\
+		raw_pdu(0x10, 0x08, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x01, 0x10, 0x08, 0x00, 0x0a),			\
+		raw_pdu(0x08, 0x01, 0x00, 0x07, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x12, 0x03, 0x00, 0x19,	\
+				0x2a, 0x05, 0x00, 0x12, 0x06, 0x00,	\
+				0x19, 0x2a),				\
+		raw_pdu(0x04, 0x04, 0x00, 0x07, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x02, 0x29, 0x05, 0x00,	\
+				0x03, 0x28, 0x06, 0x00, 0x19, 0x2a,	\
+				0x07, 0x00, 0x02, 0x29)
+
+/* A single characteristic with a long value, at MTU 23 */
+#define LONG_VALUE_DATA_PDUS						\
+		raw_pdu(0x02, 0x00, 0x02),				\
+		raw_pdu(0x03, 0x17, 0x00),				\
+		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x11, 0x06, 0x01, 0x00, 0x03, 0x00, 0x01, 0x18),\
+		raw_pdu(0x10, 0x04, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x01, 0x10, 0x04, 0x00, 0x0a),			\
+		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x01, 0x28),	\
+		raw_pdu(0x01, 0x10, 0x01, 0x00, 0x0a),			\
+		raw_pdu(0x08, 0x01, 0x00, 0x03, 0x00, 0x02, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x01, 0x00, 0x0a),			\
+		raw_pdu(0x08, 0x01, 0x00, 0x03, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x0a, 0x03, 0x00, 0x00,	\
+				0x2a),					\
+		raw_pdu(0x08, 0x03, 0x00, 0x03, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x03, 0x00, 0x0a)
+
+/* The 50 byte value takes three Prepare Writes of up to 18 bytes */
+#define LONG_VALUE_WRITE_PDUS						\
+		raw_pdu(0x16, 0x03, 0x00, 0x00, 0x00, 0x00, 0x01,	\
+				0x02, 0x03, 0x04, 0x05, 0x06,		\
+				0x07, 0x08, 0x09, 0x0a, 0x0b,		\
+				0x0c, 0x0d, 0x0e, 0x0f, 0x10,		\
+				0x11),					\
+		raw_pdu(0x17, 0x03, 0x00, 0x00, 0x00, 0x00, 0x01,	\
+				0x02, 0x03, 0x04, 0x05, 0x06,		\
+				0x07, 0x08, 0x09, 0x0a, 0x0b,		\
+				0x0c, 0x0d, 0x0e, 0x0f, 0x10,		\
+				0x11),					\
+		raw_pdu(0x16, 0x03, 0x00, 0x12, 0x00, 0x12, 0x13,	\
+				0x14, 0x15, 0x16, 0x17, 0x18,		\
+				0x19, 0x1a, 0x1b, 0x1c, 0x1d,		\
+				0x1e, 0x1f, 0x20, 0x21, 0x22,		\
+				0x23),					\
+		raw_pdu(0x17, 0x03, 0x00, 0x12, 0x00, 0x12, 0x13,	\
+				0x14, 0x15, 0x16, 0x17, 0x18,		\
+				0x19, 0x1a, 0x1b, 0x1c, 0x1d,		\
+				0x1e, 0x1f, 0x20, 0x21, 0x22,		\
+				0x23),					\
+		raw_pdu(0x16, 0x03, 0x00, 0x24, 0x00, 0x24, 0x25,	\
+				0x26, 0x27, 0x28, 0x29, 0x2a,		\
+				0x2b, 0x2c, 0x2d, 0x2e, 0x2f,		\
+				0x30, 0x31),				\
+		raw_pdu(0x17, 0x03, 0x00, 0x24, 0x00, 0x24, 0x25,	\
+				0x26, 0x27, 0x28, 0x29, 0x2a,		\
+				0x2b, 0x2c, 0x2d, 0x2e, 0x2f,		\
+				0x30, 0x31),				\
+		raw_pdu(0x18, 0x01),					\
+		raw_pdu(0x19)
+
+/* Reading it back takes three Read Blobs of up to 22 bytes */
+#define LONG_VALUE_READ_PDUS						\
+		raw_pdu(0x0c, 0x03, 0x00, 0x00, 0x00),			\
+		raw_pdu(0x0d, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05,	\
+				0x06, 0x07, 0x08, 0x09, 0x0a,		\
+				0x0b, 0x0c, 0x0d, 0x0e, 0x0f,		\
+				0x10, 0x11, 0x12, 0x13, 0x14,		\
+				0x15),					\
+		raw_pdu(0x0c, 0x03, 0x00, 0x16, 0x00),			\
+		raw_pdu(0x0d, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,	\
+				0x1c, 0x1d, 0x1e, 0x1f, 0x20,		\
+				0x21, 0x22, 0x23, 0x24, 0x25,		\
+				0x26, 0x27, 0x28, 0x29, 0x2a,		\
+				0x2b),					\
+		raw_pdu(0x0c, 0x03, 0x00, 0x2c, 0x00),			\
+		raw_pdu(0x0d, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31)
+
+/*
+ * Four services at MTU 23: characteristics are discovered with one sweep over
+ * all of them and the descriptors of the first three share a Find Information
+ * request, while the remote one at 0x0043 is asked for separately.
+ */
+#define PIPELINE_DATA_PDUS						\
+		raw_pdu(0x02, 0x00, 0x02),				\
+		raw_pdu(0x03, 0x17, 0x00),				\
+		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x11, 0x06, 0x01, 0x00, 0x05, 0x00, 0x00, 0x18,	\
+				0x06, 0x00, 0x0b, 0x00, 0x0f, 0x18,	\
+				0x0c, 0x00, 0x10, 0x00, 0x0d, 0x18),	\
+		raw_pdu(0x10, 0x11, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x11, 0x06, 0x40, 0x00, 0x43, 0x00, 0x0a, 0x18),\
+		raw_pdu(0x10, 0x44, 0x00, 0xff, 0xff, 0x00, 0x28),	\
+		raw_pdu(0x01, 0x10, 0x44, 0x00, 0x0a),			\
+		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x01, 0x28),	\
+		raw_pdu(0x01, 0x10, 0x01, 0x00, 0x0a),			\
+		raw_pdu(0x08, 0x01, 0x00, 0x43, 0x00, 0x02, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x01, 0x00, 0x0a),			\
+		raw_pdu(0x08, 0x01, 0x00, 0x43, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x02, 0x03, 0x00, 0x00,	\
+				0x2a, 0x04, 0x00, 0x02, 0x05, 0x00,	\
+				0x01, 0x2a, 0x07, 0x00, 0x12, 0x08,	\
+				0x00, 0x19, 0x2a),			\
+		raw_pdu(0x08, 0x08, 0x00, 0x43, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x09, 0x07, 0x0a, 0x00, 0x02, 0x0b, 0x00, 0x19,	\
+				0x2a, 0x0d, 0x00, 0x10, 0x0e, 0x00,	\
+				0x37, 0x2a, 0x41, 0x00, 0x02, 0x42,	\
+				0x00, 0x29, 0x2a),			\
+		raw_pdu(0x08, 0x42, 0x00, 0x43, 0x00, 0x03, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x42, 0x00, 0x0a),			\
+		raw_pdu(0x04, 0x09, 0x00, 0x10, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x09, 0x00, 0x02, 0x29, 0x0a, 0x00,	\
+				0x03, 0x28, 0x0b, 0x00, 0x19, 0x2a,	\
+				0x0c, 0x00, 0x00, 0x28, 0x0d, 0x00,	\
+				0x03, 0x28),				\
+		raw_pdu(0x04, 0x0e, 0x00, 0x10, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x0e, 0x00, 0x37, 0x2a, 0x0f, 0x00,	\
+				0x02, 0x29, 0x10, 0x00, 0x01, 0x29),	\
+		raw_pdu(0x04, 0x43, 0x00, 0x43, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x43, 0x00, 0x01, 0x29)
+
 #define PRIMARY_DISC_SMALL_DB						\
 		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),	\
 		raw_pdu(0x11, 0x06, 0x10, 0xF0, 0x17, 0xF0, 0x00, 0x18,	\
@@ -244,32 +387,25 @@ struct context {
 		raw_pdu(0x01, 0x10, 0x11, 0x00, 0x0a)
 
 #define INCLUDE_DISC_SMALL_DB						\
-		raw_pdu(0x08, 0x10, 0xf0, 0x17, 0xf0, 0x02, 0x28),	\
+		raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x02, 0x28),	\
 		raw_pdu(0x09, 0x08, 0x11, 0xf0, 0x01, 0x00, 0x0f, 0x00,	\
 			0x0a, 0x18),					\
-		raw_pdu(0x08, 0x12, 0xf0, 0x17, 0xf0, 0x02, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x12, 0xf0, 0x0a),			\
-		raw_pdu(0x08, 0x01, 0x00, 0x10, 0x00, 0x02, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x01, 0x00, 0x0a)
+		raw_pdu(0x08, 0x12, 0xf0, 0xff, 0xff, 0x02, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x12, 0xf0, 0x0a)
 
 #define CHARACTERISTIC_DISC_SMALL_DB					\
-		raw_pdu(0x08, 0x10, 0xf0, 0x17, 0xf0, 0x03, 0x28),	\
-		raw_pdu(0x09, 0x07, 0x12, 0xf0, 0x02, 0x13, 0xf0, 0x00,	\
-			0x2a),						\
-		raw_pdu(0x08, 0x13, 0xf0, 0x17, 0xf0, 0x03, 0x28),	\
+		raw_pdu(0x08, 0x01, 0x00, 0xff, 0xff, 0x03, 0x28),	\
+		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x32, 0x03, 0x00, 0x29,	\
+			0x2a, 0x12, 0xf0, 0x02, 0x13, 0xf0, 0x00, 0x2a),\
+		raw_pdu(0x08, 0x13, 0xf0, 0xff, 0xff, 0x03, 0x28),	\
 		raw_pdu(0x09, 0x15, 0x14, 0xf0, 0x02, 0x15, 0xf0, 0xef,	\
 			0xcd, 0xab, 0x89, 0x67, 0x45, 0x23, 0x01, 0x00,	\
 			0x00, 0x00, 0x00, 0x09, 0xB0, 0x00, 0x00),	\
-		raw_pdu(0x08, 0x15, 0xf0, 0x17, 0xf0, 0x03, 0x28),	\
+		raw_pdu(0x08, 0x15, 0xf0, 0xff, 0xff, 0x03, 0x28),	\
 		raw_pdu(0x09, 0x07, 0x16, 0xf0, 0x02, 0x17, 0xf0, 0x01,	\
 			0x2a),						\
-		raw_pdu(0x08, 0x17, 0xf0, 0x17, 0xf0, 0x03, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x17, 0xf0, 0x0a),			\
-		raw_pdu(0x08, 0x01, 0x00, 0x10, 0x00, 0x03, 0x28),	\
-		raw_pdu(0x09, 0x07, 0x02, 0x00, 0x32, 0x03, 0x00, 0x29,	\
-			0x2a),						\
-		raw_pdu(0x08, 0x03, 0x00, 0x10, 0x00, 0x03, 0x28),	\
-		raw_pdu(0x01, 0x08, 0x03, 0x00, 0x0a)
+		raw_pdu(0x08, 0x17, 0xf0, 0xff, 0xff, 0x03, 0x28),	\
+		raw_pdu(0x01, 0x08, 0x17, 0xf0, 0x0a)
 
 #define DESCRIPTOR_DISC_SMALL_DB					\
 		raw_pdu(0x04, 0x04, 0x00, 0x10, 0x00),			\
@@ -1526,6 +1662,83 @@ static struct gatt_db *make_service_data_3_db(void)
 	return make_db(specs);
 }
 
+static struct gatt_db *make_battery_db(void)
+{
+	const struct att_handle_spec specs[] = {
+		PRIMARY_SERVICE(0x0001, BATTERY_UUID, 7),
+		CHARACTERISTIC(0x2a19, BT_ATT_PERM_READ,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_NOTIFY, 0x01),
+		DESCRIPTOR(GATT_CLIENT_CHARAC_CFG_UUID, BT_ATT_PERM_READ |
+					BT_ATT_PERM_WRITE, 0x01, 0x00),
+		CHARACTERISTIC(0x2a19, BT_ATT_PERM_READ,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_NOTIFY, 0x02),
+		DESCRIPTOR(GATT_CLIENT_CHARAC_CFG_UUID, BT_ATT_PERM_READ |
+					BT_ATT_PERM_WRITE, 0x02, 0x00),
+		{ }
+	};
+
+	return make_db(specs);
+}
+
+static struct gatt_db *make_pipeline_db(void)
+{
+	const struct att_handle_spec specs[] = {
+		PRIMARY_SERVICE(0x0001, GAP_UUID, 5),
+		CHARACTERISTIC(GATT_CHARAC_DEVICE_NAME, BT_ATT_PERM_READ,
+					BT_GATT_CHRC_PROP_READ, 0x00),
+		CHARACTERISTIC(GATT_CHARAC_APPEARANCE, BT_ATT_PERM_READ,
+					BT_GATT_CHRC_PROP_READ, 0x00, 0x00),
+		PRIMARY_SERVICE(0x0006, BATTERY_UUID, 6),
+		CHARACTERISTIC(0x2a19, BT_ATT_PERM_READ,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_NOTIFY, 0x01),
+		DESCRIPTOR(GATT_CLIENT_CHARAC_CFG_UUID, BT_ATT_PERM_READ |
+					BT_ATT_PERM_WRITE, 0x00, 0x00),
+		CHARACTERISTIC(0x2a19, BT_ATT_PERM_READ,
+					BT_GATT_CHRC_PROP_READ, 0x02),
+		PRIMARY_SERVICE(0x000c, HEART_RATE_UUID, 5),
+		CHARACTERISTIC(0x2a37, BT_ATT_PERM_NONE,
+					BT_GATT_CHRC_PROP_NOTIFY, 0x00),
+		DESCRIPTOR(GATT_CLIENT_CHARAC_CFG_UUID, BT_ATT_PERM_READ |
+					BT_ATT_PERM_WRITE, 0x00, 0x00),
+		DESCRIPTOR_STR(GATT_CHARAC_USER_DESC_UUID, BT_ATT_PERM_READ,
+					"Heart Rate"),
+		PRIMARY_SERVICE(0x0040, DEVICE_INFORMATION_UUID, 4),
+		CHARACTERISTIC_STR(GATT_CHARAC_MANUFACTURER_NAME_STRING,
+					BT_ATT_PERM_READ,
+					BT_GATT_CHRC_PROP_READ, "BlueZ"),
+		DESCRIPTOR_STR(GATT_CHARAC_USER_DESC_UUID, BT_ATT_PERM_READ,
+					"Manufacturer Name"),
+		{ }
+	};
+
+	return make_db(specs);
+}
+
+static const uint8_t long_data_3[50] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+	0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23,
+	0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31
+};
+
+static struct gatt_db *make_long_value_db(void)
+{
+	const struct att_handle_spec specs[] = {
+		PRIMARY_SERVICE(0x0001, GATT_UUID, 3),
+		CHARACTERISTIC(GATT_CHARAC_DEVICE_NAME, BT_ATT_PERM_READ |
+					BT_ATT_PERM_WRITE,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_WRITE, 0x00),
+		{ }
+	};
+
+	return make_db(specs);
+}
+
 /*
  * Defined Test database 1:
  * Tiny database fits into a single minimum sized-pdu.
@@ -2314,10 +2527,280 @@ static const struct test_step test_indication_server_1 = {
 	.length = 0x03,
 };
 
+static void test_discovery_stats(struct context *context)
+{
+	struct bt_gatt_client_discovery_stats stats;
+
+	g_assert(bt_gatt_client_get_discovery_stats(context->client, &stats));
+	g_assert(!stats.cached);
+
+	/* Every request sent is accounted for by the script */
+	g_assert_cmpint(stats.requests, ==, 12);
+
+	context_quit(context);
+}
+
+static const struct test_step test_discovery_1 = {
+	.func = test_discovery_stats,
+};
+
+struct read_expect {
+	uint16_t handle;
+	uint8_t value[2];
+	uint16_t length;
+};
+
+static const struct read_expect battery_values[] = {
+	{ 0x0003, { 0x01 }, 1 },
+	{ 0x0004, { 0x01, 0x00 }, 2 },
+	{ 0x0006, { 0x02 }, 1 },
+	{ 0x0007, { 0x02, 0x00 }, 2 },
+};
+
+static struct {
+	struct context *context;
+	unsigned int round;
+	unsigned int pending;
+	bool cancel;
+	bool cancelled;
+} read_state;
+
+static void battery_read_all(struct context *context);
+
+static void battery_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	const struct read_expect *expect = user_data;
+	struct context *context = read_state.context;
+
+	g_assert(!read_state.cancelled);
+	g_assert(success);
+	g_assert_cmpint(length, ==, expect->length);
+	g_assert(memcmp(value, expect->value, length) == 0);
+
+	read_state.pending--;
+
+	if (read_state.round && read_state.cancel) {
+		/* None of the other values in the batch may be delivered */
+		read_state.cancelled = true;
+		g_assert(bt_gatt_client_cancel_all(context->client));
+		g_idle_add(context_quit, context);
+		return;
+	}
+
+	if (read_state.pending)
+		return;
+
+	if (!read_state.round++) {
+		battery_read_all(context);
+		return;
+	}
+
+	/* Drops the last reference to the client while the batch delivers */
+	context_quit(context);
+}
+
+static void battery_read_all(struct context *context)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(battery_values); i++) {
+		g_assert(bt_gatt_client_read_value(context->client,
+						battery_values[i].handle,
+						battery_read_cb,
+						(void *) &battery_values[i],
+						NULL));
+		read_state.pending++;
+	}
+
+	/* Joins the pending read of the same value */
+	g_assert(bt_gatt_client_read_value(context->client, 0x0003,
+						battery_read_cb,
+						(void *) &battery_values[0],
+						NULL));
+	read_state.pending++;
+}
+
+static void test_read_batch(struct context *context)
+{
+	memset(&read_state, 0, sizeof(read_state));
+	read_state.context = context;
+
+	battery_read_all(context);
+}
+
+static void test_read_batch_cancel(struct context *context)
+{
+	memset(&read_state, 0, sizeof(read_state));
+	read_state.context = context;
+	read_state.cancel = true;
+
+	battery_read_all(context);
+}
+
+static const struct test_step test_read_batch_1 = {
+	.func = test_read_batch,
+};
+
+static const struct test_step test_read_batch_2 = {
+	.func = test_read_batch_cancel,
+};
+
+static void reread_cb(bool success, uint8_t att_ecode, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	struct context *context = read_state.context;
+
+	g_assert(success);
+	g_assert(length == 1);
+
+	if (read_state.round++) {
+		/* Must not be answered with the value delivered before */
+		g_assert(value[0] == 0x42);
+		context_quit(context);
+		return;
+	}
+
+	g_assert(value[0] == 0x01);
+
+	g_assert(bt_gatt_client_read_value(context->client, 0x0003,
+						reread_cb, NULL, NULL));
+}
+
+static void test_read_from_callback(struct context *context)
+{
+	memset(&read_state, 0, sizeof(read_state));
+	read_state.context = context;
+
+	g_assert(bt_gatt_client_read_value(context->client, 0x0003,
+						reread_cb, NULL, NULL));
+}
+
+static const struct test_step test_read_batch_3 = {
+	.func = test_read_from_callback,
+};
+
+static void long_value_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct context *context = user_data;
+	const struct test_step *step = context->data->step;
+
+	g_assert(success);
+	g_assert_cmpint(length, ==, step->length);
+	g_assert(memcmp(value, step->value, length) == 0);
+
+	context_quit(context);
+}
+
+static void long_value_read_iov_cb(bool success, uint8_t att_ecode,
+					const struct iovec *iov, int iovcnt,
+					void *user_data)
+{
+	struct context *context = user_data;
+	const struct test_step *step = context->data->step;
+	size_t offset = 0;
+	int i;
+
+	g_assert(success);
+
+	/* Every Read Blob Response is handed over as it was received */
+	g_assert_cmpint(iovcnt, ==, 3);
+
+	for (i = 0; i < iovcnt; i++) {
+		g_assert(offset + iov[i].iov_len <= step->length);
+		g_assert(memcmp(iov[i].iov_base, step->value + offset,
+						iov[i].iov_len) == 0);
+		offset += iov[i].iov_len;
+	}
+
+	g_assert_cmpint(offset, ==, step->length);
+
+	g_assert(bt_gatt_client_read_long_value(context->client, step->handle,
+						0, long_value_read_cb,
+						context, NULL));
+}
+
+static void long_value_write_cb(bool success, bool reliable_error,
+					uint8_t att_ecode, void *user_data)
+{
+	struct context *context = user_data;
+	const struct test_step *step = context->data->step;
+
+	g_assert(success);
+
+	g_assert(bt_gatt_client_read_long_value_iov(context->client,
+						step->handle, 0,
+						long_value_read_iov_cb,
+						context, NULL));
+}
+
+static void test_long_value(struct context *context)
+{
+	const struct test_step *step = context->data->step;
+
+	g_assert(bt_gatt_client_write_long_value(context->client, false,
+						step->handle, 0, step->value,
+						step->length,
+						long_value_write_cb, context,
+						NULL));
+}
+
+static const struct test_step test_long_value_1 = {
+	.handle = 0x0003,
+	.func = test_long_value,
+	.value = long_data_3,
+	.length = sizeof(long_data_3),
+};
+
+static void test_server_cache(struct context *context)
+{
+	struct bt_gatt_server_cache_stats stats;
+	struct gatt_db_attribute *svc;
+	bt_uuid_t uuid;
+
+	g_assert(bt_gatt_server_get_cache_stats(context->server, &stats));
+
+	if (!stats.hits) {
+		/* Nothing is cached before the first discovery */
+		g_assert_cmpint(stats.misses, ==, 4);
+		context_process(context);
+		return;
+	}
+
+	/* Error responses aren't cached */
+	g_assert_cmpint(stats.hits, ==, 3);
+	g_assert_cmpint(stats.misses, ==, 5);
+
+	bt_uuid16_create(&uuid, 0x180a);
+	svc = gatt_db_add_service(context->server_db, &uuid, true, 1);
+	g_assert(svc);
+	g_assert(gatt_db_service_set_active(svc, true));
+
+	context_process(context);
+}
+
+static void test_server_cache_check(struct context *context)
+{
+	struct bt_gatt_server_cache_stats stats;
+
+	g_assert(bt_gatt_server_get_cache_stats(context->server, &stats));
+	g_assert_cmpint(stats.hits, ==, 3);
+	g_assert_cmpint(stats.misses, ==, 7);
+}
+
+static const struct test_step test_server_cache_1 = {
+	.func = test_server_cache,
+	.post_func = test_server_cache_check,
+};
+
 int main(int argc, char *argv[])
 {
 	struct gatt_db *service_db_1, *service_db_2, *service_db_3;
-	struct gatt_db *ts_small_db, *ts_large_db_1;
+	struct gatt_db *ts_small_db, *ts_large_db_1, *battery_db;
+	struct gatt_db *pipeline_db, *long_value_db, *cache_db;
 
 	tester_init(&argc, &argv);
 
@@ -2326,6 +2809,10 @@ int main(int argc, char *argv[])
 	service_db_3 = make_service_data_3_db();
 	ts_small_db = make_test_spec_small_db();
 	ts_large_db_1 = make_test_spec_large_db_1();
+	battery_db = make_battery_db();
+	pipeline_db = make_pipeline_db();
+	long_value_db = make_long_value_db();
+	cache_db = make_battery_db();
 
 	/*
 	 * Server Configuration
@@ -4355,5 +4842,71 @@ int main(int argc, char *argv[])
 				0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff),
 			raw_pdu(0x01, 0x16, 0x04, 0x00, 0x03));
 
+	/*
+	 * Reads of values with a size implied by their type are packed into
+	 * Read Multiple once a read of each value alone confirmed the size.
+	 */
+	define_test_client("/gatt/read/batch", test_client, battery_db,
+			&test_read_batch_1,
+			BATTERY_DATA_PDUS,
+			BATTERY_READ_SINGLE_PDUS,
+			raw_pdu(0x0e, 0x03, 0x00, 0x04, 0x00, 0x06, 0x00,
+				0x07, 0x00),
+			raw_pdu(0x0f, 0x01, 0x01, 0x00, 0x02, 0x02, 0x00));
+
+	define_test_client("/gatt/read/batch/cancel", test_client, battery_db,
+			&test_read_batch_2,
+			BATTERY_DATA_PDUS,
+			BATTERY_READ_SINGLE_PDUS,
+			raw_pdu(0x0e, 0x03, 0x00, 0x04, 0x00, 0x06, 0x00,
+				0x07, 0x00),
+			raw_pdu(0x0f, 0x01, 0x01, 0x00, 0x02, 0x02, 0x00));
+
+	/* Values are read one by one again if Read Multiple fails */
+	define_test_client("/gatt/read/batch/fallback", test_client,
+			battery_db, &test_read_batch_1,
+			BATTERY_DATA_PDUS,
+			BATTERY_READ_SINGLE_PDUS,
+			raw_pdu(0x0e, 0x03, 0x00, 0x04, 0x00, 0x06, 0x00,
+				0x07, 0x00),
+			raw_pdu(0x01, 0x0e, 0x03, 0x00, 0x06),
+			BATTERY_READ_SINGLE_PDUS);
+
+	define_test_client("/gatt/read/from-callback", test_client,
+			battery_db, &test_read_batch_3,
+			BATTERY_DATA_PDUS,
+			raw_pdu(0x0a, 0x03, 0x00),
+			raw_pdu(0x0b, 0x01),
+			raw_pdu(0x0a, 0x03, 0x00),
+			raw_pdu(0x0b, 0x42));
+
+	define_test_client("/gatt/discovery/pipeline", test_client,
+			pipeline_db, &test_discovery_1,
+			PIPELINE_DATA_PDUS);
+
+	define_test_client("/gatt/long-value", test_client, long_value_db,
+			&test_long_value_1,
+			LONG_VALUE_DATA_PDUS,
+			LONG_VALUE_WRITE_PDUS,
+			LONG_VALUE_READ_PDUS,
+			LONG_VALUE_READ_PDUS);
+
+	/*
+	 * A repeated discovery is answered from the cache, except for the
+	 * error response, until a service is added.
+	 */
+	define_test_server("/gatt/server/cache", test_server, cache_db,
+			&test_server_cache_1,
+			raw_pdu(0x03, 0x00, 0x02),
+			CACHE_DISCOVERY_PDUS,
+			raw_pdu(),
+			CACHE_DISCOVERY_PDUS,
+			raw_pdu(),
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),
+			raw_pdu(0x11, 0x06, 0x01, 0x00, 0x07, 0x00, 0x0f, 0x18,
+				0x08, 0x00, 0x08, 0x00, 0x0a, 0x18),
+			raw_pdu(0x10, 0x09, 0x00, 0xff, 0xff, 0x00, 0x28),
+			raw_pdu(0x01, 0x10, 0x09, 0x00, 0x0a));
+
 	return tester_run();
 }
@@ -0,0 +1,416 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "monitor/bt.h"
+#include "src/shared/util.h"
+#include "src/shared/hci.h"
+#include "src/shared/tester.h"
+
+#define FC_MTU		27
+#define FC_CREDITS	2
+#define FC_SDU_LEN	100
+#define FC_LAST_LEN	40
+
+#define BULK_MTU	1021
+#define BULK_CREDITS	64
+#define BULK_SDUS	3
+#define BULK_SDU_LEN	20000
+
+struct context;
+
+typedef void (*acl_func_t)(struct context *context, uint16_t handle,
+					uint8_t flags, const uint8_t *data,
+					uint16_t len);
+
+/*
+ * The controller end of a stream transport. It reassembles the H:4
+ * packets sent by bt_hci and keeps track of its own buffer credits.
+ */
+struct context {
+	struct bt_hci *hci;
+	int fd;
+	guint source;
+	uint8_t buf[4096];
+	size_t len;
+	unsigned int credits;
+	unsigned int step;
+	acl_func_t acl;
+	uint8_t sdu[BULK_SDU_LEN];
+	uint16_t sdu_len;
+	unsigned int num_sdus;
+	const uint8_t *rest;
+	size_t rest_len;
+};
+
+static uint8_t payload[BULK_SDU_LEN];
+
+static void ctrl_write(struct context *context, const void *data, size_t len)
+{
+	ssize_t ret;
+
+	ret = write(context->fd, data, len);
+	g_assert(ret == (ssize_t) len);
+}
+
+static void ctrl_event(struct context *context, uint8_t evt,
+					const void *params, uint8_t plen)
+{
+	uint8_t buf[3 + UINT8_MAX];
+
+	buf[0] = BT_H4_EVT_PKT;
+	buf[1] = evt;
+	buf[2] = plen;
+	memcpy(buf + 3, params, plen);
+
+	ctrl_write(context, buf, 3 + plen);
+}
+
+static gboolean write_rest(gpointer user_data)
+{
+	struct context *context = user_data;
+
+	ctrl_write(context, context->rest, context->rest_len);
+
+	return FALSE;
+}
+
+/* Written in two parts so that bt_hci sees a partial packet first */
+static void ctrl_num_completed(struct context *context, uint16_t handle,
+								uint16_t count)
+{
+	static uint8_t buf[8];
+
+	buf[0] = BT_H4_EVT_PKT;
+	buf[1] = BT_HCI_EVT_NUM_COMPLETED_PACKETS;
+	buf[2] = 5;
+	buf[3] = 1;
+	put_le16(handle, buf + 4);
+	put_le16(count, buf + 6);
+
+	ctrl_write(context, buf, 4);
+
+	context->rest = buf + 4;
+	context->rest_len = 4;
+	g_idle_add(write_rest, context);
+
+	context->credits += count;
+}
+
+static void ctrl_command(struct context *context, uint16_t opcode,
+					const uint8_t *data, uint8_t plen)
+{
+	uint8_t buf[sizeof(struct bt_hci_evt_cmd_complete) +
+			sizeof(struct bt_hci_rsp_read_buffer_size)];
+	struct bt_hci_evt_cmd_complete *cc = (void *) buf;
+	struct bt_hci_rsp_read_buffer_size *rsp = (void *) (buf + sizeof(*cc));
+	struct bt_hci_evt_conn_complete conn;
+
+	g_assert(opcode == BT_HCI_CMD_READ_BUFFER_SIZE);
+
+	context->credits = FC_CREDITS;
+
+	cc->ncmd = 1;
+	cc->opcode = cpu_to_le16(opcode);
+	memset(rsp, 0, sizeof(*rsp));
+	rsp->acl_mtu = cpu_to_le16(FC_MTU);
+	rsp->acl_max_pkt = cpu_to_le16(FC_CREDITS);
+
+	ctrl_event(context, BT_HCI_EVT_CMD_COMPLETE, buf, sizeof(buf));
+
+	memset(&conn, 0, sizeof(conn));
+	conn.handle = cpu_to_le16(0x0001);
+	conn.link_type = 0x01;
+
+	ctrl_event(context, BT_HCI_EVT_CONN_COMPLETE, &conn, sizeof(conn));
+}
+
+static void ctrl_acl(struct context *context, const uint8_t *data,
+								size_t len)
+{
+	uint16_t handle = get_le16(data);
+	uint16_t dlen = get_le16(data + 2);
+
+	g_assert(dlen == len - 4);
+
+	/* Never more packets in flight than the controller has buffers */
+	g_assert(context->credits > 0);
+	context->credits--;
+
+	context->acl(context, handle & 0x0fff, handle >> 12, data + 4, dlen);
+}
+
+static gboolean ctrl_handler(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct context *context = user_data;
+	size_t off = 0, pkt_len;
+	ssize_t ret;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
+		return FALSE;
+
+	ret = read(context->fd, context->buf + context->len,
+				sizeof(context->buf) - context->len);
+	g_assert(ret > 0);
+
+	context->len += ret;
+
+	while (context->len - off >= 4) {
+		const uint8_t *pkt = context->buf + off;
+
+		switch (pkt[0]) {
+		case BT_H4_CMD_PKT:
+			pkt_len = 4 + pkt[3];
+			break;
+		case BT_H4_ACL_PKT:
+			pkt_len = context->len - off < 5 ? SIZE_MAX :
+						5 + get_le16(pkt + 3);
+			break;
+		default:
+			g_assert_not_reached();
+		}
+
+		if (pkt_len == SIZE_MAX)
+			break;
+
+		g_assert(pkt_len <= sizeof(context->buf));
+
+		if (context->len - off < pkt_len)
+			break;
+
+		if (pkt[0] == BT_H4_CMD_PKT)
+			ctrl_command(context, get_le16(pkt + 1), pkt + 4,
+								pkt[3]);
+		else
+			ctrl_acl(context, pkt + 1, pkt_len - 1);
+
+		off += pkt_len;
+	}
+
+	context->len -= off;
+	memmove(context->buf, context->buf + off, context->len);
+
+	return TRUE;
+}
+
+static struct context *create_context(acl_func_t acl, int sndbuf)
+{
+	struct context *context = g_new0(struct context, 1);
+	GIOChannel *channel;
+	unsigned int i;
+	int sv[2];
+
+	for (i = 0; i < sizeof(payload); i++)
+		payload[i] = i & 0xff;
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+
+	g_assert(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+
+	if (sndbuf)
+		g_assert(setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sndbuf,
+							sizeof(sndbuf)) == 0);
+
+	context->fd = sv[0];
+	context->acl = acl;
+
+	channel = g_io_channel_unix_new(sv[0]);
+
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	context->source = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				ctrl_handler, context);
+	g_assert(context->source > 0);
+
+	g_io_channel_unref(channel);
+
+	context->hci = bt_hci_new(sv[1]);
+	g_assert(context->hci);
+
+	bt_hci_set_close_on_unref(context->hci, true);
+
+	return context;
+}
+
+static gboolean context_done(gpointer user_data)
+{
+	struct context *context = user_data;
+
+	g_source_remove(context->source);
+	bt_hci_unref(context->hci);
+	g_free(context);
+
+	tester_test_passed();
+
+	return FALSE;
+}
+
+/* Appends a fragment and returns true once len bytes have been received */
+static bool sdu_add(struct context *context, uint8_t flags,
+					const uint8_t *data, uint16_t len,
+					uint16_t mtu, uint16_t sdu_len)
+{
+	g_assert(len <= mtu);
+	g_assert(flags == (context->sdu_len ? 0x01 : 0x02));
+	g_assert(context->sdu_len + len <= sdu_len);
+
+	memcpy(context->sdu + context->sdu_len, data, len);
+	context->sdu_len += len;
+
+	if (context->sdu_len < sdu_len)
+		return false;
+
+	g_assert(memcmp(context->sdu, payload, sdu_len) == 0);
+	context->sdu_len = 0;
+
+	return true;
+}
+
+static void flow_acl(struct context *context, uint16_t handle,
+					uint8_t flags, const uint8_t *data,
+					uint16_t len)
+{
+	struct bt_hci_evt_disconnect_complete dc;
+
+	if (context->step) {
+		/* Data queued for the disconnected handle is dropped */
+		g_assert(handle == 0x0002);
+
+		if (sdu_add(context, flags, data, len, FC_MTU, FC_LAST_LEN))
+			g_idle_add(context_done, context);
+
+		return;
+	}
+
+	g_assert(handle == 0x0001);
+
+	if (!sdu_add(context, flags, data, len, FC_MTU, FC_SDU_LEN)) {
+		if (!context->credits)
+			ctrl_num_completed(context, handle, 1);
+		return;
+	}
+
+	context->step++;
+
+	/* All buffers are in use, so this has to stay queued */
+	g_assert(bt_hci_send_data(context->hci, BT_H4_ACL_PKT, 0x0001, 0x02,
+							payload, FC_SDU_LEN));
+
+	/* The controller frees the buffers of the handle */
+	context->credits = FC_CREDITS;
+
+	memset(&dc, 0, sizeof(dc));
+	dc.handle = cpu_to_le16(0x0001);
+	dc.reason = 0x13;
+
+	ctrl_event(context, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+}
+
+static void disconnect_cb(const void *data, uint8_t size, void *user_data)
+{
+	struct context *context = user_data;
+
+	/* Only goes out if the disconnection released the buffers */
+	g_assert(bt_hci_send_data(context->hci, BT_H4_ACL_PKT, 0x0002, 0x02,
+							payload, FC_LAST_LEN));
+}
+
+static void buffer_size_cb(const void *data, uint8_t size, void *user_data)
+{
+	struct context *context = user_data;
+
+	g_assert(bt_hci_send_data(context->hci, BT_H4_ACL_PKT, 0x0001, 0x02,
+							payload, FC_SDU_LEN));
+}
+
+static void test_flow_control(const void *data)
+{
+	struct context *context = create_context(flow_acl, 0);
+
+	g_assert(bt_hci_register(context->hci, BT_HCI_EVT_DISCONNECT_COMPLETE,
+					disconnect_cb, context, NULL));
+
+	g_assert(bt_hci_send(context->hci, BT_HCI_CMD_READ_BUFFER_SIZE,
+					NULL, 0, buffer_size_cb, context,
+					NULL));
+}
+
+static void bulk_acl(struct context *context, uint16_t handle,
+					uint8_t flags, const uint8_t *data,
+					uint16_t len)
+{
+	g_assert(handle == 0x0001);
+
+	if (!sdu_add(context, flags, data, len, BULK_MTU, BULK_SDU_LEN))
+		return;
+
+	if (++context->num_sdus == BULK_SDUS)
+		g_idle_add(context_done, context);
+}
+
+static void test_partial_write(const void *data)
+{
+	struct context *context;
+	unsigned int i;
+
+	/* A small socket buffer makes the batched writev stop midway */
+	context = create_context(bulk_acl, 4096);
+
+	context->credits = BULK_CREDITS;
+
+	g_assert(bt_hci_set_buffer_size(context->hci, BT_HCI_BUF_ACL,
+						BULK_MTU, BULK_CREDITS));
+
+	for (i = 0; i < BULK_SDUS; i++)
+		g_assert(bt_hci_send_data(context->hci, BT_H4_ACL_PKT, 0x0001,
+					0x02, payload, BULK_SDU_LEN));
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/hci/stream/flow-control", NULL, NULL,
+						test_flow_control, NULL);
+	tester_add("/hci/stream/partial-write", NULL, NULL,
+						test_partial_write, NULL);
+
+	return tester_run();
+}
@@ -0,0 +1,254 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "src/shared/mainloop.h"
+#include "src/shared/tester.h"
+
+struct pair {
+	int fd[2];
+	unsigned int count;
+};
+
+struct context {
+	struct pair *pairs;
+	unsigned int num_pairs;
+	unsigned int rounds;
+	unsigned int events;
+	unsigned int target;
+};
+
+static struct context test_context;
+
+static unsigned int max_pairs(unsigned int wanted)
+{
+	struct rlimit rlim;
+	unsigned int avail;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		return 64;
+
+	if (rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+		getrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	/* Leave room for stdio, the epoll fd and the tester itself */
+	avail = rlim.rlim_cur > 64 ? (rlim.rlim_cur - 64) / 2 : 0;
+
+	return wanted < avail ? wanted : avail;
+}
+
+static void context_create(struct context *context, unsigned int num_pairs,
+							unsigned int rounds)
+{
+	unsigned int i;
+
+	memset(context, 0, sizeof(*context));
+
+	context->num_pairs = max_pairs(num_pairs);
+	context->rounds = rounds;
+	context->target = context->num_pairs * rounds;
+
+	context->pairs = calloc(context->num_pairs, sizeof(struct pair));
+	g_assert(context->pairs != NULL);
+
+	for (i = 0; i < context->num_pairs; i++) {
+		struct pair *pair = &context->pairs[i];
+
+		g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+						SOCK_CLOEXEC, 0, pair->fd) == 0);
+	}
+}
+
+static void context_destroy(struct context *context)
+{
+	unsigned int i;
+
+	for (i = 0; i < context->num_pairs; i++) {
+		close(context->pairs[i].fd[0]);
+		close(context->pairs[i].fd[1]);
+	}
+
+	free(context->pairs);
+}
+
+static void pair_kick(struct pair *pair)
+{
+	uint8_t byte = 0x42;
+
+	g_assert(write(pair->fd[1], &byte, 1) == 1);
+}
+
+static void read_callback(int fd, uint32_t events, void *user_data)
+{
+	struct context *context = &test_context;
+	struct pair *pair = user_data;
+	uint8_t byte;
+
+	g_assert(read(fd, &byte, 1) == 1);
+
+	pair->count++;
+	context->events++;
+
+	if (context->events == context->target) {
+		mainloop_quit();
+		return;
+	}
+
+	if (pair->count < context->rounds)
+		pair_kick(pair);
+}
+
+static void run_pairs(struct context *context, mainloop_event_func callback)
+{
+	unsigned int i;
+
+	mainloop_init();
+
+	for (i = 0; i < context->num_pairs; i++) {
+		struct pair *pair = &context->pairs[i];
+
+		g_assert(mainloop_add_fd(pair->fd[0], EPOLLIN, callback,
+							pair, NULL) == 0);
+	}
+
+	for (i = 0; i < context->num_pairs; i++)
+		pair_kick(&context->pairs[i]);
+
+	mainloop_run();
+}
+
+static void test_many_fds(const void *data)
+{
+	struct context *context = &test_context;
+	unsigned int i;
+
+	context_create(context, 1024, 4);
+	g_assert(context->num_pairs > 128);
+
+	tester_debug("Using %u socket pairs", context->num_pairs);
+
+	run_pairs(context, read_callback);
+
+	g_assert(context->events == context->target);
+
+	for (i = 0; i < context->num_pairs; i++)
+		g_assert(context->pairs[i].count == context->rounds);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+static void remove_callback(int fd, uint32_t events, void *user_data)
+{
+	struct context *context = &test_context;
+	struct pair *pair = user_data;
+	unsigned int i;
+
+	pair->count++;
+	context->events++;
+
+	/*
+	 * Remove all fds, including those whose events are already
+	 * pending in the current batch. None of them may be dispatched
+	 * afterwards.
+	 */
+	for (i = 0; i < context->num_pairs; i++) {
+		struct pair *other = &context->pairs[i];
+
+		mainloop_remove_fd(other->fd[0]);
+	}
+
+	mainloop_quit();
+}
+
+static void test_remove_pending(const void *data)
+{
+	struct context *context = &test_context;
+	unsigned int i, count = 0;
+
+	context_create(context, 8, 1);
+
+	run_pairs(context, remove_callback);
+
+	for (i = 0; i < context->num_pairs; i++)
+		count += context->pairs[i].count;
+
+	g_assert(count == 1);
+	g_assert(context->events == 1);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+static void test_throughput(const void *data)
+{
+	struct context *context = &test_context;
+	struct timespec start, end;
+	double elapsed;
+
+	context_create(context, 4096, 64);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_pairs(context, read_callback);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	g_assert(context->events == context->target);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	tester_print("%u fds, %u events in %.3f s (%.0f events/s)",
+				context->num_pairs, context->events, elapsed,
+				elapsed > 0 ? context->events / elapsed : 0);
+
+	context_destroy(context);
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/mainloop/many_fds", NULL, NULL, test_many_fds, NULL);
+	tester_add("/mainloop/remove_pending", NULL, NULL,
+						test_remove_pending, NULL);
+	tester_add("/mainloop/throughput", NULL, NULL, test_throughput, NULL);
+
+	return tester_run();
+}
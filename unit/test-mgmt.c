@@ -48,6 +48,7 @@ enum action {
 	ACTION_PASSED,
 	ACTION_IGNORE,
 	ACTION_RESPOND,
+	ACTION_CANCEL_ALL,
 };
 
 struct handler {
@@ -103,6 +104,9 @@ static void check_actions(struct context *context, int fd,
 			return;
 		case ACTION_IGNORE:
 			return;
+		case ACTION_CANCEL_ALL:
+			mgmt_cancel_all(context->mgmt_client);
+			return;
 		}
 	}
 
@@ -282,6 +286,66 @@ static void test_command(gconstpointer data)
 	execute_context(context);
 }
 
+static void test_pipeline(gconstpointer data)
+{
+	struct context *context = create_context();
+	uint8_t mode = 0x01;
+
+	/*
+	 * Read Info for index 512 never completes, so Set Powered for the
+	 * same index has to stay queued while Read Version for another
+	 * index goes out. Set Powered is not handled and would fail.
+	 */
+	add_action(context, read_info_command, sizeof(read_info_command),
+				NULL, 0, 0, false, ACTION_IGNORE);
+	add_action(context, read_version_command,
+				sizeof(read_version_command),
+				NULL, 0, 0, false, ACTION_PASSED);
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 512, 0, NULL,
+							NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_SET_POWERED, 512,
+					sizeof(mode), &mode, NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_VERSION,
+					MGMT_INDEX_NONE, 0, NULL,
+					NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static const unsigned char set_powered_command[] =
+				{ 0x05, 0x00, 0x00, 0x02, 0x01, 0x00, 0x01 };
+
+static void cancel_destroy(void *user_data)
+{
+	struct context *context = user_data;
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 512, 0, NULL,
+							NULL, NULL, NULL);
+}
+
+static void test_cancel_all(gconstpointer data)
+{
+	struct context *context = create_context();
+	uint8_t mode = 0x01;
+
+	/*
+	 * Cancelling everything while Set Powered is pending queues Read Info
+	 * for the same index from the destroy callback, which still has to
+	 * go out.
+	 */
+	add_action(context, set_powered_command, sizeof(set_powered_command),
+				NULL, 0, 0, false, ACTION_CANCEL_ALL);
+	add_action(context, read_info_command, sizeof(read_info_command),
+				NULL, 0, 0, false, ACTION_PASSED);
+
+	mgmt_send(context->mgmt_client, MGMT_OP_SET_POWERED, 512,
+					sizeof(mode), &mode, NULL, context,
+					cancel_destroy);
+
+	execute_context(context);
+}
+
 static void response_cb(uint8_t status, uint16_t length, const void *param,
 							void *user_data)
 {
@@ -441,6 +505,9 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/mgmt/response/2", &command_test_3,
 								test_response);
 
+	g_test_add_data_func("/mgmt/pipeline/1", NULL, test_pipeline);
+	g_test_add_data_func("/mgmt/cancel/1", NULL, test_cancel_all);
+
 	g_test_add_data_func("/mgmt/event/1", &event_test_1, test_event);
 	g_test_add_data_func("/mgmt/event/2", &event_test_1, test_event2);
 
@@ -0,0 +1,402 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <glib.h>
+
+#include "src/shared/tester.h"
+
+/* The decoder tables and their lookups are private to packet.c */
+#include "monitor/packet.c"
+
+#define BENCH_ROUNDS 20000
+
+struct trace_pkt {
+	bool event;
+	const uint8_t *data;
+	uint16_t size;
+};
+
+#define CMD(_data) { false, _data, sizeof(_data) }
+#define EVT(_data) { true, _data, sizeof(_data) }
+
+static const uint8_t trace_le_set_scan_enable[] = {
+	0x0c, 0x20, 0x02, 0x01, 0x00,
+};
+
+static const uint8_t trace_le_set_scan_enable_rsp[] = {
+	0x0e, 0x04, 0x01, 0x0c, 0x20, 0x00,
+};
+
+static const uint8_t trace_le_adv_report[] = {
+	0x3e, 0x0f, 0x02, 0x01, 0x00, 0x00, 0x11, 0x22,
+	0x33, 0x44, 0x55, 0x66, 0x03, 0x02, 0x01, 0x06,
+	0xc4,
+};
+
+static const uint8_t trace_create_conn[] = {
+	0x05, 0x04, 0x0d, 0x11, 0x22, 0x33, 0x44, 0x55,
+	0x66, 0x18, 0xcc, 0x02, 0x00, 0x00, 0x00, 0x01,
+};
+
+static const uint8_t trace_create_conn_status[] = {
+	0x0f, 0x04, 0x00, 0x01, 0x05, 0x04,
+};
+
+static const uint8_t trace_conn_complete[] = {
+	0x03, 0x0b, 0x00, 0x01, 0x00, 0x11, 0x22, 0x33,
+	0x44, 0x55, 0x66, 0x01, 0x00,
+};
+
+static const uint8_t trace_num_completed[] = {
+	0x13, 0x05, 0x01, 0x01, 0x00, 0x01, 0x00,
+};
+
+static const uint8_t trace_read_bd_addr[] = {
+	0x09, 0x10, 0x00,
+};
+
+static const uint8_t trace_read_bd_addr_rsp[] = {
+	0x0e, 0x0a, 0x01, 0x09, 0x10, 0x00, 0x11, 0x22,
+	0x33, 0x44, 0x55, 0x66,
+};
+
+static const uint8_t trace_vendor_cmd[] = {
+	0x01, 0xfc, 0x01, 0x00,
+};
+
+static const uint8_t trace_disconn_complete[] = {
+	0x05, 0x04, 0x00, 0x01, 0x00, 0x13,
+};
+
+static const struct trace_pkt trace[] = {
+	CMD(trace_le_set_scan_enable),
+	EVT(trace_le_set_scan_enable_rsp),
+	EVT(trace_le_adv_report),
+	EVT(trace_le_adv_report),
+	CMD(trace_create_conn),
+	EVT(trace_create_conn_status),
+	EVT(trace_conn_complete),
+	EVT(trace_num_completed),
+	CMD(trace_read_bd_addr),
+	EVT(trace_read_bd_addr_rsp),
+	CMD(trace_vendor_cmd),
+	EVT(trace_disconn_complete),
+};
+
+void control_message(uint16_t opcode, const void *data, uint16_t size)
+{
+}
+
+/* Decoded output is of no interest, only the decoding itself */
+static int quiet_start(void)
+{
+	int fd, null_fd;
+
+	fflush(stdout);
+
+	fd = dup(STDOUT_FILENO);
+	g_assert(fd >= 0);
+
+	null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	g_assert(null_fd >= 0);
+
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	return fd;
+}
+
+static void quiet_stop(int fd)
+{
+	fflush(stdout);
+
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+}
+
+static void decode(const struct trace_pkt *pkt)
+{
+	struct timeval tv = { };
+
+	if (pkt->event)
+		packet_hci_event(&tv, 0, pkt->data, pkt->size);
+	else
+		packet_hci_command(&tv, 0, pkt->data, pkt->size);
+}
+
+static const struct opcode_data *scan_opcode(uint16_t opcode)
+{
+	int i;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		if (opcode_table[i].opcode == opcode)
+			return &opcode_table[i];
+	}
+
+	return NULL;
+}
+
+static const char *scan_command_bit(int bit)
+{
+	int i;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		if (opcode_table[i].bit == bit)
+			return opcode_table[i].str;
+	}
+
+	return NULL;
+}
+
+static void test_opcodes(const void *data)
+{
+	uint8_t cmd[3 + 255], complete[6 + 255], status[6];
+	unsigned int opcode;
+	int bit, fd;
+
+	/* Every opcode, including OGF and OCF values beyond the table */
+	for (opcode = 0; opcode <= 0xffff; opcode++)
+		g_assert(find_opcode(opcode) == scan_opcode(opcode));
+
+	/* Supported Commands has 64 octets of 8 bits each */
+	for (bit = -1; bit < 64 * 8 + 8; bit++) {
+		if (bit < 0)
+			g_assert(!get_supported_command(bit));
+		else
+			g_assert(get_supported_command(bit) ==
+						scan_command_bit(bit));
+	}
+
+	fd = quiet_start();
+
+	for (opcode = 0; opcode <= 0xffff; opcode++) {
+		const struct opcode_data *opcode_data = find_opcode(opcode);
+		uint8_t cmd_size = 0, rsp_size = 1;
+		struct trace_pkt pkt;
+
+		/* Known commands get parameters of the expected length */
+		if (opcode_data) {
+			cmd_size = opcode_data->cmd_size;
+			rsp_size = opcode_data->rsp_size ? : 1;
+		}
+
+		memset(cmd, 0, sizeof(cmd));
+		cmd[0] = opcode & 0xff;
+		cmd[1] = opcode >> 8;
+		cmd[2] = cmd_size;
+
+		pkt.event = false;
+		pkt.data = cmd;
+		pkt.size = 3 + cmd_size;
+		decode(&pkt);
+
+		memset(complete, 0, sizeof(complete));
+		complete[0] = 0x0e;
+		complete[1] = 3 + rsp_size;
+		complete[2] = 0x01;
+		complete[3] = opcode & 0xff;
+		complete[4] = opcode >> 8;
+
+		pkt.event = true;
+		pkt.data = complete;
+		pkt.size = 5 + rsp_size;
+		decode(&pkt);
+
+		status[0] = 0x0f;
+		status[1] = 0x04;
+		status[2] = opcode & 0x3f;
+		status[3] = 0x01;
+		status[4] = opcode & 0xff;
+		status[5] = opcode >> 8;
+
+		pkt.data = status;
+		pkt.size = sizeof(status);
+		decode(&pkt);
+	}
+
+	quiet_stop(fd);
+
+	tester_test_passed();
+}
+
+static const struct event_data *scan_event(uint8_t event)
+{
+	int i;
+
+	for (i = 0; event_table[i].str; i++) {
+		if (event_table[i].event == event)
+			return &event_table[i];
+	}
+
+	return NULL;
+}
+
+static const struct subevent_data *scan_subevent(uint8_t subevent)
+{
+	int i;
+
+	for (i = 0; subevent_table[i].str; i++) {
+		if (subevent_table[i].subevent == subevent)
+			return &subevent_table[i];
+	}
+
+	return NULL;
+}
+
+static void decode_event(uint8_t *evt, uint8_t size)
+{
+	const struct trace_pkt pkt = { true, evt, 2 + size };
+
+	evt[1] = size;
+	decode(&pkt);
+}
+
+static void test_events(const void *data)
+{
+	uint8_t evt[2 + 255];
+	unsigned int code;
+	int fd;
+
+	for (code = 0; code <= 0xff; code++) {
+		g_assert(find_event(code) == scan_event(code));
+		g_assert(find_subevent(code) == scan_subevent(code));
+	}
+
+	fd = quiet_start();
+
+	for (code = 0; code <= 0xff; code++) {
+		const struct event_data *event_data = find_event(code);
+		const struct subevent_data *subevent_data;
+
+		memset(evt, 0, sizeof(evt));
+
+		/* A single octet, which is too short for most of them */
+		evt[0] = code;
+		decode_event(evt, 1);
+
+		/* Exactly the expected length */
+		if (event_data && event_data->size)
+			decode_event(evt, event_data->size);
+
+		memset(evt, 0, sizeof(evt));
+		evt[0] = 0x3e;
+		evt[2] = code;
+		decode_event(evt, 1);
+
+		subevent_data = find_subevent(code);
+		if (subevent_data && subevent_data->size)
+			decode_event(evt, 1 + subevent_data->size);
+	}
+
+	quiet_stop(fd);
+
+	tester_test_passed();
+}
+
+static const char *scan_error(uint8_t error)
+{
+	int i;
+
+	for (i = 0; error2str_table[i].str; i++) {
+		if (error2str_table[i].error == error)
+			return error2str_table[i].str;
+	}
+
+	return NULL;
+}
+
+static void test_errors(const void *data)
+{
+	unsigned int code;
+
+	for (code = 0; code <= 0xff; code++)
+		g_assert(error2str(code) == scan_error(code));
+
+	tester_test_passed();
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) +
+				(end.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static void test_bench_decode(const void *data)
+{
+	struct timespec start;
+	unsigned int count = 0;
+	double elapsed;
+	int i, fd;
+
+	fd = quiet_start();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		unsigned int n;
+
+		for (n = 0; n < G_N_ELEMENTS(trace); n++)
+			decode(&trace[n]);
+
+		count += n;
+	}
+
+	elapsed = elapsed_since(&start);
+
+	quiet_stop(fd);
+
+	tester_print("%u packets in %.3f s (%.0f packets/s)", count, elapsed,
+					elapsed > 0 ? count / elapsed : 0);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	packet_set_filter(PACKET_FILTER_SHOW_INDEX);
+
+	tester_add("/packet/lookup/opcodes", NULL, NULL, test_opcodes, NULL);
+	tester_add("/packet/lookup/events", NULL, NULL, test_events, NULL);
+	tester_add("/packet/lookup/errors", NULL, NULL, test_errors, NULL);
+	tester_add("/packet/benchmark/decode", NULL, NULL,
+						test_bench_decode, NULL);
+
+	return tester_run();
+}
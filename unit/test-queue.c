@@ -25,6 +25,8 @@
 #include <config.h>
 #endif
 
+#include <time.h>
+
 #include <glib.h>
 
 #include "src/shared/util.h"
@@ -259,6 +261,336 @@ static void test_remove_all(const void *data)
 	tester_test_passed();
 }
 
+struct item {
+	unsigned int value;
+	bool destroyed;
+	struct queue_entry entry;
+};
+
+static void item_destroy(void *data)
+{
+	struct item *item = data;
+
+	item->destroyed = true;
+}
+
+static bool match_item(const void *a, const void *b)
+{
+	const struct item *item = a;
+
+	return item->value == PTR_TO_UINT(b);
+}
+
+static void test_entry(const void *data)
+{
+	struct item items[8];
+	struct queue *queue, *other;
+	struct item *item;
+	unsigned int i;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	other = queue_new();
+	g_assert(other != NULL);
+
+	for (i = 0; i < 8; i++) {
+		items[i].value = i;
+		items[i].destroyed = false;
+		queue_entry_init(&items[i].entry, &items[i]);
+	}
+
+	for (i = 1; i < 8; i++)
+		g_assert(queue_push_tail_entry(queue, &items[i].entry));
+
+	g_assert(queue_push_head_entry(queue, &items[0].entry));
+	g_assert(queue_length(queue) == 8);
+
+	/* An embedded entry can not be linked twice */
+	g_assert(!queue_push_tail_entry(queue, &items[3].entry));
+	g_assert(!queue_push_tail_entry(other, &items[3].entry));
+
+	/* Mixing embedded and allocated entries is fine */
+	g_assert(queue_push_tail(other, &items[3]));
+	g_assert(queue_remove(other, &items[3]));
+
+	g_assert(queue_pop_head(queue) == &items[0]);
+	g_assert(queue_find(queue, match_item, UINT_TO_PTR(5)) == &items[5]);
+	g_assert(queue_remove(queue, &items[5]));
+	g_assert(queue_remove_if(queue, match_item, UINT_TO_PTR(7)) ==
+								&items[7]);
+	g_assert(queue_length(queue) == 5);
+
+	/* Removed entries can be queued again */
+	g_assert(queue_push_tail_entry(other, &items[0].entry));
+	g_assert(queue_push_tail_entry(other, &items[5].entry));
+
+	queue_remove_all(queue, NULL, NULL, item_destroy);
+	g_assert(queue_isempty(queue));
+
+	for (i = 1; i < 8; i++) {
+		item = &items[i];
+		g_assert(item->destroyed == (i != 5 && i != 7));
+	}
+
+	queue_destroy(other, item_destroy);
+	g_assert(items[0].destroyed);
+	g_assert(items[5].destroyed);
+
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+static double elapsed_time(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) +
+				(end.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static void test_cache_flush(const void *data)
+{
+	struct queue *queue;
+	unsigned int i;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	/* Fill the entry cache, drop it and make sure pushes still work */
+	for (i = 0; i < 1000; i++)
+		queue_push_tail(queue, UINT_TO_PTR(i + 1));
+
+	queue_remove_all(queue, NULL, NULL, NULL);
+	queue_cache_flush();
+	queue_cache_flush();
+
+	for (i = 0; i < 10; i++)
+		g_assert(queue_push_tail(queue, UINT_TO_PTR(i + 1)));
+
+	queue_cache_flush();
+
+	for (i = 0; i < 10; i++)
+		g_assert(queue_pop_head(queue) == UINT_TO_PTR(i + 1));
+
+	g_assert(queue_isempty(queue));
+
+	queue_destroy(queue, NULL);
+	queue_cache_flush();
+
+	tester_test_passed();
+}
+
+static void test_throughput(const void *data)
+{
+	unsigned int rounds = 2000, depth = 1000;
+	unsigned int n, i, ops = rounds * depth * 2;
+	struct timespec start;
+	struct queue *queue;
+	struct item *items;
+	double elapsed;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	items = new0(struct item, depth);
+	g_assert(items != NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (n = 0; n < rounds; n++) {
+		for (i = 0; i < depth; i++)
+			queue_push_tail(queue, &items[i]);
+
+		for (i = 0; i < depth; i++)
+			queue_pop_head(queue);
+	}
+
+	elapsed = elapsed_time(&start);
+	tester_print("allocated entries: %u push/pop in %.3f s (%.0f ops/s)",
+				ops, elapsed, elapsed > 0 ? ops / elapsed : 0);
+
+	for (i = 0; i < depth; i++)
+		queue_entry_init(&items[i].entry, &items[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (n = 0; n < rounds; n++) {
+		for (i = 0; i < depth; i++)
+			queue_push_tail_entry(queue, &items[i].entry);
+
+		for (i = 0; i < depth; i++)
+			queue_pop_head(queue);
+	}
+
+	elapsed = elapsed_time(&start);
+	tester_print("embedded entries: %u push/pop in %.3f s (%.0f ops/s)",
+				ops, elapsed, elapsed > 0 ? ops / elapsed : 0);
+
+	g_assert(queue_isempty(queue));
+
+	free(items);
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+struct keyed_item {
+	uint16_t opcode;
+	unsigned int id;
+};
+
+static bool match_keyed_id(const void *a, const void *b)
+{
+	const struct keyed_item *item = a;
+
+	return item->id == PTR_TO_UINT(b);
+}
+
+static void test_keyed(const void *data)
+{
+	unsigned int count = 4096, i;
+	struct keyed_item *items;
+	struct queue *queue;
+
+	queue = queue_new_keyed(offsetof(struct keyed_item, id));
+	g_assert(queue != NULL);
+
+	items = new0(struct keyed_item, count);
+	g_assert(items != NULL);
+
+	for (i = 0; i < count; i++) {
+		items[i].id = i + 1;
+
+		if (i & 1)
+			g_assert(queue_push_tail(queue, &items[i]));
+		else
+			g_assert(queue_push_head(queue, &items[i]));
+	}
+
+	/* Entries pushed after others are indexed as well */
+	g_assert(queue_remove(queue, &items[10]));
+	g_assert(queue_push_after(queue, &items[20], &items[10]));
+
+	for (i = 0; i < count; i++)
+		g_assert(queue_find_by_key(queue, i + 1) == &items[i]);
+
+	g_assert(queue_find_by_key(queue, 0) == NULL);
+	g_assert(queue_find_by_key(queue, count + 1) == NULL);
+
+	/* Remove every third element through the different paths */
+	for (i = 0; i < count; i += 3) {
+		switch (i % 4) {
+		case 0:
+			g_assert(queue_remove_by_key(queue, i + 1) ==
+								&items[i]);
+			break;
+		case 1:
+			g_assert(queue_remove(queue, &items[i]));
+			break;
+		case 2:
+			g_assert(queue_remove_if(queue, match_keyed_id,
+						UINT_TO_PTR(i + 1)) == &items[i]);
+			break;
+		default:
+			g_assert(queue_remove_by_key(queue, i + 1) ==
+								&items[i]);
+			break;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		void *ptr = queue_find_by_key(queue, i + 1);
+
+		if (i % 3)
+			g_assert(ptr == &items[i]);
+		else
+			g_assert(ptr == NULL);
+	}
+
+	while (!queue_isempty(queue)) {
+		struct keyed_item *item = queue_pop_head(queue);
+
+		g_assert(item != NULL);
+		g_assert(queue_find_by_key(queue, item->id) == NULL);
+	}
+
+	/* A cleared queue must have an empty index */
+	for (i = 0; i < 16; i++)
+		g_assert(queue_push_tail(queue, &items[i]));
+
+	queue_remove_all(queue, NULL, NULL, NULL);
+
+	for (i = 0; i < 16; i++)
+		g_assert(queue_find_by_key(queue, i + 1) == NULL);
+
+	queue_destroy(queue, NULL);
+
+	/* Plain queues do not support lookups by key */
+	queue = queue_new();
+	g_assert(queue != NULL);
+	g_assert(queue_push_tail(queue, &items[0]));
+	g_assert(queue_find_by_key(queue, 1) == NULL);
+	g_assert(queue_remove_by_key(queue, 1) == NULL);
+
+	free(items);
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
+static void test_keyed_lookup(const void *data)
+{
+	unsigned int count = 10000, i;
+	struct keyed_item *items;
+	struct queue *linear, *keyed;
+	struct timespec start;
+	double elapsed;
+
+	linear = queue_new();
+	g_assert(linear != NULL);
+
+	keyed = queue_new_keyed(offsetof(struct keyed_item, id));
+	g_assert(keyed != NULL);
+
+	items = new0(struct keyed_item, count);
+	g_assert(items != NULL);
+
+	for (i = 0; i < count; i++) {
+		items[i].id = i + 1;
+		queue_push_tail(linear, &items[i]);
+		queue_push_tail(keyed, &items[i]);
+	}
+
+	/* Cancel everything newest first, as a mass disconnect does */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = count; i > 0; i--)
+		g_assert(queue_remove_if(linear, match_keyed_id,
+						UINT_TO_PTR(i)) == &items[i - 1]);
+
+	elapsed = elapsed_time(&start);
+	tester_print("linear: %u removes in %.3f s (%.0f ops/s)",
+				count, elapsed, elapsed > 0 ? count / elapsed : 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = count; i > 0; i--)
+		g_assert(queue_remove_by_key(keyed, i) == &items[i - 1]);
+
+	elapsed = elapsed_time(&start);
+	tester_print("keyed: %u removes in %.3f s (%.0f ops/s)",
+				count, elapsed, elapsed > 0 ? count / elapsed : 0);
+
+	g_assert(queue_isempty(linear));
+	g_assert(queue_isempty(keyed));
+
+	free(items);
+	queue_destroy(linear, NULL);
+	queue_destroy(keyed, NULL);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -276,6 +608,11 @@ int main(int argc, char *argv[])
 						test_destroy_remove, NULL);
 	tester_add("/queue/push_after",  NULL, NULL, test_push_after, NULL);
 	tester_add("/queue/remove_all",  NULL, NULL, test_remove_all, NULL);
+	tester_add("/queue/entry",  NULL, NULL, test_entry, NULL);
+	tester_add("/queue/cache_flush",  NULL, NULL, test_cache_flush, NULL);
+	tester_add("/queue/throughput",  NULL, NULL, test_throughput, NULL);
+	tester_add("/queue/keyed",  NULL, NULL, test_keyed, NULL);
+	tester_add("/queue/keyed_lookup",  NULL, NULL, test_keyed_lookup, NULL);
 
 	return tester_run();
 }
@@ -0,0 +1,363 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2015  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <glib.h>
+
+#include "src/shared/util.h"
+#include "src/shared/mainloop.h"
+#include "src/shared/timeout.h"
+#include "src/shared/tester.h"
+
+#define NUM_TIMERS 64
+
+struct timer {
+	unsigned int id;
+	unsigned int timeout;
+	unsigned int slack;
+	unsigned int fired;
+	unsigned int repeat;
+	bool destroyed;
+	uint64_t start;
+	uint64_t elapsed;
+};
+
+static struct timer timers[NUM_TIMERS];
+static unsigned int fired_order[NUM_TIMERS];
+static unsigned int fired_count;
+static unsigned int expected_count;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void reset_timers(void)
+{
+	memset(timers, 0, sizeof(timers));
+	memset(fired_order, 0, sizeof(fired_order));
+	fired_count = 0;
+	expected_count = 0;
+
+	mainloop_init();
+}
+
+static bool timer_expired(void *user_data)
+{
+	struct timer *timer = user_data;
+
+	timer->elapsed = now_ms() - timer->start;
+	timer->fired++;
+
+	if (timer->fired == 1)
+		fired_order[fired_count++] = timer - timers;
+
+	if (fired_count == expected_count && timer->fired > timer->repeat)
+		mainloop_quit();
+
+	return timer->fired <= timer->repeat;
+}
+
+static void timer_destroy(void *user_data)
+{
+	struct timer *timer = user_data;
+
+	timer->destroyed = true;
+}
+
+static void timer_start(struct timer *timer)
+{
+	timer->start = now_ms();
+	timer->id = timeout_add_slack(timer->timeout, timer->slack,
+					timer_expired, timer, timer_destroy);
+	g_assert(timer->id != 0);
+}
+
+static void test_order(const void *data)
+{
+	unsigned int i;
+
+	reset_timers();
+
+	/* Start in reverse so that the list order does not help */
+	for (i = 0; i < NUM_TIMERS; i++) {
+		struct timer *timer = &timers[NUM_TIMERS - 1 - i];
+
+		timer->timeout = (NUM_TIMERS - i) * 3;
+		timer_start(timer);
+	}
+
+	expected_count = NUM_TIMERS;
+
+	mainloop_run();
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		g_assert(fired_order[i] == i);
+		g_assert(timers[i].fired == 1);
+		g_assert(timers[i].destroyed);
+		g_assert(timers[i].elapsed >= timers[i].timeout);
+	}
+
+	tester_test_passed();
+}
+
+static void test_cancel(const void *data)
+{
+	unsigned int i;
+
+	reset_timers();
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		timers[i].timeout = 5 + i;
+		timer_start(&timers[i]);
+	}
+
+	for (i = 0; i < NUM_TIMERS; i += 2)
+		timeout_remove(timers[i].id);
+
+	/* Removing twice or removing a stale id must be harmless */
+	timeout_remove(timers[0].id);
+	timeout_remove(0);
+
+	expected_count = NUM_TIMERS / 2;
+
+	mainloop_run();
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		g_assert(timers[i].destroyed);
+		g_assert(timers[i].fired == (i & 1));
+	}
+
+	tester_test_passed();
+}
+
+static void test_repeat(const void *data)
+{
+	reset_timers();
+
+	timers[0].timeout = 10;
+	timers[0].repeat = 5;
+	timer_start(&timers[0]);
+
+	expected_count = 1;
+
+	mainloop_run();
+
+	g_assert(timers[0].fired == 6);
+	g_assert(timers[0].destroyed);
+	g_assert(timers[0].elapsed >= 60);
+
+	tester_test_passed();
+}
+
+static bool remove_self(void *user_data)
+{
+	struct timer *timer = user_data;
+
+	timer->fired++;
+	timeout_remove(timer->id);
+	g_assert(!timer->destroyed);
+
+	mainloop_quit();
+
+	return true;
+}
+
+static void test_remove_self(const void *data)
+{
+	reset_timers();
+
+	timers[0].id = timeout_add(5, remove_self, &timers[0], timer_destroy);
+	g_assert(timers[0].id != 0);
+
+	mainloop_run();
+
+	g_assert(timers[0].fired == 1);
+	g_assert(timers[0].destroyed);
+
+	tester_test_passed();
+}
+
+/*
+ * Counts the mainloop wakeups that run timer callbacks. The first callback
+ * of a wakeup pokes a pipe, which only gets dispatched by the next loop
+ * iteration and then re-opens the count for the following wakeup.
+ */
+static int wakeup_pipe[2] = { -1, -1 };
+static unsigned int wakeup_count;
+static bool wakeup_pending;
+
+static void wakeup_read(int fd, uint32_t events, void *user_data)
+{
+	char buf[16];
+
+	if (read(fd, buf, sizeof(buf)) < 0)
+		return;
+
+	wakeup_pending = false;
+}
+
+static bool slack_expired(void *user_data)
+{
+	if (!wakeup_pending) {
+		wakeup_pending = true;
+		wakeup_count++;
+		g_assert(write(wakeup_pipe[1], "x", 1) == 1);
+	}
+
+	return timer_expired(user_data);
+}
+
+static void test_slack(const void *data)
+{
+	unsigned int i;
+
+	reset_timers();
+
+	g_assert(pipe(wakeup_pipe) == 0);
+	g_assert(mainloop_add_fd(wakeup_pipe[0], EPOLLIN, wakeup_read,
+							NULL, NULL) == 0);
+	wakeup_count = 0;
+	wakeup_pending = false;
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		timers[i].timeout = 100 + i;
+		timers[i].slack = 127;
+		timers[i].start = now_ms();
+		timers[i].id = timeout_add_slack(timers[i].timeout,
+						timers[i].slack, slack_expired,
+						&timers[i], timer_destroy);
+		g_assert(timers[i].id != 0);
+	}
+
+	expected_count = NUM_TIMERS;
+
+	mainloop_run();
+
+	close(wakeup_pipe[0]);
+	close(wakeup_pipe[1]);
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		g_assert(timers[i].fired == 1);
+		g_assert(timers[i].elapsed >= timers[i].timeout);
+	}
+
+	/*
+	 * All deadlines lie within a 64 ms window and get rounded up to a
+	 * 128 ms boundary, so they can straddle at most one boundary.
+	 */
+	tester_print("%u timers expired in %u wakeups", NUM_TIMERS,
+								wakeup_count);
+	g_assert(wakeup_count >= 1 && wakeup_count <= 2);
+
+	tester_test_passed();
+}
+
+static bool dummy_expired(void *user_data)
+{
+	return false;
+}
+
+static bool quit_expired(void *user_data)
+{
+	mainloop_quit();
+
+	return false;
+}
+
+static void test_churn(const void *data)
+{
+	unsigned int count = 200000;
+	unsigned int *ids;
+	struct timespec start, end;
+	double elapsed;
+	unsigned int i;
+
+	mainloop_init();
+
+	ids = new0(unsigned int, count);
+	g_assert(ids != NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Arm a mix of short and ATT style 30 second timeouts */
+	for (i = 0; i < count; i++) {
+		ids[i] = timeout_add(1000 + (i * 7919) % 30000,
+						dummy_expired, NULL, NULL);
+		g_assert(ids[i] != 0);
+	}
+
+	/* Cancel and re-arm half of them, as request/response churn does */
+	for (i = 0; i < count; i += 2) {
+		timeout_remove(ids[i]);
+		ids[i] = timeout_add(30000, dummy_expired, NULL, NULL);
+		g_assert(ids[i] != 0);
+	}
+
+	for (i = 0; i < count; i++)
+		timeout_remove(ids[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	tester_print("%u arm/cancel operations in %.3f s (%.0f ops/s)",
+				count * 3, elapsed,
+				elapsed > 0 ? count * 3 / elapsed : 0);
+
+	free(ids);
+
+	timeout_add(1, quit_expired, NULL, NULL);
+	mainloop_run();
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/timeout/order", NULL, NULL, test_order, NULL);
+	tester_add("/timeout/cancel", NULL, NULL, test_cancel, NULL);
+	tester_add("/timeout/repeat", NULL, NULL, test_repeat, NULL);
+	tester_add("/timeout/remove_self", NULL, NULL, test_remove_self, NULL);
+	tester_add("/timeout/slack", NULL, NULL, test_slack, NULL);
+	tester_add("/timeout/churn", NULL, NULL, test_churn, NULL);
+
+	return tester_run();
+}